@@ -62,4 +62,6 @@
 
 #define SO_RXQ_OVFL             40
 
+#define SO_BUSY_POLL            41
+
 #endif /* __ASM_AVR32_SOCKET_H */
@@ -62,5 +62,7 @@
 
 #define SO_RXQ_OVFL             40
 
+#define SO_BUSY_POLL            41
+
 #endif /* _ASM_SOCKET_H */
 
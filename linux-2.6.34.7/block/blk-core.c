@@ -1479,6 +1479,13 @@ static inline void __generic_make_request(struct bio *bio)
 		trace_block_bio_queue(q, bio);
 
 		ret = q->make_request_fn(q, bio);
+
+		/*
+		 * Remapped to another queue: segments were counted
+		 * against this queue's limits.
+		 */
+		if (ret)
+			bio->bi_flags &= ~(1 << BIO_SEG_VALID);
 	} while (ret);
 
 	return;
@@ -85,6 +85,45 @@ void blk_recount_segments(struct request_queue *q, struct bio *bio)
 }
 EXPORT_SYMBOL(blk_recount_segments);
 
+static inline int blk_bvec_high(struct request_queue *q, struct bio_vec *bv)
+{
+	return page_to_pfn(bv->bv_page) > queue_bounce_pfn(q);
+}
+
+/*
+ * Accounts for the bio_vec just appended to @bio, following the rules
+ * of __blk_recalc_rq_segments() but looking only at the new entry and
+ * the one before it.  The caller guarantees the segment count and the
+ * cached front and back sizes were valid before the append.
+ */
+void blk_bio_append_segment(struct request_queue *q, struct bio *bio)
+{
+	struct bio_vec *bv = __BVEC_END(bio), *bvprv;
+
+	if (bio->bi_vcnt == 1) {
+		bio->bi_phys_segments = 0;
+		bio->bi_seg_front_size = 0;
+	} else if (test_bit(QUEUE_FLAG_CLUSTER, &q->queue_flags)) {
+		bvprv = bv - 1;
+
+		if (!blk_bvec_high(q, bv) && !blk_bvec_high(q, bvprv) &&
+		    bio->bi_seg_back_size + bv->bv_len <=
+		    queue_max_segment_size(q) &&
+		    BIOVEC_PHYS_MERGEABLE(bvprv, bv) &&
+		    BIOVEC_SEG_BOUNDARY(q, bvprv, bv)) {
+			bio->bi_seg_back_size += bv->bv_len;
+			if (bio->bi_phys_segments == 1)
+				bio->bi_seg_front_size = bio->bi_seg_back_size;
+			return;
+		}
+	}
+
+	bio->bi_phys_segments++;
+	bio->bi_seg_back_size = bv->bv_len;
+	if (bio->bi_phys_segments == 1)
+		bio->bi_seg_front_size = bv->bv_len;
+}
+
 static int blk_phys_contig_segment(struct request_queue *q, struct bio *bio,
 				   struct bio *nxt)
 {
@@ -101,6 +140,11 @@ static int blk_phys_contig_segment(struct request_queue *q, struct bio *bio,
 	if (!BIOVEC_PHYS_MERGEABLE(__BVEC_END(bio), __BVEC_START(nxt)))
 		return 0;
 
+	/* a high page may be bounced, see __blk_recalc_rq_segments() */
+	if (blk_bvec_high(q, __BVEC_END(bio)) ||
+	    blk_bvec_high(q, __BVEC_START(nxt)))
+		return 0;
+
 	/*
 	 * bio and nxt are contiguous in memory; check if the queue allows
 	 * these two to be merged into one
@@ -200,24 +244,94 @@ new_segment:
 }
 EXPORT_SYMBOL(blk_rq_map_sg);
 
+/*
+ * map a single bio to a scatterlist, for drivers that don't get a request.
+ * Same segment rules as blk_rq_map_sg(), the sglist must be large enough.
+ */
+int blk_bio_map_sg(struct request_queue *q, struct bio *bio,
+		   struct scatterlist *sglist)
+{
+	struct bio_vec *bvec, *bvprv;
+	struct scatterlist *sg;
+	int nsegs, cluster, i;
+
+	nsegs = 0;
+	cluster = test_bit(QUEUE_FLAG_CLUSTER, &q->queue_flags);
+
+	bvprv = NULL;
+	sg = NULL;
+	bio_for_each_segment(bvec, bio, i) {
+		int nbytes = bvec->bv_len;
+
+		if (bvprv && cluster) {
+			if (sg->length + nbytes > queue_max_segment_size(q))
+				goto new_segment;
+
+			if (!BIOVEC_PHYS_MERGEABLE(bvprv, bvec))
+				goto new_segment;
+			if (!BIOVEC_SEG_BOUNDARY(q, bvprv, bvec))
+				goto new_segment;
+
+			sg->length += nbytes;
+		} else {
+new_segment:
+			if (!sg)
+				sg = sglist;
+			else {
+				/* see blk_rq_map_sg() */
+				sg->page_link &= ~0x02;
+				sg = sg_next(sg);
+			}
+
+			sg_set_page(sg, bvec->bv_page, nbytes, bvec->bv_offset);
+			nsegs++;
+		}
+		bvprv = bvec;
+	}
+
+	if (sg)
+		sg_mark_end(sg);
+
+	return nsegs;
+}
+EXPORT_SYMBOL(blk_bio_map_sg);
+
+/*
+ * @bio is about to be added to the back (@back set) or the front of
+ * @req.  The cached front and back segment sizes tell us whether the
+ * segments either side of the join coalesce, so neither needs to be
+ * walked and nr_phys_segments stays exact.
+ */
 static inline int ll_new_hw_segment(struct request_queue *q,
 				    struct request *req,
-				    struct bio *bio)
+				    struct bio *bio, int back)
 {
 	int nr_phys_segs = bio_phys_segments(q, bio);
+	struct bio *prv = back ? req->biotail : bio;
+	struct bio *nxt = back ? bio : req->bio;
+	unsigned int seg_size;
+	int contig = 0;
+
+	if (nr_phys_segs && req->nr_phys_segments && bio_has_data(bio))
+		contig = blk_phys_contig_segment(q, prv, nxt);
 
-	if (req->nr_phys_segments + nr_phys_segs > queue_max_segments(q)) {
+	if (req->nr_phys_segments + nr_phys_segs - contig >
+	    queue_max_segments(q)) {
 		req->cmd_flags |= REQ_NOMERGE;
 		if (req == q->last_merge)
 			q->last_merge = NULL;
 		return 0;
 	}
 
-	/*
-	 * This will form the start of a new hw segment.  Bump both
-	 * counters.
-	 */
-	req->nr_phys_segments += nr_phys_segs;
+	if (contig) {
+		seg_size = prv->bi_seg_back_size + nxt->bi_seg_front_size;
+		if ((back ? req->nr_phys_segments : nr_phys_segs) == 1)
+			(back ? req->bio : bio)->bi_seg_front_size = seg_size;
+		if ((back ? nr_phys_segs : req->nr_phys_segments) == 1)
+			(back ? bio : req->biotail)->bi_seg_back_size = seg_size;
+	}
+
+	req->nr_phys_segments += nr_phys_segs - contig;
 	return 1;
 }
 
@@ -242,7 +356,7 @@ int ll_back_merge_fn(struct request_queue *q, struct request *req,
 	if (!bio_flagged(bio, BIO_SEG_VALID))
 		blk_recount_segments(q, bio);
 
-	return ll_new_hw_segment(q, req, bio);
+	return ll_new_hw_segment(q, req, bio, 1);
 }
 
 int ll_front_merge_fn(struct request_queue *q, struct request *req,
@@ -267,7 +381,7 @@ int ll_front_merge_fn(struct request_queue *q, struct request *req,
 	if (!bio_flagged(req->bio, BIO_SEG_VALID))
 		blk_recount_segments(q, req->bio);
 
-	return ll_new_hw_segment(q, req, bio);
+	return ll_new_hw_segment(q, req, bio, 0);
 }
 
 static int ll_merge_requests_fn(struct request_queue *q, struct request *req,
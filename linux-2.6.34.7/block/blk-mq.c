@@ -0,0 +1,632 @@
+/*
+ * Multi-queue submission path for bio based drivers.
+ *
+ * Every cpu gets a software context that maps to one of the device's
+ * hardware queues.  A bio is given a tag of that hardware queue and handed
+ * straight to the driver, without taking the request_queue lock and
+ * without going through the elevator.  Only when the hardware queue is out
+ * of tags, or the driver reports it busy, does the bio wait on the per-cpu
+ * context, to be issued again from kblockd once a command completes.
+ *
+ * Barriers drain all hardware queues and are issued on their own,
+ * bracketed by cache flushes if the device has a volatile write cache.
+ * New bios wait in blk_mq_make_request() until the barrier is done.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/bitops.h>
+#include <linux/completion.h>
+#include <linux/delay.h>
+#include <linux/workqueue.h>
+
+#include "blk.h"
+
+struct blk_mq_sync {
+	struct completion	wait;
+	int			error;
+};
+
+static struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q,
+					      unsigned int cpu)
+{
+	return q->queue_hw_ctx[cpu * q->nr_hw_queues / nr_cpu_ids];
+}
+
+static int blk_mq_get_tag(struct blk_mq_hw_ctx *hctx, struct blk_mq_ctx *ctx)
+{
+	unsigned int depth = hctx->queue_depth;
+	unsigned int tag = ctx->last_tag;
+
+	/*
+	 * start from where this cpu left off, so cpus sharing a hardware
+	 * queue mostly stay out of each other's way in the tag map
+	 */
+	do {
+		tag = find_next_zero_bit(hctx->tag_map, depth, tag);
+		if (tag >= depth) {
+			tag = find_first_zero_bit(hctx->tag_map, depth);
+			if (tag >= depth)
+				return -1;
+		}
+	} while (test_and_set_bit_lock(tag, hctx->tag_map));
+
+	ctx->last_tag = tag + 1;
+	atomic_inc(&hctx->nr_active);
+	return tag;
+}
+
+static void blk_mq_put_tag(struct blk_mq_hw_ctx *hctx, unsigned int tag)
+{
+	clear_bit_unlock(tag, hctx->tag_map);
+	atomic_dec(&hctx->nr_active);
+	smp_mb__after_atomic_dec();
+}
+
+static struct blk_mq_cmd *blk_mq_init_cmd(struct blk_mq_hw_ctx *hctx,
+					  unsigned int tag, struct bio *bio,
+					  unsigned int flags)
+{
+	struct blk_mq_cmd *cmd = hctx->cmds[tag];
+
+	cmd->bio = bio;
+	cmd->flags = flags;
+	cmd->end_io = NULL;
+	cmd->end_io_data = NULL;
+	return cmd;
+}
+
+static inline bool blk_mq_ctx_has_pending(struct blk_mq_ctx *ctx)
+{
+	return test_bit(ctx->index_hw, ctx->hctx->ctx_pending);
+}
+
+static inline bool blk_mq_hctx_has_pending(struct blk_mq_hw_ctx *hctx)
+{
+	return find_first_bit(hctx->ctx_pending, hctx->nr_ctx) < hctx->nr_ctx;
+}
+
+static void blk_mq_add_pending(struct blk_mq_ctx *ctx, struct bio *bio,
+			       bool at_head)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->lock, flags);
+	if (at_head)
+		bio_list_add_head(&ctx->pending, bio);
+	else
+		bio_list_add(&ctx->pending, bio);
+	set_bit(ctx->index_hw, ctx->hctx->ctx_pending);
+	spin_unlock_irqrestore(&ctx->lock, flags);
+}
+
+/*
+ * The driver is out of room.  Put the bio back at the front of its
+ * context and stop the hardware queue until the driver restarts it from
+ * its completion path.  If everything completed before we got here there
+ * will be no such restart, so do it ourselves.
+ */
+static void blk_mq_requeue_busy(struct blk_mq_hw_ctx *hctx,
+				struct blk_mq_ctx *ctx, struct blk_mq_cmd *cmd)
+{
+	struct bio *bio = cmd->bio;
+
+	blk_mq_put_tag(hctx, cmd->tag);
+	blk_mq_add_pending(ctx, bio, true);
+	blk_mq_stop_hw_queue(hctx);
+
+	smp_mb__after_clear_bit();
+	if (!atomic_read(&hctx->nr_active))
+		blk_mq_start_hw_queue(hctx);
+}
+
+/*
+ * Returns false if the driver was busy and the bio went back to ctx.
+ */
+static bool blk_mq_issue(struct blk_mq_hw_ctx *hctx, struct blk_mq_ctx *ctx,
+			 struct blk_mq_cmd *cmd)
+{
+	struct request_queue *q = hctx->queue;
+
+	switch (q->mq_ops->queue_cmd(hctx, cmd)) {
+	case BLK_MQ_CMD_OK:
+		hctx->queued++;
+		return true;
+	case BLK_MQ_CMD_BUSY:
+		blk_mq_requeue_busy(hctx, ctx, cmd);
+		return false;
+	default:
+		blk_mq_end_cmd(cmd, -EIO);
+		return true;
+	}
+}
+
+/*
+ * Issue whatever bios are waiting on the software contexts of this
+ * hardware queue, for as long as we can get tags.
+ */
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct blk_mq_ctx *ctx;
+	struct blk_mq_cmd *cmd;
+	struct bio *bio;
+	unsigned long flags;
+	unsigned int i;
+	int tag;
+
+	for_each_set_bit(i, hctx->ctx_pending, hctx->nr_ctx) {
+		ctx = hctx->ctxs[i];
+
+		for (;;) {
+			if (test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+				return;
+
+			spin_lock_irqsave(&ctx->lock, flags);
+			if (bio_list_empty(&ctx->pending)) {
+				clear_bit(i, hctx->ctx_pending);
+				spin_unlock_irqrestore(&ctx->lock, flags);
+				break;
+			}
+
+			tag = blk_mq_get_tag(hctx, ctx);
+			if (tag < 0) {
+				spin_unlock_irqrestore(&ctx->lock, flags);
+				return;
+			}
+
+			bio = bio_list_pop(&ctx->pending);
+			spin_unlock_irqrestore(&ctx->lock, flags);
+
+			cmd = blk_mq_init_cmd(hctx, tag, bio, 0);
+			if (!blk_mq_issue(hctx, ctx, cmd))
+				return;
+		}
+	}
+}
+
+static void blk_mq_run_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx =
+		container_of(work, struct blk_mq_hw_ctx, run_work);
+
+	__blk_mq_run_hw_queue(hctx);
+}
+
+/**
+ * blk_mq_run_hw_queue - issue bios waiting for a hardware queue
+ * @hctx:	the hardware queue
+ * @async:	defer to kblockd instead of issuing from this context
+ */
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
+{
+	if (test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+		return;
+
+	if (async)
+		kblockd_schedule_work(hctx->queue, &hctx->run_work);
+	else
+		__blk_mq_run_hw_queue(hctx);
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+/**
+ * blk_mq_stop_hw_queue - stop issuing commands to a hardware queue
+ * @hctx:	the hardware queue
+ *
+ * Bios for a stopped hardware queue wait on their software contexts
+ * until blk_mq_start_hw_queue() is called.
+ */
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+/**
+ * blk_mq_start_hw_queue - restart a stopped hardware queue
+ * @hctx:	the hardware queue
+ *
+ * May be called from interrupt context, waiting bios are issued from
+ * kblockd.
+ */
+void blk_mq_start_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	if (test_and_clear_bit(BLK_MQ_S_STOPPED, &hctx->state))
+		blk_mq_run_hw_queue(hctx, true);
+}
+EXPORT_SYMBOL(blk_mq_start_hw_queue);
+
+void blk_mq_start_stopped_hw_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		blk_mq_start_hw_queue(hctx);
+}
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+/**
+ * blk_mq_end_cmd - complete a command
+ * @cmd:	the command
+ * @error:	0 or a negative errno
+ *
+ * Ends the bio, releases the tag and kicks any bios that were waiting for
+ * one.  May be called from interrupt context.
+ */
+void blk_mq_end_cmd(struct blk_mq_cmd *cmd, int error)
+{
+	struct blk_mq_hw_ctx *hctx = cmd->hctx;
+	struct request_queue *q = hctx->queue;
+	void (*end_io)(void *, int) = cmd->end_io;
+	void *end_io_data = cmd->end_io_data;
+	struct bio *bio = cmd->bio;
+
+	blk_mq_put_tag(hctx, cmd->tag);
+
+	/*
+	 * Done with the queue before ending the bio: the last completion
+	 * may allow it to be torn down.
+	 */
+	if (waitqueue_active(&q->mq_wait))
+		wake_up(&q->mq_wait);
+
+	if (blk_mq_hctx_has_pending(hctx))
+		blk_mq_run_hw_queue(hctx, true);
+
+	if (end_io)
+		end_io(end_io_data, error);
+	else if (bio)
+		bio_endio(bio, error);
+}
+EXPORT_SYMBOL(blk_mq_end_cmd);
+
+/*
+ * Nothing in flight, nothing waiting and nobody about to submit.  Only
+ * meaningful with BLK_MQ_Q_BARRIER set, which keeps new submitters out.
+ */
+static bool blk_mq_queue_idle(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+	int cpu;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (atomic_read(&hctx->nr_active) ||
+		    blk_mq_hctx_has_pending(hctx))
+			return false;
+	}
+
+	for_each_possible_cpu(cpu) {
+		if (atomic_read(&per_cpu_ptr(q->queue_ctx, cpu)->nr_submitting))
+			return false;
+	}
+
+	return true;
+}
+
+static void blk_mq_sync_end_io(void *data, int error)
+{
+	struct blk_mq_sync *sync = data;
+
+	sync->error = error;
+	complete(&sync->wait);
+}
+
+/*
+ * Issue a single command and wait for it.  Only used for barriers, at
+ * which point all hardware queues are idle, so the driver being busy is
+ * not expected to last.
+ */
+static int blk_mq_exec_sync(struct request_queue *q, struct bio *bio,
+			    unsigned int flags)
+{
+	struct blk_mq_ctx *ctx = per_cpu_ptr(q->queue_ctx, raw_smp_processor_id());
+	struct blk_mq_hw_ctx *hctx = ctx->hctx;
+	struct blk_mq_sync sync;
+	struct blk_mq_cmd *cmd;
+	int tag, ret;
+
+	init_completion(&sync.wait);
+	sync.error = 0;
+
+	for (;;) {
+		wait_event(q->mq_wait, (tag = blk_mq_get_tag(hctx, ctx)) >= 0);
+
+		cmd = blk_mq_init_cmd(hctx, tag, bio, flags);
+		cmd->end_io = blk_mq_sync_end_io;
+		cmd->end_io_data = &sync;
+
+		ret = q->mq_ops->queue_cmd(hctx, cmd);
+		if (ret == BLK_MQ_CMD_OK)
+			break;
+
+		blk_mq_put_tag(hctx, tag);
+		if (ret != BLK_MQ_CMD_BUSY)
+			return flags & BLK_MQ_CMD_FLUSH ? -EOPNOTSUPP : -EIO;
+		msleep(1);
+	}
+
+	wait_for_completion(&sync.wait);
+	return sync.error;
+}
+
+static void blk_mq_barrier(struct request_queue *q, struct bio *bio)
+{
+	int flush = q->mq_flags & BLK_MQ_F_FLUSH;
+	int err = 0;
+
+	might_sleep();
+
+	/* one barrier at a time, and no new bios while it drains */
+	wait_event(q->mq_wait,
+		   !test_and_set_bit(BLK_MQ_Q_BARRIER, &q->mq_state));
+
+	wait_event(q->mq_wait, blk_mq_queue_idle(q));
+
+	if (flush)
+		err = blk_mq_exec_sync(q, NULL, BLK_MQ_CMD_FLUSH);
+
+	if (!err && bio_has_data(bio)) {
+		err = blk_mq_exec_sync(q, bio, 0);
+		if (!err && flush)
+			err = blk_mq_exec_sync(q, NULL, BLK_MQ_CMD_FLUSH);
+	}
+
+	clear_bit(BLK_MQ_Q_BARRIER, &q->mq_state);
+	smp_mb__after_clear_bit();
+	wake_up(&q->mq_wait);
+
+	bio_endio(bio, err);
+}
+
+/*
+ * Bios submitted while a barrier drains the queue wait for it to finish.
+ * The barrier sets its bit before looking at nr_submitting, and we bump
+ * nr_submitting before looking at the bit, so one of us sees the other.
+ */
+static struct blk_mq_ctx *blk_mq_enter(struct request_queue *q)
+{
+	struct blk_mq_ctx *ctx;
+
+	for (;;) {
+		ctx = per_cpu_ptr(q->queue_ctx, raw_smp_processor_id());
+		atomic_inc(&ctx->nr_submitting);
+		smp_mb__after_atomic_inc();
+		if (likely(!test_bit(BLK_MQ_Q_BARRIER, &q->mq_state)))
+			return ctx;
+
+		atomic_dec(&ctx->nr_submitting);
+		wake_up(&q->mq_wait);
+		wait_event(q->mq_wait,
+			   !test_bit(BLK_MQ_Q_BARRIER, &q->mq_state));
+	}
+}
+
+static void blk_mq_exit(struct request_queue *q, struct blk_mq_ctx *ctx)
+{
+	atomic_dec(&ctx->nr_submitting);
+	smp_mb__after_atomic_dec();
+	if (unlikely(test_bit(BLK_MQ_Q_BARRIER, &q->mq_state)))
+		wake_up(&q->mq_wait);
+}
+
+static int blk_mq_make_request(struct request_queue *q, struct bio *bio)
+{
+	struct blk_mq_ctx *ctx;
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_cmd *cmd;
+	int tag;
+
+	blk_queue_bounce(q, &bio);
+
+	if (unlikely(bio_rw_flagged(bio, BIO_RW_BARRIER))) {
+		blk_mq_barrier(q, bio);
+		return 0;
+	}
+
+	/*
+	 * We don't disable preemption, the driver may sleep in ->queue_cmd
+	 * just like in any make_request function.  Being migrated only costs
+	 * us some locality, the context lock takes care of the rest.
+	 */
+	ctx = blk_mq_enter(q);
+	hctx = ctx->hctx;
+
+	/*
+	 * fast path, straight to the driver unless earlier bios from this
+	 * cpu are still waiting
+	 */
+	if (!blk_mq_ctx_has_pending(ctx) &&
+	    !test_bit(BLK_MQ_S_STOPPED, &hctx->state)) {
+		tag = blk_mq_get_tag(hctx, ctx);
+		if (tag >= 0) {
+			cmd = blk_mq_init_cmd(hctx, tag, bio, 0);
+			blk_mq_issue(hctx, ctx, cmd);
+			blk_mq_exit(q, ctx);
+			return 0;
+		}
+	}
+
+	/*
+	 * Wait for a tag.  A command may have completed after we failed to
+	 * get one but before our bio was visible, so run the queue
+	 * ourselves once it is.
+	 */
+	blk_mq_add_pending(ctx, bio, false);
+	hctx->deferred++;
+	blk_mq_run_hw_queue(hctx, false);
+	blk_mq_exit(q, ctx);
+	return 0;
+}
+
+static struct blk_mq_hw_ctx *blk_mq_alloc_hctx(struct request_queue *q,
+					       struct blk_mq_reg *reg,
+					       unsigned int index)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	hctx = kzalloc_node(sizeof(*hctx), GFP_KERNEL, reg->numa_node);
+	if (!hctx)
+		return NULL;
+
+	hctx->queue = q;
+	hctx->queue_num = index;
+	hctx->queue_depth = reg->queue_depth;
+	atomic_set(&hctx->nr_active, 0);
+	INIT_WORK(&hctx->run_work, blk_mq_run_work_fn);
+
+	hctx->ctxs = kzalloc_node(nr_cpu_ids * sizeof(void *), GFP_KERNEL,
+				  reg->numa_node);
+	hctx->ctx_pending = kzalloc_node(BITS_TO_LONGS(nr_cpu_ids) *
+					 sizeof(long), GFP_KERNEL,
+					 reg->numa_node);
+	hctx->tag_map = kzalloc_node(BITS_TO_LONGS(reg->queue_depth) *
+				     sizeof(long), GFP_KERNEL, reg->numa_node);
+	hctx->cmds = kzalloc_node(reg->queue_depth * sizeof(void *),
+				  GFP_KERNEL, reg->numa_node);
+	if (!hctx->ctxs || !hctx->ctx_pending || !hctx->tag_map || !hctx->cmds)
+		return hctx;
+
+	for (i = 0; i < reg->queue_depth; i++) {
+		struct blk_mq_cmd *cmd;
+
+		cmd = kzalloc_node(sizeof(*cmd) + reg->cmd_size, GFP_KERNEL,
+				   reg->numa_node);
+		if (!cmd)
+			break;
+		cmd->hctx = hctx;
+		cmd->tag = i;
+		hctx->cmds[i] = cmd;
+	}
+
+	return hctx;
+}
+
+static void blk_mq_free_hctx(struct blk_mq_hw_ctx *hctx)
+{
+	unsigned int i;
+
+	cancel_work_sync(&hctx->run_work);
+
+	if (hctx->cmds) {
+		for (i = 0; i < hctx->queue_depth; i++)
+			kfree(hctx->cmds[i]);
+		kfree(hctx->cmds);
+	}
+	kfree(hctx->tag_map);
+	kfree(hctx->ctx_pending);
+	kfree(hctx->ctxs);
+	kfree(hctx);
+}
+
+static bool blk_mq_hctx_complete(struct blk_mq_hw_ctx *hctx)
+{
+	return hctx->ctxs && hctx->ctx_pending && hctx->tag_map &&
+		hctx->cmds && hctx->cmds[hctx->queue_depth - 1];
+}
+
+/**
+ * blk_mq_init_queue - set up a multi-queue request queue
+ * @reg:	queue layout and driver operations
+ * @driver_data: passed to ->init_hctx()
+ *
+ * Returns a queue with a make_request function that issues bios through
+ * @reg->ops.  The queue is torn down with blk_cleanup_queue() once all
+ * commands have completed.
+ */
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data)
+{
+	struct request_queue *q;
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+	int cpu;
+
+	if (!reg->nr_hw_queues || !reg->queue_depth || !reg->ops->queue_cmd)
+		return ERR_PTR(-EINVAL);
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		return ERR_PTR(-ENOMEM);
+
+	q->mq_ops = reg->ops;
+	q->mq_flags = reg->flags;
+	init_waitqueue_head(&q->mq_wait);
+
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	if (!q->queue_ctx)
+		goto err;
+
+	q->queue_hw_ctx = kzalloc_node(reg->nr_hw_queues * sizeof(void *),
+				       GFP_KERNEL, reg->numa_node);
+	if (!q->queue_hw_ctx)
+		goto err;
+
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		hctx = blk_mq_alloc_hctx(q, reg, i);
+		if (!hctx)
+			goto err;
+		q->queue_hw_ctx[i] = hctx;
+		q->nr_hw_queues++;
+		if (!blk_mq_hctx_complete(hctx))
+			goto err;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct blk_mq_ctx *ctx = per_cpu_ptr(q->queue_ctx, cpu);
+
+		spin_lock_init(&ctx->lock);
+		bio_list_init(&ctx->pending);
+		ctx->last_tag = 0;
+		atomic_set(&ctx->nr_submitting, 0);
+
+		hctx = blk_mq_map_queue(q, cpu);
+		ctx->hctx = hctx;
+		ctx->index_hw = hctx->nr_ctx;
+		hctx->ctxs[hctx->nr_ctx++] = ctx;
+	}
+
+	if (reg->ops->init_hctx) {
+		queue_for_each_hw_ctx(q, hctx, i) {
+			if (reg->ops->init_hctx(hctx, driver_data, i))
+				goto err;
+		}
+	}
+
+	blk_queue_make_request(q, blk_mq_make_request);
+
+	/*
+	 * barriers are taken care of in blk_mq_barrier(), this only tells
+	 * generic_make_request() not to fail them
+	 */
+	blk_queue_ordered(q, QUEUE_ORDERED_DRAIN, NULL);
+
+	return q;
+
+err:
+	blk_cleanup_queue(q);
+	return ERR_PTR(-ENOMEM);
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/*
+ * Called when the last reference to the queue goes away.
+ */
+void blk_mq_free_queue(struct request_queue *q)
+{
+	unsigned int i;
+
+	for (i = 0; i < q->nr_hw_queues; i++)
+		blk_mq_free_hctx(q->queue_hw_ctx[i]);
+
+	kfree(q->queue_hw_ctx);
+	free_percpu(q->queue_ctx);
+	q->nr_hw_queues = 0;
+}
@@ -13,11 +13,14 @@
 #include <linux/moduleparam.h>
 #include <linux/major.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/bio.h>
 #include <linux/highmem.h>
 #include <linux/radix-tree.h>
 #include <linux/buffer_head.h> /* invalidate_bh_lrus() */
 #include <linux/slab.h>
+#include <linux/log2.h>
+#include <linux/cpumask.h>
 
 #include <asm/uaccess.h>
 
@@ -26,11 +29,34 @@
 #define PAGE_SECTORS		(1 << PAGE_SECTORS_SHIFT)
 
 /*
- * Each block ramdisk device has a radix_tree brd_pages of pages that stores
- * the pages containing the block device's contents. A brd page's ->index is
- * its offset in PAGE_SIZE units. This is similar to, but in no way connected
- * with, the kernel's pagecache or buffer cache (which sit above our block
- * device).
+ * Consecutive backing pages are grouped into chunks of this many radix
+ * tree entries, and chunks are spread over the shards.  Large sequential
+ * I/O mostly stays within one shard, parallel I/O to different parts of
+ * the disk lands on different ones.
+ */
+#define BRD_SHARD_CHUNK_SHIFT	4
+
+/*
+ * One radix tree of backing pages and the lock serialising insertions into
+ * it.  Lookups only take rcu_read_lock().  With rd_huge, single pages
+ * allocated when no compound page was available go into small_pages,
+ * indexed in PAGE_SIZE units; a given compound page range is backed by
+ * either tree, never both.
+ */
+struct brd_shard {
+	spinlock_t		lock;
+	struct radix_tree_root	pages;
+	struct radix_tree_root	small_pages;
+} ____cacheline_aligned_in_smp;
+
+/*
+ * Each block ramdisk device has radix trees of pages that store the pages
+ * containing the block device's contents, sharded so that writers to
+ * different parts of the device don't contend on one lock.  A brd page's
+ * ->index is its offset in units of the backing page size, PAGE_SIZE or
+ * the compound page size with rd_huge.  This is similar to, but in no way
+ * connected with, the kernel's pagecache or buffer cache (which sit above
+ * our block device).
  */
 struct brd_device {
 	int		brd_number;
@@ -44,13 +70,60 @@ struct brd_device {
 	struct list_head	brd_list;
 
 	/*
-	 * Backing store of pages and lock to protect it. This is the contents
-	 * of the block device.
+	 * Backing store of pages. This is the contents of the block device.
 	 */
-	spinlock_t		brd_lock;
-	struct radix_tree_root	brd_pages;
+	struct brd_shard	*brd_shards;
+	unsigned int		brd_shard_mask;
+	unsigned int		brd_page_order;
 };
 
+static inline struct brd_shard *brd_shard(struct brd_device *brd, pgoff_t idx)
+{
+	return &brd->brd_shards[(idx >> BRD_SHARD_CHUNK_SHIFT) &
+				brd->brd_shard_mask];
+}
+
+/* sector to index of the backing (possibly compound) page */
+static inline pgoff_t brd_page_idx(struct brd_device *brd, sector_t sector)
+{
+	return sector >> (PAGE_SECTORS_SHIFT + brd->brd_page_order);
+}
+
+/* the PAGE_SIZE page of a backing page that holds sector */
+static inline struct page *brd_sub_page(struct brd_device *brd,
+					struct page *page, sector_t sector)
+{
+	return page + ((sector >> PAGE_SECTORS_SHIFT) &
+		       ((1UL << brd->brd_page_order) - 1));
+}
+
+/*
+ * Look up a single page fallback for a given sector.  Called under
+ * rcu_read_lock() or the shard lock.
+ */
+static struct page *brd_lookup_small(struct brd_shard *shard, sector_t sector)
+{
+	pgoff_t idx = sector >> PAGE_SECTORS_SHIFT;
+	struct page *page;
+
+	page = radix_tree_lookup(&shard->small_pages, idx);
+	BUG_ON(page && page->index != idx);
+	return page;
+}
+
+/* does any single page fallback cover part of compound page idx? */
+static bool brd_range_has_small(struct brd_device *brd,
+				struct brd_shard *shard, pgoff_t idx)
+{
+	pgoff_t first = idx << brd->brd_page_order;
+	struct page *page;
+
+	if (!radix_tree_gang_lookup(&shard->small_pages, (void **)&page,
+				    first, 1))
+		return false;
+	return page->index < first + (1UL << brd->brd_page_order);
+}
+
 /*
  * Look up and return a brd's page for a given sector.
  */
@@ -71,11 +144,58 @@ static struct page *brd_lookup_page(struct brd_device *brd, sector_t sector)
 	 * here, only deletes).
 	 */
 	rcu_read_lock();
-	idx = sector >> PAGE_SECTORS_SHIFT; /* sector to page index */
-	page = radix_tree_lookup(&brd->brd_pages, idx);
+	idx = brd_page_idx(brd, sector);
+	page = radix_tree_lookup(&brd_shard(brd, idx)->pages, idx);
+	if (!page && brd->brd_page_order) {
+		page = brd_lookup_small(brd_shard(brd, idx), sector);
+		rcu_read_unlock();
+		return page;
+	}
 	rcu_read_unlock();
 
-	BUG_ON(page && page->index != idx);
+	if (!page)
+		return NULL;
+
+	BUG_ON(page->index != idx);
+
+	return brd_sub_page(brd, page, sector);
+}
+
+/*
+ * rd_huge fallback: back a single PAGE_SIZE page of a compound page range
+ * that could not be allocated, unless someone else managed to allocate
+ * the compound page meanwhile.
+ */
+static struct page *brd_insert_small(struct brd_device *brd,
+				     struct brd_shard *shard, sector_t sector,
+				     gfp_t gfp_flags)
+{
+	pgoff_t idx = sector >> PAGE_SECTORS_SHIFT;
+	struct page *page, *huge;
+
+	page = alloc_page(gfp_flags);
+	if (!page)
+		return NULL;
+
+	if (radix_tree_preload(GFP_NOIO)) {
+		__free_page(page);
+		return NULL;
+	}
+
+	spin_lock(&shard->lock);
+	huge = radix_tree_lookup(&shard->pages, brd_page_idx(brd, sector));
+	if (huge) {
+		__free_page(page);
+		page = brd_sub_page(brd, huge, sector);
+	} else if (radix_tree_insert(&shard->small_pages, idx, page)) {
+		__free_page(page);
+		page = brd_lookup_small(shard, sector);
+		BUG_ON(!page);
+	} else
+		page->index = idx;
+	spin_unlock(&shard->lock);
+
+	radix_tree_preload_end();
 
 	return page;
 }
@@ -89,6 +209,7 @@ static struct page *brd_insert_page(struct brd_device *brd, sector_t sector)
 {
 	pgoff_t idx;
 	struct page *page;
+	struct brd_shard *shard;
 	gfp_t gfp_flags;
 
 	page = brd_lookup_page(brd, sector);
@@ -108,29 +229,54 @@ static struct page *brd_insert_page(struct brd_device *brd, sector_t sector)
 #ifndef CONFIG_BLK_DEV_XIP
 	gfp_flags |= __GFP_HIGHMEM;
 #endif
-	page = alloc_page(gfp_flags);
-	if (!page)
-		return NULL;
+	idx = brd_page_idx(brd, sector);
+	shard = brd_shard(brd, idx);
+
+	if (brd->brd_page_order) {
+		bool small;
+
+		/* a range that already fell back keeps using single pages */
+		rcu_read_lock();
+		small = brd_range_has_small(brd, shard, idx);
+		rcu_read_unlock();
+		if (small)
+			return brd_insert_small(brd, shard, sector, gfp_flags);
+
+		page = alloc_pages(gfp_flags | __GFP_COMP | __GFP_NOWARN,
+				   brd->brd_page_order);
+		if (!page)
+			return brd_insert_small(brd, shard, sector, gfp_flags);
+	} else {
+		page = alloc_page(gfp_flags);
+		if (!page)
+			return NULL;
+	}
 
 	if (radix_tree_preload(GFP_NOIO)) {
-		__free_page(page);
+		__free_pages(page, brd->brd_page_order);
 		return NULL;
 	}
 
-	spin_lock(&brd->brd_lock);
-	idx = sector >> PAGE_SECTORS_SHIFT;
-	if (radix_tree_insert(&brd->brd_pages, idx, page)) {
-		__free_page(page);
-		page = radix_tree_lookup(&brd->brd_pages, idx);
+	spin_lock(&shard->lock);
+	if (brd->brd_page_order && brd_range_has_small(brd, shard, idx)) {
+		/* lost a race against a single page fallback */
+		spin_unlock(&shard->lock);
+		radix_tree_preload_end();
+		__free_pages(page, brd->brd_page_order);
+		return brd_insert_small(brd, shard, sector, gfp_flags);
+	}
+	if (radix_tree_insert(&shard->pages, idx, page)) {
+		__free_pages(page, brd->brd_page_order);
+		page = radix_tree_lookup(&shard->pages, idx);
 		BUG_ON(!page);
 		BUG_ON(page->index != idx);
 	} else
 		page->index = idx;
-	spin_unlock(&brd->brd_lock);
+	spin_unlock(&shard->lock);
 
 	radix_tree_preload_end();
 
-	return page;
+	return brd_sub_page(brd, page, sector);
 }
 
 /*
@@ -138,7 +284,7 @@ static struct page *brd_insert_page(struct brd_device *brd, sector_t sector)
  * there are no other users of the device.
  */
 #define FREE_BATCH 16
-static void brd_free_pages(struct brd_device *brd)
+static void brd_free_tree(struct radix_tree_root *root, unsigned int order)
 {
 	unsigned long pos = 0;
 	struct page *pages[FREE_BATCH];
@@ -147,7 +293,7 @@ static void brd_free_pages(struct brd_device *brd)
 	do {
 		int i;
 
-		nr_pages = radix_tree_gang_lookup(&brd->brd_pages,
+		nr_pages = radix_tree_gang_lookup(root,
 				(void **)pages, pos, FREE_BATCH);
 
 		for (i = 0; i < nr_pages; i++) {
@@ -155,9 +301,9 @@ static void brd_free_pages(struct brd_device *brd)
 
 			BUG_ON(pages[i]->index < pos);
 			pos = pages[i]->index;
-			ret = radix_tree_delete(&brd->brd_pages, pos);
+			ret = radix_tree_delete(root, pos);
 			BUG_ON(!ret || ret != pages[i]);
-			__free_page(pages[i]);
+			__free_pages(pages[i], order);
 		}
 
 		pos++;
@@ -170,6 +316,16 @@ static void brd_free_pages(struct brd_device *brd)
 	} while (nr_pages == FREE_BATCH);
 }
 
+static void brd_free_pages(struct brd_device *brd)
+{
+	unsigned int i;
+
+	for (i = 0; i <= brd->brd_shard_mask; i++) {
+		brd_free_tree(&brd->brd_shards[i].pages, brd->brd_page_order);
+		brd_free_tree(&brd->brd_shards[i].small_pages, 0);
+	}
+}
+
 /*
  * copy_to_brd_setup must be called before copy_to_brd. It may sleep.
  */
@@ -285,20 +441,18 @@ out:
 	return err;
 }
 
-static int brd_make_request(struct request_queue *q, struct bio *bio)
+static int brd_do_bio(struct brd_device *brd, struct bio *bio)
 {
-	struct block_device *bdev = bio->bi_bdev;
-	struct brd_device *brd = bdev->bd_disk->private_data;
 	int rw;
 	struct bio_vec *bvec;
 	sector_t sector;
 	int i;
-	int err = -EIO;
+	int err = 0;
 
 	sector = bio->bi_sector;
 	if (sector + (bio->bi_size >> SECTOR_SHIFT) >
-						get_capacity(bdev->bd_disk))
-		goto out;
+						get_capacity(brd->brd_disk))
+		return -EIO;
 
 	rw = bio_rw(bio);
 	if (rw == READA)
@@ -313,12 +467,46 @@ static int brd_make_request(struct request_queue *q, struct bio *bio)
 		sector += len >> SECTOR_SHIFT;
 	}
 
-out:
-	bio_endio(bio, err);
+	return err;
+}
+
+static int brd_make_request(struct request_queue *q, struct bio *bio)
+{
+	struct brd_device *brd = bio->bi_bdev->bd_disk->private_data;
+
+	bio_endio(bio, brd_do_bio(brd, bio));
+
+	return 0;
+}
+
+/*
+ * Multi-queue mode.  There is no hardware to wait for, every command is
+ * copied and completed in the context of the submitter.
+ */
+static int brd_queue_cmd(struct blk_mq_hw_ctx *hctx, struct blk_mq_cmd *cmd)
+{
+	struct brd_device *brd = hctx->driver_data;
+	int err = 0;
 
+	if (cmd->bio)
+		err = brd_do_bio(brd, cmd->bio);
+
+	blk_mq_end_cmd(cmd, err);
+	return BLK_MQ_CMD_OK;
+}
+
+static int brd_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
+			 unsigned int index)
+{
+	hctx->driver_data = data;
 	return 0;
 }
 
+static struct blk_mq_ops brd_mq_ops = {
+	.queue_cmd	= brd_queue_cmd,
+	.init_hctx	= brd_init_hctx,
+};
+
 #ifdef CONFIG_BLK_DEV_XIP
 static int brd_direct_access (struct block_device *bdev, sector_t sector,
 			void **kaddr, unsigned long *pfn)
@@ -390,12 +578,24 @@ static int rd_nr;
 int rd_size = CONFIG_BLK_DEV_RAM_SIZE;
 static int max_part;
 static int part_shift;
+static int rd_huge;
+static int use_mq;
+static int submit_queues;
+static int hw_queue_depth = 64;
 module_param(rd_nr, int, 0);
 MODULE_PARM_DESC(rd_nr, "Maximum number of brd devices");
 module_param(rd_size, int, 0);
 MODULE_PARM_DESC(rd_size, "Size of each RAM disk in kbytes.");
 module_param(max_part, int, 0);
 MODULE_PARM_DESC(max_part, "Maximum number of partitions per RAM disk");
+module_param(rd_huge, int, 0);
+MODULE_PARM_DESC(rd_huge, "Back RAM disks with 2MB compound pages where available");
+module_param(use_mq, int, 0);
+MODULE_PARM_DESC(use_mq, "Submit through per-cpu queues (blk-mq)");
+module_param(submit_queues, int, 0);
+MODULE_PARM_DESC(submit_queues, "Number of hardware queues with use_mq, default one per cpu");
+module_param(hw_queue_depth, int, 0);
+MODULE_PARM_DESC(hw_queue_depth, "Tags per hardware queue with use_mq");
 MODULE_LICENSE("GPL");
 MODULE_ALIAS_BLOCKDEV_MAJOR(RAMDISK_MAJOR);
 MODULE_ALIAS("rd");
@@ -421,19 +621,46 @@ static struct brd_device *brd_alloc(int i)
 {
 	struct brd_device *brd;
 	struct gendisk *disk;
+	unsigned int nr_shards, j;
 
 	brd = kzalloc(sizeof(*brd), GFP_KERNEL);
 	if (!brd)
 		goto out;
 	brd->brd_number		= i;
-	spin_lock_init(&brd->brd_lock);
-	INIT_RADIX_TREE(&brd->brd_pages, GFP_ATOMIC);
 
-	brd->brd_queue = blk_alloc_queue(GFP_KERNEL);
-	if (!brd->brd_queue)
+	nr_shards = roundup_pow_of_two(num_possible_cpus());
+	brd->brd_shards = kcalloc(nr_shards, sizeof(struct brd_shard),
+				  GFP_KERNEL);
+	if (!brd->brd_shards)
 		goto out_free_dev;
-	blk_queue_make_request(brd->brd_queue, brd_make_request);
-	blk_queue_ordered(brd->brd_queue, QUEUE_ORDERED_TAG, NULL);
+	brd->brd_shard_mask = nr_shards - 1;
+	for (j = 0; j < nr_shards; j++) {
+		spin_lock_init(&brd->brd_shards[j].lock);
+		INIT_RADIX_TREE(&brd->brd_shards[j].pages, GFP_ATOMIC);
+		INIT_RADIX_TREE(&brd->brd_shards[j].small_pages, GFP_ATOMIC);
+	}
+
+	if (rd_huge)
+		brd->brd_page_order = min(get_order(2 << 20), MAX_ORDER - 1);
+
+	if (use_mq) {
+		struct blk_mq_reg reg = {
+			.ops		= &brd_mq_ops,
+			.nr_hw_queues	= submit_queues,
+			.queue_depth	= hw_queue_depth,
+			.numa_node	= -1,
+		};
+
+		brd->brd_queue = blk_mq_init_queue(&reg, brd);
+		if (IS_ERR(brd->brd_queue))
+			goto out_free_dev;
+	} else {
+		brd->brd_queue = blk_alloc_queue(GFP_KERNEL);
+		if (!brd->brd_queue)
+			goto out_free_dev;
+		blk_queue_make_request(brd->brd_queue, brd_make_request);
+		blk_queue_ordered(brd->brd_queue, QUEUE_ORDERED_TAG, NULL);
+	}
 	blk_queue_max_hw_sectors(brd->brd_queue, 1024);
 	blk_queue_bounce_limit(brd->brd_queue, BLK_BOUNCE_ANY);
 
@@ -454,6 +681,7 @@ static struct brd_device *brd_alloc(int i)
 out_free_queue:
 	blk_cleanup_queue(brd->brd_queue);
 out_free_dev:
+	kfree(brd->brd_shards);
 	kfree(brd);
 out:
 	return NULL;
@@ -464,6 +692,7 @@ static void brd_free(struct brd_device *brd)
 	put_disk(brd->brd_disk);
 	blk_cleanup_queue(brd->brd_queue);
 	brd_free_pages(brd);
+	kfree(brd->brd_shards);
 	kfree(brd);
 }
 
@@ -534,6 +763,11 @@ static int __init brd_init(void)
 	if (rd_nr > 1UL << (MINORBITS - part_shift))
 		return -EINVAL;
 
+	if (submit_queues <= 0 || submit_queues > nr_cpu_ids)
+		submit_queues = nr_cpu_ids;
+	if (hw_queue_depth <= 0)
+		hw_queue_depth = 64;
+
 	if (rd_nr) {
 		nr = rd_nr;
 		range = rd_nr;
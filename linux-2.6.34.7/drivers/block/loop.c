@@ -522,6 +522,278 @@ static struct bio *loop_get_bio(struct loop_device *lo)
 	return bio_list_pop(&lo->lo_bio_list);
 }
 
+/*
+ * Direct mapped mode.
+ *
+ * The backing file's blocks are mapped once with bmap() when the mode is
+ * enabled, after which bios are remapped onto the underlying block device
+ * and submitted from the caller's context, the way swap I/O is done.  No
+ * data goes through the backing file's page cache and there is no loop
+ * thread in the way, so any number of submitters can have I/O in flight,
+ * up to dio_depth bios per device.
+ *
+ * loop_make_request() never sleeps for this: barriers, bios over the depth
+ * limit and everything behind them go to lo_dio_list, and the loop thread
+ * drains, flushes and throttles them in order.
+ *
+ * Like a swapfile, the backing file must be fully allocated and written,
+ * and is marked S_SWAPFILE while mapped so it can't be truncated, unlinked
+ * or reallocated (defragmented) under us.  Nobody else may write to it
+ * either, and only file systems that overwrite in place (FS_STABLE_BMAP)
+ * are mapped.
+ *
+ * Switching modes freezes the device: new bios are held on lo_hold_list
+ * until the old mode's I/O has drained and the backing file's page cache
+ * has been written out and dropped.
+ */
+struct loop_dio {
+	struct loop_device	*lo;
+	struct bio		*bio;
+	atomic_t		pending;
+	int			error;
+	struct completion	*wait;	/* barrier data, ended by the waiter */
+};
+
+static int dio_depth = 128;
+
+static struct loop_extent *loop_find_extent(struct loop_device *lo,
+					    sector_t sector)
+{
+	unsigned int lo_idx = 0, hi_idx = lo->lo_nr_extents;
+
+	while (lo_idx < hi_idx) {
+		unsigned int mid = (lo_idx + hi_idx) / 2;
+		struct loop_extent *ext = &lo->lo_extents[mid];
+
+		if (sector < ext->file_start)
+			hi_idx = mid;
+		else if (sector >= ext->file_start + ext->nr_sects)
+			lo_idx = mid + 1;
+		else
+			return ext;
+	}
+
+	return NULL;
+}
+
+static void loop_dio_put(struct loop_dio *dio)
+{
+	struct loop_device *lo = dio->lo;
+
+	if (!atomic_dec_and_test(&dio->pending))
+		return;
+
+	if (dio->wait) {
+		complete(dio->wait);
+		return;
+	}
+
+	bio_endio(dio->bio, dio->error);
+	mempool_free(dio, lo->lo_dio_pool);
+
+	atomic_dec(&lo->lo_dio_inflight);
+	if (waitqueue_active(&lo->lo_dio_wait))
+		wake_up(&lo->lo_dio_wait);
+}
+
+static void loop_dio_destructor(struct bio *bio)
+{
+	struct loop_dio *dio = bio->bi_private;
+
+	bio_free(bio, dio->lo->lo_dio_bs);
+}
+
+static void loop_dio_end_io(struct bio *bio, int error)
+{
+	struct loop_dio *dio = bio->bi_private;
+
+	if (error)
+		dio->error = error;
+
+	bio_put(bio);
+	loop_dio_put(dio);
+}
+
+static struct bio *loop_dio_alloc(struct loop_dio *dio, struct loop_extent *ext,
+				  sector_t sector, int nr_vecs)
+{
+	struct loop_device *lo = dio->lo;
+	struct bio *bio;
+
+	bio = bio_alloc_bioset(GFP_NOIO, min(nr_vecs, BIO_MAX_PAGES),
+			       lo->lo_dio_bs);
+	bio->bi_sector = ext->disk_start + (sector - ext->file_start);
+	bio->bi_bdev = lo->lo_map_bdev;
+	bio->bi_rw = dio->bio->bi_rw & ~(1 << BIO_RW_BARRIER);
+	bio->bi_end_io = loop_dio_end_io;
+	bio->bi_private = dio;
+	bio->bi_destructor = loop_dio_destructor;
+
+	atomic_inc(&dio->pending);
+	return bio;
+}
+
+/*
+ * Split the bio wherever it crosses an extent or bio_add_page() refuses a
+ * page for the underlying queue, and submit the pieces.
+ */
+static int loop_dio_submit(struct loop_dio *dio)
+{
+	struct loop_device *lo = dio->lo;
+	struct loop_extent *ext = NULL, *child_ext = NULL;
+	struct bio *child = NULL;
+	struct bio_vec *bvec;
+	sector_t sector;
+	int i;
+
+	sector = dio->bio->bi_sector + (lo->lo_offset >> 9);
+
+	bio_for_each_segment(bvec, dio->bio, i) {
+		unsigned int off = bvec->bv_offset;
+		unsigned int len = bvec->bv_len;
+
+		while (len) {
+			unsigned int chunk;
+
+			if (!ext || sector >= ext->file_start + ext->nr_sects) {
+				ext = loop_find_extent(lo, sector);
+				if (!ext)
+					goto out_eio;
+			}
+
+			chunk = min_t(sector_t, len,
+				(ext->file_start + ext->nr_sects - sector) << 9);
+
+			if (child && child_ext != ext) {
+				generic_make_request(child);
+				child = NULL;
+			}
+			if (!child) {
+				child = loop_dio_alloc(dio, ext, sector,
+						       dio->bio->bi_vcnt - i);
+				child_ext = ext;
+			}
+
+			if (bio_add_page(child, bvec->bv_page, chunk, off) <
+			    chunk) {
+				/* an empty bio must take at least one page */
+				if (!child->bi_size)
+					goto out_eio;
+				generic_make_request(child);
+				child = NULL;
+				continue;
+			}
+
+			sector += chunk >> 9;
+			off += chunk;
+			len -= chunk;
+		}
+	}
+
+	if (child)
+		generic_make_request(child);
+	return 0;
+
+out_eio:
+	if (child) {
+		if (child->bi_size)
+			generic_make_request(child);
+		else
+			loop_dio_end_io(child, -EIO);
+	}
+	return -EIO;
+}
+
+/*
+ * Barriers are run by the loop thread once everything before them has
+ * completed, the data goes out bracketed by cache flushes of the
+ * underlying device.
+ */
+static int loop_dio_barrier(struct loop_dio *dio)
+{
+	struct loop_device *lo = dio->lo;
+	DECLARE_COMPLETION_ONSTACK(wait);
+	int err;
+
+	err = blkdev_issue_flush(lo->lo_map_bdev, NULL);
+	if (err || !bio_has_data(dio->bio))
+		return err;
+
+	dio->wait = &wait;
+	err = loop_dio_submit(dio);
+	if (!atomic_dec_and_test(&dio->pending)) {
+		blk_unplug(bdev_get_queue(lo->lo_map_bdev));
+		wait_for_completion(&wait);
+	}
+	dio->wait = NULL;
+	atomic_set(&dio->pending, 1);
+
+	if (!err)
+		err = dio->error;
+	if (!err)
+		err = blkdev_issue_flush(lo->lo_map_bdev, NULL);
+	return err;
+}
+
+/*
+ * Called with lo_dio_inflight already raised for this bio.
+ */
+static void loop_handle_dio(struct loop_device *lo, struct bio *bio)
+{
+	struct loop_dio *dio;
+	int err;
+
+	dio = mempool_alloc(lo->lo_dio_pool, GFP_NOIO);
+	dio->lo = lo;
+	dio->bio = bio;
+	dio->error = 0;
+	dio->wait = NULL;
+	atomic_set(&dio->pending, 1);
+
+	if (unlikely(bio_rw_flagged(bio, BIO_RW_BARRIER)))
+		err = loop_dio_barrier(dio);
+	else
+		err = loop_dio_submit(dio);
+
+	if (err)
+		dio->error = err;
+	loop_dio_put(dio);
+}
+
+/*
+ * Loop thread side of direct mapped mode: bios that loop_make_request()
+ * could not submit right away, in the order they arrived.  Barriers wait
+ * for everything in flight, the rest for room below dio_depth.
+ */
+static void loop_run_dio_list(struct loop_device *lo)
+{
+	struct bio *bio;
+
+	spin_lock_irq(&lo->lo_lock);
+	while ((bio = bio_list_pop(&lo->lo_dio_list))) {
+		lo->lo_dio_busy = 1;
+		spin_unlock_irq(&lo->lo_lock);
+
+		if (bio_rw_flagged(bio, BIO_RW_BARRIER))
+			wait_event(lo->lo_dio_wait,
+				   !atomic_read(&lo->lo_dio_inflight));
+		else
+			wait_event(lo->lo_dio_wait,
+				   atomic_read(&lo->lo_dio_inflight) < dio_depth);
+
+		atomic_inc(&lo->lo_dio_inflight);
+		loop_handle_dio(lo, bio);
+		if (bio_list_empty(&lo->lo_dio_list))
+			blk_unplug(bdev_get_queue(lo->lo_map_bdev));
+
+		spin_lock_irq(&lo->lo_lock);
+	}
+	lo->lo_dio_busy = 0;
+	spin_unlock_irq(&lo->lo_lock);
+
+	wake_up(&lo->lo_dio_wait);
+}
+
 static int loop_make_request(struct request_queue *q, struct bio *old_bio)
 {
 	struct loop_device *lo = q->queuedata;
@@ -537,6 +809,36 @@ static int loop_make_request(struct request_queue *q, struct bio *old_bio)
 		goto out;
 	if (unlikely(rw == WRITE && (lo->lo_flags & LO_FLAGS_READ_ONLY)))
 		goto out;
+	/* loop_switch() bios always go to the loop thread */
+	if (unlikely(!old_bio->bi_bdev))
+		goto queue;
+	if (unlikely(lo->lo_dio_frozen)) {
+		bio_list_add(&lo->lo_hold_list, old_bio);
+		spin_unlock_irq(&lo->lo_lock);
+		return 0;
+	}
+	if (lo->lo_flags & LO_FLAGS_DIRECT_MAP) {
+		/*
+		 * Only the loop thread may sleep for barriers and depth, and
+		 * nothing may overtake what it still holds.  The depth check
+		 * and increment are under lo_lock, the loop thread only raises
+		 * lo_dio_inflight while lo_dio_busy keeps us out of here.
+		 */
+		if (unlikely(bio_rw_flagged(old_bio, BIO_RW_BARRIER) ||
+			     !bio_list_empty(&lo->lo_dio_list) ||
+			     lo->lo_dio_busy ||
+			     atomic_read(&lo->lo_dio_inflight) >= dio_depth)) {
+			bio_list_add(&lo->lo_dio_list, old_bio);
+			wake_up(&lo->lo_event);
+			spin_unlock_irq(&lo->lo_lock);
+			return 0;
+		}
+		atomic_inc(&lo->lo_dio_inflight);
+		spin_unlock_irq(&lo->lo_lock);
+		loop_handle_dio(lo, old_bio);
+		return 0;
+	}
+queue:
 	loop_add_bio(lo, old_bio);
 	wake_up(&lo->lo_event);
 	spin_unlock_irq(&lo->lo_lock);
@@ -557,6 +859,8 @@ static void loop_unplug(struct request_queue *q)
 
 	queue_flag_clear_unlocked(QUEUE_FLAG_PLUGGED, q);
 	blk_run_address_space(lo->lo_backing_file->f_mapping);
+	if (lo->lo_flags & LO_FLAGS_DIRECT_MAP)
+		blk_unplug(bdev_get_queue(lo->lo_map_bdev));
 }
 
 struct switch_request {
@@ -596,12 +900,17 @@ static int loop_thread(void *data)
 
 	set_user_nice(current, -20);
 
-	while (!kthread_should_stop() || !bio_list_empty(&lo->lo_bio_list)) {
+	while (!kthread_should_stop() || !bio_list_empty(&lo->lo_bio_list) ||
+	       !bio_list_empty(&lo->lo_dio_list)) {
 
 		wait_event_interruptible(lo->lo_event,
 				!bio_list_empty(&lo->lo_bio_list) ||
+				!bio_list_empty(&lo->lo_dio_list) ||
 				kthread_should_stop());
 
+		if (!bio_list_empty(&lo->lo_dio_list))
+			loop_run_dio_list(lo);
+
 		if (bio_list_empty(&lo->lo_bio_list))
 			continue;
 		spin_lock_irq(&lo->lo_lock);
@@ -691,9 +1000,10 @@ static int loop_change_fd(struct loop_device *lo, struct block_device *bdev,
 	if (lo->lo_state != Lo_bound)
 		goto out;
 
-	/* the loop device has to be read-only */
+	/* the loop device has to be read-only, and use the backing file */
 	error = -EINVAL;
-	if (!(lo->lo_flags & LO_FLAGS_READ_ONLY))
+	if (!(lo->lo_flags & LO_FLAGS_READ_ONLY) ||
+	    (lo->lo_flags & LO_FLAGS_DIRECT_MAP))
 		goto out;
 
 	error = -EBADF;
@@ -821,6 +1131,10 @@ static int loop_set_fd(struct loop_device *lo, fmode_t mode,
 	mapping_set_gfp_mask(mapping, lo->old_gfp_mask & ~(__GFP_IO|__GFP_FS));
 
 	bio_list_init(&lo->lo_bio_list);
+	bio_list_init(&lo->lo_dio_list);
+	bio_list_init(&lo->lo_hold_list);
+	lo->lo_dio_busy = 0;
+	lo->lo_dio_frozen = 0;
 
 	/*
 	 * set queue make_request_fn, and add limits based on lower level
@@ -905,6 +1219,347 @@ loop_init_xfer(struct loop_device *lo, struct loop_func_table *xfer,
 	return err;
 }
 
+/*
+ * Nobody else may write to the backing file while its blocks are written
+ * behind the file system's back: give up our own write access to it and
+ * deny everybody else's, as for a running executable.
+ */
+static int loop_deny_writers(struct loop_device *lo, struct inode *inode)
+{
+	int own = (lo->lo_backing_file->f_mode & FMODE_WRITE) ? 1 : 0;
+	int err = -ETXTBSY;
+
+	spin_lock(&inode->i_lock);
+	if (atomic_read(&inode->i_writecount) == own) {
+		atomic_sub(own + 1, &inode->i_writecount);
+		lo->lo_map_deny = own + 1;
+		err = 0;
+	}
+	spin_unlock(&inode->i_lock);
+	return err;
+}
+
+static void loop_allow_writers(struct loop_device *lo, struct inode *inode)
+{
+	spin_lock(&inode->i_lock);
+	atomic_add(lo->lo_map_deny, &inode->i_writecount);
+	spin_unlock(&inode->i_lock);
+	lo->lo_map_deny = 0;
+}
+
+static void loop_free_direct_map(struct loop_device *lo)
+{
+	struct inode *inode = lo->lo_map_inode;
+
+	if (inode) {
+		mutex_lock(&inode->i_mutex);
+		inode->i_flags &= ~S_SWAPFILE;
+		mutex_unlock(&inode->i_mutex);
+		loop_allow_writers(lo, inode);
+		lo->lo_map_inode = NULL;
+	}
+	if (lo->lo_dio_bs)
+		bioset_free(lo->lo_dio_bs);
+	if (lo->lo_dio_pool)
+		mempool_destroy(lo->lo_dio_pool);
+	kfree(lo->lo_extents);
+	lo->lo_dio_bs = NULL;
+	lo->lo_dio_pool = NULL;
+	lo->lo_extents = NULL;
+	lo->lo_nr_extents = 0;
+	lo->lo_map_bdev = NULL;
+}
+
+static int loop_add_extent(struct loop_device *lo, unsigned int *max,
+			   sector_t file_start, sector_t nr_sects,
+			   sector_t disk_start)
+{
+	struct loop_extent *ext;
+
+	if (lo->lo_nr_extents) {
+		ext = &lo->lo_extents[lo->lo_nr_extents - 1];
+		if (ext->disk_start + ext->nr_sects == disk_start) {
+			ext->nr_sects += nr_sects;
+			return 0;
+		}
+	}
+
+	if (lo->lo_nr_extents == *max) {
+		unsigned int new_max = *max ? *max * 2 : 16;
+
+		ext = krealloc(lo->lo_extents, new_max * sizeof(*ext),
+			       GFP_KERNEL);
+		if (!ext)
+			return -ENOMEM;
+		lo->lo_extents = ext;
+		*max = new_max;
+	}
+
+	ext = &lo->lo_extents[lo->lo_nr_extents++];
+	ext->file_start = file_start;
+	ext->nr_sects = nr_sects;
+	ext->disk_start = disk_start;
+	return 0;
+}
+
+/*
+ * bmap() can't tell preallocated (unwritten) blocks from written ones,
+ * reading those through the mapping would return stale disk contents and
+ * writes would be lost when the file system zeroes them.  Where the file
+ * system implements ->fiemap, refuse anything but plain written data.
+ */
+#define LOOP_FIEMAP_BATCH	32
+
+static int loop_check_extents(struct inode *inode, loff_t size)
+{
+	struct fiemap_extent_info fieinfo;
+	struct fiemap_extent *fe;
+	mm_segment_t old_fs;
+	u64 start = 0;
+	int i, err = 0;
+
+	if (!inode->i_op->fiemap)
+		return 0;
+
+	/* what FIEMAP_FLAG_SYNC does for the ioctl, delalloc shows up as such */
+	err = filemap_write_and_wait(inode->i_mapping);
+	if (err)
+		return err;
+
+	fe = kmalloc(LOOP_FIEMAP_BATCH * sizeof(*fe), GFP_KERNEL);
+	if (!fe)
+		return -ENOMEM;
+
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+	while (start < size) {
+		memset(&fieinfo, 0, sizeof(fieinfo));
+		fieinfo.fi_flags = FIEMAP_FLAG_SYNC;
+		fieinfo.fi_extents_max = LOOP_FIEMAP_BATCH;
+		fieinfo.fi_extents_start = (struct fiemap_extent __user *)fe;
+
+		err = inode->i_op->fiemap(inode, &fieinfo, start, size - start);
+		if (err)
+			break;
+		err = -EINVAL;
+		if (!fieinfo.fi_extents_mapped)
+			break;
+
+		for (i = 0; i < fieinfo.fi_extents_mapped; i++) {
+			if (fe[i].fe_logical > start ||
+			    (fe[i].fe_flags & ~(FIEMAP_EXTENT_LAST |
+						FIEMAP_EXTENT_MERGED)))
+				goto out;
+			start = fe[i].fe_logical + fe[i].fe_length;
+			if (fe[i].fe_flags & FIEMAP_EXTENT_LAST)
+				break;
+		}
+		err = 0;
+		if (i < fieinfo.fi_extents_mapped)
+			break;
+	}
+	if (!err && start < size)
+		err = -EINVAL;
+out:
+	set_fs(old_fs);
+	kfree(fe);
+	return err;
+}
+
+/*
+ * Map every block of the backing file, the way swapon does.  Holes can't
+ * be handled without going through the file system, so they are refused.
+ * Called with the inode's i_mutex held for regular files.
+ */
+static int loop_map_extents(struct loop_device *lo, struct file *file)
+{
+	struct inode *inode = file->f_mapping->host;
+	unsigned int max = 0;
+	sector_t block, nr_blocks, size;
+	unsigned int shift;
+	int err;
+
+	if (S_ISBLK(inode->i_mode)) {
+		lo->lo_map_bdev = inode->i_bdev;
+		return loop_add_extent(lo, &max, 0,
+				       i_size_read(inode) >> 9, 0);
+	}
+
+	if (!inode->i_mapping->a_ops->bmap || !inode->i_sb->s_bdev ||
+	    inode->i_blkbits < 9)
+		return -EINVAL;
+
+	lo->lo_map_bdev = inode->i_sb->s_bdev;
+	shift = inode->i_blkbits - 9;
+	size = i_size_read(inode) >> 9;
+	nr_blocks = (size + (1 << shift) - 1) >> shift;
+
+	for (block = 0; block < nr_blocks; block++) {
+		sector_t disk_block = bmap(inode, block);
+		sector_t nr_sects;
+
+		if (!disk_block)
+			return -EINVAL;
+
+		/* the last block may only be partly inside i_size */
+		nr_sects = min_t(sector_t, 1 << shift, size - (block << shift));
+		err = loop_add_extent(lo, &max, block << shift, nr_sects,
+				      disk_block << shift);
+		if (err)
+			return err;
+
+		cond_resched();
+	}
+
+	return lo->lo_nr_extents ? 0 : -EINVAL;
+}
+
+/*
+ * Pin the backing file's blocks for as long as they are mapped, the way
+ * swapon does.  Only one user can hold the pin.  Writers are shut out
+ * first, so the extents that are checked are the ones that get mapped.
+ */
+static int loop_pin_extents(struct loop_device *lo, struct file *file)
+{
+	struct inode *inode = file->f_mapping->host;
+	int err;
+
+	if (!S_ISREG(inode->i_mode))
+		return loop_map_extents(lo, file);
+
+	/* copy on write and log structured file systems move blocks */
+	if (!(inode->i_sb->s_type->fs_flags & FS_STABLE_BMAP))
+		return -EINVAL;
+
+	err = loop_deny_writers(lo, inode);
+	if (err)
+		return err;
+
+	/* generic_block_fiemap() takes i_mutex itself */
+	err = loop_check_extents(inode, i_size_read(inode));
+	if (err)
+		goto out_allow;
+
+	mutex_lock(&inode->i_mutex);
+	err = -EBUSY;
+	if (!IS_SWAPFILE(inode)) {
+		err = loop_map_extents(lo, file);
+		if (!err) {
+			inode->i_flags |= S_SWAPFILE;
+			lo->lo_map_inode = inode;
+		}
+	}
+	mutex_unlock(&inode->i_mutex);
+	if (!err)
+		return 0;
+
+out_allow:
+	loop_allow_writers(lo, inode);
+	return err;
+}
+
+static void loop_dio_freeze(struct loop_device *lo)
+{
+	spin_lock_irq(&lo->lo_lock);
+	lo->lo_dio_frozen = 1;
+	spin_unlock_irq(&lo->lo_lock);
+}
+
+/*
+ * Set the new mode and let the bios held meanwhile through, in order and
+ * ahead of anything that comes after them.
+ */
+static void loop_dio_thaw(struct loop_device *lo, int direct)
+{
+	spin_lock_irq(&lo->lo_lock);
+	if (direct) {
+		lo->lo_flags |= LO_FLAGS_DIRECT_MAP;
+		bio_list_merge(&lo->lo_dio_list, &lo->lo_hold_list);
+	} else {
+		lo->lo_flags &= ~LO_FLAGS_DIRECT_MAP;
+		bio_list_merge(&lo->lo_bio_list, &lo->lo_hold_list);
+	}
+	bio_list_init(&lo->lo_hold_list);
+	lo->lo_dio_frozen = 0;
+	wake_up(&lo->lo_event);
+	spin_unlock_irq(&lo->lo_lock);
+}
+
+/*
+ * Both modes share nothing but the disk: write out and drop whatever the
+ * backing file's page cache holds.  Called frozen, with the old mode's
+ * I/O drained.
+ */
+static int loop_dio_sync_cache(struct loop_device *lo)
+{
+	struct address_space *mapping = lo->lo_backing_file->f_mapping;
+	int err;
+
+	err = filemap_write_and_wait(mapping);
+	if (!err)
+		err = invalidate_inode_pages2(mapping);
+	return err;
+}
+
+/*
+ * Switch LO_FLAGS_DIRECT_MAP on or off.  Called with lo_ctl_mutex held.
+ */
+static int loop_set_direct_map(struct loop_device *lo, int enable)
+{
+	struct file *file = lo->lo_backing_file;
+	int err;
+
+	if (!enable) {
+		loop_dio_freeze(lo);
+		wait_event(lo->lo_dio_wait,
+			   !atomic_read(&lo->lo_dio_inflight) &&
+			   bio_list_empty(&lo->lo_dio_list) &&
+			   !lo->lo_dio_busy);
+		/* others may have cached what we since wrote underneath */
+		loop_dio_sync_cache(lo);
+		loop_dio_thaw(lo, 0);
+		loop_free_direct_map(lo);
+		return 0;
+	}
+
+	if (lo->lo_encryption || (lo->lo_offset & 511))
+		return -EINVAL;
+
+	err = loop_pin_extents(lo, file);
+	if (err)
+		goto out_free;
+
+	err = -EINVAL;
+	if (bdev_logical_block_size(lo->lo_map_bdev) >
+	    queue_logical_block_size(lo->lo_queue))
+		goto out_free;
+
+	err = -ENOMEM;
+	lo->lo_dio_pool = mempool_create_kmalloc_pool(16,
+					sizeof(struct loop_dio));
+	lo->lo_dio_bs = bioset_create(BIO_POOL_SIZE, 0);
+	if (!lo->lo_dio_pool || !lo->lo_dio_bs)
+		goto out_free;
+
+	/*
+	 * From here on the page cache of the backing file is bypassed.  Hold
+	 * new bios, let the loop thread finish what it has, then get all it
+	 * wrote through the page cache out to disk and drop it, so neither
+	 * late writeback nor stale pages can get in the way.
+	 */
+	loop_dio_freeze(lo);
+	loop_flush(lo);
+	err = loop_dio_sync_cache(lo);
+	loop_dio_thaw(lo, !err);
+	if (err)
+		goto out_free;
+	return 0;
+
+out_free:
+	loop_free_direct_map(lo);
+	return err;
+}
+
 static int loop_clr_fd(struct loop_device *lo, struct block_device *bdev)
 {
 	struct file *filp = lo->lo_backing_file;
@@ -925,6 +1580,9 @@ static int loop_clr_fd(struct loop_device *lo, struct block_device *bdev)
 
 	kthread_stop(lo->lo_thread);
 
+	if (lo->lo_flags & LO_FLAGS_DIRECT_MAP)
+		loop_set_direct_map(lo, 0);
+
 	lo->lo_queue->unplug_fn = NULL;
 	lo->lo_backing_file = NULL;
 
@@ -979,6 +1637,10 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 	if ((unsigned int) info->lo_encrypt_key_size > LO_KEY_SIZE)
 		return -EINVAL;
 
+	/* offset and transfer may change, remapped below if still wanted */
+	if (lo->lo_flags & LO_FLAGS_DIRECT_MAP)
+		loop_set_direct_map(lo, 0);
+
 	err = loop_release_xfer(lo);
 	if (err)
 		return err;
@@ -1020,6 +1682,12 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 	     (info->lo_flags & LO_FLAGS_AUTOCLEAR))
 		lo->lo_flags ^= LO_FLAGS_AUTOCLEAR;
 
+	if (info->lo_flags & LO_FLAGS_DIRECT_MAP) {
+		err = loop_set_direct_map(lo, 1);
+		if (err)
+			return err;
+	}
+
 	lo->lo_encrypt_key_size = info->lo_encrypt_key_size;
 	lo->lo_init[0] = info->lo_init[0];
 	lo->lo_init[1] = info->lo_init[1];
@@ -1457,6 +2125,8 @@ module_param(max_loop, int, 0);
 MODULE_PARM_DESC(max_loop, "Maximum number of loop devices");
 module_param(max_part, int, 0);
 MODULE_PARM_DESC(max_part, "Maximum number of partitions per loop device");
+module_param(dio_depth, int, 0644);
+MODULE_PARM_DESC(dio_depth, "Maximum bios in flight per direct mapped loop device");
 MODULE_LICENSE("GPL");
 MODULE_ALIAS_BLOCKDEV_MAJOR(LOOP_MAJOR);
 
@@ -1517,6 +2187,8 @@ static struct loop_device *loop_alloc(int i)
 	lo->lo_number		= i;
 	lo->lo_thread		= NULL;
 	init_waitqueue_head(&lo->lo_event);
+	init_waitqueue_head(&lo->lo_dio_wait);
+	atomic_set(&lo->lo_dio_inflight, 0);
 	spin_lock_init(&lo->lo_lock);
 	disk->major		= LOOP_MAJOR;
 	disk->first_minor	= i << part_shift;
@@ -0,0 +1,597 @@
+/*
+ * Null block device, for measuring the cost of the block layer itself.
+ *
+ * Reads and writes are completed without touching any data, either inline,
+ * from softirq context or from an hrtimer after completion_nsec.  The
+ * queue can be make_request based, a classic request_fn queue with the
+ * elevator in front of it, or blk-mq.
+ */
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/bio.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
+#include <linux/wait.h>
+#include <linux/log2.h>
+
+struct nullb_cmd {
+	struct list_head list;
+	struct request *rq;
+	struct bio *bio;
+	struct blk_mq_cmd *mq_cmd;
+	unsigned int tag;
+	struct nullb_queue *nq;
+};
+
+struct nullb_queue {
+	unsigned long *tag_map;
+	wait_queue_head_t wait;
+	unsigned int queue_depth;
+
+	struct nullb_cmd *cmds;
+};
+
+struct nullb {
+	struct list_head list;
+	unsigned int index;
+	struct request_queue *q;
+	struct gendisk *disk;
+	spinlock_t lock;
+
+	struct nullb_queue *queues;
+	unsigned int nr_queues;
+};
+
+/*
+ * Commands waiting for softirq or timer completion, one list per cpu.
+ */
+struct nullb_completion_queue {
+	spinlock_t lock;
+	struct list_head list;
+	struct tasklet_struct tasklet;
+	struct hrtimer timer;
+};
+
+static LIST_HEAD(nullb_list);
+static DEFINE_MUTEX(nullb_mutex);
+static int null_major;
+static int nullb_indexes;
+static struct nullb_completion_queue __percpu *completion_queues;
+
+enum {
+	NULL_IRQ_NONE		= 0,
+	NULL_IRQ_SOFTIRQ	= 1,
+	NULL_IRQ_TIMER		= 2,
+};
+
+enum {
+	NULL_Q_BIO		= 0,
+	NULL_Q_RQ		= 1,
+	NULL_Q_MQ		= 2,
+};
+
+static int submit_queues;
+module_param(submit_queues, int, S_IRUGO);
+MODULE_PARM_DESC(submit_queues, "Number of submission queues, default one per cpu");
+
+static int home_node = -1;
+module_param(home_node, int, S_IRUGO);
+MODULE_PARM_DESC(home_node, "Home node for the device");
+
+static int queue_mode = NULL_Q_MQ;
+module_param(queue_mode, int, S_IRUGO);
+MODULE_PARM_DESC(queue_mode, "Block interface: 0=bio, 1=rq, 2=multiqueue");
+
+static int gb = 250;
+module_param(gb, int, S_IRUGO);
+MODULE_PARM_DESC(gb, "Size in GB");
+
+static int bs = 512;
+module_param(bs, int, S_IRUGO);
+MODULE_PARM_DESC(bs, "Block size in bytes");
+
+static int nr_devices = 2;
+module_param(nr_devices, int, S_IRUGO);
+MODULE_PARM_DESC(nr_devices, "Number of devices to register");
+
+static int irqmode = NULL_IRQ_SOFTIRQ;
+module_param(irqmode, int, S_IRUGO);
+MODULE_PARM_DESC(irqmode, "IRQ completion handler: 0=none, 1=softirq, 2=timer");
+
+static int completion_nsec = 10000;
+module_param(completion_nsec, int, S_IRUGO);
+MODULE_PARM_DESC(completion_nsec, "Time in ns to complete a request in hardware, with irqmode=2");
+
+static int hw_queue_depth = 64;
+module_param(hw_queue_depth, int, S_IRUGO);
+MODULE_PARM_DESC(hw_queue_depth, "Queue depth of each submission queue");
+
+/*
+ * Tags for the bio and rq modes, blk-mq brings its own.
+ */
+static void put_tag(struct nullb_queue *nq, unsigned int tag)
+{
+	clear_bit_unlock(tag, nq->tag_map);
+
+	if (waitqueue_active(&nq->wait))
+		wake_up(&nq->wait);
+}
+
+static int get_tag(struct nullb_queue *nq)
+{
+	unsigned int tag;
+
+	do {
+		tag = find_first_zero_bit(nq->tag_map, nq->queue_depth);
+		if (tag >= nq->queue_depth)
+			return -1;
+	} while (test_and_set_bit_lock(tag, nq->tag_map));
+
+	return tag;
+}
+
+static struct nullb_cmd *__alloc_cmd(struct nullb_queue *nq)
+{
+	struct nullb_cmd *cmd;
+	int tag;
+
+	tag = get_tag(nq);
+	if (tag < 0)
+		return NULL;
+
+	cmd = &nq->cmds[tag];
+	cmd->tag = tag;
+	cmd->nq = nq;
+	return cmd;
+}
+
+static struct nullb_cmd *alloc_cmd(struct nullb_queue *nq, int can_wait)
+{
+	struct nullb_cmd *cmd;
+	DEFINE_WAIT(wait);
+
+	cmd = __alloc_cmd(nq);
+	if (cmd || !can_wait)
+		return cmd;
+
+	do {
+		prepare_to_wait(&nq->wait, &wait, TASK_UNINTERRUPTIBLE);
+		cmd = __alloc_cmd(nq);
+		if (cmd)
+			break;
+
+		io_schedule();
+	} while (1);
+
+	finish_wait(&nq->wait, &wait);
+	return cmd;
+}
+
+static void end_cmd(struct nullb_cmd *cmd)
+{
+	struct request_queue *q = NULL;
+	unsigned long flags;
+
+	switch (queue_mode) {
+	case NULL_Q_MQ:
+		blk_mq_end_cmd(cmd->mq_cmd, 0);
+		return;
+	case NULL_Q_RQ:
+		q = cmd->rq->q;
+		blk_end_request_all(cmd->rq, 0);
+		break;
+	case NULL_Q_BIO:
+		bio_endio(cmd->bio, 0);
+		break;
+	}
+
+	put_tag(cmd->nq, cmd->tag);
+
+	/* restart a request queue that ran out of tags */
+	if (q && blk_queue_stopped(q)) {
+		spin_lock_irqsave(q->queue_lock, flags);
+		if (blk_queue_stopped(q))
+			blk_start_queue(q);
+		spin_unlock_irqrestore(q->queue_lock, flags);
+	}
+}
+
+static void null_complete_list(struct nullb_completion_queue *cq)
+{
+	struct nullb_cmd *cmd, *next;
+	unsigned long flags;
+	LIST_HEAD(done);
+
+	spin_lock_irqsave(&cq->lock, flags);
+	list_splice_init(&cq->list, &done);
+	spin_unlock_irqrestore(&cq->lock, flags);
+
+	list_for_each_entry_safe(cmd, next, &done, list)
+		end_cmd(cmd);
+}
+
+static enum hrtimer_restart null_cmd_timer_expired(struct hrtimer *timer)
+{
+	struct nullb_completion_queue *cq =
+		container_of(timer, struct nullb_completion_queue, timer);
+
+	null_complete_list(cq);
+	return HRTIMER_NORESTART;
+}
+
+static void null_softirq_tasklet(unsigned long data)
+{
+	null_complete_list((struct nullb_completion_queue *) data);
+}
+
+/*
+ * Queue the command on this cpu's completion list.  The timer is armed by
+ * the first command of a batch, later ones complete along with it.
+ */
+static void null_defer_cmd(struct nullb_cmd *cmd)
+{
+	struct nullb_completion_queue *cq;
+	unsigned long flags;
+	bool first;
+
+	cq = per_cpu_ptr(completion_queues, get_cpu());
+
+	spin_lock_irqsave(&cq->lock, flags);
+	first = list_empty(&cq->list);
+	list_add_tail(&cmd->list, &cq->list);
+	spin_unlock_irqrestore(&cq->lock, flags);
+
+	if (irqmode == NULL_IRQ_SOFTIRQ)
+		tasklet_schedule(&cq->tasklet);
+	else if (first)
+		hrtimer_start(&cq->timer, ktime_set(0, completion_nsec),
+			      HRTIMER_MODE_REL_PINNED);
+
+	put_cpu();
+}
+
+static void null_softirq_done_fn(struct request *rq)
+{
+	end_cmd(rq->special);
+}
+
+static void null_handle_cmd(struct nullb_cmd *cmd)
+{
+	switch (irqmode) {
+	case NULL_IRQ_NONE:
+		end_cmd(cmd);
+		break;
+	case NULL_IRQ_SOFTIRQ:
+		/* request queues complete through block/blk-softirq.c */
+		if (queue_mode == NULL_Q_RQ)
+			blk_complete_request(cmd->rq);
+		else
+			null_defer_cmd(cmd);
+		break;
+	case NULL_IRQ_TIMER:
+		null_defer_cmd(cmd);
+		break;
+	}
+}
+
+static struct nullb_queue *nullb_to_queue(struct nullb *nullb)
+{
+	int index = 0;
+
+	if (nullb->nr_queues != 1)
+		index = raw_smp_processor_id() /
+			((nr_cpu_ids + nullb->nr_queues - 1) / nullb->nr_queues);
+
+	return &nullb->queues[index];
+}
+
+static int null_make_request(struct request_queue *q, struct bio *bio)
+{
+	struct nullb *nullb = q->queuedata;
+	struct nullb_queue *nq = nullb_to_queue(nullb);
+	struct nullb_cmd *cmd;
+
+	cmd = alloc_cmd(nq, 1);
+	cmd->bio = bio;
+
+	null_handle_cmd(cmd);
+	return 0;
+}
+
+static int null_rq_prep_fn(struct request_queue *q, struct request *req)
+{
+	struct nullb *nullb = q->queuedata;
+	struct nullb_queue *nq = nullb_to_queue(nullb);
+	struct nullb_cmd *cmd;
+
+	cmd = alloc_cmd(nq, 0);
+	if (cmd) {
+		cmd->rq = req;
+		req->special = cmd;
+		return BLKPREP_OK;
+	}
+
+	blk_stop_queue(q);
+	return BLKPREP_DEFER;
+}
+
+static void null_request_fn(struct request_queue *q)
+{
+	struct request *rq;
+
+	while ((rq = blk_fetch_request(q)) != NULL) {
+		struct nullb_cmd *cmd = rq->special;
+
+		spin_unlock_irq(q->queue_lock);
+		null_handle_cmd(cmd);
+		spin_lock_irq(q->queue_lock);
+	}
+}
+
+static int null_queue_cmd(struct blk_mq_hw_ctx *hctx, struct blk_mq_cmd *mq_cmd)
+{
+	struct nullb_cmd *cmd = blk_mq_cmd_to_pdu(mq_cmd);
+
+	cmd->mq_cmd = mq_cmd;
+	cmd->bio = mq_cmd->bio;
+	cmd->nq = hctx->driver_data;
+
+	null_handle_cmd(cmd);
+	return BLK_MQ_CMD_OK;
+}
+
+static int null_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
+			  unsigned int index)
+{
+	struct nullb *nullb = data;
+
+	hctx->driver_data = &nullb->queues[index];
+	return 0;
+}
+
+static struct blk_mq_ops null_mq_ops = {
+	.queue_cmd	= null_queue_cmd,
+	.init_hctx	= null_init_hctx,
+};
+
+static const struct block_device_operations null_fops = {
+	.owner		= THIS_MODULE,
+};
+
+static void cleanup_queues(struct nullb *nullb)
+{
+	unsigned int i;
+
+	for (i = 0; i < nullb->nr_queues; i++) {
+		kfree(nullb->queues[i].cmds);
+		kfree(nullb->queues[i].tag_map);
+	}
+
+	kfree(nullb->queues);
+}
+
+static int setup_queues(struct nullb *nullb)
+{
+	struct nullb_queue *nq;
+	unsigned int i;
+
+	nullb->queues = kzalloc(submit_queues * sizeof(struct nullb_queue),
+				GFP_KERNEL);
+	if (!nullb->queues)
+		return -ENOMEM;
+
+	for (i = 0; i < submit_queues; i++) {
+		nq = &nullb->queues[i];
+		init_waitqueue_head(&nq->wait);
+		nq->queue_depth = hw_queue_depth;
+		nullb->nr_queues++;
+
+		/* blk-mq allocates commands and tags itself */
+		if (queue_mode == NULL_Q_MQ)
+			continue;
+
+		nq->cmds = kzalloc(nq->queue_depth * sizeof(*nq->cmds),
+				   GFP_KERNEL);
+		nq->tag_map = kzalloc(BITS_TO_LONGS(nq->queue_depth) *
+				      sizeof(unsigned long), GFP_KERNEL);
+		if (!nq->cmds || !nq->tag_map) {
+			cleanup_queues(nullb);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+static void null_del_dev(struct nullb *nullb)
+{
+	list_del_init(&nullb->list);
+
+	del_gendisk(nullb->disk);
+	blk_cleanup_queue(nullb->q);
+	put_disk(nullb->disk);
+	cleanup_queues(nullb);
+	kfree(nullb);
+}
+
+static int null_add_dev(void)
+{
+	struct gendisk *disk;
+	struct nullb *nullb;
+	sector_t size;
+
+	nullb = kzalloc_node(sizeof(*nullb), GFP_KERNEL, home_node);
+	if (!nullb)
+		return -ENOMEM;
+
+	spin_lock_init(&nullb->lock);
+
+	if (setup_queues(nullb))
+		goto err;
+
+	if (queue_mode == NULL_Q_MQ) {
+		struct blk_mq_reg reg = {
+			.ops		= &null_mq_ops,
+			.nr_hw_queues	= submit_queues,
+			.queue_depth	= hw_queue_depth,
+			.cmd_size	= sizeof(struct nullb_cmd),
+			.numa_node	= home_node,
+		};
+
+		nullb->q = blk_mq_init_queue(&reg, nullb);
+		if (IS_ERR(nullb->q))
+			goto queue_fail;
+	} else if (queue_mode == NULL_Q_BIO) {
+		nullb->q = blk_alloc_queue_node(GFP_KERNEL, home_node);
+		if (!nullb->q)
+			goto queue_fail;
+		blk_queue_make_request(nullb->q, null_make_request);
+		blk_queue_ordered(nullb->q, QUEUE_ORDERED_TAG, NULL);
+	} else {
+		nullb->q = blk_init_queue_node(null_request_fn, &nullb->lock,
+					       home_node);
+		if (!nullb->q)
+			goto queue_fail;
+		blk_queue_prep_rq(nullb->q, null_rq_prep_fn);
+		blk_queue_softirq_done(nullb->q, null_softirq_done_fn);
+		blk_queue_ordered(nullb->q, QUEUE_ORDERED_DRAIN, NULL);
+	}
+
+	nullb->q->queuedata = nullb;
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, nullb->q);
+
+	disk = nullb->disk = alloc_disk_node(1, home_node);
+	if (!disk) {
+		blk_cleanup_queue(nullb->q);
+		goto queue_fail;
+	}
+
+	mutex_lock(&nullb_mutex);
+	list_add_tail(&nullb->list, &nullb_list);
+	nullb->index = nullb_indexes++;
+	mutex_unlock(&nullb_mutex);
+
+	blk_queue_logical_block_size(nullb->q, bs);
+	blk_queue_physical_block_size(nullb->q, bs);
+
+	size = gb * 1024 * 1024 * 1024ULL;
+	sector_div(size, bs);
+	set_capacity(disk, size * (bs >> 9));
+
+	disk->flags |= GENHD_FL_EXT_DEVT | GENHD_FL_SUPPRESS_PARTITION_INFO;
+	disk->major		= null_major;
+	disk->first_minor	= nullb->index;
+	disk->fops		= &null_fops;
+	disk->private_data	= nullb;
+	disk->queue		= nullb->q;
+	sprintf(disk->disk_name, "nullb%d", nullb->index);
+	add_disk(disk);
+	return 0;
+
+queue_fail:
+	cleanup_queues(nullb);
+err:
+	kfree(nullb);
+	return -ENOMEM;
+}
+
+static int __init null_init(void)
+{
+	unsigned int i;
+
+	if (bs > PAGE_SIZE) {
+		pr_warning("null_blk: invalid block size\n");
+		pr_warning("null_blk: defaults block size to %lu\n", PAGE_SIZE);
+		bs = PAGE_SIZE;
+	}
+	if (bs < 512 || !is_power_of_2(bs))
+		bs = 512;
+
+	if (queue_mode < NULL_Q_BIO || queue_mode > NULL_Q_MQ)
+		queue_mode = NULL_Q_MQ;
+	if (irqmode < NULL_IRQ_NONE || irqmode > NULL_IRQ_TIMER)
+		irqmode = NULL_IRQ_SOFTIRQ;
+	if (hw_queue_depth <= 0)
+		hw_queue_depth = 64;
+
+	/* the request_fn mode has a single queue lock anyway */
+	if (queue_mode == NULL_Q_RQ || submit_queues <= 0)
+		submit_queues = queue_mode == NULL_Q_RQ ? 1 : nr_cpu_ids;
+	else if (submit_queues > nr_cpu_ids)
+		submit_queues = nr_cpu_ids;
+
+	completion_queues = alloc_percpu(struct nullb_completion_queue);
+	if (!completion_queues)
+		return -ENOMEM;
+
+	for_each_possible_cpu(i) {
+		struct nullb_completion_queue *cq;
+
+		cq = per_cpu_ptr(completion_queues, i);
+		spin_lock_init(&cq->lock);
+		INIT_LIST_HEAD(&cq->list);
+		tasklet_init(&cq->tasklet, null_softirq_tasklet,
+			     (unsigned long) cq);
+		hrtimer_init(&cq->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		cq->timer.function = null_cmd_timer_expired;
+	}
+
+	null_major = register_blkdev(0, "nullb");
+	if (null_major < 0) {
+		free_percpu(completion_queues);
+		return null_major;
+	}
+
+	for (i = 0; i < nr_devices; i++) {
+		if (null_add_dev())
+			goto err_dev;
+	}
+
+	pr_info("null_blk: module loaded\n");
+	return 0;
+
+err_dev:
+	mutex_lock(&nullb_mutex);
+	while (!list_empty(&nullb_list))
+		null_del_dev(list_entry(nullb_list.next, struct nullb, list));
+	mutex_unlock(&nullb_mutex);
+	unregister_blkdev(null_major, "nullb");
+	free_percpu(completion_queues);
+	return -ENOMEM;
+}
+
+static void __exit null_exit(void)
+{
+	struct nullb *nullb;
+	int cpu;
+
+	unregister_blkdev(null_major, "nullb");
+
+	mutex_lock(&nullb_mutex);
+	while (!list_empty(&nullb_list)) {
+		nullb = list_entry(nullb_list.next, struct nullb, list);
+		null_del_dev(nullb);
+	}
+	mutex_unlock(&nullb_mutex);
+
+	for_each_possible_cpu(cpu) {
+		struct nullb_completion_queue *cq;
+
+		cq = per_cpu_ptr(completion_queues, cpu);
+		hrtimer_cancel(&cq->timer);
+		tasklet_kill(&cq->tasklet);
+	}
+	free_percpu(completion_queues);
+}
+
+module_init(null_init);
+module_exit(null_exit);
+
+MODULE_LICENSE("GPL");
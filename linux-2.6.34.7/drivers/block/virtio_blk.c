@@ -2,6 +2,8 @@
 #include <linux/spinlock.h>
 #include <linux/slab.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/blk-iopoll.h>
 #include <linux/hdreg.h>
 #include <linux/virtio.h>
 #include <linux/virtio_blk.h>
@@ -11,6 +13,14 @@
 
 static int major, index;
 
+static int use_mq;
+module_param(use_mq, int, 0444);
+MODULE_PARM_DESC(use_mq, "Submit bios through blk-mq instead of the request queue");
+
+static int iopoll_budget = 32;
+module_param(iopoll_budget, int, 0444);
+MODULE_PARM_DESC(iopoll_budget, "Completions reaped per blk-iopoll run, 0 completes from the interrupt");
+
 struct virtio_blk
 {
 	spinlock_t lock;
@@ -26,6 +36,16 @@ struct virtio_blk
 
 	mempool_t *pool;
 
+	/* Completion polling, if iopoll_budget was set at probe time. */
+	struct blk_iopoll iopoll;
+	int use_iopoll;
+
+	/* How completions were reaped. */
+	unsigned long interrupts;
+	unsigned long polls;
+	unsigned long poll_completions;
+	unsigned long irq_completions;
+
 	/* What host tells us, plus 2 for header & tailer. */
 	unsigned int sg_elems;
 
@@ -37,22 +57,27 @@ struct virtblk_req
 {
 	struct list_head list;
 	struct request *req;
+	struct blk_mq_cmd *cmd;		/* blk-mq: req is NULL */
 	struct virtio_blk_outhdr out_hdr;
 	struct virtio_scsi_inhdr in_hdr;
 	u8 status;
 };
 
-static void blk_done(struct virtqueue *vq)
+/*
+ * Completes up to budget finished requests, called with vblk->lock held.
+ */
+static int __virtblk_complete(struct virtio_blk *vblk, int budget)
 {
-	struct virtio_blk *vblk = vq->vdev->priv;
 	struct virtblk_req *vbr;
 	unsigned int len;
-	unsigned long flags;
+	int done = 0;
 
-	spin_lock_irqsave(&vblk->lock, flags);
-	while ((vbr = vblk->vq->vq_ops->get_buf(vblk->vq, &len)) != NULL) {
+	while (done < budget &&
+	       (vbr = vblk->vq->vq_ops->get_buf(vblk->vq, &len)) != NULL) {
 		int error;
 
+		done++;
+
 		switch (vbr->status) {
 		case VIRTIO_BLK_S_OK:
 			error = 0;
@@ -65,6 +90,14 @@ static void blk_done(struct virtqueue *vq)
 			break;
 		}
 
+		list_del(&vbr->list);
+
+		/* blk-mq keeps vbr in the command, nothing to free */
+		if (vbr->cmd) {
+			blk_mq_end_cmd(vbr->cmd, error);
+			continue;
+		}
+
 		if (blk_pc_request(vbr->req)) {
 			vbr->req->resid_len = vbr->in_hdr.residual;
 			vbr->req->sense_len = vbr->in_hdr.sense_len;
@@ -72,11 +105,72 @@ static void blk_done(struct virtqueue *vq)
 		}
 
 		__blk_end_request_all(vbr->req, error);
-		list_del(&vbr->list);
 		mempool_free(vbr, vblk->pool);
 	}
 	/* In case queue is stopped waiting for more buffers. */
-	blk_start_queue(vblk->disk->queue);
+	if (done) {
+		if (use_mq)
+			blk_mq_start_stopped_hw_queues(vblk->disk->queue);
+		else
+			blk_start_queue(vblk->disk->queue);
+	}
+
+	return done;
+}
+
+/*
+ * Runs from the iopoll softirq with virtqueue callbacks disabled.  If
+ * the budget isn't used up, callbacks are turned back on, and we go
+ * round again if completions slipped in before that.
+ */
+static int virtblk_iopoll(struct blk_iopoll *iop, int budget)
+{
+	struct virtio_blk *vblk = container_of(iop, struct virtio_blk, iopoll);
+	struct virtqueue *vq = vblk->vq;
+	unsigned long flags;
+	int done;
+
+	spin_lock_irqsave(&vblk->lock, flags);
+	done = __virtblk_complete(vblk, budget);
+	vblk->polls++;
+	vblk->poll_completions += done;
+
+	if (done < budget) {
+		blk_iopoll_complete(iop);
+		if (!vq->vq_ops->enable_cb(vq) && !blk_iopoll_sched_prep(iop)) {
+			vq->vq_ops->disable_cb(vq);
+			blk_iopoll_sched(iop);
+		}
+	}
+	spin_unlock_irqrestore(&vblk->lock, flags);
+
+	return done;
+}
+
+static void blk_done(struct virtqueue *vq)
+{
+	struct virtio_blk *vblk = vq->vdev->priv;
+	unsigned long flags;
+
+	vblk->interrupts++;
+
+	/*
+	 * Hand the work to the iopoll softirq, unless it is already
+	 * scheduled.  Once polling is being torn down, fall through and
+	 * complete from here.
+	 */
+	if (vblk->use_iopoll && blk_iopoll_enabled) {
+		if (!blk_iopoll_sched_prep(&vblk->iopoll)) {
+			vq->vq_ops->disable_cb(vq);
+			blk_iopoll_sched(&vblk->iopoll);
+			return;
+		}
+		if (!blk_iopoll_disable_pending(&vblk->iopoll))
+			return;
+	}
+
+	spin_lock_irqsave(&vblk->lock, flags);
+	vblk->irq_completions += __virtblk_complete(vblk, INT_MAX);
 	spin_unlock_irqrestore(&vblk->lock, flags);
 }
 
@@ -92,6 +186,7 @@ static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
 		return false;
 
 	vbr->req = req;
+	vbr->cmd = NULL;
 	switch (req->cmd_type) {
 	case REQ_TYPE_FS:
 		vbr->out_hdr.type = 0;
@@ -183,6 +278,87 @@ static void do_virtblk_request(struct request_queue *q)
 		vblk->vq->vq_ops->kick(vblk->vq);
 }
 
+/*
+ * blk-mq: there is only the one virtqueue, and the sg table is shared, so
+ * commands still go out one at a time under vblk->lock.  What we save is
+ * the request allocation, merging and the queue lock round trips.
+ */
+static int virtblk_queue_cmd(struct blk_mq_hw_ctx *hctx,
+			     struct blk_mq_cmd *cmd)
+{
+	struct virtio_blk *vblk = hctx->driver_data;
+	struct virtblk_req *vbr = blk_mq_cmd_to_pdu(cmd);
+	struct bio *bio = cmd->bio;
+	unsigned long num = 0, out = 0, in = 0, flags;
+	int err;
+
+	vbr->req = NULL;
+	vbr->cmd = cmd;
+
+	if (cmd->flags & BLK_MQ_CMD_FLUSH) {
+		vbr->out_hdr.type = VIRTIO_BLK_T_FLUSH;
+		vbr->out_hdr.sector = 0;
+		vbr->out_hdr.ioprio = 0;
+	} else {
+		vbr->out_hdr.type = 0;
+		vbr->out_hdr.sector = bio->bi_sector;
+		vbr->out_hdr.ioprio = bio_prio(bio);
+
+		/*
+		 * hosts that can flush get barriers as flush/write/flush,
+		 * hosts with neither feature only get the queue drain.
+		 */
+		if (bio_rw_flagged(bio, BIO_RW_BARRIER) &&
+		    !virtio_has_feature(vblk->vdev, VIRTIO_BLK_F_FLUSH) &&
+		    virtio_has_feature(vblk->vdev, VIRTIO_BLK_F_BARRIER))
+			vbr->out_hdr.type |= VIRTIO_BLK_T_BARRIER;
+	}
+
+	spin_lock_irqsave(&vblk->lock, flags);
+
+	sg_set_buf(&vblk->sg[out++], &vbr->out_hdr, sizeof(vbr->out_hdr));
+
+	if (bio && bio_has_data(bio))
+		num = blk_bio_map_sg(hctx->queue, bio, vblk->sg + out);
+
+	sg_set_buf(&vblk->sg[num + out + in++], &vbr->status,
+		   sizeof(vbr->status));
+
+	if (num) {
+		if (bio_data_dir(bio) == WRITE) {
+			vbr->out_hdr.type |= VIRTIO_BLK_T_OUT;
+			out += num;
+		} else {
+			vbr->out_hdr.type |= VIRTIO_BLK_T_IN;
+			in += num;
+		}
+	}
+
+	err = vblk->vq->vq_ops->add_buf(vblk->vq, vblk->sg, out, in, vbr);
+	if (err < 0) {
+		spin_unlock_irqrestore(&vblk->lock, flags);
+		return BLK_MQ_CMD_BUSY;
+	}
+
+	list_add_tail(&vbr->list, &vblk->reqs);
+	vblk->vq->vq_ops->kick(vblk->vq);
+	spin_unlock_irqrestore(&vblk->lock, flags);
+
+	return BLK_MQ_CMD_OK;
+}
+
+static int virtblk_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
+			     unsigned int index)
+{
+	hctx->driver_data = data;
+	return 0;
+}
+
+static struct blk_mq_ops virtblk_mq_ops = {
+	.queue_cmd	= virtblk_queue_cmd,
+	.init_hctx	= virtblk_init_hctx,
+};
+
 static void virtblk_prepare_flush(struct request_queue *q, struct request *req)
 {
 	req->cmd_type = REQ_TYPE_LINUX_BLOCK;
@@ -236,6 +412,62 @@ static const struct block_device_operations virtblk_fops = {
 	.getgeo = virtblk_getgeo,
 };
 
+static ssize_t virtblk_iopoll_budget_show(struct device *dev,
+					  struct device_attribute *attr,
+					  char *buf)
+{
+	struct virtio_blk *vblk = dev_to_disk(dev)->private_data;
+
+	return sprintf(buf, "%d\n", vblk->use_iopoll ? vblk->iopoll.weight : 0);
+}
+
+static ssize_t virtblk_iopoll_budget_store(struct device *dev,
+					   struct device_attribute *attr,
+					   const char *buf, size_t count)
+{
+	struct virtio_blk *vblk = dev_to_disk(dev)->private_data;
+	unsigned long budget;
+
+	if (!vblk->use_iopoll)
+		return -EINVAL;
+	if (strict_strtoul(buf, 10, &budget) || !budget || budget > INT_MAX)
+		return -EINVAL;
+
+	/* Picked up by the next poll run. */
+	vblk->iopoll.weight = budget;
+	return count;
+}
+
+static DEVICE_ATTR(iopoll_budget, S_IRUGO | S_IWUSR,
+		   virtblk_iopoll_budget_show, virtblk_iopoll_budget_store);
+
+/*
+ * interrupts, polls, completions reaped by polls, completions reaped
+ * directly from the interrupt
+ */
+static ssize_t virtblk_iopoll_stats_show(struct device *dev,
+					 struct device_attribute *attr,
+					 char *buf)
+{
+	struct virtio_blk *vblk = dev_to_disk(dev)->private_data;
+
+	return sprintf(buf, "%lu %lu %lu %lu\n", vblk->interrupts,
+		       vblk->polls, vblk->poll_completions,
+		       vblk->irq_completions);
+}
+
+static DEVICE_ATTR(iopoll_stats, S_IRUGO, virtblk_iopoll_stats_show, NULL);
+
+static struct attribute *virtblk_attrs[] = {
+	&dev_attr_iopoll_budget.attr,
+	&dev_attr_iopoll_stats.attr,
+	NULL,
+};
+
+static struct attribute_group virtblk_attr_group = {
+	.attrs = virtblk_attrs,
+};
+
 static int index_to_minor(int index)
 {
 	return index << PART_BITS;
@@ -274,6 +506,11 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 	spin_lock_init(&vblk->lock);
 	vblk->vdev = vdev;
 	vblk->sg_elems = sg_elems;
+	vblk->interrupts = vblk->polls = 0;
+	vblk->poll_completions = vblk->irq_completions = 0;
+	vblk->use_iopoll = iopoll_budget > 0;
+	if (vblk->use_iopoll)
+		blk_iopoll_init(&vblk->iopoll, iopoll_budget, virtblk_iopoll);
 	sg_init_table(vblk->sg, vblk->sg_elems);
 
 	/* We expect one virtqueue, for output. */
@@ -296,11 +533,31 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 		goto out_mempool;
 	}
 
-	q = vblk->disk->queue = blk_init_queue(do_virtblk_request, &vblk->lock);
-	if (!q) {
-		err = -ENOMEM;
-		goto out_put_disk;
+	if (use_mq) {
+		struct blk_mq_reg reg = {
+			.ops		= &virtblk_mq_ops,
+			.nr_hw_queues	= 1,
+			.queue_depth	= 64,
+			.cmd_size	= sizeof(struct virtblk_req),
+			.numa_node	= -1,
+		};
+
+		if (virtio_has_feature(vdev, VIRTIO_BLK_F_FLUSH))
+			reg.flags |= BLK_MQ_F_FLUSH;
+
+		q = blk_mq_init_queue(&reg, vblk);
+		if (IS_ERR(q)) {
+			err = PTR_ERR(q);
+			goto out_put_disk;
+		}
+	} else {
+		q = blk_init_queue(do_virtblk_request, &vblk->lock);
+		if (!q) {
+			err = -ENOMEM;
+			goto out_put_disk;
+		}
 	}
+	vblk->disk->queue = q;
 
 	q->queuedata = vblk;
 
@@ -324,12 +581,17 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 	vblk->disk->driverfs_dev = &vdev->dev;
 	index++;
 
-	/* If barriers are supported, tell block layer that queue is ordered */
-	if (virtio_has_feature(vdev, VIRTIO_BLK_F_FLUSH))
-		blk_queue_ordered(q, QUEUE_ORDERED_DRAIN_FLUSH,
-				  virtblk_prepare_flush);
-	else if (virtio_has_feature(vdev, VIRTIO_BLK_F_BARRIER))
-		blk_queue_ordered(q, QUEUE_ORDERED_TAG, NULL);
+	/*
+	 * If barriers are supported, tell block layer that queue is ordered.
+	 * blk-mq drains and flushes around barriers on its own.
+	 */
+	if (!use_mq) {
+		if (virtio_has_feature(vdev, VIRTIO_BLK_F_FLUSH))
+			blk_queue_ordered(q, QUEUE_ORDERED_DRAIN_FLUSH,
+					  virtblk_prepare_flush);
+		else if (virtio_has_feature(vdev, VIRTIO_BLK_F_BARRIER))
+			blk_queue_ordered(q, QUEUE_ORDERED_TAG, NULL);
+	}
 
 	/* If disk is read-only in the host, the guest should obey */
 	if (virtio_has_feature(vdev, VIRTIO_BLK_F_RO))
@@ -401,8 +663,15 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 	if (!err && opt_io_size)
 		blk_queue_io_opt(q, blk_size * opt_io_size);
 
+	if (vblk->use_iopoll)
+		blk_iopoll_enable(&vblk->iopoll);
 
 	add_disk(vblk->disk);
+
+	/* The stats are only a diagnostic, carry on without them. */
+	if (sysfs_create_group(&disk_to_dev(vblk->disk)->kobj,
+			       &virtblk_attr_group))
+		dev_warn(&vdev->dev, "Couldn't create iopoll attributes\n");
 	return 0;
 
 out_put_disk:
@@ -427,6 +696,10 @@ static void __devexit virtblk_remove(struct virtio_device *vdev)
 	/* Stop all the virtqueues. */
 	vdev->config->reset(vdev);
 
+	if (vblk->use_iopoll)
+		blk_iopoll_disable(&vblk->iopoll);
+
+	sysfs_remove_group(&disk_to_dev(vblk->disk)->kobj, &virtblk_attr_group);
 	del_gendisk(vblk->disk);
 	blk_cleanup_queue(vblk->disk->queue);
 	put_disk(vblk->disk);
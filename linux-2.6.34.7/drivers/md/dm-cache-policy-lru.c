@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2010 CS411 Group 8
+ *
+ * This file is released under the GPL.
+ *
+ * Least recently used cache policy: every miss is promoted and the
+ * block that has gone longest without an io is the first victim.
+ */
+
+#include "dm-cache-policy.h"
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#define DM_MSG_PREFIX "cache-policy-lru"
+
+struct lru_policy {
+	struct list_head lru;
+	struct list_head *entries;
+	dm_cblock_t nr_cblocks;
+};
+
+static int lru_create(struct dm_cache_policy *p, dm_cblock_t nr_cblocks)
+{
+	struct lru_policy *lp;
+	dm_cblock_t i;
+
+	lp = kmalloc(sizeof(*lp), GFP_KERNEL);
+	if (!lp)
+		return -ENOMEM;
+
+	lp->entries = vmalloc(sizeof(*lp->entries) * nr_cblocks);
+	if (!lp->entries) {
+		kfree(lp);
+		return -ENOMEM;
+	}
+
+	INIT_LIST_HEAD(&lp->lru);
+	for (i = 0; i < nr_cblocks; i++)
+		INIT_LIST_HEAD(lp->entries + i);
+	lp->nr_cblocks = nr_cblocks;
+
+	p->context = lp;
+
+	return 0;
+}
+
+static void lru_destroy(struct dm_cache_policy *p)
+{
+	struct lru_policy *lp = p->context;
+
+	vfree(lp->entries);
+	kfree(lp);
+}
+
+static int lru_miss(struct dm_cache_policy *p, dm_oblock_t oblock, int rw,
+		    int cache_full)
+{
+	return 1;
+}
+
+static void lru_hit(struct dm_cache_policy *p, dm_cblock_t cblock, int rw)
+{
+	struct lru_policy *lp = p->context;
+
+	list_move_tail(lp->entries + cblock, &lp->lru);
+}
+
+static void lru_insert(struct dm_cache_policy *p, dm_cblock_t cblock,
+		       dm_oblock_t oblock)
+{
+	struct lru_policy *lp = p->context;
+
+	list_move_tail(lp->entries + cblock, &lp->lru);
+}
+
+static void lru_remove(struct dm_cache_policy *p, dm_cblock_t cblock)
+{
+	struct lru_policy *lp = p->context;
+
+	list_del_init(lp->entries + cblock);
+}
+
+static int lru_walk(struct dm_cache_policy *p, dm_cache_walk_fn fn,
+		    void *context, dm_cblock_t *result)
+{
+	struct lru_policy *lp = p->context;
+	struct list_head *e;
+	dm_cblock_t cblock;
+	int r;
+
+	list_for_each(e, &lp->lru) {
+		cblock = e - lp->entries;
+		r = fn(context, cblock);
+		if (r > 0) {
+			*result = cblock;
+			return 0;
+		}
+		if (r < 0)
+			break;
+	}
+
+	return -ENODATA;
+}
+
+static struct dm_cache_policy_type lru_policy_type = {
+	.name = "lru",
+	.module = THIS_MODULE,
+	.create = lru_create,
+	.destroy = lru_destroy,
+	.miss = lru_miss,
+	.hit = lru_hit,
+	.insert = lru_insert,
+	.remove = lru_remove,
+	.walk = lru_walk,
+};
+
+int dm_cache_lru_init(void)
+{
+	int r;
+
+	r = dm_cache_policy_type_register(&lru_policy_type);
+	if (r)
+		DMWARN("Unable to register lru cache policy");
+
+	return r;
+}
+
+void dm_cache_lru_exit(void)
+{
+	dm_cache_policy_type_unregister(&lru_policy_type);
+}
@@ -0,0 +1,360 @@
+/*
+ * Copyright (C) 2010 CS411 Group 8
+ *
+ * This file is released under the GPL.
+ *
+ * Multiqueue cache policy.
+ *
+ * Blocks are kept on one of NR_LEVELS queues according to how often
+ * they have been hit: a block with n hits lives on queue ilog2(n).
+ * Victims are taken from the front of the lowest populated queue.
+ *
+ * Hits are also counted for a bounded set of recently missed origin
+ * blocks.  Once the cache is full, an origin block is only promoted
+ * once it has been hit more often than the coldest cached block, so a
+ * single sequential scan cannot flush out the working set.
+ *
+ * Every 'period' ios all hit counts are halved, which for the cached
+ * blocks is simply a matter of shifting every queue down a level.
+ * Individual counts are aged lazily the next time they are touched.
+ */
+
+#include "dm-cache-policy.h"
+
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#define DM_MSG_PREFIX "cache-policy-mq"
+
+#define NR_LEVELS 16
+#define MIN_GHOSTS 1024
+#define MIN_PERIOD 1024
+
+struct mq_entry {
+	struct list_head list;
+	unsigned hits;
+	unsigned epoch;
+};
+
+/*
+ * An origin block that missed recently.
+ */
+struct mq_ghost {
+	struct mq_entry e;
+	struct hlist_node hash;
+	dm_oblock_t oblock;
+	int in_use;
+};
+
+struct mq_cached {
+	struct mq_entry e;
+	dm_oblock_t oblock;
+};
+
+struct mq_policy {
+	struct list_head queues[NR_LEVELS];
+	struct mq_cached *cached;
+
+	struct list_head ghost_lru;
+	struct mq_ghost *ghosts;
+	unsigned nr_ghosts;
+	struct hlist_head *ghost_hash;
+	unsigned ghost_hash_bits;
+
+	unsigned epoch;
+	unsigned tick;
+	unsigned period;
+};
+
+static unsigned hits_level(unsigned hits)
+{
+	if (!hits)
+		return 0;
+
+	return min_t(unsigned, ilog2(hits), NR_LEVELS - 1);
+}
+
+/*
+ * Bring an entry's hit count up to date with the current epoch.
+ */
+static void age_entry(struct mq_policy *mp, struct mq_entry *e)
+{
+	unsigned shift = mp->epoch - e->epoch;
+
+	e->hits = shift >= 32 ? 0 : e->hits >> shift;
+	e->epoch = mp->epoch;
+}
+
+static void tick(struct mq_policy *mp)
+{
+	unsigned level;
+
+	if (++mp->tick < mp->period)
+		return;
+
+	mp->tick = 0;
+	mp->epoch++;
+
+	for (level = 1; level < NR_LEVELS; level++)
+		list_splice_tail_init(mp->queues + level,
+				      mp->queues + level - 1);
+}
+
+static unsigned coldest_level(struct mq_policy *mp)
+{
+	unsigned level;
+
+	for (level = 0; level < NR_LEVELS; level++)
+		if (!list_empty(mp->queues + level))
+			return level;
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------
+ * Ghost entries
+ *---------------------------------------------------------------*/
+static struct hlist_head *ghost_bucket(struct mq_policy *mp,
+				       dm_oblock_t oblock)
+{
+	return mp->ghost_hash + hash_64(oblock, mp->ghost_hash_bits);
+}
+
+static struct mq_ghost *find_ghost(struct mq_policy *mp, dm_oblock_t oblock)
+{
+	struct mq_ghost *g;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(g, n, ghost_bucket(mp, oblock), hash)
+		if (g->oblock == oblock)
+			return g;
+
+	return NULL;
+}
+
+static void del_ghost(struct mq_ghost *g)
+{
+	hlist_del(&g->hash);
+	list_del(&g->e.list);
+	g->in_use = 0;
+}
+
+/*
+ * Recycles the least recently missed ghost.  Free ghosts are kept at
+ * the front of the lru.
+ */
+static struct mq_ghost *new_ghost(struct mq_policy *mp, dm_oblock_t oblock,
+				  unsigned hits)
+{
+	struct mq_ghost *g;
+
+	g = list_first_entry(&mp->ghost_lru, struct mq_ghost, e.list);
+	if (g->in_use)
+		hlist_del(&g->hash);
+
+	g->oblock = oblock;
+	g->in_use = 1;
+	g->e.hits = hits;
+	g->e.epoch = mp->epoch;
+	hlist_add_head(&g->hash, ghost_bucket(mp, oblock));
+	list_move_tail(&g->e.list, &mp->ghost_lru);
+
+	return g;
+}
+
+/*-----------------------------------------------------------------
+ * Policy interface
+ *---------------------------------------------------------------*/
+static int mq_create(struct dm_cache_policy *p, dm_cblock_t nr_cblocks)
+{
+	struct mq_policy *mp;
+	unsigned i, nr_buckets;
+
+	mp = kzalloc(sizeof(*mp), GFP_KERNEL);
+	if (!mp)
+		return -ENOMEM;
+
+	for (i = 0; i < NR_LEVELS; i++)
+		INIT_LIST_HEAD(mp->queues + i);
+	INIT_LIST_HEAD(&mp->ghost_lru);
+
+	mp->cached = vmalloc(sizeof(*mp->cached) * nr_cblocks);
+	if (!mp->cached)
+		goto bad_cached;
+
+	for (i = 0; i < nr_cblocks; i++)
+		INIT_LIST_HEAD(&mp->cached[i].e.list);
+
+	mp->nr_ghosts = max_t(unsigned, nr_cblocks, MIN_GHOSTS);
+	mp->ghosts = vmalloc(sizeof(*mp->ghosts) * mp->nr_ghosts);
+	if (!mp->ghosts)
+		goto bad_ghosts;
+
+	for (i = 0; i < mp->nr_ghosts; i++) {
+		mp->ghosts[i].in_use = 0;
+		list_add(&mp->ghosts[i].e.list, &mp->ghost_lru);
+	}
+
+	nr_buckets = roundup_pow_of_two(mp->nr_ghosts / 4);
+	mp->ghost_hash_bits = ilog2(nr_buckets);
+	mp->ghost_hash = vmalloc(sizeof(*mp->ghost_hash) * nr_buckets);
+	if (!mp->ghost_hash)
+		goto bad_hash;
+
+	for (i = 0; i < nr_buckets; i++)
+		INIT_HLIST_HEAD(mp->ghost_hash + i);
+
+	mp->period = max_t(unsigned, nr_cblocks, MIN_PERIOD);
+	p->context = mp;
+
+	return 0;
+
+bad_hash:
+	vfree(mp->ghosts);
+bad_ghosts:
+	vfree(mp->cached);
+bad_cached:
+	kfree(mp);
+	return -ENOMEM;
+}
+
+static void mq_destroy(struct dm_cache_policy *p)
+{
+	struct mq_policy *mp = p->context;
+
+	vfree(mp->ghost_hash);
+	vfree(mp->ghosts);
+	vfree(mp->cached);
+	kfree(mp);
+}
+
+static int mq_miss(struct dm_cache_policy *p, dm_oblock_t oblock, int rw,
+		   int cache_full)
+{
+	struct mq_policy *mp = p->context;
+	struct mq_ghost *g;
+
+	tick(mp);
+
+	g = find_ghost(mp, oblock);
+	if (g) {
+		age_entry(mp, &g->e);
+		g->e.hits++;
+		list_move_tail(&g->e.list, &mp->ghost_lru);
+	} else
+		g = new_ghost(mp, oblock, 1);
+
+	if (!cache_full)
+		return 1;
+
+	return hits_level(g->e.hits) > coldest_level(mp);
+}
+
+static void requeue(struct mq_policy *mp, struct mq_cached *c)
+{
+	list_move_tail(&c->e.list, mp->queues + hits_level(c->e.hits));
+}
+
+static void mq_hit(struct dm_cache_policy *p, dm_cblock_t cblock, int rw)
+{
+	struct mq_policy *mp = p->context;
+	struct mq_cached *c = mp->cached + cblock;
+
+	tick(mp);
+
+	age_entry(mp, &c->e);
+	c->e.hits++;
+	requeue(mp, c);
+}
+
+static void mq_insert(struct dm_cache_policy *p, dm_cblock_t cblock,
+		      dm_oblock_t oblock)
+{
+	struct mq_policy *mp = p->context;
+	struct mq_cached *c = mp->cached + cblock;
+	struct mq_ghost *g;
+
+	c->oblock = oblock;
+	c->e.hits = 1;
+	c->e.epoch = mp->epoch;
+
+	/* Carry over the hits that earned the promotion. */
+	g = find_ghost(mp, oblock);
+	if (g) {
+		age_entry(mp, &g->e);
+		c->e.hits = max(g->e.hits, 1u);
+		del_ghost(g);
+		list_add(&g->e.list, &mp->ghost_lru);
+	}
+
+	requeue(mp, c);
+}
+
+static void mq_remove(struct dm_cache_policy *p, dm_cblock_t cblock)
+{
+	struct mq_policy *mp = p->context;
+	struct mq_cached *c = mp->cached + cblock;
+
+	list_del_init(&c->e.list);
+
+	/*
+	 * Remember half of the demoted block's hits so that it doesn't
+	 * have to start from scratch if it turns out to be needed.
+	 */
+	age_entry(mp, &c->e);
+	if (!find_ghost(mp, c->oblock))
+		new_ghost(mp, c->oblock, c->e.hits / 2);
+}
+
+static int mq_walk(struct dm_cache_policy *p, dm_cache_walk_fn fn,
+		   void *context, dm_cblock_t *result)
+{
+	struct mq_policy *mp = p->context;
+	struct mq_cached *c;
+	unsigned level;
+	int r;
+
+	for (level = 0; level < NR_LEVELS; level++)
+		list_for_each_entry(c, mp->queues + level, e.list) {
+			r = fn(context, c - mp->cached);
+			if (r > 0) {
+				*result = c - mp->cached;
+				return 0;
+			}
+			if (r < 0)
+				return -ENODATA;
+		}
+
+	return -ENODATA;
+}
+
+static struct dm_cache_policy_type mq_policy_type = {
+	.name = "mq",
+	.module = THIS_MODULE,
+	.create = mq_create,
+	.destroy = mq_destroy,
+	.miss = mq_miss,
+	.hit = mq_hit,
+	.insert = mq_insert,
+	.remove = mq_remove,
+	.walk = mq_walk,
+};
+
+int dm_cache_mq_init(void)
+{
+	int r;
+
+	r = dm_cache_policy_type_register(&mq_policy_type);
+	if (r)
+		DMWARN("Unable to register mq cache policy");
+
+	return r;
+}
+
+void dm_cache_mq_exit(void)
+{
+	dm_cache_policy_type_unregister(&mq_policy_type);
+}
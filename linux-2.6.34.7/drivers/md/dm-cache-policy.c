@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2010 CS411 Group 8
+ *
+ * This file is released under the GPL.
+ *
+ * Cache promotion policy registration.
+ */
+
+#include "dm-cache-policy.h"
+
+#include <linux/kmod.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+
+#define DM_MSG_PREFIX "cache policies"
+
+static LIST_HEAD(_policy_types);
+static DEFINE_SPINLOCK(_lock);
+
+static struct dm_cache_policy_type *__find_policy_type(const char *name)
+{
+	struct dm_cache_policy_type *type;
+
+	list_for_each_entry(type, &_policy_types, list)
+		if (!strcmp(name, type->name))
+			return type;
+
+	return NULL;
+}
+
+static struct dm_cache_policy_type *_get_policy_type(const char *name)
+{
+	struct dm_cache_policy_type *type;
+
+	spin_lock(&_lock);
+
+	type = __find_policy_type(name);
+
+	if (type && !try_module_get(type->module))
+		type = NULL;
+
+	spin_unlock(&_lock);
+
+	return type;
+}
+
+/*
+ * Policies living outside this module are expected to be in a module
+ * called "dm-cache-<name>".
+ */
+static struct dm_cache_policy_type *get_type(const char *name)
+{
+	struct dm_cache_policy_type *type;
+
+	type = _get_policy_type(name);
+	if (type)
+		return type;
+
+	if (!request_module("dm-cache-%s", name))
+		type = _get_policy_type(name);
+
+	if (!type)
+		DMWARN("Module for cache policy \"%s\" not found.", name);
+
+	return type;
+}
+
+static void put_type(struct dm_cache_policy_type *type)
+{
+	spin_lock(&_lock);
+	module_put(type->module);
+	spin_unlock(&_lock);
+}
+
+int dm_cache_policy_type_register(struct dm_cache_policy_type *type)
+{
+	int r = 0;
+
+	spin_lock(&_lock);
+	if (!__find_policy_type(type->name))
+		list_add(&type->list, &_policy_types);
+	else
+		r = -EEXIST;
+	spin_unlock(&_lock);
+
+	return r;
+}
+EXPORT_SYMBOL(dm_cache_policy_type_register);
+
+int dm_cache_policy_type_unregister(struct dm_cache_policy_type *type)
+{
+	spin_lock(&_lock);
+
+	if (!__find_policy_type(type->name)) {
+		spin_unlock(&_lock);
+		return -EINVAL;
+	}
+
+	list_del(&type->list);
+
+	spin_unlock(&_lock);
+
+	return 0;
+}
+EXPORT_SYMBOL(dm_cache_policy_type_unregister);
+
+int dm_cache_policy_create(const char *name, dm_cblock_t nr_cblocks,
+			   struct dm_cache_policy *p)
+{
+	struct dm_cache_policy_type *type;
+	int r;
+
+	type = get_type(name);
+	if (!type)
+		return -EINVAL;
+
+	p->type = type;
+	p->context = NULL;
+
+	r = type->create(p, nr_cblocks);
+	if (r) {
+		put_type(type);
+		p->type = NULL;
+	}
+
+	return r;
+}
+
+void dm_cache_policy_destroy(struct dm_cache_policy *p)
+{
+	struct dm_cache_policy_type *type = p->type;
+
+	type->destroy(p);
+	put_type(type);
+	p->type = NULL;
+}
+
+int dm_cache_policy_init(void)
+{
+	int r;
+
+	r = dm_cache_lru_init();
+	if (r) {
+		DMERR("Unable to register lru cache policy.");
+		goto lru_fail;
+	}
+
+	r = dm_cache_mq_init();
+	if (r) {
+		DMERR("Unable to register mq cache policy.");
+		goto mq_fail;
+	}
+
+	return 0;
+
+mq_fail:
+	dm_cache_lru_exit();
+lru_fail:
+	return r;
+}
+
+void dm_cache_policy_exit(void)
+{
+	dm_cache_mq_exit();
+	dm_cache_lru_exit();
+}
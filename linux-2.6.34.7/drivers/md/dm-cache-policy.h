@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2010 CS411 Group 8
+ *
+ * This file is released under the GPL.
+ *
+ * Cache promotion policy registration.
+ */
+
+#ifndef DM_CACHE_POLICY_H
+#define DM_CACHE_POLICY_H
+
+#include <linux/device-mapper.h>
+#include <linux/list.h>
+
+/*
+ * Origin blocks are the fixed size blocks the origin device is divided
+ * into, cache blocks are the slots on the fast device that may hold a
+ * copy of one of them.
+ */
+typedef sector_t dm_oblock_t;
+typedef u32 dm_cblock_t;
+
+/*
+ * The policy decides which origin blocks deserve a slot on the cache
+ * device and which cached blocks are the cheapest to give up.  It
+ * knows nothing about the data or the on-disk format; all calls are
+ * made with the target's lock held and must not block.
+ */
+struct dm_cache_policy_type;
+struct dm_cache_policy {
+	struct dm_cache_policy_type *type;
+	void *context;
+};
+
+/*
+ * Victim walkers return a positive value to claim the block offered to
+ * them, zero to pass on it or a negative value to end the walk.
+ */
+typedef int (*dm_cache_walk_fn)(void *context, dm_cblock_t cblock);
+
+struct dm_cache_policy_type {
+	struct list_head list;
+
+	char *name;
+	struct module *module;
+
+	int (*create)(struct dm_cache_policy *p, dm_cblock_t nr_cblocks);
+	void (*destroy)(struct dm_cache_policy *p);
+
+	/*
+	 * An io touched an origin block that isn't cached.  Returns
+	 * non-zero if the block should be promoted.  cache_full tells
+	 * the policy whether a promotion would cost an existing block.
+	 */
+	int (*miss)(struct dm_cache_policy *p, dm_oblock_t oblock, int rw,
+		    int cache_full);
+
+	/*
+	 * An io touched a cached block.
+	 */
+	void (*hit)(struct dm_cache_policy *p, dm_cblock_t cblock, int rw);
+
+	/*
+	 * cblock now holds a copy of oblock, or no longer holds anything.
+	 */
+	void (*insert)(struct dm_cache_policy *p, dm_cblock_t cblock,
+		       dm_oblock_t oblock);
+	void (*remove)(struct dm_cache_policy *p, dm_cblock_t cblock);
+
+	/*
+	 * Offers cached blocks to fn, least valuable first, until fn
+	 * claims one or gives up.  Returns 0 and fills in *result if a
+	 * block was claimed, -ENODATA otherwise.
+	 */
+	int (*walk)(struct dm_cache_policy *p, dm_cache_walk_fn fn,
+		    void *context, dm_cblock_t *result);
+};
+
+int dm_cache_policy_create(const char *name, dm_cblock_t nr_cblocks,
+			   struct dm_cache_policy *p);
+void dm_cache_policy_destroy(struct dm_cache_policy *p);
+
+int dm_cache_policy_type_register(struct dm_cache_policy_type *type);
+int dm_cache_policy_type_unregister(struct dm_cache_policy_type *type);
+
+int dm_cache_policy_init(void);
+void dm_cache_policy_exit(void);
+
+/*
+ * Built in policies.
+ */
+int dm_cache_lru_init(void);
+void dm_cache_lru_exit(void);
+
+int dm_cache_mq_init(void);
+void dm_cache_mq_exit(void);
+
+#endif
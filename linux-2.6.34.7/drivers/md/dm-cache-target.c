@@ -0,0 +1,1469 @@
+/*
+ * Copyright (C) 2010 CS411 Group 8
+ *
+ * This file is released under the GPL.
+ *
+ * Block cache target: keeps copies of the busiest blocks of a slow
+ * origin device on a fast cache device.
+ */
+
+#include "dm-cache-policy.h"
+
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/dm-io.h>
+#include <linux/dm-kcopyd.h>
+#include <linux/hash.h>
+#include <linux/init.h>
+#include <linux/jiffies.h>
+#include <linux/log2.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+
+#define DM_MSG_PREFIX "cache"
+
+#define DM_IO_PAGES 64
+#define COPY_PAGES (((1UL << 20) >> PAGE_SHIFT) ? : 1)
+
+#define MIN_BLOCK_SECTORS 8
+#define MAX_BLOCK_SECTORS 8192
+
+/*
+ * Clean runs of mapping sectors up to this long between dirty ones
+ * are rewritten rather than splitting the metadata write.
+ */
+#define META_GAP_SECTORS 8
+
+/*
+ * The most promotions and cleanings that may be in flight at once.
+ */
+#define MAX_MIGRATIONS 16
+
+/*
+ * How many cached blocks a victim search looks at before giving up.
+ */
+#define WALK_BUDGET 64
+
+/*
+ * Dirty blocks are written back once the cache has been idle this
+ * long, or straight away if more than half the cache is dirty.
+ */
+#define IDLE_JIFFIES HZ
+
+/*
+ * Writes sent straight to the origin are counted in hashed buckets so
+ * that a promotion can wait for any that overlap the block it copies.
+ */
+#define ORIGIN_WRITE_BITS 8
+#define NR_ORIGIN_WRITE_BUCKETS (1 << ORIGIN_WRITE_BITS)
+
+/*-----------------------------------------------------------------
+ * On disk metadata.
+ *
+ * Sector 0 of the cache device holds the superblock, followed by an
+ * array with one entry per cache block.  Cached data starts on the
+ * first block boundary after the array.
+ *---------------------------------------------------------------*/
+#define CACHE_MAGIC 0x48434d44		/* "DMCH" */
+#define CACHE_VERSION 1
+
+#define SUPER_SECTOR 0
+#define MAPPING_START 1
+
+struct disk_super {
+	__le32 magic;
+	__le32 version;
+	__le32 block_sectors;
+	__le32 nr_cblocks;
+	__le64 origin_sectors;
+	__le64 data_start;
+} __packed;
+
+#define M_VALID 1
+#define M_DIRTY 2
+
+struct disk_mapping {
+	__le64 oblock;
+	__le32 flags;
+	__le32 pad;
+} __packed;
+
+#define MAPPINGS_PER_SECTOR ((1 << SECTOR_SHIFT) / sizeof(struct disk_mapping))
+
+/*-----------------------------------------------------------------
+ * In core structures.
+ *---------------------------------------------------------------*/
+enum cache_mode {
+	CM_WRITEBACK,
+	CM_WRITETHROUGH,
+};
+
+/* cache_block flags */
+#define CB_VALID	1
+#define CB_DIRTY	2
+#define CB_BUSY		4	/* metadata update or copy in progress */
+
+/* Work a busy block is waiting for */
+enum cache_op {
+	OP_PROMOTE,
+	OP_CLEAN,
+	OP_MARK_DIRTY,
+};
+
+struct cache_c;
+
+struct cache_block {
+	struct hlist_node hash;
+	struct list_head list;		/* free list or worker queues */
+
+	struct cache_c *cache;
+	dm_oblock_t oblock;
+	unsigned flags;
+	enum cache_op op;
+	int error;
+
+	/* ios remapped to the cache copy that haven't completed */
+	atomic_t pending;
+
+	/* ios held back while the block is busy */
+	struct bio_list waiting;
+};
+
+/*
+ * Tags stored in map_info so end_io knows what a bio was holding.
+ */
+#define TAG_NONE	0
+#define TAG_CACHE	1
+#define TAG_ORIGIN	2
+#define TAG_SHIFT	2
+
+struct cache_c {
+	struct dm_target *ti;
+	struct dm_dev *cache_dev;
+	struct dm_dev *origin_dev;
+
+	sector_t block_sectors;
+	unsigned block_shift;
+	dm_oblock_t nr_oblocks;
+	dm_cblock_t nr_cblocks;
+	sector_t data_start;
+	enum cache_mode mode;
+
+	struct dm_cache_policy policy;
+
+	spinlock_t lock;
+	struct cache_block *blocks;
+	struct hlist_head *hash;
+	unsigned hash_bits;
+	struct list_head free;
+	dm_cblock_t nr_free;
+	dm_cblock_t nr_dirty;
+	unsigned nr_migrations;
+	int need_clean;
+	int quiescing;
+	int failed;
+	unsigned long last_io;
+
+	struct list_head prepare;	/* need a metadata update */
+	struct list_head delayed;	/* promotions waiting for the origin */
+	struct list_head complete;	/* copies that have finished */
+	wait_queue_head_t migration_wait;
+
+	atomic_t origin_writes[NR_ORIGIN_WRITE_BUCKETS];
+
+	/* Only touched by the worker once the target is running */
+	struct disk_mapping *mappings;
+	sector_t meta_sectors;
+	unsigned long *meta_dirty;
+
+	struct dm_io_client *io_client;
+	struct dm_kcopyd_client *kcopyd_client;
+
+	struct workqueue_struct *wq;
+	struct work_struct worker;
+	struct delayed_work waker;
+
+	atomic_t read_hit;
+	atomic_t read_miss;
+	atomic_t write_hit;
+	atomic_t write_miss;
+	atomic_t promotion;
+	atomic_t demotion;
+	atomic_t writeback;
+};
+
+static void wake_worker(struct cache_c *cache)
+{
+	queue_work(cache->wq, &cache->worker);
+}
+
+static dm_cblock_t to_cblock(struct cache_c *cache, struct cache_block *cb)
+{
+	return cb - cache->blocks;
+}
+
+static sector_t cblock_sector(struct cache_c *cache, dm_cblock_t cblock)
+{
+	return cache->data_start + ((sector_t) cblock << cache->block_shift);
+}
+
+static dm_oblock_t get_bio_block(struct cache_c *cache, struct bio *bio)
+{
+	return (bio->bi_sector - cache->ti->begin) >> cache->block_shift;
+}
+
+static unsigned origin_bucket(dm_oblock_t oblock)
+{
+	return hash_64(oblock, ORIGIN_WRITE_BITS);
+}
+
+/*-----------------------------------------------------------------
+ * Block lookup, cache->lock must be held.
+ *---------------------------------------------------------------*/
+static struct hlist_head *block_bucket(struct cache_c *cache,
+				       dm_oblock_t oblock)
+{
+	return cache->hash + hash_64(oblock, cache->hash_bits);
+}
+
+static struct cache_block *__find_block(struct cache_c *cache,
+					dm_oblock_t oblock)
+{
+	struct cache_block *cb;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(cb, n, block_bucket(cache, oblock), hash)
+		if (cb->oblock == oblock)
+			return cb;
+
+	return NULL;
+}
+
+static void __insert_block(struct cache_c *cache, struct cache_block *cb)
+{
+	hlist_add_head(&cb->hash, block_bucket(cache, cb->oblock));
+}
+
+static void __remove_block(struct cache_c *cache, struct cache_block *cb)
+{
+	hlist_del(&cb->hash);
+}
+
+static void __free_block(struct cache_c *cache, struct cache_block *cb)
+{
+	cb->flags = 0;
+	list_add(&cb->list, &cache->free);
+	cache->nr_free++;
+}
+
+/*
+ * Victim searches claim the first idle block whose flags match.
+ */
+struct walk_info {
+	struct cache_c *cache;
+	unsigned want;
+	unsigned budget;
+};
+
+static int walk_idle(void *context, dm_cblock_t cblock)
+{
+	struct walk_info *wi = context;
+	struct cache_block *cb = wi->cache->blocks + cblock;
+
+	if (!wi->budget--)
+		return -1;
+
+	if ((cb->flags & (CB_VALID | CB_DIRTY | CB_BUSY)) != wi->want)
+		return 0;
+
+	return !atomic_read(&cb->pending);
+}
+
+static struct cache_block *__find_idle(struct cache_c *cache, unsigned want)
+{
+	struct walk_info wi = {
+		.cache = cache,
+		.want = want,
+		.budget = WALK_BUDGET,
+	};
+	dm_cblock_t cblock;
+
+	if (cache->policy.type->walk(&cache->policy, walk_idle, &wi, &cblock))
+		return NULL;
+
+	return cache->blocks + cblock;
+}
+
+/*
+ * Finds a home for a promotion: a free block if there is one,
+ * otherwise the least valuable clean block that isn't in use.
+ */
+static struct cache_block *__alloc_block(struct cache_c *cache)
+{
+	struct cache_block *cb;
+
+	if (!list_empty(&cache->free)) {
+		cb = list_first_entry(&cache->free, struct cache_block, list);
+		list_del(&cb->list);
+		cache->nr_free--;
+		return cb;
+	}
+
+	cb = __find_idle(cache, CB_VALID);
+	if (!cb) {
+		if (cache->nr_dirty)
+			cache->need_clean = 1;
+		return NULL;
+	}
+
+	__remove_block(cache, cb);
+	cache->policy.type->remove(&cache->policy, to_cblock(cache, cb));
+	cb->flags = 0;
+	atomic_inc(&cache->demotion);
+
+	return cb;
+}
+
+/*-----------------------------------------------------------------
+ * Metadata io
+ *---------------------------------------------------------------*/
+static int meta_io(struct cache_c *cache, int rw, sector_t sector,
+		   sector_t count, void *data, enum dm_io_mem_type type)
+{
+	struct dm_io_region where = {
+		.bdev = cache->cache_dev->bdev,
+		.sector = sector,
+		.count = count,
+	};
+	struct dm_io_request io_req = {
+		.bi_rw = rw,
+		.mem.type = type,
+		.mem.ptr.addr = data,
+		.notify.fn = NULL,
+		.client = cache->io_client,
+	};
+
+	return dm_io(&io_req, 1, &where, NULL);
+}
+
+static void set_mapping(struct cache_c *cache, dm_cblock_t cblock,
+			dm_oblock_t oblock, unsigned flags)
+{
+	struct disk_mapping *m = cache->mappings + cblock;
+
+	m->oblock = cpu_to_le64(oblock);
+	m->flags = cpu_to_le32(flags);
+	__set_bit(cblock / MAPPINGS_PER_SECTOR, cache->meta_dirty);
+}
+
+static unsigned get_mapping_flags(struct cache_c *cache, dm_cblock_t cblock)
+{
+	return le32_to_cpu(cache->mappings[cblock].flags);
+}
+
+/*
+ * Devices that don't support flushes have no volatile write cache to
+ * flush, or nothing more can be done about it.
+ */
+static int flush_dev(struct dm_dev *dev)
+{
+	int r = blkdev_issue_flush(dev->bdev, NULL);
+
+	return r == -EOPNOTSUPP ? 0 : r;
+}
+
+/*
+ * Writes out every mapping sector touched since the last call, in as
+ * few ios as short clean gaps allow.  The first flush makes sure any
+ * copy completed beforehand is on disk before the mapping that refers
+ * to it, cleanings having copied to the origin.  The last one makes
+ * the mappings themselves stable before the ios waiting on them go.
+ */
+static int write_metadata(struct cache_c *cache, int flush_origin)
+{
+	unsigned long start, end, next, nr = cache->meta_sectors;
+	int r;
+
+	start = find_first_bit(cache->meta_dirty, nr);
+	if (start >= nr)
+		return 0;
+
+	r = flush_dev(cache->cache_dev);
+	if (!r && flush_origin)
+		r = flush_dev(cache->origin_dev);
+	if (r)
+		return r;
+
+	while (start < nr) {
+		end = find_next_zero_bit(cache->meta_dirty, nr, start);
+		while (end < nr) {
+			next = find_next_bit(cache->meta_dirty, nr, end);
+			if (next >= nr || next - end > META_GAP_SECTORS)
+				break;
+			end = find_next_zero_bit(cache->meta_dirty, nr, next);
+		}
+
+		r = meta_io(cache, WRITE, MAPPING_START + start, end - start,
+			    (char *) cache->mappings + to_bytes(start),
+			    DM_IO_VMA);
+		if (r)
+			return r;
+
+		start = find_next_bit(cache->meta_dirty, nr, end);
+	}
+
+	r = flush_dev(cache->cache_dev);
+	if (r)
+		return r;
+
+	bitmap_zero(cache->meta_dirty, nr);
+
+	return 0;
+}
+
+static int format_metadata(struct cache_c *cache, struct disk_super *ds)
+{
+	dm_cblock_t i;
+	int r;
+
+	memset(cache->mappings, 0, to_bytes(cache->meta_sectors));
+	r = meta_io(cache, WRITE, MAPPING_START, cache->meta_sectors,
+		    cache->mappings, DM_IO_VMA);
+	if (r)
+		return r;
+
+	memset(ds, 0, 1 << SECTOR_SHIFT);
+	ds->magic = cpu_to_le32(CACHE_MAGIC);
+	ds->version = cpu_to_le32(CACHE_VERSION);
+	ds->block_sectors = cpu_to_le32(cache->block_sectors);
+	ds->nr_cblocks = cpu_to_le32(cache->nr_cblocks);
+	ds->origin_sectors = cpu_to_le64(cache->ti->len);
+	ds->data_start = cpu_to_le64(cache->data_start);
+
+	r = flush_dev(cache->cache_dev);
+	if (r)
+		return r;
+
+	r = meta_io(cache, WRITE, SUPER_SECTOR, 1, ds, DM_IO_KMEM);
+	if (!r)
+		r = flush_dev(cache->cache_dev);
+	if (r)
+		return r;
+
+	for (i = 0; i < cache->nr_cblocks; i++)
+		__free_block(cache, cache->blocks + i);
+
+	return 0;
+}
+
+static int load_mappings(struct cache_c *cache)
+{
+	struct cache_block *cb;
+	dm_cblock_t i;
+	unsigned flags;
+	int r;
+
+	r = meta_io(cache, READ, MAPPING_START, cache->meta_sectors,
+		    cache->mappings, DM_IO_VMA);
+	if (r) {
+		cache->ti->error = "Couldn't read cache metadata";
+		return r;
+	}
+
+	for (i = 0; i < cache->nr_cblocks; i++) {
+		cb = cache->blocks + i;
+		flags = get_mapping_flags(cache, i);
+
+		if (!(flags & M_VALID)) {
+			__free_block(cache, cb);
+			continue;
+		}
+
+		cb->oblock = le64_to_cpu(cache->mappings[i].oblock);
+		if (cb->oblock >= cache->nr_oblocks ||
+		    __find_block(cache, cb->oblock)) {
+			cache->ti->error = "Cache metadata is corrupt";
+			return -EINVAL;
+		}
+
+		cb->flags = CB_VALID;
+		if (flags & M_DIRTY) {
+			cb->flags |= CB_DIRTY;
+			cache->nr_dirty++;
+		}
+
+		__insert_block(cache, cb);
+		cache->policy.type->insert(&cache->policy, i, cb->oblock);
+	}
+
+	return 0;
+}
+
+/*
+ * Formats a cache device that doesn't carry our magic, otherwise
+ * rebuilds the in core state from what is on disk.
+ */
+static int read_or_format_metadata(struct cache_c *cache)
+{
+	struct disk_super *ds;
+	int r;
+
+	ds = kmalloc(1 << SECTOR_SHIFT, GFP_KERNEL);
+	if (!ds) {
+		cache->ti->error = "Cannot allocate superblock";
+		return -ENOMEM;
+	}
+
+	r = meta_io(cache, READ, SUPER_SECTOR, 1, ds, DM_IO_KMEM);
+	if (r) {
+		cache->ti->error = "Couldn't read cache superblock";
+		goto out;
+	}
+
+	if (le32_to_cpu(ds->magic) != CACHE_MAGIC) {
+		r = format_metadata(cache, ds);
+		if (r)
+			cache->ti->error = "Couldn't format cache device";
+		goto out;
+	}
+
+	if (le32_to_cpu(ds->version) != CACHE_VERSION) {
+		cache->ti->error = "Unsupported cache metadata version";
+		r = -EINVAL;
+		goto out;
+	}
+
+	if (le32_to_cpu(ds->block_sectors) != cache->block_sectors ||
+	    le32_to_cpu(ds->nr_cblocks) != cache->nr_cblocks ||
+	    le64_to_cpu(ds->origin_sectors) != cache->ti->len ||
+	    le64_to_cpu(ds->data_start) != cache->data_start) {
+		cache->ti->error = "Cache metadata doesn't match table";
+		r = -EINVAL;
+		goto out;
+	}
+
+	r = load_mappings(cache);
+
+out:
+	kfree(ds);
+	return r;
+}
+
+/*
+ * Works out how many blocks fit on the cache device alongside the
+ * metadata describing them.
+ */
+static sector_t calc_data_start(dm_cblock_t nr_cblocks, sector_t block_sectors)
+{
+	sector_t meta_end = MAPPING_START +
+			    dm_div_up(nr_cblocks, MAPPINGS_PER_SECTOR);
+
+	return (meta_end + block_sectors - 1) & ~(block_sectors - 1);
+}
+
+static dm_cblock_t calc_nr_cblocks(sector_t dev_sectors,
+				   sector_t block_sectors)
+{
+	sector_t nr;
+
+	if (dev_sectors <= block_sectors)
+		return 0;
+
+	nr = (dev_sectors - 1) * MAPPINGS_PER_SECTOR;
+	sector_div(nr, block_sectors * MAPPINGS_PER_SECTOR + 1);
+	if (nr > UINT_MAX)
+		nr = UINT_MAX;
+
+	while (nr && calc_data_start(nr, block_sectors) +
+		     nr * block_sectors > dev_sectors)
+		nr--;
+
+	return nr;
+}
+
+/*-----------------------------------------------------------------
+ * Bio remapping
+ *---------------------------------------------------------------*/
+static void remap_to_origin(struct cache_c *cache, struct bio *bio)
+{
+	bio->bi_bdev = cache->origin_dev->bdev;
+	bio->bi_sector = bio->bi_sector - cache->ti->begin;
+}
+
+static void remap_to_cache(struct cache_c *cache, struct bio *bio,
+			   dm_cblock_t cblock)
+{
+	sector_t offset = (bio->bi_sector - cache->ti->begin) &
+			  (cache->block_sectors - 1);
+
+	bio->bi_bdev = cache->cache_dev->bdev;
+	bio->bi_sector = cblock_sector(cache, cblock) + offset;
+}
+
+/*
+ * Sends a bio for an uncached block to the origin.  Writes are
+ * counted so a promotion of the same block can wait for them.
+ */
+static void __remap_to_origin_tracked(struct cache_c *cache, struct bio *bio,
+				      dm_oblock_t oblock,
+				      union map_info *map_context)
+{
+	unsigned bucket;
+
+	if (bio_data_dir(bio) == WRITE) {
+		bucket = origin_bucket(oblock);
+		atomic_inc(&cache->origin_writes[bucket]);
+		map_context->ll = ((u64) bucket << TAG_SHIFT) | TAG_ORIGIN;
+	}
+
+	remap_to_origin(cache, bio);
+}
+
+static void writethrough_endio(unsigned long error, void *context)
+{
+	struct bio *bio = context;
+
+	bio_endio(bio, error ? -EIO : 0);
+}
+
+/*
+ * Writes to a cached block in writethrough mode update both copies.
+ * The bio is always ended, by writethrough_endio() or here.
+ */
+static void issue_writethrough(struct cache_c *cache, struct bio *bio,
+			       dm_cblock_t cblock)
+{
+	sector_t offset = (bio->bi_sector - cache->ti->begin) &
+			  (cache->block_sectors - 1);
+	struct dm_io_region where[2];
+	struct dm_io_request io_req = {
+		.bi_rw = WRITE | (bio->bi_rw & WRITE_BARRIER),
+		.mem.type = DM_IO_BVEC,
+		.mem.ptr.bvec = bio->bi_io_vec + bio->bi_idx,
+		.notify.fn = writethrough_endio,
+		.notify.context = bio,
+		.client = cache->io_client,
+	};
+	int r;
+
+	where[0].bdev = cache->origin_dev->bdev;
+	where[0].sector = bio->bi_sector - cache->ti->begin;
+	where[0].count = bio_sectors(bio);
+
+	where[1].bdev = cache->cache_dev->bdev;
+	where[1].sector = cblock_sector(cache, cblock) + offset;
+	where[1].count = bio_sectors(bio);
+
+	r = dm_io(&io_req, 2, where, NULL);
+	if (r)
+		bio_endio(bio, r);
+}
+
+/*
+ * Returns DM_MAPIO_REMAPPED if the caller should issue the bio,
+ * DM_MAPIO_SUBMITTED if it has been issued or held back.
+ */
+static int map_bio(struct cache_c *cache, struct bio *bio,
+		   union map_info *map_context)
+{
+	dm_oblock_t oblock = get_bio_block(cache, bio);
+	int rw = bio_data_dir(bio);
+	struct cache_block *cb;
+	dm_cblock_t cblock;
+	int writethrough;
+
+	map_context->ll = TAG_NONE;
+	cache->last_io = jiffies;
+
+	/* A trailing partial block is never cached. */
+	if (oblock >= cache->nr_oblocks) {
+		remap_to_origin(cache, bio);
+		return DM_MAPIO_REMAPPED;
+	}
+
+	spin_lock_irq(&cache->lock);
+
+	cb = __find_block(cache, oblock);
+	if (cb) {
+		if (cb->flags & CB_BUSY) {
+			bio_list_add(&cb->waiting, bio);
+			spin_unlock_irq(&cache->lock);
+			return DM_MAPIO_SUBMITTED;
+		}
+
+		cblock = to_cblock(cache, cb);
+		cache->policy.type->hit(&cache->policy, cblock, rw);
+		atomic_inc(rw == WRITE ? &cache->write_hit : &cache->read_hit);
+
+		/*
+		 * The first write to a clean block in writeback mode
+		 * must wait for the dirty bit to reach the disk.
+		 */
+		if (rw == WRITE && !(cb->flags & CB_DIRTY) &&
+		    cache->mode == CM_WRITEBACK && !cache->failed) {
+			cb->flags |= CB_BUSY;
+			cb->op = OP_MARK_DIRTY;
+			bio_list_add(&cb->waiting, bio);
+			list_add_tail(&cb->list, &cache->prepare);
+			spin_unlock_irq(&cache->lock);
+			wake_worker(cache);
+			return DM_MAPIO_SUBMITTED;
+		}
+
+		/*
+		 * Without working metadata, clean blocks can't be
+		 * dirtied and fall back to writethrough.
+		 */
+		writethrough = rw == WRITE &&
+			       (cache->mode == CM_WRITETHROUGH ||
+				!(cb->flags & CB_DIRTY));
+
+		atomic_inc(&cb->pending);
+		map_context->ll = ((u64) cblock << TAG_SHIFT) | TAG_CACHE;
+		spin_unlock_irq(&cache->lock);
+
+		if (writethrough) {
+			issue_writethrough(cache, bio, cblock);
+			return DM_MAPIO_SUBMITTED;
+		}
+
+		remap_to_cache(cache, bio, cblock);
+		return DM_MAPIO_REMAPPED;
+	}
+
+	atomic_inc(rw == WRITE ? &cache->write_miss : &cache->read_miss);
+
+	if (!cache->quiescing && !cache->failed &&
+	    cache->nr_migrations < MAX_MIGRATIONS &&
+	    cache->policy.type->miss(&cache->policy, oblock, rw,
+				     list_empty(&cache->free)) &&
+	    (cb = __alloc_block(cache))) {
+		cb->oblock = oblock;
+		cb->flags = CB_BUSY;
+		cb->op = OP_PROMOTE;
+		cb->error = 0;
+		__insert_block(cache, cb);
+		bio_list_add(&cb->waiting, bio);
+		list_add_tail(&cb->list, &cache->prepare);
+		cache->nr_migrations++;
+		atomic_inc(&cache->promotion);
+		spin_unlock_irq(&cache->lock);
+		wake_worker(cache);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	__remap_to_origin_tracked(cache, bio, oblock, map_context);
+	spin_unlock_irq(&cache->lock);
+
+	return DM_MAPIO_REMAPPED;
+}
+
+/*-----------------------------------------------------------------
+ * Migrations: promotions copy a block from the origin into the cache,
+ * cleanings copy a dirty block back.
+ *---------------------------------------------------------------*/
+static void copy_complete(int read_err, unsigned long write_err, void *context)
+{
+	struct cache_block *cb = context;
+	struct cache_c *cache = cb->cache;
+	unsigned long flags;
+
+	cb->error = (read_err || write_err) ? -EIO : 0;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	list_add_tail(&cb->list, &cache->complete);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	wake_worker(cache);
+}
+
+static void start_copy(struct cache_c *cache, struct cache_block *cb)
+{
+	struct dm_io_region origin, cached;
+
+	origin.bdev = cache->origin_dev->bdev;
+	origin.sector = cb->oblock << cache->block_shift;
+	origin.count = cache->block_sectors;
+
+	cached.bdev = cache->cache_dev->bdev;
+	cached.sector = cblock_sector(cache, to_cblock(cache, cb));
+	cached.count = cache->block_sectors;
+
+	if (cb->op == OP_PROMOTE)
+		dm_kcopyd_copy(cache->kcopyd_client, &origin, 1, &cached,
+			       0, copy_complete, cb);
+	else
+		dm_kcopyd_copy(cache->kcopyd_client, &cached, 1, &origin,
+			       0, copy_complete, cb);
+}
+
+/*
+ * Starts the promotions that no longer overlap a write in flight to
+ * the origin.
+ */
+static void issue_delayed_promotions(struct cache_c *cache)
+{
+	struct cache_block *cb, *tmp;
+	LIST_HEAD(ready);
+
+	/* Pairs with the atomic_dec_and_test() in cache_end_io(). */
+	smp_mb();
+
+	spin_lock_irq(&cache->lock);
+	list_for_each_entry_safe(cb, tmp, &cache->delayed, list)
+		if (!atomic_read(&cache->origin_writes[origin_bucket(cb->oblock)]))
+			list_move_tail(&cb->list, &ready);
+	spin_unlock_irq(&cache->lock);
+
+	list_for_each_entry_safe(cb, tmp, &ready, list) {
+		list_del(&cb->list);
+		start_copy(cache, cb);
+	}
+}
+
+static int should_clean(struct cache_c *cache)
+{
+	if (!cache->nr_dirty || cache->quiescing || cache->failed)
+		return 0;
+
+	return cache->mode == CM_WRITETHROUGH || cache->need_clean ||
+	       cache->nr_dirty > cache->nr_cblocks / 2 ||
+	       time_after(jiffies, cache->last_io + IDLE_JIFFIES);
+}
+
+static void start_cleaning(struct cache_c *cache)
+{
+	struct cache_block *cb, *tmp;
+	LIST_HEAD(clean);
+
+	spin_lock_irq(&cache->lock);
+	while (cache->nr_migrations < MAX_MIGRATIONS && should_clean(cache)) {
+		cb = __find_idle(cache, CB_VALID | CB_DIRTY);
+		if (!cb)
+			break;
+
+		cb->flags |= CB_BUSY;
+		cb->op = OP_CLEAN;
+		cb->error = 0;
+		list_add_tail(&cb->list, &clean);
+		cache->nr_migrations++;
+		cache->need_clean = 0;
+	}
+	spin_unlock_irq(&cache->lock);
+
+	list_for_each_entry_safe(cb, tmp, &clean, list) {
+		list_del(&cb->list);
+		start_copy(cache, cb);
+	}
+}
+
+/*-----------------------------------------------------------------
+ * Worker
+ *---------------------------------------------------------------*/
+static void __release_waiting(struct cache_c *cache, struct cache_block *cb,
+			      struct bio_list *bios)
+{
+	cb->flags &= ~CB_BUSY;
+	bio_list_merge(bios, &cb->waiting);
+	bio_list_init(&cb->waiting);
+}
+
+/*
+ * Blocks that are about to be promoted into, or dirtied, need their
+ * mappings updated before any data moves.
+ */
+static void prepare_mappings(struct cache_c *cache, struct list_head *prepare)
+{
+	struct cache_block *cb;
+	dm_cblock_t cblock;
+
+	list_for_each_entry(cb, prepare, list) {
+		cblock = to_cblock(cache, cb);
+
+		if (cb->op == OP_MARK_DIRTY)
+			set_mapping(cache, cblock, cb->oblock, M_VALID | M_DIRTY);
+
+		else if (get_mapping_flags(cache, cblock) & M_VALID)
+			set_mapping(cache, cblock, 0, 0);
+	}
+}
+
+/*
+ * Returns whether any cleaning copied data to the origin.
+ */
+static int complete_mappings(struct cache_c *cache, struct list_head *complete)
+{
+	struct cache_block *cb;
+	int cleaned = 0;
+
+	list_for_each_entry(cb, complete, list) {
+		if (cb->error)
+			continue;
+
+		set_mapping(cache, to_cblock(cache, cb), cb->oblock, M_VALID);
+		if (cb->op == OP_CLEAN)
+			cleaned = 1;
+	}
+
+	return cleaned;
+}
+
+static void finish_prepared(struct cache_c *cache, struct list_head *prepare,
+			    int r, struct bio_list *bios)
+{
+	struct cache_block *cb, *tmp;
+
+	spin_lock_irq(&cache->lock);
+	list_for_each_entry_safe(cb, tmp, prepare, list) {
+		if (cb->op == OP_PROMOTE) {
+			if (r) {
+				cb->error = r;
+				list_move_tail(&cb->list, &cache->complete);
+			} else
+				list_move_tail(&cb->list, &cache->delayed);
+			continue;
+		}
+
+		/*
+		 * If the dirty bit didn't make it, the held writes are
+		 * remapped and go writethrough instead.
+		 */
+		list_del(&cb->list);
+		if (!r) {
+			cb->flags |= CB_DIRTY;
+			cache->nr_dirty++;
+		} else
+			set_mapping(cache, to_cblock(cache, cb), cb->oblock,
+				    M_VALID);
+		__release_waiting(cache, cb, bios);
+	}
+	spin_unlock_irq(&cache->lock);
+}
+
+static void finish_complete(struct cache_c *cache, struct list_head *complete,
+			    int r, struct bio_list *bios,
+			    struct bio_list *origin_bios)
+{
+	struct cache_block *cb, *tmp;
+	struct bio *bio;
+
+	spin_lock_irq(&cache->lock);
+	list_for_each_entry_safe(cb, tmp, complete, list) {
+		list_del(&cb->list);
+		cache->nr_migrations--;
+
+		if (!cb->error && r)
+			cb->error = r;
+
+		/*
+		 * On failure the in core mapping goes back to what the
+		 * disk is known to hold.
+		 */
+		if (cb->op == OP_CLEAN) {
+			if (cb->error) {
+				DMERR_LIMIT("Writeback of block %llu failed",
+					    (unsigned long long) cb->oblock);
+				set_mapping(cache, to_cblock(cache, cb),
+					    cb->oblock, M_VALID | M_DIRTY);
+			} else {
+				cb->flags &= ~CB_DIRTY;
+				cache->nr_dirty--;
+				atomic_inc(&cache->writeback);
+			}
+			__release_waiting(cache, cb, bios);
+			continue;
+		}
+
+		if (!cb->error) {
+			cb->flags |= CB_VALID;
+			cache->policy.type->insert(&cache->policy,
+						   to_cblock(cache, cb),
+						   cb->oblock);
+			__release_waiting(cache, cb, bios);
+			continue;
+		}
+
+		/*
+		 * A failed promotion gives the block back and sends the
+		 * ios it held straight to the origin rather than
+		 * retrying.
+		 */
+		DMERR_LIMIT("Promotion of block %llu failed",
+			    (unsigned long long) cb->oblock);
+		__remove_block(cache, cb);
+		set_mapping(cache, to_cblock(cache, cb), 0, 0);
+		while ((bio = bio_list_pop(&cb->waiting))) {
+			__remap_to_origin_tracked(cache, bio, cb->oblock,
+						  dm_get_mapinfo(bio));
+			bio_list_add(origin_bios, bio);
+		}
+		__free_block(cache, cb);
+	}
+	spin_unlock_irq(&cache->lock);
+}
+
+static void issue_bios(struct cache_c *cache, struct bio_list *bios)
+{
+	struct bio *bio;
+
+	while ((bio = bio_list_pop(bios)))
+		if (map_bio(cache, bio, dm_get_mapinfo(bio)) ==
+		    DM_MAPIO_REMAPPED)
+			generic_make_request(bio);
+}
+
+static void do_worker(struct work_struct *ws)
+{
+	struct cache_c *cache = container_of(ws, struct cache_c, worker);
+	struct bio_list bios, origin_bios;
+	LIST_HEAD(prepare);
+	LIST_HEAD(complete);
+	struct bio *bio;
+	int cleaned, r;
+
+	bio_list_init(&bios);
+	bio_list_init(&origin_bios);
+
+	spin_lock_irq(&cache->lock);
+	list_splice_init(&cache->prepare, &prepare);
+	list_splice_init(&cache->complete, &complete);
+	spin_unlock_irq(&cache->lock);
+
+	if (!list_empty(&prepare) || !list_empty(&complete)) {
+		prepare_mappings(cache, &prepare);
+		cleaned = complete_mappings(cache, &complete);
+
+		r = write_metadata(cache, cleaned);
+		if (r && !cache->failed) {
+			DMERR("Couldn't write cache metadata: "
+			      "no further promotions or writebacks");
+			spin_lock_irq(&cache->lock);
+			cache->failed = 1;
+			spin_unlock_irq(&cache->lock);
+		}
+
+		finish_prepared(cache, &prepare, r, &bios);
+		finish_complete(cache, &complete, r, &bios, &origin_bios);
+	}
+
+	issue_delayed_promotions(cache);
+
+	while ((bio = bio_list_pop(&origin_bios)))
+		generic_make_request(bio);
+	issue_bios(cache, &bios);
+
+	start_cleaning(cache);
+
+	/*
+	 * Promotions that failed their metadata update were queued
+	 * on complete and need another pass.
+	 */
+	spin_lock_irq(&cache->lock);
+	if (!list_empty(&cache->complete))
+		wake_worker(cache);
+	if (!cache->nr_migrations)
+		wake_up(&cache->migration_wait);
+	spin_unlock_irq(&cache->lock);
+}
+
+static void do_waker(struct work_struct *ws)
+{
+	struct cache_c *cache = container_of(to_delayed_work(ws),
+					     struct cache_c, waker);
+
+	wake_worker(cache);
+	queue_delayed_work(cache->wq, &cache->waker, IDLE_JIFFIES);
+}
+
+/*-----------------------------------------------------------------
+ * Target methods
+ *---------------------------------------------------------------*/
+static void destroy_cache(struct cache_c *cache)
+{
+	if (cache->policy.type)
+		dm_cache_policy_destroy(&cache->policy);
+	if (cache->wq)
+		destroy_workqueue(cache->wq);
+	if (cache->kcopyd_client)
+		dm_kcopyd_client_destroy(cache->kcopyd_client);
+	if (cache->io_client)
+		dm_io_client_destroy(cache->io_client);
+
+	vfree(cache->meta_dirty);
+	vfree(cache->mappings);
+	vfree(cache->hash);
+	vfree(cache->blocks);
+	kfree(cache);
+}
+
+static int create_structures(struct cache_c *cache)
+{
+	unsigned long bitmap_size;
+	unsigned i, nr_buckets;
+	int r;
+
+	cache->blocks = vmalloc(sizeof(*cache->blocks) * cache->nr_cblocks);
+	if (!cache->blocks)
+		return -ENOMEM;
+
+	for (i = 0; i < cache->nr_cblocks; i++) {
+		struct cache_block *cb = cache->blocks + i;
+
+		INIT_LIST_HEAD(&cb->list);
+		cb->cache = cache;
+		cb->flags = 0;
+		atomic_set(&cb->pending, 0);
+		bio_list_init(&cb->waiting);
+	}
+
+	nr_buckets = roundup_pow_of_two(max(cache->nr_cblocks / 4, 64u));
+	cache->hash_bits = ilog2(nr_buckets);
+	cache->hash = vmalloc(sizeof(*cache->hash) * nr_buckets);
+	if (!cache->hash)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_buckets; i++)
+		INIT_HLIST_HEAD(cache->hash + i);
+
+	cache->mappings = vmalloc(to_bytes(cache->meta_sectors));
+	if (!cache->mappings)
+		return -ENOMEM;
+
+	bitmap_size = BITS_TO_LONGS(cache->meta_sectors) * sizeof(long);
+	cache->meta_dirty = vmalloc(bitmap_size);
+	if (!cache->meta_dirty)
+		return -ENOMEM;
+	memset(cache->meta_dirty, 0, bitmap_size);
+
+	cache->io_client = dm_io_client_create(DM_IO_PAGES);
+	if (IS_ERR(cache->io_client)) {
+		r = PTR_ERR(cache->io_client);
+		cache->io_client = NULL;
+		return r;
+	}
+
+	r = dm_kcopyd_client_create(COPY_PAGES, &cache->kcopyd_client);
+	if (r)
+		return r;
+
+	cache->wq = create_singlethread_workqueue("kcached");
+	if (!cache->wq)
+		return -ENOMEM;
+
+	return 0;
+}
+
+/*
+ * Construct a cache mapping:
+ *
+ * cache <cache dev> <origin dev> <block size> <writeback|writethrough>
+ *       <policy>
+ *
+ * block size is in sectors and must be a power of two.
+ */
+static int cache_ctr(struct dm_target *ti, unsigned argc, char **argv)
+{
+	struct cache_c *cache;
+	unsigned long long tmpll;
+	sector_t cache_sectors;
+	unsigned i;
+	int r = -EINVAL;
+
+	if (argc != 5) {
+		ti->error = "Invalid argument count";
+		return -EINVAL;
+	}
+
+	cache = kzalloc(sizeof(*cache), GFP_KERNEL);
+	if (!cache) {
+		ti->error = "Cannot allocate cache context";
+		return -ENOMEM;
+	}
+
+	cache->ti = ti;
+	spin_lock_init(&cache->lock);
+	INIT_LIST_HEAD(&cache->free);
+	INIT_LIST_HEAD(&cache->prepare);
+	INIT_LIST_HEAD(&cache->delayed);
+	INIT_LIST_HEAD(&cache->complete);
+	init_waitqueue_head(&cache->migration_wait);
+	INIT_WORK(&cache->worker, do_worker);
+	INIT_DELAYED_WORK(&cache->waker, do_waker);
+	for (i = 0; i < NR_ORIGIN_WRITE_BUCKETS; i++)
+		atomic_set(&cache->origin_writes[i], 0);
+	cache->last_io = jiffies;
+
+	if (sscanf(argv[2], "%llu", &tmpll) != 1 ||
+	    tmpll < MIN_BLOCK_SECTORS || tmpll > MAX_BLOCK_SECTORS ||
+	    !is_power_of_2(tmpll)) {
+		ti->error = "Invalid block size";
+		goto bad;
+	}
+	cache->block_sectors = tmpll;
+	cache->block_shift = ilog2(tmpll);
+
+	if (!strcasecmp(argv[3], "writeback"))
+		cache->mode = CM_WRITEBACK;
+	else if (!strcasecmp(argv[3], "writethrough"))
+		cache->mode = CM_WRITETHROUGH;
+	else {
+		ti->error = "Invalid cache mode";
+		goto bad;
+	}
+
+	if (dm_get_device(ti, argv[0], dm_table_get_mode(ti->table),
+			  &cache->cache_dev)) {
+		ti->error = "Cache device lookup failed";
+		goto bad;
+	}
+
+	if (dm_get_device(ti, argv[1], dm_table_get_mode(ti->table),
+			  &cache->origin_dev)) {
+		ti->error = "Origin device lookup failed";
+		goto bad_cache_dev;
+	}
+
+	cache_sectors = i_size_read(cache->cache_dev->bdev->bd_inode) >>
+			SECTOR_SHIFT;
+	cache->nr_cblocks = calc_nr_cblocks(cache_sectors,
+					    cache->block_sectors);
+	if (!cache->nr_cblocks) {
+		ti->error = "Cache device too small";
+		goto bad_origin_dev;
+	}
+	cache->nr_oblocks = ti->len >> cache->block_shift;
+	cache->data_start = calc_data_start(cache->nr_cblocks,
+					    cache->block_sectors);
+	cache->meta_sectors = dm_div_up(cache->nr_cblocks,
+					MAPPINGS_PER_SECTOR);
+
+	r = dm_cache_policy_create(argv[4], cache->nr_cblocks,
+				   &cache->policy);
+	if (r) {
+		ti->error = "Cache policy creation failed";
+		goto bad_origin_dev;
+	}
+
+	r = create_structures(cache);
+	if (r) {
+		ti->error = "Cannot allocate cache structures";
+		goto bad_origin_dev;
+	}
+
+	r = read_or_format_metadata(cache);
+	if (r)
+		goto bad_origin_dev;
+
+	ti->split_io = cache->block_sectors;
+	ti->num_flush_requests = 2;
+	ti->private = cache;
+
+	return 0;
+
+bad_origin_dev:
+	dm_put_device(ti, cache->origin_dev);
+bad_cache_dev:
+	dm_put_device(ti, cache->cache_dev);
+bad:
+	destroy_cache(cache);
+	return r;
+}
+
+static void cache_dtr(struct dm_target *ti)
+{
+	struct cache_c *cache = ti->private;
+
+	cancel_delayed_work_sync(&cache->waker);
+	flush_workqueue(cache->wq);
+
+	dm_put_device(ti, cache->origin_dev);
+	dm_put_device(ti, cache->cache_dev);
+
+	destroy_cache(cache);
+}
+
+static int cache_map(struct dm_target *ti, struct bio *bio,
+		     union map_info *map_context)
+{
+	struct cache_c *cache = ti->private;
+
+	/*
+	 * Flushes go to both devices; dirty data and the mappings
+	 * describing it both live on the cache device.
+	 */
+	if (unlikely(bio_empty_barrier(bio))) {
+		map_context->ll = TAG_NONE;
+		bio->bi_bdev = map_context->flush_request ?
+			       cache->origin_dev->bdev :
+			       cache->cache_dev->bdev;
+		return DM_MAPIO_REMAPPED;
+	}
+
+	return map_bio(cache, bio, map_context);
+}
+
+static int cache_end_io(struct dm_target *ti, struct bio *bio,
+			int error, union map_info *map_context)
+{
+	struct cache_c *cache = ti->private;
+	u64 tag = map_context->ll;
+	unsigned long flags;
+	int delayed;
+
+	switch (tag & ((1 << TAG_SHIFT) - 1)) {
+	case TAG_CACHE:
+		atomic_dec(&cache->blocks[tag >> TAG_SHIFT].pending);
+		break;
+
+	case TAG_ORIGIN:
+		if (atomic_dec_and_test(&cache->origin_writes[tag >> TAG_SHIFT])) {
+			spin_lock_irqsave(&cache->lock, flags);
+			delayed = !list_empty(&cache->delayed);
+			spin_unlock_irqrestore(&cache->lock, flags);
+			if (delayed)
+				wake_worker(cache);
+		}
+		break;
+	}
+
+	return error;
+}
+
+static void cache_presuspend(struct dm_target *ti)
+{
+	struct cache_c *cache = ti->private;
+
+	spin_lock_irq(&cache->lock);
+	cache->quiescing = 1;
+	spin_unlock_irq(&cache->lock);
+}
+
+static int no_migrations(struct cache_c *cache)
+{
+	int r;
+
+	spin_lock_irq(&cache->lock);
+	r = !cache->nr_migrations;
+	spin_unlock_irq(&cache->lock);
+
+	return r;
+}
+
+static void cache_postsuspend(struct dm_target *ti)
+{
+	struct cache_c *cache = ti->private;
+
+	cancel_delayed_work_sync(&cache->waker);
+	wait_event(cache->migration_wait, no_migrations(cache));
+	flush_workqueue(cache->wq);
+}
+
+static void cache_resume(struct dm_target *ti)
+{
+	struct cache_c *cache = ti->private;
+
+	spin_lock_irq(&cache->lock);
+	cache->quiescing = 0;
+	spin_unlock_irq(&cache->lock);
+
+	queue_delayed_work(cache->wq, &cache->waker, IDLE_JIFFIES);
+}
+
+static int cache_status(struct dm_target *ti, status_type_t type,
+			char *result, unsigned maxlen)
+{
+	struct cache_c *cache = ti->private;
+	unsigned sz = 0;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		spin_lock_irq(&cache->lock);
+		DMEMIT("%u %u %u %u %u %u %u %u/%u %u",
+		       atomic_read(&cache->read_hit),
+		       atomic_read(&cache->read_miss),
+		       atomic_read(&cache->write_hit),
+		       atomic_read(&cache->write_miss),
+		       atomic_read(&cache->promotion),
+		       atomic_read(&cache->demotion),
+		       atomic_read(&cache->writeback),
+		       cache->nr_cblocks - cache->nr_free,
+		       cache->nr_cblocks, cache->nr_dirty);
+		spin_unlock_irq(&cache->lock);
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("%s %s %llu %s %s", cache->cache_dev->name,
+		       cache->origin_dev->name,
+		       (unsigned long long) cache->block_sectors,
+		       cache->mode == CM_WRITEBACK ?
+		       "writeback" : "writethrough",
+		       cache->policy.type->name);
+		break;
+	}
+
+	return 0;
+}
+
+static int cache_iterate_devices(struct dm_target *ti,
+				 iterate_devices_callout_fn fn, void *data)
+{
+	struct cache_c *cache = ti->private;
+	int r;
+
+	r = fn(ti, cache->cache_dev, 0,
+	       cblock_sector(cache, cache->nr_cblocks), data);
+	if (r)
+		return r;
+
+	return fn(ti, cache->origin_dev, 0, ti->len, data);
+}
+
+static struct target_type cache_target = {
+	.name	     = "cache",
+	.version     = {1, 0, 0},
+	.module      = THIS_MODULE,
+	.ctr	     = cache_ctr,
+	.dtr	     = cache_dtr,
+	.map	     = cache_map,
+	.end_io	     = cache_end_io,
+	.presuspend  = cache_presuspend,
+	.postsuspend = cache_postsuspend,
+	.resume	     = cache_resume,
+	.status	     = cache_status,
+	.iterate_devices = cache_iterate_devices,
+};
+
+static int __init dm_cache_init(void)
+{
+	int r;
+
+	r = dm_cache_policy_init();
+	if (r) {
+		DMERR("Failed to initialize cache policies");
+		return r;
+	}
+
+	r = dm_register_target(&cache_target);
+	if (r < 0) {
+		DMERR("register failed %d", r);
+		dm_cache_policy_exit();
+	}
+
+	return r;
+}
+
+static void __exit dm_cache_exit(void)
+{
+	dm_unregister_target(&cache_target);
+	dm_cache_policy_exit();
+}
+
+/* Module hooks */
+module_init(dm_cache_init);
+module_exit(dm_cache_exit);
+
+MODULE_DESCRIPTION(DM_NAME " cache target");
+MODULE_LICENSE("GPL");
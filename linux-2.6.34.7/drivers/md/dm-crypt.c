@@ -18,6 +18,9 @@
 #include <linux/crypto.h>
 #include <linux/workqueue.h>
 #include <linux/backing-dev.h>
+#include <linux/percpu.h>
+#include <linux/kthread.h>
+#include <linux/rbtree.h>
 #include <asm/atomic.h>
 #include <linux/scatterlist.h>
 #include <asm/page.h>
@@ -57,6 +60,9 @@ struct dm_crypt_io {
 	int error;
 	sector_t sector;
 	struct dm_crypt_io *base_io;
+
+	int cpu;			/* submitter, reads decrypt there */
+	struct rb_node rb_node;		/* in cc->write_tree */
 };
 
 struct dm_crypt_request {
@@ -86,6 +92,13 @@ struct iv_benbi_private {
 	int shift;
 };
 
+/*
+ * Per cpu state, only touched by the kcryptd thread of that cpu.
+ */
+struct crypt_cpu {
+	struct ablkcipher_request *req;
+};
+
 /*
  * Crypt: maps a linear range of a block device
  * and encrypts / decrypts at the same time.
@@ -107,6 +120,14 @@ struct crypt_config {
 	struct workqueue_struct *io_queue;
 	struct workqueue_struct *crypt_queue;
 
+	/*
+	 * Encrypted writes finish in any order on any cpu, they are
+	 * collected here and submitted sorted by sector.
+	 */
+	struct task_struct *write_thread;
+	wait_queue_head_t write_thread_wait;
+	struct rb_root write_tree;
+
 	/*
 	 * crypto related data
 	 */
@@ -133,7 +154,7 @@ struct crypt_config {
 	 * correctly aligned.
 	 */
 	unsigned int dmreq_start;
-	struct ablkcipher_request *req;
+	struct crypt_cpu __percpu *cpu;
 
 	char cipher[CRYPTO_MAX_ALG_NAME];
 	char chainmode[CRYPTO_MAX_ALG_NAME];
@@ -457,24 +478,31 @@ static int crypt_convert_block(struct crypt_config *cc,
 
 static void kcryptd_async_done(struct crypto_async_request *async_req,
 			       int error);
-static void crypt_alloc_req(struct crypt_config *cc,
+static void crypt_alloc_req(struct crypt_config *cc, struct crypt_cpu *cpu,
 			    struct convert_context *ctx)
 {
-	if (!cc->req)
-		cc->req = mempool_alloc(cc->req_pool, GFP_NOIO);
-	ablkcipher_request_set_tfm(cc->req, cc->tfm);
-	ablkcipher_request_set_callback(cc->req, CRYPTO_TFM_REQ_MAY_BACKLOG |
+	if (!cpu->req)
+		cpu->req = mempool_alloc(cc->req_pool, GFP_NOIO);
+	ablkcipher_request_set_tfm(cpu->req, cc->tfm);
+	ablkcipher_request_set_callback(cpu->req, CRYPTO_TFM_REQ_MAY_BACKLOG |
 					CRYPTO_TFM_REQ_MAY_SLEEP,
 					kcryptd_async_done,
-					dmreq_of_req(cc, cc->req));
+					dmreq_of_req(cc, cpu->req));
 }
 
 /*
  * Encrypt / decrypt data from one bio to another one (can be the same one)
+ *
+ * Only called from kcryptd, whose per cpu threads are bound and run one
+ * work item at a time, so the cpu's spare request can't be shared.
+ * Requests that went asynchronous belong to the cipher until they
+ * complete, the next block gets a fresh one, so an async cipher has the
+ * whole bio in flight at once.
  */
 static int crypt_convert(struct crypt_config *cc,
 			 struct convert_context *ctx)
 {
+	struct crypt_cpu *cpu = this_cpu_ptr(cc->cpu);
 	int r;
 
 	atomic_set(&ctx->pending, 1);
@@ -482,11 +510,11 @@ static int crypt_convert(struct crypt_config *cc,
 	while(ctx->idx_in < ctx->bio_in->bi_vcnt &&
 	      ctx->idx_out < ctx->bio_out->bi_vcnt) {
 
-		crypt_alloc_req(cc, ctx);
+		crypt_alloc_req(cc, cpu, ctx);
 
 		atomic_inc(&ctx->pending);
 
-		r = crypt_convert_block(cc, ctx, cc->req);
+		r = crypt_convert_block(cc, ctx, cpu->req);
 
 		switch (r) {
 		/* async */
@@ -495,7 +523,7 @@ static int crypt_convert(struct crypt_config *cc,
 			INIT_COMPLETION(ctx->restart);
 			/* fall through*/
 		case -EINPROGRESS:
-			cc->req = NULL;
+			cpu->req = NULL;
 			ctx->sector++;
 			continue;
 
@@ -605,6 +633,7 @@ static struct dm_crypt_io *crypt_io_alloc(struct dm_target *ti,
 	io->sector = sector;
 	io->error = 0;
 	io->base_io = NULL;
+	io->cpu = -1;
 	atomic_set(&io->pending, 0);
 
 	return io;
@@ -749,6 +778,83 @@ static void kcryptd_queue_io(struct dm_crypt_io *io)
 	queue_work(cc->io_queue, &io->work);
 }
 
+static int dmcrypt_write(void *data)
+{
+	struct crypt_config *cc = data;
+	struct dm_crypt_io *io;
+
+	while (1) {
+		struct rb_root write_tree;
+		DECLARE_WAITQUEUE(wait, current);
+
+		spin_lock_irq(&cc->write_thread_wait.lock);
+continue_locked:
+		if (!RB_EMPTY_ROOT(&cc->write_tree))
+			goto pop_from_list;
+
+		__set_current_state(TASK_INTERRUPTIBLE);
+		__add_wait_queue(&cc->write_thread_wait, &wait);
+
+		spin_unlock_irq(&cc->write_thread_wait.lock);
+
+		if (unlikely(kthread_should_stop())) {
+			set_task_state(current, TASK_RUNNING);
+			remove_wait_queue(&cc->write_thread_wait, &wait);
+			break;
+		}
+
+		schedule();
+
+		set_task_state(current, TASK_RUNNING);
+		spin_lock_irq(&cc->write_thread_wait.lock);
+		__remove_wait_queue(&cc->write_thread_wait, &wait);
+		goto continue_locked;
+
+pop_from_list:
+		write_tree = cc->write_tree;
+		cc->write_tree = RB_ROOT;
+		spin_unlock_irq(&cc->write_thread_wait.lock);
+
+		/*
+		 * Everything that got encrypted since the last pass goes
+		 * out in ascending sector order.
+		 */
+		do {
+			io = rb_entry(rb_first(&write_tree),
+				      struct dm_crypt_io, rb_node);
+			rb_erase(&io->rb_node, &write_tree);
+			generic_make_request(io->ctx.bio_out);
+		} while (!RB_EMPTY_ROOT(&write_tree));
+	}
+
+	return 0;
+}
+
+static void kcryptd_queue_write(struct dm_crypt_io *io)
+{
+	struct crypt_config *cc = io->target->private;
+	sector_t sector = io->ctx.bio_out->bi_sector;
+	struct rb_node **rbp, *parent;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cc->write_thread_wait.lock, flags);
+	rbp = &cc->write_tree.rb_node;
+	parent = NULL;
+	while (*rbp) {
+		parent = *rbp;
+		if (sector < rb_entry(parent, struct dm_crypt_io,
+				      rb_node)->ctx.bio_out->bi_sector)
+			rbp = &(*rbp)->rb_left;
+		else
+			rbp = &(*rbp)->rb_right;
+	}
+	rb_link_node(&io->rb_node, parent, rbp);
+	rb_insert_color(&io->rb_node, &cc->write_tree);
+
+	wake_up_locked(&cc->write_thread_wait);
+	spin_unlock_irqrestore(&cc->write_thread_wait.lock, flags);
+}
+
 static void kcryptd_crypt_write_io_submit(struct dm_crypt_io *io,
 					  int error, int async)
 {
@@ -768,7 +874,14 @@ static void kcryptd_crypt_write_io_submit(struct dm_crypt_io *io,
 
 	clone->bi_sector = cc->start + io->sector;
 
-	if (async)
+	/*
+	 * A clone that covers the whole bio is the only one of its io and
+	 * can be parked in the write tree.  Fragments share the io with the
+	 * next fragment, they go out right away as before.
+	 */
+	if (likely(clone->bi_size == io->base_bio->bi_size))
+		kcryptd_queue_write(io);
+	else if (async)
 		kcryptd_queue_io(io);
 	else
 		generic_make_request(clone);
@@ -925,12 +1038,22 @@ static void kcryptd_crypt(struct work_struct *work)
 		kcryptd_crypt_write_convert(io);
 }
 
+/*
+ * Writes are encrypted on the cpu that submitted them.  Reads come back
+ * here from the completion interrupt, wherever that was taken, and are
+ * sent back to their submitter so decryption is spread the same way.
+ */
 static void kcryptd_queue_crypt(struct dm_crypt_io *io)
 {
 	struct crypt_config *cc = io->target->private;
+	int cpu = get_cpu();
 
 	INIT_WORK(&io->work, kcryptd_crypt);
-	queue_work(cc->crypt_queue, &io->work);
+	if (io->cpu < 0 || io->cpu == cpu || !cpu_online(io->cpu))
+		queue_work(cc->crypt_queue, &io->work);
+	else
+		queue_work_on(io->cpu, cc->crypt_queue, &io->work);
+	put_cpu();
 }
 
 /*
@@ -1134,8 +1257,6 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		ti->error = "Cannot allocate crypt request mempool";
 		goto bad_req_pool;
 	}
-	cc->req = NULL;
-
 	cc->page_pool = mempool_create_page_pool(MIN_POOL_PAGES, 0);
 	if (!cc->page_pool) {
 		ti->error = "Cannot allocate page mempool";
@@ -1177,25 +1298,45 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	} else
 		cc->iv_mode = NULL;
 
+	cc->cpu = alloc_percpu(struct crypt_cpu);
+	if (!cc->cpu) {
+		ti->error = "Cannot allocate per cpu state";
+		goto bad_percpu;
+	}
+
 	cc->io_queue = create_singlethread_workqueue("kcryptd_io");
 	if (!cc->io_queue) {
 		ti->error = "Couldn't create kcryptd io queue";
 		goto bad_io_queue;
 	}
 
-	cc->crypt_queue = create_singlethread_workqueue("kcryptd");
+	cc->crypt_queue = create_workqueue("kcryptd");
 	if (!cc->crypt_queue) {
 		ti->error = "Couldn't create kcryptd queue";
 		goto bad_crypt_queue;
 	}
 
+	init_waitqueue_head(&cc->write_thread_wait);
+	cc->write_tree = RB_ROOT;
+
+	cc->write_thread = kthread_create(dmcrypt_write, cc, "dmcrypt_write");
+	if (IS_ERR(cc->write_thread)) {
+		ti->error = "Couldn't spawn write thread";
+		goto bad_write_thread;
+	}
+	wake_up_process(cc->write_thread);
+
 	ti->num_flush_requests = 1;
 	ti->private = cc;
 	return 0;
 
+bad_write_thread:
+	destroy_workqueue(cc->crypt_queue);
 bad_crypt_queue:
 	destroy_workqueue(cc->io_queue);
 bad_io_queue:
+	free_percpu(cc->cpu);
+bad_percpu:
 	kfree(cc->iv_mode);
 bad_ivmode_string:
 	dm_put_device(ti, cc->dev);
@@ -1221,12 +1362,19 @@ bad_cipher:
 static void crypt_dtr(struct dm_target *ti)
 {
 	struct crypt_config *cc = (struct crypt_config *) ti->private;
+	struct crypt_cpu *cpu;
+	int i;
 
+	kthread_stop(cc->write_thread);
 	destroy_workqueue(cc->io_queue);
 	destroy_workqueue(cc->crypt_queue);
 
-	if (cc->req)
-		mempool_free(cc->req, cc->req_pool);
+	for_each_possible_cpu(i) {
+		cpu = per_cpu_ptr(cc->cpu, i);
+		if (cpu->req)
+			mempool_free(cpu->req, cc->req_pool);
+	}
+	free_percpu(cc->cpu);
 
 	bioset_free(cc->bs);
 	mempool_destroy(cc->page_pool);
@@ -1256,6 +1404,7 @@ static int crypt_map(struct dm_target *ti, struct bio *bio,
 	}
 
 	io = crypt_io_alloc(ti, bio, bio->bi_sector - ti->begin);
+	io->cpu = raw_smp_processor_id();
 
 	if (bio_data_dir(io->base_bio) == READ)
 		kcryptd_queue_io(io);
@@ -260,6 +260,31 @@ static inline void update_head_pos(int disk, r1bio_t *r1_bio)
 		r1_bio->sector + (r1_bio->sectors);
 }
 
+/*
+ * Fold the completion time of a read into the mirror's moving average.
+ * Concurrent completions may lose an update, which doesn't matter for an
+ * estimate.
+ */
+static void update_read_lat(int disk, r1bio_t *r1_bio)
+{
+	conf_t *conf = r1_bio->mddev->private;
+	mirror_info_t *mirror = conf->mirrors + disk;
+	unsigned long lat, avg;
+
+	if (!r1_bio->read_start)
+		return;
+
+	lat = min_t(u64, ktime_to_ns(ktime_get()) - r1_bio->read_start,
+		    ULONG_MAX >> RAID1_READ_LAT_SHIFT);
+	avg = mirror->read_lat;
+	if (!avg)
+		/* the first sample seeds the average, 0 means "no sample" */
+		mirror->read_lat = lat ?: 1;
+	else
+		mirror->read_lat = avg - (avg >> RAID1_READ_LAT_SHIFT) +
+				   (lat >> RAID1_READ_LAT_SHIFT);
+}
+
 static void raid1_end_read_request(struct bio *bio, int error)
 {
 	int uptodate = test_bit(BIO_UPTODATE, &bio->bi_flags);
@@ -273,9 +298,10 @@ static void raid1_end_read_request(struct bio *bio, int error)
 	 */
 	update_head_pos(mirror, r1_bio);
 
-	if (uptodate)
+	if (uptodate) {
+		update_read_lat(mirror, r1_bio);
 		set_bit(R1BIO_Uptodate, &r1_bio->state);
-	else {
+	} else {
 		/* If all other devices have failed, we want to return
 		 * the error upwards rather than fail the last device.
 		 * Here we redefine "uptodate" to mean "Don't want to retry"
@@ -402,6 +428,35 @@ static void raid1_end_write_request(struct bio *bio, int error)
 }
 
 
+/*
+ * RAID1_READ_LATENCY: pick the mirror expected to complete the read
+ * first.  A mirror without a latency sample yet counts as 1ns, so
+ * unknown mirrors get tried and are balanced by queue depth meanwhile.
+ */
+static int read_balance_latency(conf_t *conf, r1bio_t *r1_bio, int disk)
+{
+	int best = disk, i;
+	u64 cost, best_cost = ULLONG_MAX;
+	mdk_rdev_t *rdev;
+
+	for (i = 0; i < conf->raid_disks; i++) {
+		rdev = rcu_dereference(conf->mirrors[i].rdev);
+
+		if (!rdev || r1_bio->bios[i] == IO_BLOCKED ||
+		    !test_bit(In_sync, &rdev->flags) ||
+		    test_bit(WriteMostly, &rdev->flags))
+			continue;
+
+		cost = (u64)(atomic_read(&rdev->nr_pending) + 1) *
+			(conf->mirrors[i].read_lat ?: 1);
+		if (cost < best_cost) {
+			best_cost = cost;
+			best = i;
+		}
+	}
+	return best;
+}
+
 /*
  * This routine returns the disk from which the requested read should
  * be done. There is a per-array 'next expected sequential IO' sector
@@ -479,6 +534,11 @@ static int read_balance(conf_t *conf, r1bio_t *r1_bio)
 	if (new_disk < 0)
 		goto rb_out;
 
+	if (conf->read_policy == RAID1_READ_LATENCY) {
+		new_disk = read_balance_latency(conf, r1_bio, new_disk);
+		goto rb_out;
+	}
+
 	disk = new_disk;
 	/* now disk == new_disk == starting point for search */
 
@@ -534,6 +594,9 @@ static int read_balance(conf_t *conf, r1bio_t *r1_bio)
 		}
 		conf->next_seq_sect = this_sector + sectors;
 		conf->last_used = new_disk;
+		r1_bio->read_start = 0;
+		if (conf->read_policy == RAID1_READ_LATENCY)
+			r1_bio->read_start = ktime_to_ns(ktime_get());
 	}
 	rcu_read_unlock();
 
@@ -1180,6 +1243,7 @@ static int raid1_add_disk(mddev_t *mddev, mdk_rdev_t *rdev)
 			}
 
 			p->head_position = 0;
+			p->read_lat = 0;
 			rdev->raid_disk = mirror;
 			err = 0;
 			/* As all devices are equivalent, we don't need a full recovery
@@ -2083,6 +2147,52 @@ static conf_t *setup_conf(mddev_t *mddev)
 	return ERR_PTR(err);
 }
 
+static ssize_t
+raid1_show_read_policy(mddev_t *mddev, char *page)
+{
+	conf_t *conf = mddev->private;
+	if (!conf)
+		return 0;
+	if (conf->read_policy == RAID1_READ_LATENCY)
+		return sprintf(page, "distance [latency]\n");
+	return sprintf(page, "[distance] latency\n");
+}
+
+static ssize_t
+raid1_store_read_policy(mddev_t *mddev, const char *page, size_t len)
+{
+	conf_t *conf = mddev->private;
+	int i;
+
+	if (!conf)
+		return -ENODEV;
+
+	if (sysfs_streq(page, "distance"))
+		conf->read_policy = RAID1_READ_DISTANCE;
+	else if (sysfs_streq(page, "latency")) {
+		/* start from fresh samples */
+		for (i = 0; i < conf->raid_disks; i++)
+			conf->mirrors[i].read_lat = 0;
+		conf->read_policy = RAID1_READ_LATENCY;
+	} else
+		return -EINVAL;
+	return len;
+}
+
+static struct md_sysfs_entry
+raid1_read_policy = __ATTR(read_policy, S_IRUGO | S_IWUSR,
+			   raid1_show_read_policy,
+			   raid1_store_read_policy);
+
+static struct attribute *raid1_attrs[] =  {
+	&raid1_read_policy.attr,
+	NULL,
+};
+static struct attribute_group raid1_attrs_group = {
+	.name = NULL,
+	.attrs = raid1_attrs,
+};
+
 static int run(mddev_t *mddev)
 {
 	conf_t *conf;
@@ -2153,6 +2263,13 @@ static int run(mddev_t *mddev)
 	conf->thread = NULL;
 	mddev->private = conf;
 
+	if (mddev->to_remove == &raid1_attrs_group)
+		mddev->to_remove = NULL;
+	else if (sysfs_create_group(&mddev->kobj, &raid1_attrs_group))
+		printk(KERN_WARNING
+		       "raid1: failed to create sysfs attributes for %s\n",
+		       mdname(mddev));
+
 	md_set_array_sectors(mddev, raid1_size(mddev, 0, 0));
 
 	mddev->queue->unplug_fn = raid1_unplug;
@@ -2187,6 +2304,7 @@ static int stop(mddev_t *mddev)
 	kfree(conf->poolinfo);
 	kfree(conf);
 	mddev->private = NULL;
+	mddev->to_remove = &raid1_attrs_group;
 	return 0;
 }
 
@@ -6,6 +6,8 @@ typedef struct mirror_info mirror_info_t;
 struct mirror_info {
 	mdk_rdev_t	*rdev;
 	sector_t	head_position;
+	unsigned long	read_lat;	/* moving average of read completion
+					 * time in ns, for RAID1_READ_LATENCY */
 };
 
 /*
@@ -30,6 +32,7 @@ struct r1_private_data_s {
 	int			raid_disks;
 	int			last_used;
 	sector_t		next_seq_sect;
+	int			read_policy;	/* RAID1_READ_* */
 	spinlock_t		device_lock;
 
 	struct list_head	retry_list;
@@ -68,6 +71,19 @@ struct r1_private_data_s {
 
 typedef struct r1_private_data_s conf_t;
 
+/*
+ * How read_balance() picks a mirror.  DISTANCE prefers sequential reads
+ * and the closest head position.  LATENCY sends each read to the mirror
+ * with the lowest expected completion time, its average read latency
+ * times the requests it already has in flight, which suits mirrors of
+ * unlike devices such as an SSD and a disk.
+ */
+#define	RAID1_READ_DISTANCE	0
+#define	RAID1_READ_LATENCY	1
+
+/* weight of a new sample in read_lat is 1/2^RAID1_READ_LAT_SHIFT */
+#define	RAID1_READ_LAT_SHIFT	3
+
 /*
  * this is our 'private' RAID1 bio.
  *
@@ -94,6 +110,7 @@ struct r1bio_s {
 	 * if the IO is in READ direction, then this is where we read
 	 */
 	int			read_disk;
+	u64			read_start;	/* ns, 0 if not timed */
 
 	struct list_head	retry_list;
 	struct bitmap_update	*bitmap_update;
@@ -69,6 +69,7 @@
 #define HASH_MASK		(NR_HASH - 1)
 
 #define stripe_hash(conf, sect)	(&((conf)->stripe_hashtbl[((sect) >> STRIPE_SHIFT) & HASH_MASK]))
+#define stripe_hash_lock(conf, sect)	(&((conf)->hash_locks[((sect) >> STRIPE_SHIFT) & STRIPE_HASH_LOCKS_MASK]))
 
 /* bio's attached to a stripe+device for I/O are linked together in bi_sector
  * order without overlap.  There may be several bio's per stripe+device, and
@@ -192,6 +193,12 @@ static int stripe_operations_active(struct stripe_head *sh)
 	       test_bit(STRIPE_COMPUTE_RUN, &sh->state);
 }
 
+static struct r5worker *stripe_worker(raid5_conf_t *conf,
+				       struct stripe_head *sh)
+{
+	return &conf->workers[sh->cpu * conf->group_thread_cnt / nr_cpu_ids];
+}
+
 static void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
 {
 	if (atomic_dec_and_test(&sh->count)) {
@@ -205,6 +212,13 @@ static void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
 				   sh->bm_seq - conf->seq_write > 0) {
 				list_add_tail(&sh->lru, &conf->bitmap_list);
 				blk_plug_device(conf->mddev->queue);
+			} else if (conf->group_thread_cnt) {
+				struct r5worker *worker = stripe_worker(conf, sh);
+
+				clear_bit(STRIPE_BIT_DELAY, &sh->state);
+				list_add_tail(&sh->lru, &worker->handle_list);
+				wake_up(&worker->wait);
+				return;
 			} else {
 				clear_bit(STRIPE_BIT_DELAY, &sh->state);
 				list_add_tail(&sh->lru, &conf->handle_list);
@@ -240,10 +254,14 @@ static void release_stripe(struct stripe_head *sh)
 
 static inline void remove_hash(struct stripe_head *sh)
 {
+	spinlock_t *lock = stripe_hash_lock(sh->raid_conf, sh->sector);
+
 	pr_debug("remove_hash(), stripe %llu\n",
 		(unsigned long long)sh->sector);
 
+	spin_lock(lock);
 	hlist_del_init(&sh->hash);
+	spin_unlock(lock);
 }
 
 static inline void insert_hash(raid5_conf_t *conf, struct stripe_head *sh)
@@ -254,7 +272,9 @@ static inline void insert_hash(raid5_conf_t *conf, struct stripe_head *sh)
 		(unsigned long long)sh->sector);
 
 	CHECK_DEVLOCK();
+	spin_lock(stripe_hash_lock(conf, sh->sector));
 	hlist_add_head(&sh->hash, hp);
+	spin_unlock(stripe_hash_lock(conf, sh->sector));
 }
 
 
@@ -354,7 +374,7 @@ static struct stripe_head *__find_stripe(raid5_conf_t *conf, sector_t sector,
 	struct stripe_head *sh;
 	struct hlist_node *hn;
 
-	CHECK_DEVLOCK();
+	/* caller holds device_lock or the hash lock for this sector */
 	pr_debug("__find_stripe, sector %llu\n", (unsigned long long)sector);
 	hlist_for_each_entry(sh, hn, stripe_hash(conf, sector), hash)
 		if (sh->sector == sector && sh->generation == generation)
@@ -374,6 +394,24 @@ get_active_stripe(raid5_conf_t *conf, sector_t sector,
 
 	pr_debug("get_stripe, sector %llu\n", (unsigned long long)sector);
 
+	/*
+	 * Fast path: a stripe that is already active only needs another
+	 * reference, which the hash lock is enough to take safely.  Its
+	 * count can't drop to zero under us as that needs device_lock.
+	 */
+	if (!conf->quiesce || noquiesce) {
+		spinlock_t *lock = stripe_hash_lock(conf, sector);
+
+		spin_lock_irq(lock);
+		sh = __find_stripe(conf, sector, conf->generation - previous);
+		if (sh && atomic_inc_not_zero(&sh->count)) {
+			sh->cpu = raw_smp_processor_id();
+			spin_unlock_irq(lock);
+			return sh;
+		}
+		spin_unlock_irq(lock);
+	}
+
 	spin_lock_irq(&conf->device_lock);
 
 	do {
@@ -414,8 +452,10 @@ get_active_stripe(raid5_conf_t *conf, sector_t sector,
 		}
 	} while (sh == NULL);
 
-	if (sh)
+	if (sh) {
 		atomic_inc(&sh->count);
+		sh->cpu = raw_smp_processor_id();
+	}
 
 	spin_unlock_irq(&conf->device_lock);
 	return sh;
@@ -3861,8 +3901,7 @@ static struct stripe_head *__get_priority_stripe(raid5_conf_t *conf)
 		return NULL;
 
 	list_del_init(&sh->lru);
-	atomic_inc(&sh->count);
-	BUG_ON(atomic_read(&sh->count) != 1);
+	BUG_ON(atomic_inc_return(&sh->count) != 1);
 	return sh;
 }
 
@@ -4481,6 +4520,104 @@ static void raid5d(mddev_t *mddev)
 	pr_debug("--- raid5d inactive\n");
 }
 
+static int raid5_worker(void *data)
+{
+	struct r5worker *worker = data;
+	raid5_conf_t *conf = worker->conf;
+	struct stripe_head *sh;
+	int handled;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(worker->wait,
+					 !list_empty(&worker->handle_list) ||
+					 kthread_should_stop());
+
+		handled = 0;
+		spin_lock_irq(&conf->device_lock);
+		while (!list_empty(&worker->handle_list)) {
+			sh = list_entry(worker->handle_list.next,
+					struct stripe_head, lru);
+			list_del_init(&sh->lru);
+			BUG_ON(atomic_inc_return(&sh->count) != 1);
+			spin_unlock_irq(&conf->device_lock);
+
+			handled++;
+			handle_stripe(sh);
+			release_stripe(sh);
+			cond_resched();
+
+			spin_lock_irq(&conf->device_lock);
+		}
+		spin_unlock_irq(&conf->device_lock);
+
+		if (handled) {
+			async_tx_issue_pending_all();
+			unplug_slaves(conf->mddev);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Hand every queued stripe back to raid5d and stop the workers.  Stripes
+ * released after group_thread_cnt is cleared go to conf->handle_list.
+ */
+static void raid5_stop_workers(raid5_conf_t *conf)
+{
+	struct r5worker *workers = conf->workers;
+	int i, cnt = conf->group_thread_cnt;
+
+	if (!workers)
+		return;
+
+	spin_lock_irq(&conf->device_lock);
+	conf->group_thread_cnt = 0;
+	for (i = 0; i < cnt; i++)
+		list_splice_tail_init(&workers[i].handle_list,
+				      &conf->handle_list);
+	spin_unlock_irq(&conf->device_lock);
+	md_wakeup_thread(conf->mddev->thread);
+
+	for (i = 0; i < cnt; i++)
+		kthread_stop(workers[i].thread);
+	conf->workers = NULL;
+	kfree(workers);
+}
+
+static int raid5_start_workers(raid5_conf_t *conf, int cnt)
+{
+	struct r5worker *workers;
+	int i;
+
+	workers = kcalloc(cnt, sizeof(struct r5worker), GFP_KERNEL);
+	if (!workers)
+		return -ENOMEM;
+
+	for (i = 0; i < cnt; i++) {
+		struct r5worker *worker = &workers[i];
+
+		worker->conf = conf;
+		INIT_LIST_HEAD(&worker->handle_list);
+		init_waitqueue_head(&worker->wait);
+		worker->thread = kthread_run(raid5_worker, worker, "%s_raid5w%d",
+					     mdname(conf->mddev), i);
+		if (IS_ERR(worker->thread)) {
+			int err = PTR_ERR(worker->thread);
+
+			while (i--)
+				kthread_stop(workers[i].thread);
+			kfree(workers);
+			return err;
+		}
+	}
+
+	spin_lock_irq(&conf->device_lock);
+	conf->workers = workers;
+	conf->group_thread_cnt = cnt;
+	spin_unlock_irq(&conf->device_lock);
+	return 0;
+}
+
 static ssize_t
 raid5_show_stripe_cache_size(mddev_t *mddev, char *page)
 {
@@ -4563,6 +4700,49 @@ raid5_preread_bypass_threshold = __ATTR(preread_bypass_threshold,
 					raid5_show_preread_threshold,
 					raid5_store_preread_threshold);
 
+static ssize_t
+raid5_show_group_thread_cnt(mddev_t *mddev, char *page)
+{
+	raid5_conf_t *conf = mddev->private;
+	if (conf)
+		return sprintf(page, "%d\n", conf->group_thread_cnt);
+	else
+		return 0;
+}
+
+static ssize_t
+raid5_store_group_thread_cnt(mddev_t *mddev, const char *page, size_t len)
+{
+	raid5_conf_t *conf = mddev->private;
+	unsigned long new;
+	int err;
+
+	if (len >= PAGE_SIZE)
+		return -EINVAL;
+	if (!conf)
+		return -ENODEV;
+
+	if (strict_strtoul(page, 10, &new))
+		return -EINVAL;
+	if (new > num_possible_cpus())
+		return -EINVAL;
+	if (new == conf->group_thread_cnt)
+		return len;
+
+	raid5_stop_workers(conf);
+	if (new) {
+		err = raid5_start_workers(conf, new);
+		if (err)
+			return err;
+	}
+	return len;
+}
+
+static struct md_sysfs_entry
+raid5_group_thread_cnt = __ATTR(group_thread_cnt, S_IRUGO | S_IWUSR,
+				raid5_show_group_thread_cnt,
+				raid5_store_group_thread_cnt);
+
 static ssize_t
 stripe_cache_active_show(mddev_t *mddev, char *page)
 {
@@ -4580,6 +4760,7 @@ static struct attribute *raid5_attrs[] =  {
 	&raid5_stripecache_size.attr,
 	&raid5_stripecache_active.attr,
 	&raid5_preread_bypass_threshold.attr,
+	&raid5_group_thread_cnt.attr,
 	NULL,
 };
 static struct attribute_group raid5_attrs_group = {
@@ -4718,7 +4899,7 @@ static int raid5_alloc_percpu(raid5_conf_t *conf)
 static raid5_conf_t *setup_conf(mddev_t *mddev)
 {
 	raid5_conf_t *conf;
-	int raid_disk, memory, max_disks;
+	int raid_disk, memory, max_disks, i;
 	mdk_rdev_t *rdev;
 	struct disk_info *disk;
 
@@ -4755,6 +4936,8 @@ static raid5_conf_t *setup_conf(mddev_t *mddev)
 	if (conf == NULL)
 		goto abort;
 	spin_lock_init(&conf->device_lock);
+	for (i = 0; i < NR_STRIPE_HASH_LOCKS; i++)
+		spin_lock_init(conf->hash_locks + i);
 	init_waitqueue_head(&conf->wait_for_stripe);
 	init_waitqueue_head(&conf->wait_for_overlap);
 	INIT_LIST_HEAD(&conf->handle_list);
@@ -5131,6 +5314,7 @@ static int stop(mddev_t *mddev)
 {
 	raid5_conf_t *conf = (raid5_conf_t *) mddev->private;
 
+	raid5_stop_workers(conf);
 	md_unregister_thread(mddev->thread);
 	mddev->thread = NULL;
 	mddev->queue->backing_dev_info.congested_fn = NULL;
@@ -212,6 +212,8 @@ struct stripe_head {
 	spinlock_t		lock;
 	int			bm_seq;	/* sequence number for bitmap flushes */
 	int			disks;		/* disks in stripe */
+	int			cpu;		/* last cpu to get a reference,
+						 * picks the handling worker */
 	enum check_states	check_state;
 	enum reconstruct_states reconstruct_state;
 	/**
@@ -343,6 +345,29 @@ struct disk_info {
 	mdk_rdev_t	*rdev;
 };
 
+/*
+ * The stripe hash chains are protected by a small array of locks as well
+ * as by device_lock: changing a chain needs both, walking it needs
+ * either.  That lets get_active_stripe() find a stripe that is already
+ * active without touching device_lock.
+ */
+#define NR_STRIPE_HASH_LOCKS	8
+#define STRIPE_HASH_LOCKS_MASK	(NR_STRIPE_HASH_LOCKS - 1)
+
+/*
+ * Optional group of threads that take over stripe handling from raid5d.
+ * Stripes that become ready for handling are queued to the worker serving
+ * the cpu that last referenced them, so a stripe tends to be handled where
+ * its bios were submitted.  raid5d keeps the hold, delayed and bitmap lists,
+ * which need the ordering logic in __get_priority_stripe().
+ */
+struct r5worker {
+	struct raid5_private_data *conf;
+	struct list_head	handle_list;	/* under device_lock */
+	wait_queue_head_t	wait;
+	struct task_struct	*thread;
+};
+
 struct raid5_private_data {
 	struct hlist_head	*stripe_hashtbl;
 	mddev_t			*mddev;
@@ -426,6 +451,10 @@ struct raid5_private_data {
 							 */
 	int			pool_size; /* number of disks in stripeheads in pool */
 	spinlock_t		device_lock;
+	spinlock_t		hash_locks[NR_STRIPE_HASH_LOCKS];
+	struct r5worker		*workers;
+	int			group_thread_cnt; /* workers in use, 0 if raid5d
+						   * handles all stripes */
 	struct disk_info	*disks;
 
 	/* When taking over an array from a different personality, we store
@@ -17,11 +17,11 @@
  */
 
 #include <linux/raid/pq.h>
-#include <linux/gfp.h>
 #ifndef __KERNEL__
 #include <sys/mman.h>
 #include <stdio.h>
 #else
+#include <linux/gfp.h>
 #if !RAID6_USE_EMPTY_ZERO_PAGE
 /* In .bss so it's zeroed */
 const char raid6_empty_zero_page[PAGE_SIZE] __attribute__((aligned(256)));
@@ -49,10 +49,19 @@ const struct raid6_calls * const raid6_algos[] = {
 	&raid6_sse2x1,
 	&raid6_sse2x2,
 #endif
+#if defined(__i386__) && !defined(__arch_um__) && defined(CONFIG_AS_AVX2)
+	&raid6_avx2x1,
+	&raid6_avx2x2,
+#endif
 #if defined(__x86_64__) && !defined(__arch_um__)
 	&raid6_sse2x1,
 	&raid6_sse2x2,
 	&raid6_sse2x4,
+#ifdef CONFIG_AS_AVX2
+	&raid6_avx2x1,
+	&raid6_avx2x2,
+	&raid6_avx2x4,
+#endif
 #endif
 #ifdef CONFIG_ALTIVEC
 	&raid6_altivec1,
@@ -63,6 +72,19 @@ const struct raid6_calls * const raid6_algos[] = {
 	NULL
 };
 
+const struct raid6_recov_calls * const raid6_recov_algos[] = {
+#if (defined(__i386__) || defined(__x86_64__)) && !defined(__arch_um__)
+#ifdef CONFIG_AS_AVX2
+	&raid6_recov_avx2,
+#endif
+#ifdef CONFIG_AS_SSSE3
+	&raid6_recov_ssse3,
+#endif
+#endif
+	&raid6_recov_intx1,
+	NULL
+};
+
 #ifdef __KERNEL__
 #define RAID6_TIME_JIFFIES_LG2	4
 #else
@@ -71,6 +93,22 @@ const struct raid6_calls * const raid6_algos[] = {
 #define time_before(x, y) ((x) < (y))
 #endif
 
+/* Recovery doesn't depend on the data, just take the best usable one */
+static void __init raid6_select_recov(void)
+{
+	const struct raid6_recov_calls * const * algo;
+	const struct raid6_recov_calls * best = NULL;
+
+	for ( algo = raid6_recov_algos ; *algo ; algo++ )
+		if ( !best || (*algo)->priority > best->priority )
+			if ( !(*algo)->valid || (*algo)->valid() )
+				best = *algo;
+
+	raid6_2data_recov = best->data2;
+	raid6_datap_recov = best->datap;
+	printk("raid6: using %s recovery algorithm\n", best->name);
+}
+
 /* Try to pick the best algorithm */
 /* This code uses the gfmul table as convenient data set to abuse */
 
@@ -81,7 +119,7 @@ int __init raid6_select_algo(void)
 	char *syndromes;
 	void *dptrs[(65536/PAGE_SIZE)+2];
 	int i, disks;
-	unsigned long perf, bestperf;
+	unsigned long perf, bestperf, xperf;
 	int bestprefer;
 	unsigned long j0, j1;
 
@@ -116,6 +154,21 @@ int __init raid6_select_algo(void)
 				(*algo)->gen_syndrome(disks, PAGE_SIZE, dptrs);
 				perf++;
 			}
+
+			/* Partial stripe update of the upper half of the disks */
+			xperf = 0;
+			if ( (*algo)->xor_syndrome ) {
+				j0 = jiffies;
+				while ( (j1 = jiffies) == j0 )
+					cpu_relax();
+				while (time_before(jiffies,
+						    j1 + (1<<RAID6_TIME_JIFFIES_LG2))) {
+					(*algo)->xor_syndrome(disks, (disks-2) >> 1,
+							      disks-3, PAGE_SIZE,
+							      dptrs);
+					xperf++;
+				}
+			}
 			preempt_enable();
 
 			if ( (*algo)->prefer > bestprefer ||
@@ -125,8 +178,14 @@ int __init raid6_select_algo(void)
 				bestprefer = best->prefer;
 				bestperf = perf;
 			}
-			printk("raid6: %-8s %5ld MB/s\n", (*algo)->name,
-			       (perf*HZ) >> (20-16+RAID6_TIME_JIFFIES_LG2));
+			if ( (*algo)->xor_syndrome )
+				printk("raid6: %-8s gen() %5ld MB/s, "
+				       "xor() %5ld MB/s\n", (*algo)->name,
+				       (perf*HZ) >> (20-16+RAID6_TIME_JIFFIES_LG2),
+				       (xperf*HZ) >> (20-16+RAID6_TIME_JIFFIES_LG2+1));
+			else
+				printk("raid6: %-8s %5ld MB/s\n", (*algo)->name,
+				       (perf*HZ) >> (20-16+RAID6_TIME_JIFFIES_LG2));
 		}
 	}
 
@@ -140,6 +199,8 @@ int __init raid6_select_algo(void)
 
 	free_pages((unsigned long)syndromes, 1);
 
+	raid6_select_recov();
+
 	return best ? 0 : -EINVAL;
 }
 
@@ -0,0 +1,189 @@
+/* -*- linux-c -*- ------------------------------------------------------- *
+ *
+ *   Copyright 2002 H. Peter Anvin - All Rights Reserved
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 53 Temple Place Ste 330,
+ *   Boston MA 02111-1307, USA; either version 2 of the License, or
+ *   (at your option) any later version; incorporated herein by reference.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * raid6recov_avx2.c
+ *
+ * RAID-6 dual failure recovery using AVX2.  A GF(2^8) multiplication
+ * by a constant is split into its low and high nibble halves, each of
+ * which is a 16 entry lookup.  vpshufb looks up within each 128 bit
+ * half, so the raid6_vgfmul tables are broadcast to both halves.  bytes
+ * must be a multiple of 32.
+ */
+
+#if (defined(__i386__) || defined(__x86_64__)) && !defined(__arch_um__) && \
+	defined(CONFIG_AS_AVX2)
+
+#include <linux/raid/pq.h>
+#include "raid6x86.h"
+
+static const u8 raid6_x0f[32] __aligned(32) = {
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+};
+
+static int raid6_has_avx2(void)
+{
+	return raid6_cpu_has_avx2();
+}
+
+/* Recover two failed data blocks. */
+static void raid6_2data_recov_avx2(int disks, size_t bytes, int faila,
+				   int failb, void **ptrs)
+{
+	u8 *p, *q, *dp, *dq;
+	const u8 *pbmul;	/* P multiplier table for B data */
+	const u8 *qmul;		/* Q multiplier table (for both) */
+
+	p = (u8 *)ptrs[disks-2];
+	q = (u8 *)ptrs[disks-1];
+
+	/* Compute syndrome with zero for the missing data pages
+	   Use the dead data pages as temporary storage for
+	   delta p and delta q */
+	dp = (u8 *)ptrs[faila];
+	ptrs[faila] = (void *)raid6_empty_zero_page;
+	ptrs[disks-2] = dp;
+	dq = (u8 *)ptrs[failb];
+	ptrs[failb] = (void *)raid6_empty_zero_page;
+	ptrs[disks-1] = dq;
+
+	raid6_call.gen_syndrome(disks, bytes, ptrs);
+
+	/* Restore pointer table */
+	ptrs[faila]   = dp;
+	ptrs[failb]   = dq;
+	ptrs[disks-2] = p;
+	ptrs[disks-1] = q;
+
+	/* Now, pick the proper data tables */
+	pbmul = raid6_vgfmul[raid6_gfexi[failb-faila]];
+	qmul  = raid6_vgfmul[raid6_gfinv[raid6_gfexp[faila]^raid6_gfexp[failb]]];
+
+	kernel_fpu_begin();
+
+	asm volatile("vmovdqa %0,%%ymm7" : : "m" (raid6_x0f[0]));
+	asm volatile("vbroadcasti128 %0,%%ymm6" : : "m" (qmul[0]));
+	asm volatile("vbroadcasti128 %0,%%ymm5" : : "m" (qmul[16]));
+
+	while (bytes) {
+		/* ymm1 = q ^ dq, ymm0 = px = p ^ dp */
+		asm volatile("vmovdqa %0,%%ymm1" : : "m" (q[0]));
+		asm volatile("vpxor %0,%%ymm1,%%ymm1" : : "m" (dq[0]));
+		asm volatile("vmovdqa %0,%%ymm0" : : "m" (p[0]));
+		asm volatile("vpxor %0,%%ymm0,%%ymm0" : : "m" (dp[0]));
+
+		/* ymm2 = qx = qmul[q ^ dq] */
+		asm volatile("vpsraw $4,%ymm1,%ymm3");
+		asm volatile("vpand %ymm7,%ymm1,%ymm1");
+		asm volatile("vpand %ymm7,%ymm3,%ymm3");
+		asm volatile("vpshufb %ymm1,%ymm6,%ymm2");
+		asm volatile("vpshufb %ymm3,%ymm5,%ymm3");
+		asm volatile("vpxor %ymm3,%ymm2,%ymm2");
+
+		/* ymm3 = pbmul[px] */
+		asm volatile("vpsraw $4,%ymm0,%ymm4");
+		asm volatile("vpand %ymm7,%ymm0,%ymm1");
+		asm volatile("vpand %ymm7,%ymm4,%ymm4");
+		asm volatile("vbroadcasti128 %0,%%ymm3" : : "m" (pbmul[0]));
+		asm volatile("vpshufb %ymm1,%ymm3,%ymm3");
+		asm volatile("vbroadcasti128 %0,%%ymm1" : : "m" (pbmul[16]));
+		asm volatile("vpshufb %ymm4,%ymm1,%ymm1");
+		asm volatile("vpxor %ymm1,%ymm3,%ymm3");
+
+		/* Reconstructed B = pbmul[px] ^ qx, A = B ^ px */
+		asm volatile("vpxor %ymm2,%ymm3,%ymm3");
+		asm volatile("vmovdqa %%ymm3,%0" : "=m" (dq[0]));
+		asm volatile("vpxor %ymm3,%ymm0,%ymm0");
+		asm volatile("vmovdqa %%ymm0,%0" : "=m" (dp[0]));
+
+		bytes -= 32;
+		p += 32;
+		q += 32;
+		dp += 32;
+		dq += 32;
+	}
+
+	asm volatile("vzeroupper");
+	kernel_fpu_end();
+}
+
+/* Recover failure of one data block plus the P block */
+static void raid6_datap_recov_avx2(int disks, size_t bytes, int faila,
+				   void **ptrs)
+{
+	u8 *p, *q, *dq;
+	const u8 *qmul;		/* Q multiplier table */
+
+	p = (u8 *)ptrs[disks-2];
+	q = (u8 *)ptrs[disks-1];
+
+	/* Compute syndrome with zero for the missing data page
+	   Use the dead data page as temporary storage for delta q */
+	dq = (u8 *)ptrs[faila];
+	ptrs[faila] = (void *)raid6_empty_zero_page;
+	ptrs[disks-1] = dq;
+
+	raid6_call.gen_syndrome(disks, bytes, ptrs);
+
+	/* Restore pointer table */
+	ptrs[faila]   = dq;
+	ptrs[disks-1] = q;
+
+	/* Now, pick the proper data tables */
+	qmul  = raid6_vgfmul[raid6_gfinv[raid6_gfexp[faila]]];
+
+	kernel_fpu_begin();
+
+	asm volatile("vmovdqa %0,%%ymm7" : : "m" (raid6_x0f[0]));
+	asm volatile("vbroadcasti128 %0,%%ymm6" : : "m" (qmul[0]));
+	asm volatile("vbroadcasti128 %0,%%ymm5" : : "m" (qmul[16]));
+
+	while (bytes) {
+		/* ymm1 = q ^ dq */
+		asm volatile("vmovdqa %0,%%ymm1" : : "m" (q[0]));
+		asm volatile("vpxor %0,%%ymm1,%%ymm1" : : "m" (dq[0]));
+
+		/* ymm2 = qmul[q ^ dq] */
+		asm volatile("vpsraw $4,%ymm1,%ymm3");
+		asm volatile("vpand %ymm7,%ymm1,%ymm1");
+		asm volatile("vpand %ymm7,%ymm3,%ymm3");
+		asm volatile("vpshufb %ymm1,%ymm6,%ymm2");
+		asm volatile("vpshufb %ymm3,%ymm5,%ymm3");
+		asm volatile("vpxor %ymm3,%ymm2,%ymm2");
+
+		/* dq = qmul[q ^ dq], p ^= dq */
+		asm volatile("vmovdqa %%ymm2,%0" : "=m" (dq[0]));
+		asm volatile("vpxor %0,%%ymm2,%%ymm2" : : "m" (p[0]));
+		asm volatile("vmovdqa %%ymm2,%0" : "=m" (p[0]));
+
+		bytes -= 32;
+		p += 32;
+		q += 32;
+		dq += 32;
+	}
+
+	asm volatile("vzeroupper");
+	kernel_fpu_end();
+}
+
+const struct raid6_recov_calls raid6_recov_avx2 = {
+	.data2 = raid6_2data_recov_avx2,
+	.datap = raid6_datap_recov_avx2,
+	.valid = raid6_has_avx2,
+	.name = "avx2",
+	.priority = 2,
+};
+
+#endif
@@ -11,28 +11,33 @@
 /*
  * raid6test.c
  *
- * Test RAID-6 recovery with various algorithms
+ * Test RAID-6 syndrome generation, partial stripe updates and recovery
+ * with all the algorithms, then measure how fast each of them is
  */
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <linux/raid/pq.h>
 
 #define NDISKS		16	/* Including P and Q */
+#define BENCH_NSEC	200000000LL	/* Time spent measuring each routine */
 
 const char raid6_empty_zero_page[PAGE_SIZE] __attribute__((aligned(256)));
-struct raid6_calls raid6_call;
 
 char *dataptrs[NDISKS];
-char data[NDISKS][PAGE_SIZE];
-char recovi[PAGE_SIZE], recovj[PAGE_SIZE];
+char data[NDISKS][PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+char recovi[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+char recovj[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+char refp[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+char refq[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
 
-static void makedata(void)
+static void makedata(int start, int stop)
 {
 	int i, j;
 
-	for (i = 0; i < NDISKS; i++) {
+	for (i = start; i <= stop; i++) {
 		for (j = 0; j < PAGE_SIZE; j++)
 			data[i][j] = rand();
 
@@ -52,6 +57,8 @@ static char disk_type(int d)
 	}
 }
 
+static const char *recov_name;
+
 static int test_disks(int i, int j)
 {
 	int erra, errb;
@@ -72,8 +79,8 @@ static int test_disks(int i, int j)
 		   equivalent to a RAID-5 failure (XOR, then recompute Q) */
 		erra = errb = 0;
 	} else {
-		printf("algo=%-8s  faila=%3d(%c)  failb=%3d(%c)  %s\n",
-		       raid6_call.name,
+		printf("algo=%-8s  recov=%-6s  faila=%3d(%c)  failb=%3d(%c)  %s\n",
+		       raid6_call.name, recov_name,
 		       i, disk_type(i),
 		       j, disk_type(j),
 		       (!erra && !errb) ? "OK" :
@@ -87,32 +94,150 @@ static int test_disks(int i, int j)
 	return erra || errb;
 }
 
+/*
+ * Take disks start..stop out of P and Q, replace their data and fold them
+ * back in, the way a read-modify-write of part of a stripe does.  The
+ * result must match a full syndrome of the new data.
+ */
+static int test_xor(int start, int stop)
+{
+	char *p = dataptrs[NDISKS-2], *q = dataptrs[NDISKS-1];
+	int err;
+
+	raid6_call.xor_syndrome(NDISKS, start, stop, PAGE_SIZE,
+				(void **)&dataptrs);
+	makedata(start, stop);
+	raid6_call.xor_syndrome(NDISKS, start, stop, PAGE_SIZE,
+				(void **)&dataptrs);
+
+	dataptrs[NDISKS-2] = refp;
+	dataptrs[NDISKS-1] = refq;
+	raid6_call.gen_syndrome(NDISKS, PAGE_SIZE, (void **)&dataptrs);
+	dataptrs[NDISKS-2] = p;
+	dataptrs[NDISKS-1] = q;
+
+	err = memcmp(p, refp, PAGE_SIZE) || memcmp(q, refq, PAGE_SIZE);
+	if (err)
+		printf("algo=%-8s  xor_syndrome start=%d stop=%d  ERR\n",
+		       raid6_call.name, start, stop);
+	return err;
+}
+
+static long long now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Run a routine for BENCH_NSEC, return GB/s of data disk bytes handled */
+#define BENCH(bytes_per_call, call)					\
+({									\
+	long long t0 = now_nsec(), t;					\
+	unsigned long n = 0;						\
+									\
+	do {								\
+		call;							\
+		n++;							\
+	} while ((t = now_nsec() - t0) < BENCH_NSEC);			\
+	(double)n * (bytes_per_call) / t;				\
+})
+
+static void bench_algo(void)
+{
+	double gen, xor;
+
+	gen = BENCH((NDISKS-2) * PAGE_SIZE,
+		    raid6_call.gen_syndrome(NDISKS, PAGE_SIZE,
+					    (void **)&dataptrs));
+	if (raid6_call.xor_syndrome) {
+		xor = BENCH((NDISKS-2)/2 * PAGE_SIZE,
+			    raid6_call.xor_syndrome(NDISKS, (NDISKS-2)/2,
+						    NDISKS-3, PAGE_SIZE,
+						    (void **)&dataptrs));
+		printf("bench algo=%-8s  gen %6.2f GB/s  xor %6.2f GB/s\n",
+		       raid6_call.name, gen, xor);
+	} else
+		printf("bench algo=%-8s  gen %6.2f GB/s\n",
+		       raid6_call.name, gen);
+}
+
+/* Recovery reads and writes pages in place, so it works on a copy */
+static void bench_recov(const struct raid6_recov_calls *recov)
+{
+	static char save[NDISKS][PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+	double d2, dp;
+
+	memcpy(save, data, sizeof(data));
+	d2 = BENCH(2 * PAGE_SIZE,
+		   recov->data2(NDISKS, PAGE_SIZE, 0, 1, (void **)&dataptrs));
+	dp = BENCH(PAGE_SIZE,
+		   recov->datap(NDISKS, PAGE_SIZE, 0, (void **)&dataptrs));
+	memcpy(data, save, sizeof(data));
+
+	printf("bench recov=%-6s  2data %6.2f GB/s  datap %6.2f GB/s\n",
+	       recov->name, d2, dp);
+}
+
 int main(int argc, char *argv[])
 {
 	const struct raid6_calls *const *algo;
-	int i, j;
+	const struct raid6_recov_calls *const *recov;
+	int i, j, p1, p2;
 	int err = 0;
 
-	makedata();
+	makedata(0, NDISKS-1);
 
 	for (algo = raid6_algos; *algo; algo++) {
-		if (!(*algo)->valid || (*algo)->valid()) {
-			raid6_call = **algo;
+		if ((*algo)->valid && !(*algo)->valid())
+			continue;
+
+		raid6_call = **algo;
+
+		/* Nuke syndromes */
+		memset(data[NDISKS-2], 0xee, 2*PAGE_SIZE);
+
+		/* Generate assumed good syndrome */
+		raid6_call.gen_syndrome(NDISKS, PAGE_SIZE,
+					(void **)&dataptrs);
 
-			/* Nuke syndromes */
-			memset(data[NDISKS-2], 0xee, 2*PAGE_SIZE);
+		for (recov = raid6_recov_algos; *recov; recov++) {
+			if ((*recov)->valid && !(*recov)->valid())
+				continue;
 
-			/* Generate assumed good syndrome */
-			raid6_call.gen_syndrome(NDISKS, PAGE_SIZE,
-						(void **)&dataptrs);
+			raid6_2data_recov = (*recov)->data2;
+			raid6_datap_recov = (*recov)->datap;
+			recov_name = (*recov)->name;
 
 			for (i = 0; i < NDISKS-1; i++)
 				for (j = i+1; j < NDISKS; j++)
 					err += test_disks(i, j);
 		}
+
+		if (raid6_call.xor_syndrome) {
+			for (p1 = 0; p1 < NDISKS-2; p1++)
+				for (p2 = p1; p2 < NDISKS-2; p2++)
+					err += test_xor(p1, p2);
+			printf("algo=%-8s  xor_syndrome  %s\n", raid6_call.name,
+			       err ? "ERRORS" : "OK");
+		}
 		printf("\n");
 	}
 
+	printf("\n");
+	for (algo = raid6_algos; *algo; algo++) {
+		if ((*algo)->valid && !(*algo)->valid())
+			continue;
+		raid6_call = **algo;
+		bench_algo();
+	}
+	for (recov = raid6_recov_algos; *recov; recov++) {
+		if ((*recov)->valid && !(*recov)->valid())
+			continue;
+		bench_recov(*recov);
+	}
+
 	printf("\n");
 	/* Pick the best algorithm test */
 	raid6_select_algo();
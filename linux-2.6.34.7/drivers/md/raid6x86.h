@@ -24,6 +24,25 @@
 #ifdef __KERNEL__ /* Real code */
 
 #include <asm/i387.h>
+#include <asm/processor.h>
+
+/*
+ * AVX2 is reported in cpuid leaf 7, which this kernel doesn't collect
+ * into the capability words, so ask the cpu directly.  The ymm state is
+ * only saved by kernel_fpu_begin() when xsave is in use.
+ */
+static inline int raid6_cpu_has_avx2(void)
+{
+	u32 eax, ebx, ecx, edx;
+
+	if (!boot_cpu_has(X86_FEATURE_AVX) ||
+	    !boot_cpu_has(X86_FEATURE_XSAVE) ||
+	    boot_cpu_data.cpuid_level < 7)
+		return 0;
+
+	cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+	return (ebx >> 5) & 1;
+}
 
 #else /* Dummy code for user space testing */
 
@@ -41,18 +60,40 @@ static inline void kernel_fpu_end(void)
 #define X86_FEATURE_XMM		(0*32+25) /* Streaming SIMD Extensions */
 #define X86_FEATURE_XMM2	(0*32+26) /* Streaming SIMD Extensions-2 */
 #define X86_FEATURE_MMXEXT	(1*32+22) /* AMD MMX extensions */
+#define X86_FEATURE_SSSE3	(4*32+ 9) /* Supplemental SSE-3 */
+#define X86_FEATURE_OSXSAVE	(4*32+27) /* XSAVE enabled by the OS */
+#define X86_FEATURE_AVX		(4*32+28) /* Advanced Vector Extensions */
 
 /* Should work well enough on modern CPUs for testing */
 static inline int boot_cpu_has(int flag)
 {
-	u32 eax = (flag >> 5) ? 0x80000001 : 1;
-	u32 edx;
+	u32 eax = (flag >> 5) == 1 ? 0x80000001 : 1;
+	u32 ecx, edx;
+
+	asm volatile("cpuid"
+		     : "+a" (eax), "=c" (ecx), "=d" (edx)
+		     : : "ebx");
+
+	return (((flag >> 5) == 4 ? ecx : edx) >> (flag & 31)) & 1;
+}
+
+static inline int raid6_cpu_has_avx2(void)
+{
+	u32 eax = 7, ebx, ecx = 0, edx, xcr0;
+
+	if (!boot_cpu_has(X86_FEATURE_AVX) ||
+	    !boot_cpu_has(X86_FEATURE_OSXSAVE))
+		return 0;
+
+	/* The OS must save the sse and ymm state */
+	asm volatile("xgetbv" : "=a" (xcr0), "=d" (edx) : "c" (0));
+	if ((xcr0 & 6) != 6)
+		return 0;
 
 	asm volatile("cpuid"
-		     : "+a" (eax), "=d" (edx)
-		     : : "ecx", "ebx");
+		     : "+a" (eax), "=b" (ebx), "+c" (ecx), "=d" (edx));
 
-	return (edx >> (flag & 31)) & 1;
+	return (ebx >> 5) & 1;
 }
 
 #endif /* ndef __KERNEL__ */
@@ -430,6 +430,54 @@ void exit_aio(struct mm_struct *mm)
 	}
 }
 
+/*
+ * aio_wake_function:
+ *	Wait queue callback for a kiocb whose retry method returned
+ *	-EIOCBRETRY after queueing ki_wait on a bit wait queue, such as
+ *	a page's.  Kicks the retry once the bit it waits on is clear.
+ *	Runs with the wait queue lock held, so kick_iocb() nests the
+ *	ioctx lock inside it.
+ */
+static int aio_wake_function(wait_queue_t *wait, unsigned mode,
+			     int sync, void *arg)
+{
+	struct wait_bit_queue *wait_bit =
+		container_of(wait, struct wait_bit_queue, wait);
+	struct kiocb *iocb = container_of(wait_bit, struct kiocb, ki_wait);
+	struct wait_bit_key *key = arg;
+
+	if (key && (wait_bit->key.flags != key->flags ||
+		    wait_bit->key.bit_nr != key->bit_nr ||
+		    test_bit(key->bit_nr, key->flags)))
+		return 0;
+
+	list_del_init(&wait->task_list);
+	kick_iocb(iocb);
+	return 1;
+}
+
+/*
+ * aio_dequeue_wait:
+ *	Takes ki_wait off the wait queue it was last queued on, if it has
+ *	not been woken yet.  Once this returns no wake up can kick the
+ *	kiocb any more, so it must be called before the kiocb completes.
+ *	Must not be called with the ioctx lock held: aio_wake_function()
+ *	nests that lock inside the wait queue lock.
+ */
+void aio_dequeue_wait(struct kiocb *iocb)
+{
+	wait_queue_head_t *q = iocb->ki_wait_head;
+	unsigned long flags;
+
+	if (!q)
+		return;
+	spin_lock_irqsave(&q->lock, flags);
+	list_del_init(&iocb->ki_wait.wait.task_list);
+	spin_unlock_irqrestore(&q->lock, flags);
+	iocb->ki_wait_head = NULL;
+}
+EXPORT_SYMBOL(aio_dequeue_wait);
+
 /* aio_get_req
  *	Allocate a slot for an aio request.  Increments the users count
  * of the kioctx so that the kioctx stays around until all requests are
@@ -460,6 +508,9 @@ static struct kiocb *__aio_get_req(struct kioctx *ctx)
 	req->private = NULL;
 	req->ki_iovec = NULL;
 	INIT_LIST_HEAD(&req->ki_run_list);
+	init_waitqueue_func_entry(&req->ki_wait.wait, aio_wake_function);
+	INIT_LIST_HEAD(&req->ki_wait.wait.task_list);
+	req->ki_wait_head = NULL;
 	req->ki_eventfd = NULL;
 
 	/* Check if the completion queue has enough free space to
@@ -554,6 +605,11 @@ static int __aio_put_req(struct kioctx *ctx, struct kiocb *req)
 	BUG_ON(req->ki_users < 0);
 	if (likely(req->ki_users))
 		return 0;
+	/*
+	 * aio_complete() dequeued ki_wait; the wait queue lock can't be
+	 * taken here under ctx_lock.
+	 */
+	WARN_ON(!list_empty(&req->ki_wait.wait.task_list));
 	list_del(&req->ki_list);		/* remove from active_reqs */
 	req->ki_cancel = NULL;
 	req->ki_retry = NULL;
@@ -926,6 +982,9 @@ int aio_complete(struct kiocb *iocb, long res, long res2)
 		return 1;
 	}
 
+	/* No page unlock may kick the kiocb once it has been freed. */
+	aio_dequeue_wait(iocb);
+
 	info = &ctx->ring_info;
 
 	/* add a completion event to the ring buffer.
@@ -1779,9 +1838,11 @@ SYSCALL_DEFINE3(io_cancel, aio_context_t, ctx_id, struct iocb __user *, iocb,
 		tmp.data = kiocb->ki_user_data;
 		ret = cancel(kiocb, &tmp);
 		if (!ret) {
-			/* Cancellation succeeded -- copy the result
-			 * into the user's buffer.
+			/* Cancellation succeeded -- nothing may kick the
+			 * kiocb now, and copy the result into the user's
+			 * buffer.
 			 */
+			aio_dequeue_wait(kiocb);
 			if (copy_to_user(result, &tmp, sizeof(tmp)))
 				ret = -EFAULT;
 		}
@@ -560,6 +560,17 @@ static int __bio_add_page(struct request_queue *q, struct bio *bio, struct page
 				}
 			}
 
+			/* the last segment grew, recount if it's now too big */
+			if (bio_flagged(bio, BIO_SEG_VALID)) {
+				bio->bi_seg_back_size += len;
+				if (bio->bi_phys_segments == 1)
+					bio->bi_seg_front_size =
+						bio->bi_seg_back_size;
+				if (bio->bi_seg_back_size >
+				    queue_max_segment_size(q))
+					bio->bi_flags &= ~(1 << BIO_SEG_VALID);
+			}
+
 			goto done;
 		}
 	}
@@ -615,12 +626,19 @@ static int __bio_add_page(struct request_queue *q, struct bio *bio, struct page
 		}
 	}
 
-	/* If we may be able to merge these biovecs, force a recount */
-	if (bio->bi_vcnt && (BIOVEC_PHYS_MERGEABLE(bvec-1, bvec)))
-		bio->bi_flags &= ~(1 << BIO_SEG_VALID);
-
 	bio->bi_vcnt++;
-	bio->bi_phys_segments++;
+
+	/*
+	 * Keep the segment count and the front and back segment sizes
+	 * exact as pages are added, so merging the bio into a request
+	 * never has to walk it.  A count that has already gone stale is
+	 * left for blk_recount_segments().
+	 */
+	if (bio->bi_vcnt == 1 || bio_flagged(bio, BIO_SEG_VALID)) {
+		blk_bio_append_segment(q, bio);
+		bio->bi_flags |= 1 << BIO_SEG_VALID;
+	} else
+		bio->bi_phys_segments++;
  done:
 	bio->bi_size += len;
 	return len;
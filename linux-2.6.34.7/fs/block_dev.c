@@ -26,6 +26,7 @@
 #include <linux/namei.h>
 #include <linux/log2.h>
 #include <linux/kmemleak.h>
+#include <linux/task_io_accounting_ops.h>
 #include <asm/uaccess.h>
 #include "internal.h"
 
@@ -165,6 +166,105 @@ blkdev_get_blocks(struct inode *inode, sector_t iblock,
 	return 0;
 }
 
+/*
+ * Small synchronous direct I/O, such as a single 4k read, is dominated
+ * by setting up a struct dio and mapping the blocks one at a time.  A
+ * block device maps every block to itself, so a request for a few
+ * aligned pages of a single iovec is instead sent as one bio built on
+ * the stack straight from the pinned user pages.
+ */
+#define DIO_INLINE_BIO_VECS	4
+
+static void blkdev_bio_end_io_simple(struct bio *bio, int error)
+{
+	struct task_struct *waiter = bio->bi_private;
+
+	bio->bi_private = NULL;
+	wake_up_process(waiter);
+}
+
+/*
+ * Returns -ENOTBLK if the request has to go through the generic path.
+ */
+static ssize_t
+__blkdev_direct_IO_simple(int rw, struct inode *inode, const struct iovec *iov,
+			  loff_t offset)
+{
+	struct block_device *bdev = I_BDEV(inode);
+	unsigned long addr = (unsigned long)iov->iov_base;
+	size_t len = iov->iov_len;
+	unsigned int align = bdev_logical_block_size(bdev) - 1;
+	struct page *pages[DIO_INLINE_BIO_VECS];
+	struct bio_vec vecs[DIO_INLINE_BIO_VECS];
+	unsigned int first, nr_pages, i;
+	struct bio bio;
+	ssize_t ret;
+	int pinned;
+
+	if (!len || ((offset | addr | len) & align))
+		return -ENOTBLK;
+	if (offset + len > i_size_read(inode))
+		return -ENOTBLK;
+	if (bdev_get_integrity(bdev))
+		return -ENOTBLK;
+
+	nr_pages = ((addr + len - 1) >> PAGE_SHIFT) - (addr >> PAGE_SHIFT) + 1;
+	if (nr_pages > DIO_INLINE_BIO_VECS)
+		return -ENOTBLK;
+
+	pinned = get_user_pages_fast(addr, nr_pages, rw == READ, pages);
+	if (pinned < 0)
+		return pinned;
+	if (pinned < nr_pages) {
+		ret = -ENOTBLK;
+		goto out_release;
+	}
+
+	bio_init(&bio);
+	bio.bi_io_vec = vecs;
+	bio.bi_max_vecs = DIO_INLINE_BIO_VECS;
+	bio.bi_bdev = bdev;
+	bio.bi_sector = offset >> 9;
+	bio.bi_private = current;
+	bio.bi_end_io = blkdev_bio_end_io_simple;
+
+	first = addr & ~PAGE_MASK;
+	for (i = 0; i < nr_pages; i++) {
+		unsigned int bytes = min_t(size_t, PAGE_SIZE - first, len);
+
+		if (bio_add_page(&bio, pages[i], bytes, first) != bytes) {
+			ret = -ENOTBLK;
+			goto out_release;
+		}
+		len -= bytes;
+		first = 0;
+	}
+
+	if (rw == WRITE)
+		task_io_account_write(iov->iov_len);
+
+	submit_bio(rw == WRITE ? WRITE_SYNC : READ_SYNC, &bio);
+
+	for (;;) {
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		if (!ACCESS_ONCE(bio.bi_private))
+			break;
+		io_schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+
+	ret = test_bit(BIO_UPTODATE, &bio.bi_flags) ? iov->iov_len : -EIO;
+
+	for (i = 0; i < nr_pages; i++)
+		if (rw == READ && !PageCompound(pages[i]))
+			set_page_dirty_lock(pages[i]);
+
+out_release:
+	for (i = 0; i < pinned; i++)
+		page_cache_release(pages[i]);
+	return ret;
+}
+
 static ssize_t
 blkdev_direct_IO(int rw, struct kiocb *iocb, const struct iovec *iov,
 			loff_t offset, unsigned long nr_segs)
@@ -172,6 +272,14 @@ blkdev_direct_IO(int rw, struct kiocb *iocb, const struct iovec *iov,
 	struct file *file = iocb->ki_filp;
 	struct inode *inode = file->f_mapping->host;
 
+	if (nr_segs == 1 && is_sync_kiocb(iocb)) {
+		ssize_t ret;
+
+		ret = __blkdev_direct_IO_simple(rw, inode, iov, offset);
+		if (ret != -ENOTBLK)
+			return ret;
+	}
+
 	return blockdev_direct_IO_no_locking(rw, iocb, inode, I_BDEV(inode),
 				iov, offset, nr_segs, blkdev_get_blocks, NULL);
 }
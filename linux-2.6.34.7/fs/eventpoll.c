@@ -33,6 +33,10 @@
 #include <linux/bitops.h>
 #include <linux/mutex.h>
 #include <linux/anon_inodes.h>
+#include <linux/fdtable.h>
+#include <linux/hrtimer.h>
+#include <linux/vmalloc.h>
+#include <net/busy_poll.h>
 #include <asm/uaccess.h>
 #include <asm/system.h>
 #include <asm/io.h>
@@ -45,14 +49,17 @@
  *
  * 1) epmutex (mutex)
  * 2) ep->mtx (mutex)
- * 3) ep->lock (spinlock)
+ * 3) the per-CPU ready list locks (spinlock)
  *
  * The acquire order is the one listed above, from 1 to 3.
- * We need a spinlock (ep->lock) because we manipulate objects
- * from inside the poll callback, that might be triggered from
- * a wake_up() that in turn might be called from IRQ context.
+ * We need spinlocks for the per-CPU ready lists because we queue
+ * items on them from inside the poll callback, that might be triggered
+ * from a wake_up() that in turn might be called from IRQ context.
  * So we can't sleep inside the poll callback and hence we need
- * a spinlock. During the event transfer loop (from kernel to
+ * a spinlock. The callback only takes the lock of the CPU it runs on,
+ * so wakeups hitting different CPUs don't contend. The lists are merged
+ * into ep->rdllist, which is protected by "ep->mtx", when events are
+ * collected. During the event transfer loop (from kernel to
  * user space) we could end up sleeping due a copy_to_user(), so
  * we need a lock that will allow us to sleep. This lock is a
  * mutex (ep->mtx). It is acquired during the event transfer loop,
@@ -64,7 +71,7 @@
  * if a file has been pushed inside an epoll set and it is then
  * close()d without a previous call toepoll_ctl(EPOLL_CTL_DEL).
  * It is possible to drop the "ep->mtx" and to use the global
- * mutex "epmutex" (together with "ep->lock") to have it working,
+ * mutex "epmutex" (together with the ready list locks) to have it working,
  * but having "ep->mtx" will make the interface more scalable.
  * Events that require holding "epmutex" are very rare, while for
  * normal operations the epoll private "ep->mtx" will guarantee
@@ -72,7 +79,16 @@
  */
 
 /* Epoll private bits inside the event mask */
-#define EP_PRIVATE_BITS (EPOLLONESHOT | EPOLLET)
+#define EP_PRIVATE_BITS (EPOLLONESHOT | EPOLLET | EPOLLEXCLUSIVE)
+
+#define EPOLLINOUT_BITS (POLLIN | POLLOUT)
+
+/* Events that can be asked for together with EPOLLEXCLUSIVE */
+#define EPOLLEXCLUSIVE_OK_BITS (EPOLLINOUT_BITS | POLLERR | POLLHUP | \
+				EPOLLET | EPOLLEXCLUSIVE)
+
+/* epitem->flags: the item is queued on a ready list */
+#define EPI_READY 0
 
 /* Maximum number of nesting allowed inside epoll sets */
 #define EP_MAX_NESTS 4
@@ -82,8 +98,6 @@
 
 #define EP_MAX_EVENTS (INT_MAX / sizeof(struct epoll_event))
 
-#define EP_UNACTIVE_PTR ((void *) -1L)
-
 #define EP_ITEM_COST (sizeof(struct epitem) + sizeof(struct eppoll_entry))
 
 struct epoll_filefd {
@@ -122,10 +136,10 @@ struct epitem {
 	struct list_head rdllink;
 
 	/*
-	 * Works together "struct eventpoll"->ovflist in keeping the
-	 * single linked chain of items.
+	 * EPI_READY is set while the item is on a ready list, or being
+	 * looked at by ep_scan_ready_list() after being taken off one.
 	 */
-	struct epitem *next;
+	unsigned long flags;
 
 	/* The file descriptor information this item refers to */
 	struct epoll_filefd ffd;
@@ -146,15 +160,20 @@ struct epitem {
 	struct epoll_event event;
 };
 
+/*
+ * Per-CPU list of items made ready by the poll callback.
+ */
+struct ep_rdl {
+	spinlock_t lock;
+	struct list_head list;
+};
+
 /*
  * This structure is stored inside the "private_data" member of the file
  * structure and rapresent the main data sructure for the eventpoll
  * interface.
  */
 struct eventpoll {
-	/* Protect the this structure access */
-	spinlock_t lock;
-
 	/*
 	 * This mutex is used to ensure that files are not removed
 	 * while epoll is using them. This is held during the event
@@ -169,21 +188,28 @@ struct eventpoll {
 	/* Wait queue used by file->poll() */
 	wait_queue_head_t poll_wait;
 
-	/* List of ready file descriptors */
+	/* List of ready file descriptors, protected by "mtx" */
 	struct list_head rdllist;
 
+	/* Items queued by the poll callback, merged into rdllist under "mtx" */
+	struct ep_rdl __percpu *pcpu_rdl;
+
 	/* RB tree root used to store monitored fd structs */
 	struct rb_root rbr;
 
 	/*
-	 * This is a single linked list that chains all the "struct epitem" that
-	 * happened while transfering ready events to userspace w/out
-	 * holding ->lock.
+	 * The user that created the eventpoll descriptor, whose watches
+	 * it counts, or NULL for a pollset's
 	 */
-	struct epitem *ovflist;
-
-	/* The user that created the eventpoll descriptor */
 	struct user_struct *user;
+
+	/* Items removed by eventpoll_release_file(), protected by "mtx" */
+	unsigned int nr_released;
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	/* NAPI context of the last socket to become ready, to busy poll */
+	unsigned int napi_id;
+#endif
 };
 
 /* Wait structure used by the poll hooks */
@@ -415,6 +441,106 @@ static void ep_poll_safewake(wait_queue_head_t *wq)
 	put_cpu();
 }
 
+/*
+ * Moves the items queued by the poll callback on the per-CPU ready lists
+ * to @head. Must be called with "mtx" held.
+ */
+static void ep_merge_ready(struct eventpoll *ep, struct list_head *head)
+{
+	int cpu;
+	unsigned long flags;
+	struct ep_rdl *rdl;
+
+	for_each_possible_cpu(cpu) {
+		rdl = per_cpu_ptr(ep->pcpu_rdl, cpu);
+		if (list_empty(&rdl->list))
+			continue;
+
+		spin_lock_irqsave(&rdl->lock, flags);
+		list_splice_tail_init(&rdl->list, head);
+		spin_unlock_irqrestore(&rdl->lock, flags);
+	}
+}
+
+/* Tells if there might be events to collect, without taking any lock */
+static int ep_events_available(struct eventpoll *ep)
+{
+	int cpu;
+
+	if (!list_empty(&ep->rdllist))
+		return 1;
+
+	for_each_possible_cpu(cpu)
+		if (!list_empty(&per_cpu_ptr(ep->pcpu_rdl, cpu)->list))
+			return 1;
+
+	return 0;
+}
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+static bool ep_busy_loop_end(void *p)
+{
+	return ep_events_available(p);
+}
+
+/*
+ * If net.core.busy_poll is set, poll the device that the last ready
+ * socket received from for a while, hoping to find an event there
+ * before having to go to sleep.
+ */
+static void ep_busy_loop(struct eventpoll *ep, int nonblock)
+{
+	unsigned int napi_id = ACCESS_ONCE(ep->napi_id);
+
+	if (napi_id && net_busy_loop_on())
+		napi_busy_loop(napi_id, nonblock ? 0 : sysctl_net_busy_poll,
+			       ep_busy_loop_end, ep);
+}
+
+static void ep_set_busy_poll_napi_id(struct epitem *epi)
+{
+	struct eventpoll *ep = epi->ep;
+	unsigned int napi_id = file_napi_id(epi->ffd.file);
+
+	if (napi_id && napi_id != ep->napi_id)
+		ep->napi_id = napi_id;
+}
+#else
+static inline void ep_busy_loop(struct eventpoll *ep, int nonblock)
+{
+}
+
+static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
+{
+}
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
+/*
+ * Wake up ( if active ) both the eventpoll wait list and the ->poll()
+ * wait list, after an item has been queued on a ready list. Returns
+ * non-zero if a task waiting in epoll_wait() has been woken up.
+ */
+static int ep_wake_waiters(struct eventpoll *ep)
+{
+	int woken = 0;
+
+	/*
+	 * Order the queueing of the item against the waitqueue_active()
+	 * checks. Pairs with the barrier in prepare_to_wait_exclusive(),
+	 * done by ep_poll() before it looks at the ready lists.
+	 */
+	smp_mb();
+
+	if (waitqueue_active(&ep->wq)) {
+		wake_up(&ep->wq);
+		woken = 1;
+	}
+	if (waitqueue_active(&ep->poll_wait))
+		ep_poll_safewake(&ep->poll_wait);
+
+	return woken;
+}
+
 /*
  * This function unregisters poll callbacks from the associated file
  * descriptor.  Must be called with "mtx" held (or "epmutex" if called from
@@ -450,9 +576,7 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 					   struct list_head *, void *),
 			      void *priv)
 {
-	int error, pwake = 0;
-	unsigned long flags;
-	struct epitem *epi, *nepi;
+	int error, wake;
 	LIST_HEAD(txlist);
 
 	/*
@@ -462,69 +586,30 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 	mutex_lock(&ep->mtx);
 
 	/*
-	 * Steal the ready list, and re-init the original one to the
-	 * empty list. Also, set ep->ovflist to NULL so that events
-	 * happening while looping w/out locks, are not lost. We cannot
-	 * have the poll callback to queue directly on ep->rdllist,
-	 * because we want the "sproc" callback to be able to do it
-	 * in a lockless way.
+	 * Steal the ready lists, the main one and the per-CPU ones. The
+	 * items keep their EPI_READY bit, so the poll callback won't queue
+	 * them again while the "sproc" callback walks "txlist" without
+	 * locks. "sproc" clears the bit before it calls f_op->poll() on an
+	 * item, so events happening after that are not lost either.
 	 */
-	spin_lock_irqsave(&ep->lock, flags);
 	list_splice_init(&ep->rdllist, &txlist);
-	ep->ovflist = NULL;
-	spin_unlock_irqrestore(&ep->lock, flags);
+	ep_merge_ready(ep, &txlist);
 
 	/*
 	 * Now call the callback function.
 	 */
 	error = (*sproc)(ep, &txlist, priv);
 
-	spin_lock_irqsave(&ep->lock, flags);
-	/*
-	 * During the time we spent inside the "sproc" callback, some
-	 * other events might have been queued by the poll callback.
-	 * We re-insert them inside the main ready-list here.
-	 */
-	for (nepi = ep->ovflist; (epi = nepi) != NULL;
-	     nepi = epi->next, epi->next = EP_UNACTIVE_PTR) {
-		/*
-		 * We need to check if the item is already in the list.
-		 * During the "sproc" callback execution time, items are
-		 * queued into ->ovflist but the "txlist" might already
-		 * contain them, and the list_splice() below takes care of them.
-		 */
-		if (!ep_is_linked(&epi->rdllink))
-			list_add_tail(&epi->rdllink, &ep->rdllist);
-	}
-	/*
-	 * We need to set back ep->ovflist to EP_UNACTIVE_PTR, so that after
-	 * releasing the lock, events will be queued in the normal way inside
-	 * ep->rdllist.
-	 */
-	ep->ovflist = EP_UNACTIVE_PTR;
-
 	/*
 	 * Quickly re-inject items left on "txlist".
 	 */
 	list_splice(&txlist, &ep->rdllist);
-
-	if (!list_empty(&ep->rdllist)) {
-		/*
-		 * Wake up (if active) both the eventpoll wait list and
-		 * the ->poll() wait list (delayed after we release the lock).
-		 */
-		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
-		if (waitqueue_active(&ep->poll_wait))
-			pwake++;
-	}
-	spin_unlock_irqrestore(&ep->lock, flags);
+	wake = !list_empty(&ep->rdllist);
 
 	mutex_unlock(&ep->mtx);
 
-	/* We have to call this outside the lock */
-	if (pwake)
-		ep_poll_safewake(&ep->poll_wait);
+	if (wake)
+		ep_wake_waiters(ep);
 
 	return error;
 }
@@ -535,16 +620,14 @@ static int ep_scan_ready_list(struct eventpoll *ep,
  */
 static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 {
-	unsigned long flags;
 	struct file *file = epi->ffd.file;
 
 	/*
 	 * Removes poll wait queue hooks. We _have_ to do this without holding
-	 * the "ep->lock" otherwise a deadlock might occur. This because of the
-	 * sequence of the lock acquisition. Here we do "ep->lock" then the wait
-	 * queue head lock when unregistering the wait queue. The wakeup callback
-	 * will run by holding the wait queue head lock and will call our callback
-	 * that will try to get "ep->lock".
+	 * a ready list lock otherwise a deadlock might occur. This because of
+	 * the sequence of the lock acquisition. The wakeup callback will run by
+	 * holding the wait queue head lock and will call our callback that will
+	 * try to get a ready list lock.
 	 */
 	ep_unregister_pollwait(ep, epi);
 
@@ -556,15 +639,20 @@ static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 
 	rb_erase(&epi->rbn, &ep->rbr);
 
-	spin_lock_irqsave(&ep->lock, flags);
-	if (ep_is_linked(&epi->rdllink))
+	/*
+	 * The poll callback can't run anymore, so the bit is stable. The
+	 * item might be on a per-CPU list, gather those first.
+	 */
+	if (test_bit(EPI_READY, &epi->flags)) {
+		ep_merge_ready(ep, &ep->rdllist);
 		list_del_init(&epi->rdllink);
-	spin_unlock_irqrestore(&ep->lock, flags);
+	}
 
 	/* At this point it is safe to free the eventpoll item */
 	kmem_cache_free(epi_cache, epi);
 
-	atomic_dec(&ep->user->epoll_watches);
+	if (ep->user)
+		atomic_dec(&ep->user->epoll_watches);
 
 	return 0;
 }
@@ -601,7 +689,7 @@ static void ep_free(struct eventpoll *ep)
 	 * Walks through the whole tree by freeing each "struct epitem". At this
 	 * point we are sure no poll callbacks will be lingering around, and also by
 	 * holding "epmutex" we can be sure that no file cleanup code will hit
-	 * us during this operation. So we can avoid the lock on "ep->lock".
+	 * us during this operation.
 	 */
 	while ((rbp = rb_first(&ep->rbr)) != NULL) {
 		epi = rb_entry(rbp, struct epitem, rbn);
@@ -610,6 +698,7 @@ static void ep_free(struct eventpoll *ep)
 
 	mutex_unlock(&epmutex);
 	mutex_destroy(&ep->mtx);
+	free_percpu(ep->pcpu_rdl);
 	free_uid(ep->user);
 	kfree(ep);
 }
@@ -630,17 +719,22 @@ static int ep_read_events_proc(struct eventpoll *ep, struct list_head *head,
 	struct epitem *epi, *tmp;
 
 	list_for_each_entry_safe(epi, tmp, head, rdllink) {
+		list_del_init(&epi->rdllink);
+		clear_bit(EPI_READY, &epi->flags);
+		smp_mb__after_clear_bit();
+
 		if (epi->ffd.file->f_op->poll(epi->ffd.file, NULL) &
-		    epi->event.events)
+		    epi->event.events) {
+			/* Unless the poll callback beat us to it */
+			if (!test_and_set_bit(EPI_READY, &epi->flags))
+				list_add(&epi->rdllink, head);
 			return POLLIN | POLLRDNORM;
-		else {
-			/*
-			 * Item has been dropped into the ready list by the poll
-			 * callback, but it's not actually ready, as far as
-			 * caller requested events goes. We can remove it here.
-			 */
-			list_del_init(&epi->rdllink);
 		}
+		/*
+		 * Item has been dropped into the ready list by the poll
+		 * callback, but it's not actually ready, as far as
+		 * caller requested events goes. We can leave it out here.
+		 */
 	}
 
 	return 0;
@@ -716,6 +810,7 @@ void eventpoll_release_file(struct file *file)
 		list_del_init(&epi->fllink);
 		mutex_lock(&ep->mtx);
 		ep_remove(ep, epi);
+		ep->nr_released++;
 		mutex_unlock(&ep->mtx);
 	}
 
@@ -724,9 +819,10 @@ void eventpoll_release_file(struct file *file)
 
 static int ep_alloc(struct eventpoll **pep)
 {
-	int error;
+	int error, cpu;
 	struct user_struct *user;
 	struct eventpoll *ep;
+	struct ep_rdl *rdl;
 
 	user = get_current_user();
 	error = -ENOMEM;
@@ -734,19 +830,29 @@ static int ep_alloc(struct eventpoll **pep)
 	if (unlikely(!ep))
 		goto free_uid;
 
-	spin_lock_init(&ep->lock);
+	ep->pcpu_rdl = alloc_percpu(struct ep_rdl);
+	if (unlikely(!ep->pcpu_rdl))
+		goto free_ep;
+
+	for_each_possible_cpu(cpu) {
+		rdl = per_cpu_ptr(ep->pcpu_rdl, cpu);
+		spin_lock_init(&rdl->lock);
+		INIT_LIST_HEAD(&rdl->list);
+	}
+
 	mutex_init(&ep->mtx);
 	init_waitqueue_head(&ep->wq);
 	init_waitqueue_head(&ep->poll_wait);
 	INIT_LIST_HEAD(&ep->rdllist);
 	ep->rbr = RB_ROOT;
-	ep->ovflist = EP_UNACTIVE_PTR;
 	ep->user = user;
 
 	*pep = ep;
 
 	return 0;
 
+free_ep:
+	kfree(ep);
 free_uid:
 	free_uid(user);
 	return error;
@@ -788,12 +894,11 @@ static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
  */
 static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *key)
 {
-	int pwake = 0;
+	int cpu, ewake = 0;
 	unsigned long flags;
 	struct epitem *epi = ep_item_from_wait(wait);
 	struct eventpoll *ep = epi->ep;
-
-	spin_lock_irqsave(&ep->lock, flags);
+	struct ep_rdl *rdl;
 
 	/*
 	 * If the event mask does not contain any poll(2) event, we consider the
@@ -802,7 +907,7 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * until the next EPOLL_CTL_MOD will be issued.
 	 */
 	if (!(epi->event.events & ~EP_PRIVATE_BITS))
-		goto out_unlock;
+		goto out;
 
 	/*
 	 * Check the events coming with the callback. At this stage, not
@@ -811,43 +916,52 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * test for "key" != NULL before the event match test.
 	 */
 	if (key && !((unsigned long) key & epi->event.events))
-		goto out_unlock;
+		goto out;
 
 	/*
-	 * If we are trasfering events to userspace, we can hold no locks
-	 * (because we're accessing user memory, and because of linux f_op->poll()
-	 * semantics). All the events that happens during that period of time are
-	 * chained in ep->ovflist and requeued later on.
+	 * If this file is already on a ready list, or being transferred to
+	 * userspace, we exit soon: whoever queued it has woken up the
+	 * waiters, and the f_op->poll() done on it by ep_scan_ready_list()
+	 * will see this event. Otherwise queue it on this CPU's list.
 	 */
-	if (unlikely(ep->ovflist != EP_UNACTIVE_PTR)) {
-		if (epi->next == EP_UNACTIVE_PTR) {
-			epi->next = ep->ovflist;
-			ep->ovflist = epi;
-		}
-		goto out_unlock;
-	}
+	if (test_and_set_bit(EPI_READY, &epi->flags))
+		goto out;
+
+	cpu = get_cpu();
+	rdl = per_cpu_ptr(ep->pcpu_rdl, cpu);
+	spin_lock_irqsave(&rdl->lock, flags);
+	list_add_tail(&epi->rdllink, &rdl->list);
+	spin_unlock_irqrestore(&rdl->lock, flags);
+	put_cpu();
 
-	/* If this file is already in the ready list we exit soon */
-	if (!ep_is_linked(&epi->rdllink))
-		list_add_tail(&epi->rdllink, &ep->rdllist);
+	ep_set_busy_poll_napi_id(epi);
 
 	/*
-	 * Wake up ( if active ) both the eventpoll wait list and the ->poll()
-	 * wait list.
+	 * In exclusive mode, only report the wakeup as done if a waiter got
+	 * an event it asked for. Otherwise the wakeup goes on to the next
+	 * epoll set waiting exclusively on the file.
 	 */
-	if (waitqueue_active(&ep->wq))
-		wake_up_locked(&ep->wq);
-	if (waitqueue_active(&ep->poll_wait))
-		pwake++;
-
-out_unlock:
-	spin_unlock_irqrestore(&ep->lock, flags);
+	if (ep_wake_waiters(ep) && (epi->event.events & EPOLLEXCLUSIVE)) {
+		switch ((unsigned long) key & EPOLLINOUT_BITS) {
+		case POLLIN:
+			if (epi->event.events & POLLIN)
+				ewake = 1;
+			break;
+		case POLLOUT:
+			if (epi->event.events & POLLOUT)
+				ewake = 1;
+			break;
+		case 0:
+			ewake = 1;
+			break;
+		}
+	}
 
-	/* We have to call this outside the lock */
-	if (pwake)
-		ep_poll_safewake(&ep->poll_wait);
+out:
+	if (!(epi->event.events & EPOLLEXCLUSIVE))
+		ewake = 1;
 
-	return 1;
+	return ewake;
 }
 
 /*
@@ -864,7 +978,10 @@ static void ep_ptable_queue_proc(struct file *file, wait_queue_head_t *whead,
 		init_waitqueue_func_entry(&pwq->wait, ep_poll_callback);
 		pwq->whead = whead;
 		pwq->base = epi;
-		add_wait_queue(whead, &pwq->wait);
+		if (epi->event.events & EPOLLEXCLUSIVE)
+			add_wait_queue_exclusive(whead, &pwq->wait);
+		else
+			add_wait_queue(whead, &pwq->wait);
 		list_add_tail(&pwq->llink, &epi->pwqlist);
 		epi->nwait++;
 	} else {
@@ -898,13 +1015,12 @@ static void ep_rbtree_insert(struct eventpoll *ep, struct epitem *epi)
 static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 		     struct file *tfile, int fd)
 {
-	int error, revents, pwake = 0;
-	unsigned long flags;
+	int error, revents;
 	struct epitem *epi;
 	struct ep_pqueue epq;
 
-	if (unlikely(atomic_read(&ep->user->epoll_watches) >=
-		     max_user_watches))
+	if (ep->user && unlikely(atomic_read(&ep->user->epoll_watches) >=
+				 max_user_watches))
 		return -ENOSPC;
 	if (!(epi = kmem_cache_alloc(epi_cache, GFP_KERNEL)))
 		return -ENOMEM;
@@ -917,7 +1033,7 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	ep_set_ffd(&epi->ffd, tfile, fd);
 	epi->event = *event;
 	epi->nwait = 0;
-	epi->next = EP_UNACTIVE_PTR;
+	epi->flags = 0;
 
 	/* Initialize the poll table using the queue callback */
 	epq.epi = epi;
@@ -951,29 +1067,24 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	 * protected by "mtx", and ep_insert() is called with "mtx" held.
 	 */
 	ep_rbtree_insert(ep, epi);
+	ep_set_busy_poll_napi_id(epi);
 
-	/* We have to drop the new item inside our item list to keep track of it */
-	spin_lock_irqsave(&ep->lock, flags);
+	if (ep->user)
+		atomic_inc(&ep->user->epoll_watches);
 
-	/* If the file is already "ready" we drop it inside the ready list */
-	if ((revents & event->events) && !ep_is_linked(&epi->rdllink)) {
+	/*
+	 * If the file is already "ready" we drop it inside the ready list,
+	 * unless the poll callback already did. We hold "mtx", which
+	 * protects ep->rdllist.
+	 */
+	if ((revents & event->events) &&
+	    !test_and_set_bit(EPI_READY, &epi->flags)) {
 		list_add_tail(&epi->rdllink, &ep->rdllist);
 
 		/* Notify waiting tasks that events are available */
-		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
-		if (waitqueue_active(&ep->poll_wait))
-			pwake++;
+		ep_wake_waiters(ep);
 	}
 
-	spin_unlock_irqrestore(&ep->lock, flags);
-
-	atomic_inc(&ep->user->epoll_watches);
-
-	/* We have to call this outside the lock */
-	if (pwake)
-		ep_poll_safewake(&ep->poll_wait);
-
 	return 0;
 
 error_unregister:
@@ -981,14 +1092,12 @@ error_unregister:
 
 	/*
 	 * We need to do this because an event could have been arrived on some
-	 * allocated wait queue. Note that we don't care about the ep->ovflist
-	 * list, since that is used/cleaned only inside a section bound by "mtx".
-	 * And ep_insert() is called with "mtx" held.
+	 * allocated wait queue, and queued the item on a per-CPU ready list.
 	 */
-	spin_lock_irqsave(&ep->lock, flags);
-	if (ep_is_linked(&epi->rdllink))
+	if (test_bit(EPI_READY, &epi->flags)) {
+		ep_merge_ready(ep, &ep->rdllist);
 		list_del_init(&epi->rdllink);
-	spin_unlock_irqrestore(&ep->lock, flags);
+	}
 
 	kmem_cache_free(epi_cache, epi);
 
@@ -1001,7 +1110,6 @@ error_unregister:
  */
 static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_event *event)
 {
-	int pwake = 0;
 	unsigned int revents;
 
 	/*
@@ -1019,26 +1127,16 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	revents = epi->ffd.file->f_op->poll(epi->ffd.file, NULL);
 
 	/*
-	 * If the item is "hot" and it is not registered inside the ready
+	 * If the item is "hot" and it is not registered inside a ready
 	 * list, push it inside.
 	 */
-	if (revents & event->events) {
-		spin_lock_irq(&ep->lock);
-		if (!ep_is_linked(&epi->rdllink)) {
-			list_add_tail(&epi->rdllink, &ep->rdllist);
-
-			/* Notify waiting tasks that events are available */
-			if (waitqueue_active(&ep->wq))
-				wake_up_locked(&ep->wq);
-			if (waitqueue_active(&ep->poll_wait))
-				pwake++;
-		}
-		spin_unlock_irq(&ep->lock);
-	}
+	if ((revents & event->events) &&
+	    !test_and_set_bit(EPI_READY, &epi->flags)) {
+		list_add_tail(&epi->rdllink, &ep->rdllist);
 
-	/* We have to call this outside the lock */
-	if (pwake)
-		ep_poll_safewake(&ep->poll_wait);
+		/* Notify waiting tasks that events are available */
+		ep_wake_waiters(ep);
+	}
 
 	return 0;
 }
@@ -1061,7 +1159,13 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 	     !list_empty(head) && eventcnt < esed->maxevents;) {
 		epi = list_first_entry(head, struct epitem, rdllink);
 
+		/*
+		 * From now on the poll callback queues the item again, so an
+		 * event that f_op->poll() below misses is not lost.
+		 */
 		list_del_init(&epi->rdllink);
+		clear_bit(EPI_READY, &epi->flags);
+		smp_mb__after_clear_bit();
 
 		revents = epi->ffd.file->f_op->poll(epi->ffd.file, NULL) &
 			epi->event.events;
@@ -1075,7 +1179,8 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 		if (revents) {
 			if (__put_user(revents, &uevent->events) ||
 			    __put_user(epi->event.data, &uevent->data)) {
-				list_add(&epi->rdllink, head);
+				if (!test_and_set_bit(EPI_READY, &epi->flags))
+					list_add(&epi->rdllink, head);
 				return eventcnt ? eventcnt : -EFAULT;
 			}
 			eventcnt++;
@@ -1092,9 +1197,12 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 				 * into ep->rdllist besides us. The epoll_ctl()
 				 * callers are locked out by
 				 * ep_scan_ready_list() holding "mtx" and the
-				 * poll callback will queue them in ep->ovflist.
+				 * poll callback only uses the per-CPU lists,
+				 * where it may have queued the item already.
 				 */
-				list_add_tail(&epi->rdllink, &ep->rdllist);
+				if (!test_and_set_bit(EPI_READY, &epi->flags))
+					list_add_tail(&epi->rdllink,
+						      &ep->rdllist);
 			}
 		}
 	}
@@ -1117,9 +1225,8 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		   int maxevents, long timeout)
 {
 	int res, eavail;
-	unsigned long flags;
 	long jtimeout;
-	wait_queue_t wait;
+	DEFINE_WAIT(wait);
 
 	/*
 	 * Calculate the timeout by checking for the "infinite" value (-1)
@@ -1130,45 +1237,38 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		MAX_SCHEDULE_TIMEOUT : (timeout * HZ + 999) / 1000;
 
 retry:
-	spin_lock_irqsave(&ep->lock, flags);
-
 	res = 0;
-	if (list_empty(&ep->rdllist)) {
+	if (!ep_events_available(ep))
+		ep_busy_loop(ep, !jtimeout);
+
+	if (!ep_events_available(ep)) {
 		/*
 		 * We don't have any available event to return to the caller.
 		 * We need to sleep here, and we will be wake up by
 		 * ep_poll_callback() when events will become available.
+		 * Waiters are exclusive, an event wakes up only one of them.
 		 */
-		init_waitqueue_entry(&wait, current);
-		wait.flags |= WQ_FLAG_EXCLUSIVE;
-		__add_wait_queue(&ep->wq, &wait);
-
 		for (;;) {
 			/*
 			 * We don't want to sleep if the ep_poll_callback() sends us
 			 * a wakeup in between. That's why we set the task state
 			 * to TASK_INTERRUPTIBLE before doing the checks.
 			 */
-			set_current_state(TASK_INTERRUPTIBLE);
-			if (!list_empty(&ep->rdllist) || !jtimeout)
+			prepare_to_wait_exclusive(&ep->wq, &wait,
+						  TASK_INTERRUPTIBLE);
+			if (ep_events_available(ep) || !jtimeout)
 				break;
 			if (signal_pending(current)) {
 				res = -EINTR;
 				break;
 			}
 
-			spin_unlock_irqrestore(&ep->lock, flags);
 			jtimeout = schedule_timeout(jtimeout);
-			spin_lock_irqsave(&ep->lock, flags);
 		}
-		__remove_wait_queue(&ep->wq, &wait);
-
-		set_current_state(TASK_RUNNING);
+		finish_wait(&ep->wq, &wait);
 	}
 	/* Is it worth to try to dig for events ? */
-	eavail = !list_empty(&ep->rdllist) || ep->ovflist != EP_UNACTIVE_PTR;
-
-	spin_unlock_irqrestore(&ep->lock, flags);
+	eavail = ep_events_available(ep);
 
 	/*
 	 * Try to transfer events to user space. In case we get 0 events and
@@ -1182,6 +1282,326 @@ retry:
 	return res;
 }
 
+/*
+ * A pollset mirrors a pollfd array in a private eventpoll, with one level
+ * triggered item per entry whose "data" is the entry's index. The items
+ * stay hooked to the files' wait queues between pollset_poll() calls, so
+ * only entries that changed, and files that have events, cost anything.
+ */
+struct pollset_slot {
+	/* File the item was added for, NULL if there's no item */
+	struct file *file;
+	int fd;
+	short events;
+};
+
+struct pollset {
+	struct eventpoll *ep;
+
+	/* ep->nr_released when the slots were last checked against "ep" */
+	unsigned int nr_released;
+
+	unsigned int nslots;
+	struct pollset_slot *slots;
+};
+
+/* Used by pollset_poll() as ep_scan_ready_list() private data */
+struct pollset_events_data {
+	struct pollfd *fds;
+	int count;
+};
+
+static void *pollset_alloc_slots(unsigned int nslots)
+{
+	size_t size = nslots * sizeof(struct pollset_slot);
+
+	if (size <= PAGE_SIZE)
+		return kmalloc(size, GFP_KERNEL);
+	return vmalloc(size);
+}
+
+static void pollset_free_slots(struct pollset_slot *slots)
+{
+	if (is_vmalloc_addr(slots))
+		vfree(slots);
+	else
+		kfree(slots);
+}
+
+struct pollset *pollset_alloc(void)
+{
+	struct pollset *ps;
+	int error;
+
+	ps = kzalloc(sizeof(*ps), GFP_KERNEL);
+	if (!ps)
+		return ERR_PTR(-ENOMEM);
+
+	error = ep_alloc(&ps->ep);
+	if (error < 0) {
+		kfree(ps);
+		return ERR_PTR(error);
+	}
+
+	/*
+	 * The items mirror a poll(2) call's array, already limited by
+	 * RLIMIT_NOFILE, so they don't count against max_user_watches.
+	 */
+	free_uid(ps->ep->user);
+	ps->ep->user = NULL;
+
+	return ps;
+}
+
+void pollset_free(struct pollset *ps)
+{
+	ep_free(ps->ep);
+	if (ps->slots)
+		pollset_free_slots(ps->slots);
+	kfree(ps);
+}
+
+/*
+ * Forget about the files behind slots whose item has been removed by
+ * eventpoll_release_file(). Must be called with "mtx" held.
+ */
+static void pollset_check_released(struct pollset *ps)
+{
+	struct eventpoll *ep = ps->ep;
+	struct pollset_slot *slot;
+	struct epitem *epi;
+	unsigned int i;
+
+	if (ps->nr_released == ep->nr_released)
+		return;
+
+	for (i = 0, slot = ps->slots; i < ps->nslots; i++, slot++) {
+		if (!slot->file)
+			continue;
+		epi = ep_find(ep, slot->file, slot->fd);
+		if (!epi || epi->event.data != i)
+			slot->file = NULL;
+	}
+	ps->nr_released = ep->nr_released;
+}
+
+/* Must be called with "mtx" held */
+static void pollset_clear_slot(struct pollset *ps, struct pollset_slot *slot)
+{
+	struct epitem *epi;
+
+	if (slot->file) {
+		epi = ep_find(ps->ep, slot->file, slot->fd);
+		if (epi)
+			ep_remove(ps->ep, epi);
+		slot->file = NULL;
+	}
+}
+
+static int pollset_resize(struct pollset *ps, unsigned int nslots)
+{
+	struct pollset_slot *slots;
+	unsigned int i;
+
+	if (nslots == ps->nslots)
+		return 0;
+
+	slots = pollset_alloc_slots(nslots);
+	if (!slots)
+		return -ENOMEM;
+
+	mutex_lock(&ps->ep->mtx);
+	pollset_check_released(ps);
+	for (i = nslots; i < ps->nslots; i++)
+		pollset_clear_slot(ps, ps->slots + i);
+	mutex_unlock(&ps->ep->mtx);
+
+	for (i = 0; i < nslots; i++) {
+		if (i < ps->nslots) {
+			slots[i] = ps->slots[i];
+		} else {
+			slots[i].file = NULL;
+			slots[i].fd = -1;
+			slots[i].events = 0;
+		}
+	}
+
+	if (ps->slots)
+		pollset_free_slots(ps->slots);
+	ps->slots = slots;
+	ps->nslots = nslots;
+
+	return 0;
+}
+
+/*
+ * Bring the items in line with "fds". Returns the number of entries
+ * with a closed descriptor, which poll(2) reports as POLLNVAL, or an
+ * error if the set cannot mirror "fds".
+ */
+static int pollset_update(struct pollset *ps, struct pollfd *fds)
+{
+	struct eventpoll *ep = ps->ep;
+	struct pollset_slot *slot;
+	struct epoll_event event;
+	struct file *file;
+	unsigned int i;
+	int error, count = 0;
+
+	/*
+	 * Drop the items of entries whose descriptor, file or events have
+	 * changed. A file with an item cannot go away while we hold "mtx",
+	 * so comparing it with what the descriptor refers to is safe.
+	 */
+	mutex_lock(&ep->mtx);
+	pollset_check_released(ps);
+	rcu_read_lock();
+	for (i = 0, slot = ps->slots; i < ps->nslots; i++, slot++) {
+		fds[i].revents = 0;
+		file = fds[i].fd >= 0 ? fcheck(fds[i].fd) : NULL;
+
+		if (slot->fd != fds[i].fd || slot->file != file ||
+		    slot->events != fds[i].events) {
+			pollset_clear_slot(ps, slot);
+			slot->fd = fds[i].fd;
+			slot->events = fds[i].events;
+		} else if (fds[i].fd >= 0 && !file) {
+			fds[i].revents = POLLNVAL;
+			count++;
+		}
+	}
+	rcu_read_unlock();
+	mutex_unlock(&ep->mtx);
+
+	/*
+	 * Now add items for the entries that need one. ep_insert() wants
+	 * the file pinned, and the final fput() would need "mtx" for
+	 * eventpoll_release_file(), so it is done outside of it.
+	 */
+	for (i = 0, slot = ps->slots; i < ps->nslots; i++, slot++) {
+		if (fds[i].fd < 0 || slot->file || fds[i].revents)
+			continue;
+
+		file = fget(fds[i].fd);
+		if (!file) {
+			fds[i].revents = POLLNVAL;
+			count++;
+			continue;
+		}
+
+		error = -EINVAL;
+		if (file->f_op && file->f_op->poll) {
+			event.events = (u16) fds[i].events | POLLERR | POLLHUP;
+			event.data = i;
+
+			mutex_lock(&ep->mtx);
+			error = ep_insert(ep, &event, file, fds[i].fd);
+			if (!error)
+				slot->file = file;
+			mutex_unlock(&ep->mtx);
+		}
+		fput(file);
+
+		/* Duplicate descriptors end up here too, with -EEXIST */
+		if (error)
+			return error;
+	}
+
+	return count;
+}
+
+static int pollset_events_proc(struct eventpoll *ep, struct list_head *head,
+			       void *priv)
+{
+	struct pollset_events_data *ped = priv;
+	struct epitem *epi, *tmp;
+	unsigned int revents;
+
+	list_for_each_entry_safe(epi, tmp, head, rdllink) {
+		list_del_init(&epi->rdllink);
+		clear_bit(EPI_READY, &epi->flags);
+		smp_mb__after_clear_bit();
+
+		revents = epi->ffd.file->f_op->poll(epi->ffd.file, NULL) &
+			epi->event.events;
+		if (revents) {
+			ped->fds[epi->event.data].revents = revents;
+			ped->count++;
+
+			/* Level triggered, see ep_send_events_proc() */
+			if (!test_and_set_bit(EPI_READY, &epi->flags))
+				list_add_tail(&epi->rdllink, &ep->rdllist);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * pollset_poll - poll(2) on a persistent interest set
+ * @ps: the set, which is updated to mirror @fds
+ * @fds: the entries, whose revents are filled in
+ * @nfds: number of entries
+ * @expires: absolute timeout, or NULL to wait forever
+ * @slack: timer slack, as for poll_schedule_timeout()
+ * @timed_out: don't wait at all
+ *
+ * Returns the number of entries with events, -EINTR if a signal arrived
+ * first, or another negative error if @ps cannot mirror @fds. In that
+ * case nothing has been waited for and the caller should use the
+ * ordinary poll(2) implementation.
+ */
+int pollset_poll(struct pollset *ps, struct pollfd *fds, unsigned int nfds,
+		 ktime_t *expires, unsigned long slack, int timed_out)
+{
+	struct eventpoll *ep = ps->ep;
+	struct pollset_events_data ped;
+	int nvalid, res;
+	DEFINE_WAIT(wait);
+
+	res = pollset_resize(ps, nfds);
+	if (res)
+		return res;
+
+	nvalid = pollset_update(ps, fds);
+	if (nvalid < 0)
+		return nvalid;
+	if (nvalid)
+		timed_out = 1;
+
+	ped.fds = fds;
+	for (;;) {
+		res = 0;
+		if (!ep_events_available(ep))
+			ep_busy_loop(ep, timed_out);
+
+		if (!ep_events_available(ep)) {
+			for (;;) {
+				prepare_to_wait_exclusive(&ep->wq, &wait,
+							  TASK_INTERRUPTIBLE);
+				if (ep_events_available(ep) || timed_out)
+					break;
+				if (signal_pending(current)) {
+					res = -EINTR;
+					break;
+				}
+				if (!schedule_hrtimeout_range(expires, slack,
+							      HRTIMER_MODE_ABS))
+					timed_out = 1;
+			}
+			finish_wait(&ep->wq, &wait);
+		}
+		if (res)
+			return res;
+
+		ped.count = 0;
+		if (ep_events_available(ep))
+			ep_scan_ready_list(ep, pollset_events_proc, &ped);
+		if (ped.count || timed_out)
+			return ped.count + nvalid;
+	}
+}
+
 /*
  * Open an eventpoll file descriptor.
  */
@@ -1265,6 +1685,19 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 	if (file == tfile || !is_file_epoll(file))
 		goto error_tgt_fput;
 
+	/*
+	 * EPOLLEXCLUSIVE only makes sense for wakeups coming from the target
+	 * file, so it can't be changed later, can't be used on epoll files
+	 * and only goes with the basic events.
+	 */
+	if (ep_op_has_event(op) && (epds.events & EPOLLEXCLUSIVE)) {
+		if (op == EPOLL_CTL_MOD)
+			goto error_tgt_fput;
+		if (is_file_epoll(tfile) ||
+		    (epds.events & ~EPOLLEXCLUSIVE_OK_BITS))
+			goto error_tgt_fput;
+	}
+
 	/*
 	 * At this point it is safe to assume that the "private_data" contains
 	 * our own data structure.
@@ -1297,8 +1730,10 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 		break;
 	case EPOLL_CTL_MOD:
 		if (epi) {
-			epds.events |= POLLERR | POLLHUP;
-			error = ep_modify(ep, epi, &epds);
+			if (!(epi->event.events & EPOLLEXCLUSIVE)) {
+				epds.events |= POLLERR | POLLHUP;
+				error = ep_modify(ep, epi, &epds);
+			}
 		} else
 			error = -ENOENT;
 		break;
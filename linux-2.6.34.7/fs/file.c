@@ -246,20 +246,14 @@ static int expand_fdtable(struct files_struct *files, int nr)
  * Return <0 error code on error; 0 when nothing done; 1 when files were
  * expanded and execution may have blocked.
  * The files->file_lock should be held on entry, and will be held on exit.
+ * The caller has checked nr against whichever RLIMIT_NOFILE applies.
  */
-int expand_files(struct files_struct *files, int nr)
+static int __expand_files(struct files_struct *files, int nr)
 {
 	struct fdtable *fdt;
 
 	fdt = files_fdtable(files);
 
-	/*
-	 * N.B. For clone tasks sharing a files structure, this test
-	 * will limit the total number of files that can be opened.
-	 */
-	if (nr >= rlimit(RLIMIT_NOFILE))
-		return -EMFILE;
-
 	/* Do we need to expand? */
 	if (nr < fdt->max_fds)
 		return 0;
@@ -272,6 +266,21 @@ int expand_files(struct files_struct *files, int nr)
 	return expand_fdtable(files, nr);
 }
 
+/*
+ * As __expand_files(), limited by the caller's RLIMIT_NOFILE.
+ */
+int expand_files(struct files_struct *files, int nr)
+{
+	/*
+	 * N.B. For clone tasks sharing a files structure, this test
+	 * will limit the total number of files that can be opened.
+	 */
+	if (nr >= rlimit(RLIMIT_NOFILE))
+		return -EMFILE;
+
+	return __expand_files(files, nr);
+}
+
 static int count_open_files(struct fdtable *fdt)
 {
 	int size = fdt->max_fds;
@@ -438,9 +447,9 @@ struct files_struct init_files = {
 /*
  * allocate a file descriptor, mark it busy.
  */
-int alloc_fd(unsigned start, unsigned flags)
+int __alloc_fd(struct files_struct *files, unsigned start, unsigned long end,
+	       unsigned flags)
 {
-	struct files_struct *files = current->files;
 	unsigned int fd;
 	int error;
 	struct fdtable *fdt;
@@ -456,7 +465,11 @@ repeat:
 		fd = find_next_zero_bit(fdt->open_fds->fds_bits,
 					   fdt->max_fds, fd);
 
-	error = expand_files(files, fd);
+	error = -EMFILE;
+	if (fd >= end)
+		goto out;
+
+	error = __expand_files(files, fd);
 	if (error < 0)
 		goto out;
 
@@ -489,6 +502,11 @@ out:
 	return error;
 }
 
+int alloc_fd(unsigned start, unsigned flags)
+{
+	return __alloc_fd(current->files, start, rlimit(RLIMIT_NOFILE), flags);
+}
+
 int get_unused_fd(void)
 {
 	return alloc_fd(0, 0);
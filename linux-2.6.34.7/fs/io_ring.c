@@ -0,0 +1,1298 @@
+/*
+ *	Ring based asynchronous I/O.
+ *
+ *	Submission and completion queues live in memory shared with the
+ *	process, so a batch of requests costs at most one system call and
+ *	no copying of control blocks.  With IORING_SETUP_SQPOLL a kernel
+ *	thread picks up new submissions and no system call is needed at
+ *	all while it is busy.
+ *
+ *	Requests are run in the submitting context when they shouldn't
+ *	sleep for long: reads that hit the page cache, and reads, writes
+ *	and accepts on files whose poll method says they are ready.
+ *	Otherwise requests on pollable files are parked on the file's wait
+ *	queue until it is ready, and everything else (reads that miss the
+ *	page cache, writes and fsyncs to regular files) is handed to one of
+ *	the ring's worker threads.
+ *
+ *	See ../COPYING for licensing terms.
+ */
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/errno.h>
+#include <linux/syscalls.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/fdtable.h>
+#include <linux/mm.h>
+#include <linux/mmu_context.h>
+#include <linux/mmu_notifier.h>
+#include <linux/pagemap.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/poll.h>
+#include <linux/net.h>
+#include <linux/kthread.h>
+#include <linux/workqueue.h>
+#include <linux/anon_inodes.h>
+#include <linux/cred.h>
+#include <linux/log2.h>
+#include <linux/io_ring.h>
+
+#include <asm/uaccess.h>
+
+#define IORING_MAX_ENTRIES	4096
+#define IORING_MAX_WORKERS	16
+
+/*
+ * The largest read that is checked against the page cache to decide
+ * whether it can be run without a worker.
+ */
+#define IORING_INLINE_PAGES	16
+
+/*
+ * How long the submission thread keeps polling after the last
+ * submission if the caller doesn't say.
+ */
+#define IORING_SQ_IDLE_DEFAULT	(HZ)
+
+struct io_uring {
+	u32 head ____cacheline_aligned_in_smp;
+	u32 tail ____cacheline_aligned_in_smp;
+};
+
+/*
+ * Both rings are written by one side and read by the other: the
+ * submission tail and the completion head belong to user space, the
+ * rest to the kernel.  Entries are published with a write barrier
+ * before the tail moves and only reused once the head has passed them.
+ */
+struct io_sq_ring {
+	struct io_uring		r;
+	u32			ring_mask;
+	u32			ring_entries;
+	u32			dropped;
+	u32			flags;
+	u32			array[0];
+};
+
+struct io_cq_ring {
+	struct io_uring		r;
+	u32			ring_mask;
+	u32			ring_entries;
+	u32			overflow;
+	struct io_ring_cqe	cqes[0];
+};
+
+struct io_ring_ctx {
+	/* submission, serialised by uring_lock */
+	struct mutex		uring_lock;
+	struct io_sq_ring	*sq_ring;
+	struct io_ring_sqe	*sq_sqes;
+	unsigned		sq_entries;
+	unsigned		sq_mask;
+	unsigned		cached_sq_head;
+
+	/* completion, protected by completion_lock */
+	spinlock_t		completion_lock;
+	struct io_cq_ring	*cq_ring;
+	unsigned		cq_entries;
+	unsigned		cq_mask;
+	unsigned		cached_cq_tail;
+	unsigned		inflight;
+	wait_queue_head_t	cq_wait;
+
+	/* whose descriptors, memory and credentials requests use */
+	struct task_struct	*owner;
+	struct mm_struct	*mm;
+	const struct cred	*creds;
+	struct files_struct	*files;
+	unsigned long		nofile;		/* RLIMIT_NOFILE for files */
+	struct mmu_notifier	mmu_notifier;
+	struct work_struct	files_work;
+
+	/* requests waiting for a worker */
+	spinlock_t		work_lock;
+	struct list_head	work_list;
+	wait_queue_head_t	work_wait;
+	unsigned		idle_workers;
+	unsigned		nr_workers;
+	struct task_struct	*workers[IORING_MAX_WORKERS];
+
+	/* requests parked on a file's wait queue */
+	spinlock_t		poll_lock;
+	struct list_head	poll_list;
+
+	/* set under both work_lock and poll_lock */
+	int			dying;
+
+	struct task_struct	*sqo_thread;
+	wait_queue_head_t	sqo_wait;
+	unsigned long		sq_thread_idle;
+
+	struct work_struct	exit_work;
+};
+
+struct io_kiocb {
+	struct list_head	list;		/* on work_list */
+	struct io_ring_ctx	*ctx;
+	struct file		*file;
+	struct io_ring_sqe	sqe;
+
+	/* waiting for the file to become ready */
+	struct list_head	poll_entry;	/* on poll_list */
+	poll_table		pt;
+	wait_queue_head_t	*head;
+	wait_queue_t		wait;
+	unsigned		events;
+	int			error;
+	int			arming;		/* under head->lock */
+};
+
+static struct kmem_cache *io_req_cachep;
+static struct workqueue_struct *io_ring_exit_wq;
+static const struct file_operations io_ring_fops;
+
+static void io_issue(struct io_kiocb *req, int async);
+
+/*-----------------------------------------------------------------
+ * Completion
+ *---------------------------------------------------------------*/
+static unsigned io_cqring_events(struct io_ring_ctx *ctx)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+
+	return ACCESS_ONCE(ring->r.tail) - ACCESS_ONCE(ring->r.head);
+}
+
+/*
+ * A request may only be started once there is room for its completion,
+ * counting both the completions user space hasn't reaped yet and the
+ * requests still in flight, so the completion ring never overflows.
+ */
+static int io_get_cq_slot(struct io_ring_ctx *ctx)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+	int r = 0;
+
+	spin_lock_irq(&ctx->completion_lock);
+	if (ctx->inflight + ctx->cached_cq_tail - ACCESS_ONCE(ring->r.head) <
+	    ctx->cq_entries) {
+		ctx->inflight++;
+		r = 1;
+	}
+	spin_unlock_irq(&ctx->completion_lock);
+
+	return r;
+}
+
+static void io_put_cq_slot(struct io_ring_ctx *ctx)
+{
+	spin_lock_irq(&ctx->completion_lock);
+	ctx->inflight--;
+	spin_unlock_irq(&ctx->completion_lock);
+}
+
+static void io_cqring_fill_event(struct io_ring_ctx *ctx, u64 user_data,
+				 long res)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+	struct io_ring_cqe *cqe;
+	unsigned tail = ctx->cached_cq_tail;
+
+	/*
+	 * Only a misbehaving process that moves the head backwards can
+	 * get here with the ring full.
+	 */
+	if (tail - ACCESS_ONCE(ring->r.head) >= ctx->cq_entries) {
+		ring->overflow++;
+		return;
+	}
+
+	/* Don't overwrite an entry before user space is done with it. */
+	smp_mb();
+
+	cqe = &ring->cqes[tail & ctx->cq_mask];
+	cqe->user_data = user_data;
+	cqe->res = res;
+	cqe->flags = 0;
+
+	ctx->cached_cq_tail = tail + 1;
+	smp_wmb();
+	ring->r.tail = ctx->cached_cq_tail;
+}
+
+static void io_complete(struct io_kiocb *req, long res)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->completion_lock, flags);
+	io_cqring_fill_event(ctx, req->sqe.user_data, res);
+	ctx->inflight--;
+	spin_unlock_irqrestore(&ctx->completion_lock, flags);
+
+	/* the CQ tail must be visible before we look for waiters */
+	smp_mb();
+	if (waitqueue_active(&ctx->cq_wait))
+		wake_up(&ctx->cq_wait);
+
+	if (req->file)
+		fput(req->file);
+	kmem_cache_free(io_req_cachep, req);
+}
+
+/*-----------------------------------------------------------------
+ * Workers
+ *---------------------------------------------------------------*/
+static void io_queue_async(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->work_lock, flags);
+	list_add_tail(&req->list, &ctx->work_list);
+	spin_unlock_irqrestore(&ctx->work_lock, flags);
+
+	wake_up(&ctx->work_wait);
+}
+
+static struct io_kiocb *io_get_work(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req = NULL;
+	DEFINE_WAIT(wait);
+
+	spin_lock_irq(&ctx->work_lock);
+	for (;;) {
+		if (!ctx->dying && !list_empty(&ctx->work_list)) {
+			req = list_first_entry(&ctx->work_list,
+					       struct io_kiocb, list);
+			list_del_init(&req->list);
+			break;
+		}
+
+		if (kthread_should_stop())
+			break;
+
+		prepare_to_wait_exclusive(&ctx->work_wait, &wait,
+					  TASK_INTERRUPTIBLE);
+		ctx->idle_workers++;
+		spin_unlock_irq(&ctx->work_lock);
+
+		/* A kill meant for the last request mustn't keep us awake. */
+		flush_signals(current);
+		schedule();
+
+		spin_lock_irq(&ctx->work_lock);
+		ctx->idle_workers--;
+		finish_wait(&ctx->work_wait, &wait);
+	}
+	spin_unlock_irq(&ctx->work_lock);
+
+	return req;
+}
+
+static void io_poll_unlist(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+
+	spin_lock_irq(&ctx->poll_lock);
+	list_del_init(&req->poll_entry);
+	spin_unlock_irq(&ctx->poll_lock);
+}
+
+static void io_run_async(struct io_kiocb *req)
+{
+	struct mm_struct *mm = req->ctx->mm;
+	mm_segment_t old_fs;
+
+	io_poll_unlist(req);
+
+	/* The process has gone and taken its buffers with it. */
+	if (!atomic_inc_not_zero(&mm->mm_users)) {
+		io_complete(req, -EFAULT);
+		return;
+	}
+
+	/* Buffer addresses come from user space, check them as such. */
+	use_mm(mm);
+	old_fs = get_fs();
+	set_fs(USER_DS);
+	io_issue(req, 1);
+	set_fs(old_fs);
+	unuse_mm(mm);
+	mmput(mm);
+}
+
+/*
+ * Workers run with the credentials of the ring's creator and can be
+ * killed to abort whatever they are blocked on when the ring goes
+ * away.
+ */
+static int io_worker(void *data)
+{
+	struct io_ring_ctx *ctx = data;
+	const struct cred *old_cred;
+	struct io_kiocb *req;
+
+	allow_signal(SIGKILL);
+	old_cred = override_creds(ctx->creds);
+
+	while ((req = io_get_work(ctx)))
+		io_run_async(req);
+
+	revert_creds(old_cred);
+	return 0;
+}
+
+static int io_new_worker(struct io_ring_ctx *ctx)
+{
+	struct task_struct *t;
+
+	t = kthread_run(io_worker, ctx, "io_ring/%d", task_pid_nr(ctx->owner));
+	if (IS_ERR(t))
+		return PTR_ERR(t);
+
+	ctx->workers[ctx->nr_workers++] = t;
+	return 0;
+}
+
+/*
+ * Called after each batch of submissions.  Workers are only added
+ * from here, with uring_lock held; requests queued from a wake up wait
+ * for a worker to become free.
+ */
+static void io_grow_workers(struct io_ring_ctx *ctx)
+{
+	int needed;
+
+	if (ctx->nr_workers == IORING_MAX_WORKERS)
+		return;
+
+	spin_lock_irq(&ctx->work_lock);
+	needed = !ctx->idle_workers && !list_empty(&ctx->work_list);
+	spin_unlock_irq(&ctx->work_lock);
+
+	if (needed)
+		io_new_worker(ctx);
+}
+
+/*-----------------------------------------------------------------
+ * Waiting for readiness
+ *---------------------------------------------------------------*/
+static int io_poll_wake(wait_queue_t *wait, unsigned mode, int sync,
+			void *key)
+{
+	struct io_kiocb *req = container_of(wait, struct io_kiocb, wait);
+	unsigned long mask = (unsigned long) key;
+
+	if (mask && !(mask & req->events))
+		return 0;
+
+	list_del_init(&wait->task_list);
+	/* io_poll_arm() still owns it and will queue it itself */
+	if (!req->arming)
+		io_queue_async(req);
+
+	return 1;
+}
+
+static void io_poll_queue_proc(struct file *file, wait_queue_head_t *head,
+			       poll_table *pt)
+{
+	struct io_kiocb *req = container_of(pt, struct io_kiocb, pt);
+
+	/* Only one wait queue per request is supported. */
+	if (req->head) {
+		req->error = -EINVAL;
+		return;
+	}
+
+	req->head = head;
+	add_wait_queue(head, &req->wait);
+}
+
+static unsigned io_file_poll(struct file *file)
+{
+	if (!file->f_op || !file->f_op->poll)
+		return DEFAULT_POLLMASK;
+
+	return file->f_op->poll(file, NULL);
+}
+
+/*
+ * Parks a request until its file reports one of @events, at which
+ * point it is run again by a worker.
+ *
+ * A wake up can come as soon as ->poll has added us to the wait queue.
+ * Until ->arming is cleared under the wait queue lock, io_poll_wake()
+ * only takes the request off the queue and leaves running it to us,
+ * so nobody else can run, complete or free it while we look at it.
+ */
+static void io_poll_arm(struct io_kiocb *req, unsigned events)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	unsigned mask;
+	int queued = 0;
+
+	req->events = events;
+	req->head = NULL;
+	req->error = 0;
+	req->arming = 1;
+	init_waitqueue_func_entry(&req->wait, io_poll_wake);
+	INIT_LIST_HEAD(&req->wait.task_list);
+	init_poll_funcptr(&req->pt, io_poll_queue_proc);
+
+	mask = req->file->f_op->poll(req->file, &req->pt);
+
+	spin_lock_irq(&ctx->poll_lock);
+	if (req->head) {
+		spin_lock(&req->head->lock);
+		req->arming = 0;
+		if (list_empty(&req->wait.task_list)) {
+			/* woken while arming */
+			spin_unlock(&req->head->lock);
+			spin_unlock_irq(&ctx->poll_lock);
+			io_queue_async(req);
+			return;
+		}
+
+		if (!(mask & events) && !req->error && !ctx->dying) {
+			list_add_tail(&req->poll_entry, &ctx->poll_list);
+			queued = 1;
+		} else
+			list_del_init(&req->wait.task_list);
+		spin_unlock(&req->head->lock);
+	}
+	spin_unlock_irq(&ctx->poll_lock);
+
+	if (queued)
+		return;
+
+	if (ctx->dying)
+		io_complete(req, -ECANCELED);
+	else if (req->error)
+		io_complete(req, req->error);
+	else if (!req->head && !(mask & events))
+		/* not ready, and nothing would ever wake us */
+		io_complete(req, -EINVAL);
+	else
+		/* ready already, or there is nothing to wait on */
+		io_queue_async(req);
+}
+
+/*
+ * Takes every parked request off its wait queue and cancels it.
+ * Requests that were woken first are on the work list by now.
+ */
+static void io_poll_cancel(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req, *tmp;
+	LIST_HEAD(list);
+
+	spin_lock_irq(&ctx->poll_lock);
+	list_for_each_entry_safe(req, tmp, &ctx->poll_list, poll_entry) {
+		spin_lock(&req->head->lock);
+		if (!list_empty(&req->wait.task_list)) {
+			list_del_init(&req->wait.task_list);
+			list_move_tail(&req->poll_entry, &list);
+		}
+		spin_unlock(&req->head->lock);
+	}
+	spin_unlock_irq(&ctx->poll_lock);
+
+	list_for_each_entry_safe(req, tmp, &list, poll_entry) {
+		list_del_init(&req->poll_entry);
+		io_complete(req, -ECANCELED);
+	}
+}
+
+/*-----------------------------------------------------------------
+ * Operations
+ *---------------------------------------------------------------*/
+enum {
+	IO_INLINE,	/* run it now */
+	IO_PUNT,	/* give it to a worker */
+	IO_POLL,	/* wait for the file to become ready */
+};
+
+static loff_t io_rw_pos(struct io_kiocb *req)
+{
+	return req->sqe.off == (u64) -1 ? req->file->f_pos : req->sqe.off;
+}
+
+/*
+ * Is every page of a buffered read already in the page cache?
+ */
+static int io_read_cached(struct io_kiocb *req)
+{
+	struct file *file = req->file;
+	struct address_space *mapping = file->f_mapping;
+	struct inode *inode = mapping->host;
+	loff_t pos = io_rw_pos(req);
+	loff_t size = i_size_read(inode);
+	pgoff_t index, last;
+	struct page *page;
+	int uptodate;
+
+	if (file->f_flags & O_DIRECT)
+		return 0;
+
+	if (!req->sqe.len || pos >= size)
+		return 1;
+
+	index = pos >> PAGE_CACHE_SHIFT;
+	last = (min_t(loff_t, pos + req->sqe.len, size) - 1) >>
+		PAGE_CACHE_SHIFT;
+	if (last - index >= IORING_INLINE_PAGES)
+		return 0;
+
+	for (; index <= last; index++) {
+		page = find_get_page(mapping, index);
+		if (!page)
+			return 0;
+		uptodate = PageUptodate(page);
+		page_cache_release(page);
+		if (!uptodate)
+			return 0;
+	}
+
+	return 1;
+}
+
+static int io_rw_plan(struct io_kiocb *req, unsigned *events)
+{
+	struct file *file = req->file;
+	int write = req->sqe.opcode == IORING_OP_WRITE;
+	unsigned want;
+
+	if (S_ISREG(file->f_mapping->host->i_mode)) {
+		if (!write && io_read_cached(req))
+			return IO_INLINE;
+		return IO_PUNT;
+	}
+
+	if (!file->f_op || !file->f_op->poll)
+		return IO_PUNT;
+
+	want = (write ? POLLOUT : POLLIN) | POLLERR | POLLHUP;
+	*events = want;
+	if (!(io_file_poll(file) & want))
+		return IO_POLL;
+
+	/*
+	 * Ready only means there is some data or room: a bigger write or
+	 * a racing reader can still sleep, so only I/O that fails with
+	 * -EAGAIN instead is run inline.
+	 */
+	if (S_ISSOCK(file->f_mapping->host->i_mode) ||
+	    (file->f_flags & O_NONBLOCK))
+		return IO_INLINE;
+	return IO_PUNT;
+}
+
+/*
+ * With @nonblock set a socket is never waited on, whatever its file's
+ * O_NONBLOCK says.
+ */
+static long io_rw(struct io_kiocb *req, int nonblock)
+{
+	struct io_ring_sqe *sqe = &req->sqe;
+	struct file *file = req->file;
+	void __user *buf = (void __user *)(unsigned long) sqe->addr;
+	loff_t pos = io_rw_pos(req);
+	ssize_t ret;
+
+	if (nonblock && S_ISSOCK(file->f_mapping->host->i_mode))
+		return sock_rw_nonblock(file, buf, sqe->len,
+					sqe->opcode == IORING_OP_WRITE);
+
+	if (sqe->opcode == IORING_OP_READ)
+		ret = vfs_read(file, buf, sqe->len, &pos);
+	else
+		ret = vfs_write(file, buf, sqe->len, &pos);
+
+	if (sqe->off == (u64) -1 && ret >= 0)
+		file->f_pos = pos;
+
+	return ret;
+}
+
+static long io_fsync(struct io_kiocb *req)
+{
+	struct io_ring_sqe *sqe = &req->sqe;
+	loff_t end = sqe->len ? sqe->off + sqe->len - 1 : LLONG_MAX;
+
+	if (sqe->op_flags & ~IORING_FSYNC_DATASYNC)
+		return -EINVAL;
+
+	return vfs_fsync_range(req->file, req->file->f_path.dentry, sqe->off,
+			       end, sqe->op_flags & IORING_FSYNC_DATASYNC);
+}
+
+/*
+ * The new descriptor goes into the ring creator's table whichever
+ * thread gets to run the accept, limited by the creator's
+ * RLIMIT_NOFILE rather than ours.
+ */
+static long io_accept(struct io_kiocb *req)
+{
+	struct io_ring_sqe *sqe = &req->sqe;
+	struct files_struct *files;
+	struct file *newfile;
+	long ret;
+
+	newfile = sock_accept_file(req->file,
+				   (struct sockaddr __user *)(unsigned long) sqe->addr,
+				   (int __user *)(unsigned long) sqe->addr2,
+				   sqe->op_flags, 1);
+	if (IS_ERR(newfile))
+		return PTR_ERR(newfile);
+
+	ret = -EBADF;
+	files = req->ctx->files;
+	if (files) {
+		/* SOCK_CLOEXEC == O_CLOEXEC */
+		ret = __alloc_fd(files, 0, req->ctx->nofile,
+				 sqe->op_flags & O_CLOEXEC);
+		if (ret >= 0) {
+			__fd_install(files, ret, newfile);
+			newfile = NULL;
+		}
+	}
+
+	if (newfile)
+		fput(newfile);
+
+	return ret;
+}
+
+/*
+ * Runs a request, or parks it until it can make progress.  @async is
+ * set in a worker, which is allowed to block.
+ */
+static void io_issue(struct io_kiocb *req, int async)
+{
+	unsigned events = 0;
+	long ret;
+
+	switch (req->sqe.opcode) {
+	case IORING_OP_NOP:
+		ret = 0;
+		break;
+
+	case IORING_OP_READ:
+	case IORING_OP_WRITE:
+		switch (io_rw_plan(req, &events)) {
+		case IO_POLL:
+			goto poll;
+		case IO_PUNT:
+			if (!async)
+				goto punt;
+		}
+		ret = io_rw(req, !async);
+		/*
+		 * Lost a race for the data or room poll reported: wait for
+		 * it once more.  A worker gives O_NONBLOCK files' -EAGAIN
+		 * back rather than loop on it.
+		 */
+		if (ret == -EAGAIN && events && !async)
+			goto poll;
+		break;
+
+	case IORING_OP_FSYNC:
+		if (!async)
+			goto punt;
+		ret = io_fsync(req);
+		break;
+
+	case IORING_OP_POLL_ADD:
+		events = req->sqe.poll_events | POLLERR | POLLHUP;
+		ret = io_file_poll(req->file) & events;
+		if (!ret)
+			goto poll;
+		break;
+
+	case IORING_OP_ACCEPT:
+		ret = io_accept(req);
+		if (ret == -EAGAIN) {
+			events = POLLIN | POLLERR | POLLHUP;
+			goto poll;
+		}
+		break;
+
+	default:
+		ret = -EINVAL;
+	}
+
+	io_complete(req, ret);
+	return;
+
+poll:
+	if (!req->file->f_op || !req->file->f_op->poll) {
+		io_complete(req, -EINVAL);
+		return;
+	}
+	io_poll_arm(req, events);
+	return;
+
+punt:
+	io_queue_async(req);
+}
+
+/*-----------------------------------------------------------------
+ * Submission
+ *---------------------------------------------------------------*/
+static struct file *io_file_get(struct files_struct *files, int fd)
+{
+	struct file *file;
+
+	rcu_read_lock();
+	file = fcheck_files(files, fd);
+	if (file && !atomic_long_inc_not_zero(&file->f_count))
+		file = NULL;
+	rcu_read_unlock();
+
+	/* A ring waiting on itself would never be released. */
+	if (file && file->f_op == &io_ring_fops) {
+		fput(file);
+		file = NULL;
+	}
+
+	return file;
+}
+
+/*
+ * Returns non-zero if the entry couldn't be accepted and should be
+ * retried later.  Malformed entries are consumed and fail through the
+ * completion ring.
+ */
+static int io_submit_sqe(struct io_ring_ctx *ctx,
+			 const struct io_ring_sqe *sqe,
+			 struct files_struct *files)
+{
+	struct io_kiocb *req;
+
+	if (!io_get_cq_slot(ctx))
+		return -EBUSY;
+
+	req = kmem_cache_alloc(io_req_cachep, GFP_KERNEL);
+	if (!req) {
+		io_put_cq_slot(ctx);
+		return -EAGAIN;
+	}
+
+	/* The entry is shared; work only on our own copy of it. */
+	memcpy(&req->sqe, sqe, sizeof(req->sqe));
+	req->ctx = ctx;
+	req->file = NULL;
+	INIT_LIST_HEAD(&req->list);
+	INIT_LIST_HEAD(&req->poll_entry);
+
+	if (req->sqe.flags) {
+		io_complete(req, -EINVAL);
+		return 0;
+	}
+
+	if (req->sqe.opcode != IORING_OP_NOP) {
+		if (files)
+			req->file = io_file_get(files, req->sqe.fd);
+		if (!req->file) {
+			io_complete(req, -EBADF);
+			return 0;
+		}
+	}
+
+	io_issue(req, 0);
+	return 0;
+}
+
+static unsigned io_sqring_entries(struct io_ring_ctx *ctx)
+{
+	return ACCESS_ONCE(ctx->sq_ring->r.tail) - ctx->cached_sq_head;
+}
+
+/*
+ * Called with uring_lock held, in a context using the ring's mm, which
+ * keeps ctx->files around.
+ */
+static int io_submit_sqes(struct io_ring_ctx *ctx, unsigned to_submit)
+{
+	struct io_sq_ring *ring = ctx->sq_ring;
+	struct files_struct *files;
+	unsigned head, tail, idx, submitted = 0;
+	int r = 0;
+
+	files = ctx->files;
+
+	head = ctx->cached_sq_head;
+	tail = ACCESS_ONCE(ring->r.tail);
+	/* Read the entries only after the tail that published them. */
+	smp_rmb();
+
+	while (head != tail && submitted < to_submit) {
+		idx = ACCESS_ONCE(ring->array[head & ctx->sq_mask]);
+		if (idx >= ctx->sq_entries) {
+			ring->dropped++;
+			head++;
+			continue;
+		}
+
+		r = io_submit_sqe(ctx, &ctx->sq_sqes[idx], files);
+		if (r)
+			break;
+
+		head++;
+		submitted++;
+	}
+
+	if (head != ctx->cached_sq_head) {
+		ctx->cached_sq_head = head;
+		/* The entries have been copied, let them be reused. */
+		smp_mb();
+		ring->r.head = head;
+	}
+
+	io_grow_workers(ctx);
+
+	return submitted ? submitted : r;
+}
+
+static int io_sq_thread(void *data)
+{
+	struct io_ring_ctx *ctx = data;
+	struct mm_struct *mm = ctx->mm;
+	const struct cred *old_cred;
+	mm_segment_t old_fs;
+	unsigned long timeout;
+	DEFINE_WAIT(wait);
+
+	old_cred = override_creds(ctx->creds);
+	timeout = jiffies + ctx->sq_thread_idle;
+
+	while (!kthread_should_stop()) {
+		if (io_sqring_entries(ctx) &&
+		    atomic_inc_not_zero(&mm->mm_users)) {
+			use_mm(mm);
+			old_fs = get_fs();
+			set_fs(USER_DS);
+			mutex_lock(&ctx->uring_lock);
+			io_submit_sqes(ctx, UINT_MAX);
+			mutex_unlock(&ctx->uring_lock);
+			set_fs(old_fs);
+			unuse_mm(mm);
+			mmput(mm);
+
+			timeout = jiffies + ctx->sq_thread_idle;
+			cond_resched();
+			continue;
+		}
+
+		if (time_before(jiffies, timeout)) {
+			cond_resched();
+			continue;
+		}
+
+		prepare_to_wait(&ctx->sqo_wait, &wait, TASK_INTERRUPTIBLE);
+		ctx->sq_ring->flags |= IORING_SQ_NEED_WAKEUP;
+		/* Pairs with the barrier between user space's tail update
+		 * and its check of the flag. */
+		smp_mb();
+		if ((!io_sqring_entries(ctx) || !atomic_read(&mm->mm_users)) &&
+		    !kthread_should_stop())
+			schedule();
+		finish_wait(&ctx->sqo_wait, &wait);
+		ctx->sq_ring->flags &= ~IORING_SQ_NEED_WAKEUP;
+
+		timeout = jiffies + ctx->sq_thread_idle;
+	}
+
+	revert_creds(old_cred);
+	return 0;
+}
+
+SYSCALL_DEFINE4(io_ring_enter, unsigned int, fd, u32, to_submit,
+		u32, min_complete, u32, flags)
+{
+	struct io_ring_ctx *ctx;
+	struct file *file;
+	long ret;
+
+	if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP))
+		return -EINVAL;
+
+	file = fget(fd);
+	if (!file)
+		return -EBADF;
+
+	ret = -EOPNOTSUPP;
+	if (file->f_op != &io_ring_fops)
+		goto out;
+
+	/* Buffer addresses only make sense in the ring creator's mm. */
+	ret = -EPERM;
+	ctx = file->private_data;
+	if (current->mm != ctx->mm)
+		goto out;
+
+	ret = 0;
+	if (ctx->sqo_thread) {
+		if (flags & IORING_ENTER_SQ_WAKEUP)
+			wake_up(&ctx->sqo_wait);
+		ret = to_submit;
+	} else if (to_submit) {
+		mutex_lock(&ctx->uring_lock);
+		ret = io_submit_sqes(ctx, to_submit);
+		mutex_unlock(&ctx->uring_lock);
+		if (ret < 0)
+			goto out;
+	}
+
+	if (flags & IORING_ENTER_GETEVENTS) {
+		long r;
+
+		min_complete = min(min_complete, ctx->cq_entries);
+		r = wait_event_interruptible(ctx->cq_wait,
+				io_cqring_events(ctx) >= min_complete);
+		if (r && !ret)
+			ret = r;
+	}
+
+out:
+	fput(file);
+	return ret;
+}
+
+/*-----------------------------------------------------------------
+ * Setup and teardown
+ *---------------------------------------------------------------*/
+/*
+ * The ring holds a reference on its creator's files, so requests can
+ * use them from any thread, but the ring usually is one of those files
+ * itself.  To let them go at exit, the reference is dropped once the
+ * creator's address space is torn down: no request can run after that.
+ */
+static void io_ring_put_files(struct work_struct *work)
+{
+	struct io_ring_ctx *ctx = container_of(work, struct io_ring_ctx,
+					       files_work);
+	struct files_struct *files = xchg(&ctx->files, NULL);
+
+	if (files)
+		put_files_struct(files);
+}
+
+/* The last user of the mm is gone.  Can't sleep here. */
+static void io_ring_mm_release(struct mmu_notifier *mn, struct mm_struct *mm)
+{
+	struct io_ring_ctx *ctx = container_of(mn, struct io_ring_ctx,
+					       mmu_notifier);
+
+	schedule_work(&ctx->files_work);
+}
+
+static const struct mmu_notifier_ops io_ring_mmu_notifier_ops = {
+	.release	= io_ring_mm_release,
+};
+
+/*
+ * Stops the ring's threads, cancels everything still outstanding and
+ * frees it.
+ */
+static void io_ring_ctx_free(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req, *tmp;
+	LIST_HEAD(list);
+	unsigned i;
+
+	if (ctx->sqo_thread)
+		kthread_stop(ctx->sqo_thread);
+
+	spin_lock_irq(&ctx->poll_lock);
+	spin_lock(&ctx->work_lock);
+	ctx->dying = 1;
+	spin_unlock(&ctx->work_lock);
+	spin_unlock_irq(&ctx->poll_lock);
+
+	io_poll_cancel(ctx);
+
+	/* Interrupt whatever the workers are waiting for and stop them. */
+	for (i = 0; i < ctx->nr_workers; i++)
+		send_sig(SIGKILL, ctx->workers[i], 1);
+	for (i = 0; i < ctx->nr_workers; i++)
+		kthread_stop(ctx->workers[i]);
+
+	spin_lock_irq(&ctx->work_lock);
+	list_splice_init(&ctx->work_list, &list);
+	spin_unlock_irq(&ctx->work_lock);
+
+	list_for_each_entry_safe(req, tmp, &list, list) {
+		list_del_init(&req->poll_entry);
+		io_complete(req, -ECANCELED);
+	}
+
+	WARN_ON(ctx->inflight);
+
+	if (ctx->mmu_notifier.ops)
+		mmu_notifier_unregister(&ctx->mmu_notifier, ctx->mm);
+	flush_work(&ctx->files_work);
+	if (ctx->files)
+		put_files_struct(ctx->files);
+
+	vfree(ctx->sq_ring);
+	vfree(ctx->sq_sqes);
+	vfree(ctx->cq_ring);
+	put_cred(ctx->creds);
+	mmdrop(ctx->mm);
+	put_task_struct(ctx->owner);
+	kfree(ctx);
+}
+
+static void io_ring_exit_work(struct work_struct *work)
+{
+	io_ring_ctx_free(container_of(work, struct io_ring_ctx, exit_work));
+}
+
+/*
+ * The last reference to the ring can be dropped by one of its own
+ * workers, so stopping them is left to a separate thread.
+ */
+static int io_ring_release(struct inode *inode, struct file *file)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+
+	INIT_WORK(&ctx->exit_work, io_ring_exit_work);
+	queue_work(io_ring_exit_wq, &ctx->exit_work);
+
+	return 0;
+}
+
+static int io_ring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+	loff_t offset = (loff_t) vma->vm_pgoff << PAGE_SHIFT;
+	void *ptr;
+
+	switch (offset) {
+	case IORING_OFF_SQ_RING:
+		ptr = ctx->sq_ring;
+		break;
+	case IORING_OFF_SQES:
+		ptr = ctx->sq_sqes;
+		break;
+	case IORING_OFF_CQ_RING:
+		ptr = ctx->cq_ring;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return remap_vmalloc_range(vma, ptr, 0);
+}
+
+static unsigned int io_ring_poll(struct file *file, poll_table *wait)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+
+	poll_wait(file, &ctx->cq_wait, wait);
+	smp_rmb();
+
+	return io_cqring_events(ctx) ? POLLIN | POLLRDNORM : 0;
+}
+
+static const struct file_operations io_ring_fops = {
+	.release	= io_ring_release,
+	.mmap		= io_ring_mmap,
+	.poll		= io_ring_poll,
+};
+
+static int io_allocate_rings(struct io_ring_ctx *ctx, unsigned entries)
+{
+	ctx->sq_entries = entries;
+	ctx->sq_mask = entries - 1;
+	ctx->cq_entries = 2 * entries;
+	ctx->cq_mask = ctx->cq_entries - 1;
+
+	ctx->sq_ring = vmalloc_user(sizeof(struct io_sq_ring) +
+				    entries * sizeof(u32));
+	ctx->sq_sqes = vmalloc_user(entries * sizeof(struct io_ring_sqe));
+	ctx->cq_ring = vmalloc_user(sizeof(struct io_cq_ring) +
+				    ctx->cq_entries * sizeof(struct io_ring_cqe));
+	if (!ctx->sq_ring || !ctx->sq_sqes || !ctx->cq_ring)
+		return -ENOMEM;
+
+	ctx->sq_ring->ring_mask = ctx->sq_mask;
+	ctx->sq_ring->ring_entries = ctx->sq_entries;
+	ctx->cq_ring->ring_mask = ctx->cq_mask;
+	ctx->cq_ring->ring_entries = ctx->cq_entries;
+
+	return 0;
+}
+
+static void io_fill_offsets(struct io_ring_ctx *ctx, struct io_ring_params *p)
+{
+	p->sq_entries = ctx->sq_entries;
+	p->cq_entries = ctx->cq_entries;
+
+	memset(&p->sq_off, 0, sizeof(p->sq_off));
+	p->sq_off.head = offsetof(struct io_sq_ring, r.head);
+	p->sq_off.tail = offsetof(struct io_sq_ring, r.tail);
+	p->sq_off.ring_mask = offsetof(struct io_sq_ring, ring_mask);
+	p->sq_off.ring_entries = offsetof(struct io_sq_ring, ring_entries);
+	p->sq_off.flags = offsetof(struct io_sq_ring, flags);
+	p->sq_off.dropped = offsetof(struct io_sq_ring, dropped);
+	p->sq_off.array = offsetof(struct io_sq_ring, array);
+
+	memset(&p->cq_off, 0, sizeof(p->cq_off));
+	p->cq_off.head = offsetof(struct io_cq_ring, r.head);
+	p->cq_off.tail = offsetof(struct io_cq_ring, r.tail);
+	p->cq_off.ring_mask = offsetof(struct io_cq_ring, ring_mask);
+	p->cq_off.ring_entries = offsetof(struct io_cq_ring, ring_entries);
+	p->cq_off.overflow = offsetof(struct io_cq_ring, overflow);
+	p->cq_off.cqes = offsetof(struct io_cq_ring, cqes);
+}
+
+static struct io_ring_ctx *io_ring_ctx_alloc(unsigned entries)
+{
+	struct io_ring_ctx *ctx;
+	int r;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return ERR_PTR(-ENOMEM);
+
+	mutex_init(&ctx->uring_lock);
+	spin_lock_init(&ctx->completion_lock);
+	init_waitqueue_head(&ctx->cq_wait);
+	spin_lock_init(&ctx->work_lock);
+	INIT_LIST_HEAD(&ctx->work_list);
+	init_waitqueue_head(&ctx->work_wait);
+	spin_lock_init(&ctx->poll_lock);
+	INIT_LIST_HEAD(&ctx->poll_list);
+	init_waitqueue_head(&ctx->sqo_wait);
+	INIT_WORK(&ctx->files_work, io_ring_put_files);
+
+	get_task_struct(current);
+	ctx->owner = current;
+	atomic_inc(&current->mm->mm_count);
+	ctx->mm = current->mm;
+	ctx->creds = get_current_cred();
+	atomic_inc(&current->files->count);
+	ctx->files = current->files;
+	ctx->nofile = rlimit(RLIMIT_NOFILE);
+
+	ctx->mmu_notifier.ops = &io_ring_mmu_notifier_ops;
+	r = mmu_notifier_register(&ctx->mmu_notifier, ctx->mm);
+	if (r) {
+		ctx->mmu_notifier.ops = NULL;
+		goto bad;
+	}
+
+	r = io_allocate_rings(ctx, entries);
+	if (r)
+		goto bad;
+
+	r = io_new_worker(ctx);
+	if (r)
+		goto bad;
+
+	return ctx;
+
+bad:
+	io_ring_ctx_free(ctx);
+	return ERR_PTR(r);
+}
+
+static int io_start_sq_thread(struct io_ring_ctx *ctx,
+			      struct io_ring_params *p)
+{
+	struct task_struct *t;
+
+	ctx->sq_thread_idle = p->sq_thread_idle ?
+		msecs_to_jiffies(p->sq_thread_idle) : IORING_SQ_IDLE_DEFAULT;
+
+	t = kthread_run(io_sq_thread, ctx, "io_ring_sq/%d",
+			task_pid_nr(current));
+	if (IS_ERR(t))
+		return PTR_ERR(t);
+
+	ctx->sqo_thread = t;
+	return 0;
+}
+
+SYSCALL_DEFINE2(io_ring_setup, u32, entries,
+		struct io_ring_params __user *, params)
+{
+	struct io_ring_params p;
+	struct io_ring_ctx *ctx;
+	struct file *file;
+	int fd, r, i;
+
+	if (copy_from_user(&p, params, sizeof(p)))
+		return -EFAULT;
+
+	for (i = 0; i < ARRAY_SIZE(p.resv); i++)
+		if (p.resv[i])
+			return -EINVAL;
+
+	if (p.flags & ~IORING_SETUP_SQPOLL)
+		return -EINVAL;
+
+	if (!entries || entries > IORING_MAX_ENTRIES)
+		return -EINVAL;
+
+	/* A thread spinning on behalf of a process is a privilege. */
+	if ((p.flags & IORING_SETUP_SQPOLL) && !capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (!current->mm)
+		return -EINVAL;
+
+	ctx = io_ring_ctx_alloc(roundup_pow_of_two(entries));
+	if (IS_ERR(ctx))
+		return PTR_ERR(ctx);
+
+	if (p.flags & IORING_SETUP_SQPOLL) {
+		r = io_start_sq_thread(ctx, &p);
+		if (r) {
+			io_ring_ctx_free(ctx);
+			return r;
+		}
+	}
+
+	/* From here on the ring is torn down by io_ring_release(). */
+	file = anon_inode_getfile("[io_ring]", &io_ring_fops, ctx, O_RDWR);
+	if (IS_ERR(file)) {
+		io_ring_ctx_free(ctx);
+		return PTR_ERR(file);
+	}
+
+	fd = get_unused_fd_flags(O_CLOEXEC);
+	if (fd < 0) {
+		fput(file);
+		return fd;
+	}
+
+	io_fill_offsets(ctx, &p);
+	if (copy_to_user(params, &p, sizeof(p))) {
+		put_unused_fd(fd);
+		fput(file);
+		return -EFAULT;
+	}
+
+	fd_install(fd, file);
+	return fd;
+}
+
+static int __init io_ring_init(void)
+{
+	io_req_cachep = KMEM_CACHE(io_kiocb, SLAB_HWCACHE_ALIGN | SLAB_PANIC);
+
+	io_ring_exit_wq = create_singlethread_workqueue("io_ring_exit");
+	if (!io_ring_exit_wq)
+		panic("io_ring_init: cannot create workqueue\n");
+
+	return 0;
+}
+__initcall(io_ring_init);
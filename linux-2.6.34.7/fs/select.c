@@ -26,6 +26,9 @@
 #include <linux/fs.h>
 #include <linux/rcupdate.h>
 #include <linux/hrtimer.h>
+#include <linux/eventpoll.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include <asm/uaccess.h>
 
@@ -822,6 +825,205 @@ static int do_poll(unsigned int nfds,  struct poll_list *list,
 	return count;
 }
 
+#ifdef CONFIG_EPOLL
+/*
+ * Programs that poll(2) many descriptors usually pass the same pollfd
+ * array every time. Once a task has done so twice in a row, the array
+ * is mirrored in a pollset (see fs/eventpoll.c), whose wait queue
+ * registrations persist between calls: a call then only has to look
+ * for changed entries, instead of calling f_op->poll() and queueing
+ * itself on every descriptor and unhooking again afterwards.
+ */
+#define POLL_CACHE_MIN_FDS	64
+
+/* A pollset that hasn't been polled for this long is dropped */
+#define POLL_CACHE_IDLE		(10 * HZ)
+
+struct poll_cache {
+	/* Held by the task polling, and by idle_work dropping the set */
+	struct mutex lock;
+	unsigned long last_used;
+	struct delayed_work idle_work;
+
+	/* Array passed by the last call */
+	struct pollfd __user *ufds;
+	unsigned int nfds;
+
+	/* Set if the array cannot be mirrored, e.g. for duplicate fds */
+	int bypass;
+
+	/* Mirror of the array and copy of its entries, once it came back */
+	struct pollset *ps;
+	struct pollfd *fds;
+};
+
+static void poll_cache_free_fds(struct poll_cache *pc)
+{
+	if (is_vmalloc_addr(pc->fds))
+		vfree(pc->fds);
+	else
+		kfree(pc->fds);
+	pc->fds = NULL;
+}
+
+static void poll_cache_drop(struct poll_cache *pc)
+{
+	if (pc->ps) {
+		pollset_free(pc->ps);
+		pc->ps = NULL;
+	}
+	if (pc->fds)
+		poll_cache_free_fds(pc);
+}
+
+/*
+ * Don't keep the set hooked to the files' wait queues once the task has
+ * stopped polling; if it comes back, the set is rebuilt.
+ */
+static void poll_cache_idle(struct work_struct *work)
+{
+	struct poll_cache *pc = container_of(work, struct poll_cache,
+					     idle_work.work);
+	unsigned long idle_end;
+
+	/* Busy polling, so not idle */
+	if (!mutex_trylock(&pc->lock)) {
+		schedule_delayed_work(&pc->idle_work, POLL_CACHE_IDLE);
+		return;
+	}
+
+	idle_end = pc->last_used + POLL_CACHE_IDLE;
+	if (time_before(jiffies, idle_end))
+		schedule_delayed_work(&pc->idle_work, idle_end - jiffies);
+	else
+		poll_cache_drop(pc);
+	mutex_unlock(&pc->lock);
+}
+
+void free_poll_cache(struct poll_cache *pc)
+{
+	cancel_delayed_work_sync(&pc->idle_work);
+	poll_cache_drop(pc);
+	kfree(pc);
+}
+
+static int poll_cache_prepare(struct poll_cache *pc, unsigned int nfds)
+{
+	size_t size = nfds * sizeof(struct pollfd);
+	struct pollset *ps;
+
+	if (!pc->ps) {
+		ps = pollset_alloc();
+		if (IS_ERR(ps))
+			return PTR_ERR(ps);
+		pc->ps = ps;
+	}
+
+	if (pc->fds && pc->nfds != nfds)
+		poll_cache_free_fds(pc);
+	if (!pc->fds) {
+		if (size <= PAGE_SIZE)
+			pc->fds = kmalloc(size, GFP_KERNEL);
+		else
+			pc->fds = vmalloc(size);
+		if (!pc->fds)
+			return -ENOMEM;
+		pc->nfds = nfds;
+	}
+
+	return 0;
+}
+
+/* Called with pc->lock held, see do_poll_cached() */
+static int __do_poll_cached(struct poll_cache *pc, struct pollfd __user *ufds,
+			    unsigned int nfds, struct timespec *end_time,
+			    int *ret)
+{
+	ktime_t expire, *to = NULL;
+	int timed_out = 0, err;
+	unsigned long slack = 0;
+	unsigned int i;
+
+	if (pc->ufds != ufds) {
+		/* Only worth mirroring if it gets passed again */
+		poll_cache_drop(pc);
+		pc->ufds = ufds;
+		pc->bypass = 0;
+		return 0;
+	}
+	if (pc->bypass || poll_cache_prepare(pc, nfds))
+		return 0;
+
+	*ret = -EFAULT;
+	if (copy_from_user(pc->fds, ufds, nfds * sizeof(struct pollfd)))
+		return 1;
+
+	if (end_time && !end_time->tv_sec && !end_time->tv_nsec)
+		timed_out = 1;
+	if (end_time && !timed_out) {
+		slack = estimate_accuracy(end_time);
+		expire = timespec_to_ktime(*end_time);
+		to = &expire;
+	}
+
+	err = pollset_poll(pc->ps, pc->fds, nfds, to, slack, timed_out);
+	if (err < 0 && err != -EINTR) {
+		poll_cache_drop(pc);
+		pc->bypass = 1;
+		return 0;
+	}
+
+	if (err >= 0)
+		for (i = 0; i < nfds; i++)
+			if (__put_user(pc->fds[i].revents, &ufds[i].revents))
+				return 1;
+
+	*ret = err;
+	return 1;
+}
+
+/*
+ * Poll through the current task's cached pollset if @ufds is the array
+ * it was called with last time. Returns 0 if the caller has to do the
+ * work itself, or 1 with the poll(2) result in *@ret.
+ */
+static int do_poll_cached(struct pollfd __user *ufds, unsigned int nfds,
+			  struct timespec *end_time, int *ret)
+{
+	struct poll_cache *pc = current->poll_cache;
+	int err;
+
+	if (nfds < POLL_CACHE_MIN_FDS)
+		return 0;
+
+	if (!pc) {
+		pc = kzalloc(sizeof(*pc), GFP_KERNEL);
+		if (!pc)
+			return 0;
+		mutex_init(&pc->lock);
+		INIT_DELAYED_WORK(&pc->idle_work, poll_cache_idle);
+		current->poll_cache = pc;
+	}
+
+	mutex_lock(&pc->lock);
+	err = __do_poll_cached(pc, ufds, nfds, end_time, ret);
+	if (pc->ps) {
+		pc->last_used = jiffies;
+		if (!delayed_work_pending(&pc->idle_work))
+			schedule_delayed_work(&pc->idle_work, POLL_CACHE_IDLE);
+	}
+	mutex_unlock(&pc->lock);
+
+	return err;
+}
+#else
+static inline int do_poll_cached(struct pollfd __user *ufds, unsigned int nfds,
+				 struct timespec *end_time, int *ret)
+{
+	return 0;
+}
+#endif /* CONFIG_EPOLL */
+
 #define N_STACK_PPS ((sizeof(stack_pps) - sizeof(struct poll_list))  / \
 			sizeof(struct pollfd))
 
@@ -841,6 +1043,9 @@ int do_sys_poll(struct pollfd __user *ufds, unsigned int nfds,
 	if (nfds > rlimit(RLIMIT_NOFILE))
 		return -EINVAL;
 
+	if (do_poll_cached(ufds, nfds, end_time, &err))
+		return err;
+
 	len = min_t(unsigned int, nfds, N_STACK_PPS);
 	for (;;) {
 		walk->next = NULL;
@@ -3,6 +3,7 @@
 
 #include <linux/list.h>
 #include <linux/workqueue.h>
+#include <linux/wait.h>
 #include <linux/aio_abi.h>
 #include <linux/uio.h>
 #include <linux/rcupdate.h>
@@ -77,8 +78,9 @@ struct kioctx;
  *
  * If ki_retry returns -EIOCBRETRY it has made a promise that kick_iocb()
  * will be called on the kiocb pointer in the future.  This may happen
- * through generic helpers that associate kiocb->ki_wait with a wait
- * queue head that ki_retry uses via current->io_wait.  It can also happen
+ * through generic helpers such as lock_page_async() that queue
+ * kiocb->ki_wait on the wait queue of whatever ki_retry would have slept
+ * on, so that the wake up kicks the kiocb.  It can also happen
  * with custom tracking and manual calls to kick_iocb(), though that is
  * discouraged.  In either case, kick_iocb() must be called once and only
  * once.  ki_retry must ensure forward progress, the AIO core will wait
@@ -118,6 +120,11 @@ struct kiocb {
 	struct list_head	ki_list;	/* the aio core uses this
 						 * for cancellation */
 
+	/* kicks the kiocb when a ki_retry that returned -EIOCBRETRY
+	 * can make progress */
+	struct wait_bit_queue	ki_wait;
+	wait_queue_head_t	*ki_wait_head;	/* where ki_wait was queued */
+
 	/*
 	 * If the aio_resfd field of the userspace iocb is not zero,
 	 * this is the underlying eventfd context to deliver events to.
@@ -210,6 +217,7 @@ extern ssize_t wait_on_sync_kiocb(struct kiocb *iocb);
 extern int aio_put_req(struct kiocb *iocb);
 extern void kick_iocb(struct kiocb *iocb);
 extern int aio_complete(struct kiocb *iocb, long res, long res2);
+extern void aio_dequeue_wait(struct kiocb *iocb);
 struct mm_struct;
 extern void exit_aio(struct mm_struct *mm);
 extern long do_io_submit(aio_context_t ctx_id, long nr,
@@ -219,6 +227,7 @@ static inline ssize_t wait_on_sync_kiocb(struct kiocb *iocb) { return 0; }
 static inline int aio_put_req(struct kiocb *iocb) { return 0; }
 static inline void kick_iocb(struct kiocb *iocb) { }
 static inline int aio_complete(struct kiocb *iocb, long res, long res2) { return 0; }
+static inline void aio_dequeue_wait(struct kiocb *iocb) { }
 struct mm_struct;
 static inline void exit_aio(struct mm_struct *mm) { }
 static inline long do_io_submit(aio_context_t ctx_id, long nr,
@@ -38,6 +38,9 @@ typedef int (congested_fn)(void *, int);
 enum bdi_stat_item {
 	BDI_RECLAIMABLE,
 	BDI_WRITEBACK,
+	BDI_RA_HIT,		/* read ahead pages that were then read */
+	BDI_RA_MISS,		/* reads that waited for a missing page */
+	BDI_RA_WASTED,		/* read ahead pages dropped unread */
 	NR_BDI_STAT_ITEMS
 };
 
@@ -0,0 +1,141 @@
+#ifndef BLK_MQ_H
+#define BLK_MQ_H
+
+#include <linux/blkdev.h>
+
+struct blk_mq_hw_ctx;
+
+/*
+ * One in-flight command.  A command is bound to a tag of its hardware
+ * queue for its whole lifetime, drivers can go from the tag back to the
+ * command with blk_mq_tag_to_cmd().  Driver private data of cmd_size bytes
+ * follows the structure, see blk_mq_cmd_to_pdu().
+ */
+struct blk_mq_cmd {
+	struct bio		*bio;		/* NULL for a cache flush */
+	struct blk_mq_hw_ctx	*hctx;
+	unsigned int		tag;
+	unsigned int		flags;
+
+	/* internal, for commands issued by the core itself */
+	void			(*end_io)(void *, int);
+	void			*end_io_data;
+};
+
+/*
+ * blk_mq_cmd->flags
+ */
+#define BLK_MQ_CMD_FLUSH	(1 << 0)	/* flush the volatile write cache */
+
+/*
+ * return values of ->queue_cmd()
+ */
+enum {
+	BLK_MQ_CMD_OK		= 0,	/* queued, will be completed later */
+	BLK_MQ_CMD_BUSY		= 1,	/* no room, retry after a completion */
+	BLK_MQ_CMD_ERROR	= 2,	/* can't be queued, fail it */
+};
+
+typedef int (queue_cmd_fn)(struct blk_mq_hw_ctx *, struct blk_mq_cmd *);
+typedef int (init_hctx_fn)(struct blk_mq_hw_ctx *, void *, unsigned int);
+
+struct blk_mq_ops {
+	/*
+	 * Queue a command to the hardware.  Called without any block
+	 * layer lock held, possibly from several cpus at once for the
+	 * same hardware queue, either in the context of the submitter or
+	 * from kblockd for bios that had to wait.
+	 */
+	queue_cmd_fn		*queue_cmd;
+
+	/*
+	 * Optional, set up per hardware queue driver state.
+	 */
+	init_hctx_fn		*init_hctx;
+};
+
+/*
+ * blk_mq_reg->flags
+ */
+#define BLK_MQ_F_FLUSH		(1 << 0)	/* device has a volatile cache */
+
+struct blk_mq_reg {
+	struct blk_mq_ops	*ops;
+	unsigned int		nr_hw_queues;
+	unsigned int		queue_depth;	/* tags per hardware queue */
+	unsigned int		cmd_size;	/* driver data per command */
+	int			numa_node;
+	unsigned int		flags;
+};
+
+/*
+ * Per-cpu software submission queue.  Bios only wait here when their
+ * hardware queue is out of tags or stopped.
+ */
+struct blk_mq_ctx {
+	spinlock_t		lock;
+	struct bio_list		pending;
+	unsigned int		index_hw;	/* bit in hctx->ctx_pending */
+	unsigned int		last_tag;	/* allocation hint */
+	atomic_t		nr_submitting;	/* in blk_mq_make_request */
+	struct blk_mq_hw_ctx	*hctx;
+} ____cacheline_aligned_in_smp;
+
+struct blk_mq_hw_ctx {
+	struct request_queue	*queue;
+	unsigned int		queue_num;
+	void			*driver_data;
+	unsigned long		state;
+
+	unsigned int		nr_ctx;
+	struct blk_mq_ctx	**ctxs;
+	unsigned long		*ctx_pending;	/* ctxs with waiting bios */
+
+	unsigned int		queue_depth;
+	unsigned long		*tag_map;
+	struct blk_mq_cmd	**cmds;		/* indexed by tag */
+	atomic_t		nr_active;
+
+	struct work_struct	run_work;
+
+	unsigned long		queued;
+	unsigned long		deferred;
+} ____cacheline_aligned_in_smp;
+
+/*
+ * blk_mq_hw_ctx->state
+ */
+enum {
+	BLK_MQ_S_STOPPED	= 0,
+};
+
+/*
+ * request_queue->mq_state
+ */
+enum {
+	BLK_MQ_Q_BARRIER	= 0,	/* a barrier is draining the queue */
+};
+
+extern struct request_queue *blk_mq_init_queue(struct blk_mq_reg *, void *);
+extern void blk_mq_end_cmd(struct blk_mq_cmd *, int);
+extern void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *);
+extern void blk_mq_start_hw_queue(struct blk_mq_hw_ctx *);
+extern void blk_mq_start_stopped_hw_queues(struct request_queue *);
+extern void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *, bool);
+
+static inline void *blk_mq_cmd_to_pdu(struct blk_mq_cmd *cmd)
+{
+	return cmd + 1;
+}
+
+static inline struct blk_mq_cmd *blk_mq_tag_to_cmd(struct blk_mq_hw_ctx *hctx,
+						   unsigned int tag)
+{
+	return hctx->cmds[tag];
+}
+
+#define queue_for_each_hw_ctx(q, hctx, i)				\
+	for ((i) = 0; (i) < (q)->nr_hw_queues &&			\
+	     ({ hctx = (q)->queue_hw_ctx[i]; 1; }); (i)++)
+
+#endif
@@ -28,6 +28,9 @@ struct request_queue;
 struct elevator_queue;
 struct request_pm_state;
 struct blk_trace;
+struct blk_mq_ops;
+struct blk_mq_ctx;
+struct blk_mq_hw_ctx;
 struct request;
 struct sg_io_hdr;
 
@@ -439,6 +442,17 @@ struct request_queue
 
 	struct mutex		sysfs_lock;
 
+	/*
+	 * multi-queue submission, see block/blk-mq.c
+	 */
+	struct blk_mq_ops	*mq_ops;
+	struct blk_mq_ctx __percpu *queue_ctx;
+	struct blk_mq_hw_ctx	**queue_hw_ctx;
+	unsigned int		nr_hw_queues;
+	unsigned int		mq_flags;
+	unsigned long		mq_state;
+	wait_queue_head_t	mq_wait;
+
 #if defined(CONFIG_BLK_DEV_BSG)
 	struct bsg_class_device bsg_dev;
 #endif
@@ -790,6 +804,7 @@ extern void blk_plug_device(struct request_queue *);
 extern void blk_plug_device_unlocked(struct request_queue *);
 extern int blk_remove_plug(struct request_queue *);
 extern void blk_recount_segments(struct request_queue *, struct bio *);
+extern void blk_bio_append_segment(struct request_queue *, struct bio *);
 extern int scsi_cmd_ioctl(struct request_queue *, struct gendisk *, fmode_t,
 			  unsigned int, void __user *);
 extern int sg_scsi_ioctl(struct request_queue *, struct gendisk *, fmode_t,
@@ -964,6 +979,7 @@ extern unsigned blk_ordered_req_seq(struct request *);
 extern bool blk_ordered_complete_seq(struct request_queue *, unsigned, int);
 
 extern int blk_rq_map_sg(struct request_queue *, struct request *, struct scatterlist *);
+extern int blk_bio_map_sg(struct request_queue *, struct bio *, struct scatterlist *);
 extern void blk_dump_rq_flags(struct request *, char *);
 extern void generic_unplug_device(struct request_queue *);
 extern long nr_blockdev_pages(void);
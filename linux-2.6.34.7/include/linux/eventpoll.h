@@ -26,6 +26,12 @@
 #define EPOLL_CTL_DEL 2
 #define EPOLL_CTL_MOD 3
 
+/*
+ * Set exclusive wakeup mode for the target file descriptor: when several
+ * epoll sets wait on it, an event wakes up one of them rather than all.
+ */
+#define EPOLLEXCLUSIVE (1 << 28)
+
 /* Set the One Shot behaviour for the target file descriptor */
 #define EPOLLONESHOT (1 << 30)
 
@@ -51,8 +57,12 @@ struct epoll_event {
 
 #ifdef __KERNEL__
 
+#include <linux/ktime.h>
+
 /* Forward declarations to avoid compiler errors */
 struct file;
+struct pollfd;
+struct pollset;
 
 
 #ifdef CONFIG_EPOLL
@@ -95,6 +105,12 @@ static inline void eventpoll_release(struct file *file)
 	eventpoll_release_file(file);
 }
 
+/* Persistent interest sets behind the poll(2) fast path, see fs/select.c */
+struct pollset *pollset_alloc(void);
+void pollset_free(struct pollset *ps);
+int pollset_poll(struct pollset *ps, struct pollfd *fds, unsigned int nfds,
+		 ktime_t *expires, unsigned long slack, int timed_out);
+
 #else
 
 static inline void eventpoll_init_file(struct file *file) {}
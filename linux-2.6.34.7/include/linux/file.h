@@ -10,6 +10,7 @@
 #include <linux/posix_types.h>
 
 struct file;
+struct files_struct;
 
 extern void __fput(struct file *);
 extern void fput(struct file *);
@@ -32,11 +33,15 @@ extern struct file *fget(unsigned int fd);
 extern struct file *fget_light(unsigned int fd, int *fput_needed);
 extern void set_close_on_exec(unsigned int fd, int flag);
 extern void put_filp(struct file *);
+extern int __alloc_fd(struct files_struct *files, unsigned start,
+		      unsigned long end, unsigned flags);
 extern int alloc_fd(unsigned start, unsigned flags);
 extern int get_unused_fd(void);
 #define get_unused_fd_flags(flags) alloc_fd(0, (flags))
 extern void put_unused_fd(unsigned int fd);
 
+extern void __fd_install(struct files_struct *files, unsigned int fd,
+			 struct file *file);
 extern void fd_install(unsigned int fd, struct file *file);
 
 #endif /* __LINUX_FILE_H */
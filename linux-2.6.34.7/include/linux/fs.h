@@ -176,6 +176,7 @@ struct inodes_stat_t {
 #define FS_REQUIRES_DEV 1 
 #define FS_BINARY_MOUNTDATA 2
 #define FS_HAS_SUBTYPE 4
+#define FS_STABLE_BMAP	8	/* Overwrites stay in the blocks bmap() gave */
 #define FS_REVAL_DOT	16384	/* Check the paths ".", ".." for staleness */
 #define FS_RENAME_DOES_D_MOVE	32768	/* FS will handle d_move()
 					 * during rename() internally.
@@ -884,6 +885,18 @@ struct fown_struct {
 	int signum;		/* posix.1b rt signal to be delivered on IO */
 };
 
+/*
+ * A readahead window put aside while another stream on the same file
+ * is being read.
+ */
+struct ra_stream {
+	pgoff_t start;
+	unsigned int size;
+	unsigned int async_size;
+};
+
+#define RA_STREAMS	2
+
 /*
  * Track a single file's readahead state
  */
@@ -896,6 +909,15 @@ struct file_ra_state {
 	unsigned int ra_pages;		/* Maximum readahead window */
 	unsigned int mmap_miss;		/* Cache miss stat for mmap accesses */
 	loff_t prev_pos;		/* Cache last read() position */
+
+	unsigned int thrash_size;	/* Window cap after read ahead pages
+					   were evicted unused, or 0 */
+	unsigned int stride;		/* Distance between the last misses */
+	pgoff_t prev_miss;		/* Last small random miss */
+	pgoff_t stride_next;		/* Next record to read ahead, and */
+	unsigned int stride_chunk;	/* its size, once a stride is seen */
+
+	struct ra_stream streams[RA_STREAMS];	/* Interleaved streams */
 };
 
 /*
@@ -0,0 +1,102 @@
+#ifndef _LINUX_IO_RING_H
+#define _LINUX_IO_RING_H
+/*
+ * Ring based asynchronous I/O.
+ *
+ * Requests are queued by filling in submission queue entries in memory
+ * shared with the kernel and completions are read back from a shared
+ * completion queue, so neither needs a copy to or from user space.
+ * See Documentation/filesystems/io_ring.txt.
+ */
+
+#include <linux/types.h>
+
+/*
+ * A submission queue entry.
+ */
+struct io_ring_sqe {
+	__u8	opcode;		/* IORING_OP_* */
+	__u8	flags;		/* must be zero */
+	__u16	poll_events;	/* IORING_OP_POLL_ADD mask */
+	__s32	fd;
+	__u64	off;		/* file offset, or -1 for the file position */
+	__u64	addr;		/* buffer or sockaddr */
+	__u32	len;		/* buffer length */
+	__u32	op_flags;	/* IORING_FSYNC_* or SOCK_* for accept */
+	__u64	user_data;	/* passed back in the completion */
+	__u64	addr2;		/* accept: socklen_t pointer */
+	__u64	__pad[2];
+};
+
+#define IORING_OP_NOP		0
+#define IORING_OP_READ		1
+#define IORING_OP_WRITE		2
+#define IORING_OP_FSYNC		3
+#define IORING_OP_POLL_ADD	4
+#define IORING_OP_ACCEPT	5
+
+#define IORING_FSYNC_DATASYNC	(1U << 0)
+
+/*
+ * A completion queue entry.  res is what the equivalent system call
+ * would have returned, or a negative errno.
+ */
+struct io_ring_cqe {
+	__u64	user_data;
+	__s32	res;
+	__u32	flags;
+};
+
+/*
+ * Magic offsets for mmap() on the ring file descriptor.
+ */
+#define IORING_OFF_SQ_RING	0ULL
+#define IORING_OFF_CQ_RING	0x8000000ULL
+#define IORING_OFF_SQES		0x10000000ULL
+
+/*
+ * Where the fields of the rings live, relative to their mappings.
+ */
+struct io_sqring_offsets {
+	__u32 head;
+	__u32 tail;
+	__u32 ring_mask;
+	__u32 ring_entries;
+	__u32 flags;
+	__u32 dropped;
+	__u32 array;
+	__u32 resv1;
+	__u64 resv2;
+};
+
+/* sq_ring->flags: the polling thread is asleep */
+#define IORING_SQ_NEED_WAKEUP	(1U << 0)
+
+struct io_cqring_offsets {
+	__u32 head;
+	__u32 tail;
+	__u32 ring_mask;
+	__u32 ring_entries;
+	__u32 overflow;
+	__u32 cqes;
+	__u64 resv[2];
+};
+
+/* io_ring_params->flags */
+#define IORING_SETUP_SQPOLL	(1U << 0)	/* kernel thread submits */
+
+struct io_ring_params {
+	__u32 sq_entries;
+	__u32 cq_entries;
+	__u32 flags;
+	__u32 sq_thread_idle;	/* milliseconds */
+	__u32 resv[4];
+	struct io_sqring_offsets sq_off;
+	struct io_cqring_offsets cq_off;
+};
+
+/* io_ring_enter() flags */
+#define IORING_ENTER_GETEVENTS	(1U << 0)
+#define IORING_ENTER_SQ_WAKEUP	(1U << 1)
+
+#endif /* _LINUX_IO_RING_H */
@@ -28,6 +28,16 @@ enum {
 
 struct loop_func_table;
 
+/*
+ * A run of the backing file that is contiguous on the underlying block
+ * device, in 512 byte sectors.
+ */
+struct loop_extent {
+	sector_t	file_start;
+	sector_t	nr_sects;
+	sector_t	disk_start;
+};
+
 struct loop_device {
 	int		lo_number;
 	int		lo_refcnt;
@@ -65,6 +75,21 @@ struct loop_device {
 	struct request_queue	*lo_queue;
 	struct gendisk		*lo_disk;
 	struct list_head	lo_list;
+
+	/* LO_FLAGS_DIRECT_MAP state */
+	struct loop_extent	*lo_extents;
+	unsigned int		lo_nr_extents;
+	struct block_device	*lo_map_bdev;
+	struct inode		*lo_map_inode;	/* pinned with S_SWAPFILE */
+	int			lo_map_deny;	/* taken from its i_writecount */
+	struct bio_set		*lo_dio_bs;
+	mempool_t		*lo_dio_pool;
+	atomic_t		lo_dio_inflight;
+	wait_queue_head_t	lo_dio_wait;
+	struct bio_list		lo_dio_list;	/* left to the loop thread */
+	int			lo_dio_busy;	/* loop thread is submitting */
+	int			lo_dio_frozen;	/* switching modes */
+	struct bio_list		lo_hold_list;	/* bios held meanwhile */
 };
 
 #endif /* __KERNEL__ */
@@ -76,6 +101,7 @@ enum {
 	LO_FLAGS_READ_ONLY	= 1,
 	LO_FLAGS_USE_AOPS	= 2,
 	LO_FLAGS_AUTOCLEAR	= 4,
+	LO_FLAGS_DIRECT_MAP	= 8,
 };
 
 #include <asm/posix_types.h>	/* for __kernel_old_dev_t */
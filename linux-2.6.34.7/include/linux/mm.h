@@ -1323,6 +1323,20 @@ unsigned long ra_submit(struct file_ra_state *ra,
 			struct address_space *mapping,
 			struct file *filp);
 
+void __page_cache_readahead_hit(struct address_space *mapping,
+				struct page *page);
+
+/*
+ * Called when a reader gets to a page cache page, to count the pages
+ * that readahead brought in before they were needed.
+ */
+static inline void page_cache_readahead_hit(struct address_space *mapping,
+					    struct page *page)
+{
+	if (unlikely(PageReadaheadUnused(page)))
+		__page_cache_readahead_hit(mapping, page);
+}
+
 /* Do stack extension */
 extern int expand_stack(struct vm_area_struct *vma, unsigned long address);
 #ifdef CONFIG_IA64
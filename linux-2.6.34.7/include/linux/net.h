@@ -42,6 +42,7 @@
 #define SYS_RECVMSG	17		/* sys_recvmsg(2)		*/
 #define SYS_ACCEPT4	18		/* sys_accept4(2)		*/
 #define SYS_RECVMMSG	19		/* sys_recvmmsg(2)		*/
+#define SYS_SENDMMSG	20		/* sys_sendmmsg(2)		*/
 
 typedef enum {
 	SS_FREE = 0,			/* not allocated		*/
@@ -55,6 +56,7 @@ typedef enum {
 
 #ifdef __KERNEL__
 #include <linux/stringify.h>
+#include <linux/err.h>
 #include <linux/random.h>
 #include <linux/wait.h>
 #include <linux/fcntl.h>	/* For O_CLOEXEC and O_NONBLOCK */
@@ -192,6 +194,9 @@ struct proto_ops {
 #endif
 	int		(*sendmsg)   (struct kiocb *iocb, struct socket *sock,
 				      struct msghdr *m, size_t total_len);
+	/* optional: as ->sendmsg, with the socket lock already held */
+	int		(*sendmsg_locked)(struct kiocb *iocb, struct socket *sock,
+				      struct msghdr *m, size_t total_len);
 	int		(*recvmsg)   (struct kiocb *iocb, struct socket *sock,
 				      struct msghdr *m, size_t total_len,
 				      int flags);
@@ -201,6 +206,8 @@ struct proto_ops {
 				      int offset, size_t size, int flags);
 	ssize_t 	(*splice_read)(struct socket *sock,  loff_t *ppos,
 				       struct pipe_inode_info *pipe, size_t len, unsigned int flags);
+	ssize_t		(*splice_direct)(struct socket *sock, struct file *out,
+					 loff_t *ppos, size_t len, unsigned int flags);
 };
 
 #define DECLARE_SOCKADDR(type, dst, src)	\
@@ -272,6 +279,38 @@ extern int kernel_sock_ioctl(struct socket *sock, int cmd, unsigned long arg);
 extern int kernel_sock_shutdown(struct socket *sock,
 				enum sock_shutdown_cmd how);
 
+#ifdef CONFIG_NET
+extern struct file *sock_accept_file(struct file *file,
+				     struct sockaddr __user *upeer_sockaddr,
+				     int __user *upeer_addrlen, int flags,
+				     int nonblock);
+extern ssize_t sock_rw_nonblock(struct file *file, void __user *buf,
+				size_t len, int write);
+extern long sock_splice_direct(struct file *in, struct file *out,
+			       loff_t *ppos, size_t len, unsigned int flags);
+#else
+static inline struct file *sock_accept_file(struct file *file,
+					    struct sockaddr __user *upeer_sockaddr,
+					    int __user *upeer_addrlen,
+					    int flags, int nonblock)
+{
+	return ERR_PTR(-ENOTSOCK);
+}
+
+static inline ssize_t sock_rw_nonblock(struct file *file, void __user *buf,
+				       size_t len, int write)
+{
+	return -ENOTSOCK;
+}
+
+static inline long sock_splice_direct(struct file *in, struct file *out,
+				      loff_t *ppos, size_t len,
+				      unsigned int flags)
+{
+	return -EINVAL;
+}
+#endif
+
 #define MODULE_ALIAS_NETPROTO(proto) \
 	MODULE_ALIAS("net-pf-" __stringify(proto))
 
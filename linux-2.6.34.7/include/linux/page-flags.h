@@ -99,6 +99,7 @@ enum pageflags {
 	PG_buddy,		/* Page is free, on buddy lists */
 	PG_swapbacked,		/* Page is backed by RAM/swap */
 	PG_unevictable,		/* Page is "unevictable"  */
+	PG_readahead_unused,	/* Read ahead, not yet read by anyone */
 #ifdef CONFIG_MMU
 	PG_mlocked,		/* Page is vma mlocked */
 #endif
@@ -238,6 +239,16 @@ PAGEFLAG(MappedToDisk, mappedtodisk)
 /* PG_readahead is only used for file reads; PG_reclaim is only for writes */
 PAGEFLAG(Reclaim, reclaim) TESTCLEARFLAG(Reclaim, reclaim)
 PAGEFLAG(Readahead, reclaim)		/* Reminder to do async read-ahead */
+/*
+ * PG_readahead_unused drives the per-bdi readahead hit/waste counters.
+ * It needs a bit of its own: PG_readahead marks a single page per window
+ * and is cleared when the next window starts, and PG_referenced is set
+ * by writers and left clear by mmap readers.  The bit costs one from the
+ * fields area; where that is short, NODE_NOT_IN_PAGE_FLAGS moves the node
+ * id out of page->flags.
+ */
+PAGEFLAG(ReadaheadUnused, readahead_unused)
+	TESTCLEARFLAG(ReadaheadUnused, readahead_unused)
 
 #ifdef CONFIG_HIGHMEM
 /*
@@ -291,6 +291,8 @@ static inline pgoff_t linear_page_index(struct vm_area_struct *vma,
 
 extern void __lock_page(struct page *page);
 extern int __lock_page_killable(struct page *page);
+struct kiocb;
+extern int __lock_page_async(struct page *page, struct kiocb *iocb);
 extern void __lock_page_nosync(struct page *page);
 extern void unlock_page(struct page *page);
 
@@ -332,6 +334,21 @@ static inline int lock_page_killable(struct page *page)
 	return 0;
 }
 
+/*
+ * lock_page_async is lock_page_killable for aio reads that can be
+ * retried: rather than sleep it queues the kiocb's wait entry to kick
+ * @iocb when the page is unlocked and returns -EIOCBRETRY.  With no
+ * @iocb it sleeps.
+ */
+static inline int lock_page_async(struct page *page, struct kiocb *iocb)
+{
+	if (!iocb)
+		return lock_page_killable(page);
+	if (trylock_page(page))
+		return 0;
+	return __lock_page_async(page, iocb);
+}
+
 /*
  * lock_page_nosync should only be used if we can't pin the page's inode.
  * Doesn't play quite so well with block device plugging.
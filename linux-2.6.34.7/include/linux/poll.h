@@ -136,6 +136,15 @@ extern int core_sys_select(int n, fd_set __user *inp, fd_set __user *outp,
 
 extern int poll_select_set_timeout(struct timespec *to, long sec, long nsec);
 
+struct poll_cache;
+#ifdef CONFIG_EPOLL
+extern void free_poll_cache(struct poll_cache *pc);
+#else
+static inline void free_poll_cache(struct poll_cache *pc)
+{
+}
+#endif
+
 #endif /* KERNEL */
 
 #endif /* _LINUX_POLL_H */
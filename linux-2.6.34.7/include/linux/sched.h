@@ -1004,6 +1004,7 @@ partition_sched_domains(int ndoms_new, cpumask_var_t doms_new[],
 
 
 struct io_context;			/* See blkdev.h */
+struct poll_cache;			/* See fs/select.c */
 
 
 #ifdef ARCH_HAS_PREFETCH_SWITCH_STACK
@@ -1457,6 +1458,10 @@ struct task_struct {
 	 * cache last used pipe for splice
 	 */
 	struct pipe_inode_info *splice_pipe;
+	/*
+	 * persistent interest set for the last pollfd array
+	 */
+	struct poll_cache *poll_cache;
 #ifdef	CONFIG_TASK_DELAY_ACCT
 	struct task_delay_info *delays;
 #endif
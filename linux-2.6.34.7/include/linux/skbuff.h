@@ -94,6 +94,7 @@
 struct net_device;
 struct scatterlist;
 struct pipe_inode_info;
+struct file;
 
 #if defined(CONFIG_NF_CONNTRACK) || defined(CONFIG_NF_CONNTRACK_MODULE)
 struct nf_conntrack {
@@ -300,6 +301,7 @@ typedef unsigned char *sk_buff_data_t;
  *	@ndisc_nodetype: router type (from link layer)
  *	@dma_cookie: a cookie to one of several possible DMA operations
  *		done by skb DMA functions
+ *	@napi_id: id of the NAPI context this buffer was received on
  *	@secmark: security marking
  *	@vlan_tci: vlan tag control information
  */
@@ -381,6 +383,9 @@ struct sk_buff {
 #ifdef CONFIG_NET_DMA
 	dma_cookie_t		dma_cookie;
 #endif
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	unsigned int		napi_id;
+#endif
 #ifdef CONFIG_NETWORK_SECMARK
 	__u32			secmark;
 #endif
@@ -1773,6 +1778,12 @@ extern int             skb_splice_bits(struct sk_buff *skb,
 						struct pipe_inode_info *pipe,
 						unsigned int len,
 						unsigned int flags);
+extern int             skb_splice_direct(struct sk_buff *skb,
+						  unsigned int offset,
+						  struct file *out,
+						  loff_t *ppos,
+						  unsigned int len,
+						  unsigned int flags);
 extern void	       skb_copy_and_csum_dev(const struct sk_buff *skb, u8 *to);
 extern void	       skb_split(struct sk_buff *skb,
 				 struct sk_buff *skb1, const u32 len);
@@ -227,6 +227,9 @@ enum
 	LINUX_MIB_SACKSHIFTFALLBACK,
 	LINUX_MIB_TCPBACKLOGDROP,
 	LINUX_MIB_TCPMINTTLDROP, /* RFC 5082 */
+	LINUX_MIB_BUSYPOLLRXPACKETS,		/* BusyPollRxPackets */
+	LINUX_MIB_BUSYPOLLHITS,			/* BusyPollHits */
+	LINUX_MIB_BUSYPOLLSLEEPS,		/* BusyPollSleeps */
 	__LINUX_MIB_MAX
 };
 
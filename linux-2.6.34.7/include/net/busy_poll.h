@@ -0,0 +1,124 @@
+/*
+ * Busy polling of a device's receive queue from process context.
+ *
+ * A task about to sleep waiting for packets can instead call the
+ * ->poll() routine of the NAPI context those packets arrive on, and so
+ * pick them up without waiting for an interrupt, the softirq and a
+ * wakeup.  Each packet records the NAPI context it was received on and
+ * each socket remembers the one its last packet came from.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+#ifndef _NET_BUSY_POLL_H
+#define _NET_BUSY_POLL_H
+
+#include <linux/netdevice.h>
+#include <net/sock.h>
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+
+extern unsigned int sysctl_net_busy_read;
+extern unsigned int sysctl_net_busy_poll;
+
+extern bool napi_busy_loop(unsigned int napi_id, unsigned long usecs,
+			   bool (*loop_end)(void *), void *loop_end_arg);
+
+/* Is busy polling enabled for poll(), select() and epoll_wait()? */
+static inline bool net_busy_loop_on(void)
+{
+	return sysctl_net_busy_poll;
+}
+
+static inline bool sk_can_busy_loop(struct sock *sk)
+{
+	return sk->sk_ll_usec && sk->sk_napi_id && !signal_pending(current);
+}
+
+static inline bool sk_busy_loop_end(void *p)
+{
+	struct sock *sk = p;
+
+	return !skb_queue_empty(&sk->sk_receive_queue);
+}
+
+/*
+ * Poll the device @sk last received from until a packet is queued on
+ * @sk, for at most SO_BUSY_POLL microseconds or just once if @nonblock.
+ * Must be called without the socket lock, or the packets would only
+ * get as far as the backlog.  Returns true if there is data to read.
+ */
+static inline bool sk_busy_loop(struct sock *sk, int nonblock)
+{
+	return napi_busy_loop(sk->sk_napi_id, nonblock ? 0 : sk->sk_ll_usec,
+			      sk_busy_loop_end, sk);
+}
+
+static inline void skb_mark_napi_id(struct sk_buff *skb,
+				    struct napi_struct *napi)
+{
+	skb->napi_id = napi->napi_id;
+}
+
+static inline void sk_mark_napi_id(struct sock *sk, const struct sk_buff *skb)
+{
+	sk->sk_napi_id = skb->napi_id;
+}
+
+/*
+ * The NAPI context the socket behind @file last received on, or zero
+ * if it isn't a socket.
+ */
+static inline unsigned int file_napi_id(struct file *file)
+{
+	struct inode *inode = file->f_path.dentry->d_inode;
+	struct sock *sk;
+
+	if (!S_ISSOCK(inode->i_mode))
+		return 0;
+
+	sk = SOCKET_I(inode)->sk;
+	return sk ? ACCESS_ONCE(sk->sk_napi_id) : 0;
+}
+
+#else /* CONFIG_NET_RX_BUSY_POLL */
+
+static inline bool napi_busy_loop(unsigned int napi_id, unsigned long usecs,
+				  bool (*loop_end)(void *), void *loop_end_arg)
+{
+	return false;
+}
+
+static inline bool net_busy_loop_on(void)
+{
+	return false;
+}
+
+static inline bool sk_can_busy_loop(struct sock *sk)
+{
+	return false;
+}
+
+static inline bool sk_busy_loop(struct sock *sk, int nonblock)
+{
+	return false;
+}
+
+static inline void skb_mark_napi_id(struct sk_buff *skb,
+				    struct napi_struct *napi)
+{
+}
+
+static inline void sk_mark_napi_id(struct sock *sk, const struct sk_buff *skb)
+{
+}
+
+static inline unsigned int file_napi_id(struct file *file)
+{
+	return 0;
+}
+
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+#endif /* _NET_BUSY_POLL_H */
@@ -26,6 +26,10 @@ extern int			inet_sendmsg(struct kiocb *iocb,
 					     struct socket *sock, 
 					     struct msghdr *msg, 
 					     size_t size);
+extern int			inet_sendmsg_locked(struct kiocb *iocb,
+						    struct socket *sock,
+						    struct msghdr *msg,
+						    size_t size);
 extern int			inet_shutdown(struct socket *sock, int how);
 extern int			inet_listen(struct socket *sock, int backlog);
 
@@ -189,6 +189,8 @@ struct sock_common {
   *	@sk_err_soft: errors that don't cause failure but are the cause of a
   *		      persistent failure not just 'timed out'
   *	@sk_drops: raw/udp drops counter
+  *	@sk_napi_id: id of the NAPI context the last packet came in on
+  *	@sk_ll_usec: %SO_BUSY_POLL setting, microseconds to busy poll for
   *	@sk_ack_backlog: current listen backlog
   *	@sk_max_ack_backlog: listen backlog set in listen()
   *	@sk_priority: %SO_PRIORITY setting
@@ -287,6 +289,10 @@ struct sock {
 	int			sk_err,
 				sk_err_soft;
 	atomic_t		sk_drops;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	unsigned int		sk_napi_id;
+	unsigned int		sk_ll_usec;
+#endif
 	unsigned short		sk_ack_backlog;
 	unsigned short		sk_max_ack_backlog;
 	__u32			sk_priority;
@@ -682,6 +688,9 @@ struct proto {
 #endif
 	int			(*sendmsg)(struct kiocb *iocb, struct sock *sk,
 					   struct msghdr *msg, size_t len);
+	int			(*sendmsg_locked)(struct kiocb *iocb,
+						  struct sock *sk,
+						  struct msghdr *msg, size_t len);
 	int			(*recvmsg)(struct kiocb *iocb, struct sock *sk,
 					   struct msghdr *msg,
 					size_t len, int noblock, int flags, 
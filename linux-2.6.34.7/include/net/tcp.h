@@ -334,6 +334,8 @@ extern void			tcp_twsk_destructor(struct sock *sk);
 
 extern ssize_t			tcp_splice_read(struct socket *sk, loff_t *ppos,
 					        struct pipe_inode_info *pipe, size_t len, unsigned int flags);
+extern ssize_t			tcp_splice_direct(struct socket *sk, struct file *out,
+						  loff_t *ppos, size_t len, unsigned int flags);
 
 static inline void tcp_dec_quickack_mode(struct sock *sk,
 					 const unsigned int pkts)
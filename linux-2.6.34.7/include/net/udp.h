@@ -168,6 +168,8 @@ extern void	udp_err(struct sk_buff *, u32);
 
 extern int	udp_sendmsg(struct kiocb *iocb, struct sock *sk,
 			    struct msghdr *msg, size_t len);
+extern int	udp_sendmsg_locked(struct kiocb *iocb, struct sock *sk,
+				   struct msghdr *msg, size_t len);
 extern void	udp_flush_pending_frames(struct sock *sk);
 
 extern int	udp_rcv(struct sk_buff *skb);
@@ -40,6 +40,7 @@
 #include <linux/mutex.h>
 #include <linux/futex.h>
 #include <linux/pipe_fs_i.h>
+#include <linux/poll.h>
 #include <linux/audit.h> /* for audit_free() */
 #include <linux/resource.h>
 #include <linux/blkdev.h>
@@ -1027,6 +1028,9 @@ NORET_TYPE void do_exit(long code)
 	if (tsk->splice_pipe)
 		__free_pipe_info(tsk->splice_pipe);
 
+	if (tsk->poll_cache)
+		free_poll_cache(tsk->poll_cache);
+
 	validate_creds_for_do_exit(tsk);
 
 	preempt_disable();
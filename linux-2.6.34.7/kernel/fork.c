@@ -273,6 +273,7 @@ static struct task_struct *dup_task_struct(struct task_struct *orig)
 	tsk->btrace_seq = 0;
 #endif
 	tsk->splice_pipe = NULL;
+	tsk->poll_cache = NULL;
 
 	account_kernel_stack(ti, 1);
 
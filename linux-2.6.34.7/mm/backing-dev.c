@@ -99,6 +99,9 @@ static int bdi_debug_stats_show(struct seq_file *m, void *v)
 		   "BdiDirtyThresh:   %8lu kB\n"
 		   "DirtyThresh:      %8lu kB\n"
 		   "BackgroundThresh: %8lu kB\n"
+		   "ReadaheadHits:    %8lu kB\n"
+		   "ReadaheadMisses:  %8lu\n"
+		   "ReadaheadWasted:  %8lu kB\n"
 		   "WritebackThreads: %8lu\n"
 		   "b_dirty:          %8lu\n"
 		   "b_io:             %8lu\n"
@@ -111,7 +114,11 @@ static int bdi_debug_stats_show(struct seq_file *m, void *v)
 		   (unsigned long) K(bdi_stat(bdi, BDI_WRITEBACK)),
 		   (unsigned long) K(bdi_stat(bdi, BDI_RECLAIMABLE)),
 		   K(bdi_thresh), K(dirty_thresh),
-		   K(background_thresh), nr_wb, nr_dirty, nr_io, nr_more_io,
+		   K(background_thresh),
+		   (unsigned long) K(bdi_stat(bdi, BDI_RA_HIT)),
+		   (unsigned long) bdi_stat(bdi, BDI_RA_MISS),
+		   (unsigned long) K(bdi_stat(bdi, BDI_RA_WASTED)),
+		   nr_wb, nr_dirty, nr_io, nr_more_io,
 		   !list_empty(&bdi->bdi_list), bdi->state, bdi->wb_mask,
 		   !list_empty(&bdi->wb_list), bdi->wb_cnt);
 #undef K
@@ -222,12 +229,19 @@ static ssize_t max_ratio_store(struct device *dev,
 }
 BDI_SHOW(max_ratio, bdi->max_ratio)
 
+BDI_SHOW(read_ahead_hits, bdi_stat_sum(bdi, BDI_RA_HIT))
+BDI_SHOW(read_ahead_misses, bdi_stat_sum(bdi, BDI_RA_MISS))
+BDI_SHOW(read_ahead_wasted, bdi_stat_sum(bdi, BDI_RA_WASTED))
+
 #define __ATTR_RW(attr) __ATTR(attr, 0644, attr##_show, attr##_store)
 
 static struct device_attribute bdi_dev_attrs[] = {
 	__ATTR_RW(read_ahead_kb),
 	__ATTR_RW(min_ratio),
 	__ATTR_RW(max_ratio),
+	__ATTR_RO(read_ahead_hits),
+	__ATTR_RO(read_ahead_misses),
+	__ATTR_RO(read_ahead_wasted),
 	__ATTR_NULL,
 };
 
@@ -138,6 +138,9 @@ void __remove_from_page_cache(struct page *page)
 		dec_zone_page_state(page, NR_FILE_DIRTY);
 		dec_bdi_stat(mapping->backing_dev_info, BDI_RECLAIMABLE);
 	}
+
+	if (TestClearPageReadaheadUnused(page))
+		inc_bdi_stat(mapping->backing_dev_info, BDI_RA_WASTED);
 }
 
 void remove_from_page_cache(struct page *page)
@@ -152,12 +155,9 @@ void remove_from_page_cache(struct page *page)
 	mem_cgroup_uncharge_cache_page(page);
 }
 
-static int sync_page(void *word)
+static void __sync_page(struct page *page)
 {
 	struct address_space *mapping;
-	struct page *page;
-
-	page = container_of((unsigned long *)word, struct page, flags);
 
 	/*
 	 * page_mapping() is being called without PG_locked held.
@@ -184,6 +184,11 @@ static int sync_page(void *word)
 	mapping = page_mapping(page);
 	if (mapping && mapping->a_ops && mapping->a_ops->sync_page)
 		mapping->a_ops->sync_page(page);
+}
+
+static int sync_page(void *word)
+{
+	__sync_page(container_of((unsigned long *)word, struct page, flags));
 	io_schedule();
 	return 0;
 }
@@ -591,6 +596,47 @@ int __lock_page_killable(struct page *page)
 }
 EXPORT_SYMBOL_GPL(__lock_page_killable);
 
+/**
+ * __lock_page_async - lock a page or arrange for an aio retry
+ * @page: the page to lock
+ * @iocb: the kiocb to kick
+ *
+ * Returns 0 if the page was locked, or -EIOCBRETRY once @iocb's wait
+ * entry has been queued to kick it when the page is unlocked.  The
+ * entry stays queued until it is woken or aio_dequeue_wait() takes it
+ * off again, which the read does as soon as it makes progress.
+ */
+int __lock_page_async(struct page *page, struct kiocb *iocb)
+{
+	wait_queue_head_t *q = page_waitqueue(page);
+	struct wait_bit_queue *wait = &iocb->ki_wait;
+	unsigned long flags;
+
+	/* Still queued for a page from an earlier pass? */
+	if (iocb->ki_wait_head != q)
+		aio_dequeue_wait(iocb);
+
+	spin_lock_irqsave(&q->lock, flags);
+	wait->key.flags = &page->flags;
+	wait->key.bit_nr = PG_locked;
+	if (list_empty(&wait->wait.task_list))
+		__add_wait_queue_tail(q, &wait->wait);
+	iocb->ki_wait_head = q;
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	/* Nobody is going to sleep in sync_page() for this read. */
+	__sync_page(page);
+
+	/* The page may have been unlocked before we were queued. */
+	if (trylock_page(page)) {
+		aio_dequeue_wait(iocb);
+		return 0;
+	}
+
+	return -EIOCBRETRY;
+}
+EXPORT_SYMBOL_GPL(__lock_page_async);
+
 /**
  * __lock_page_nosync - get a lock on the page, without calling sync_page()
  * @page: the page to lock
@@ -955,15 +1001,21 @@ static void shrink_readahead_size_eio(struct file *filp,
  * @ppos:	current file position
  * @desc:	read_descriptor
  * @actor:	read method
+ * @iocb:	aio kiocb to kick, or NULL to sleep on page locks
  *
  * This is a generic file read routine, and uses the
  * mapping->a_ops->readpage() function for the actual low-level stuff.
  *
+ * With an @iocb the read never sleeps for a page to be read in:
+ * it stops with -EIOCBRETRY in desc->error and the kiocb is kicked to
+ * carry on from there once the page is unlocked.
+ *
  * This is really ugly. But the goto's actually try to clarify some
  * of the logic when it comes to error handling etc.
  */
 static void do_generic_file_read(struct file *filp, loff_t *ppos,
-		read_descriptor_t *desc, read_actor_t actor)
+		read_descriptor_t *desc, read_actor_t actor,
+		struct kiocb *iocb)
 {
 	struct address_space *mapping = filp->f_mapping;
 	struct inode *inode = mapping->host;
@@ -998,6 +1050,7 @@ find_page:
 			if (unlikely(page == NULL))
 				goto no_cached_page;
 		}
+		page_cache_readahead_hit(mapping, page);
 		if (PageReadahead(page)) {
 			page_cache_async_readahead(mapping,
 					ra, filp, page,
@@ -1080,7 +1133,7 @@ page_ok:
 
 page_not_up_to_date:
 		/* Get exclusive access to the page ... */
-		error = lock_page_killable(page);
+		error = lock_page_async(page, iocb);
 		if (unlikely(error))
 			goto readpage_error;
 
@@ -1117,7 +1170,7 @@ readpage:
 		}
 
 		if (!PageUptodate(page)) {
-			error = lock_page_killable(page);
+			error = lock_page_async(page, iocb);
 			if (unlikely(error))
 				goto readpage_error;
 			if (!PageUptodate(page)) {
@@ -1314,7 +1367,8 @@ generic_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
 		if (desc.count == 0)
 			continue;
 		desc.error = 0;
-		do_generic_file_read(filp, ppos, &desc, file_read_actor);
+		do_generic_file_read(filp, ppos, &desc, file_read_actor,
+				     is_sync_kiocb(iocb) ? NULL : iocb);
 		retval += desc.written;
 		if (desc.error) {
 			retval = retval ?: desc.error;
@@ -1323,6 +1377,12 @@ generic_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
 		if (desc.count > 0)
 			break;
 	}
+	/*
+	 * A partial read is returned rather than retried, so the kiocb may
+	 * be completed and freed before the page it waits for is unlocked.
+	 */
+	if (retval > 0 && !is_sync_kiocb(iocb))
+		aio_dequeue_wait(iocb);
 out:
 	return retval;
 }
@@ -1506,6 +1566,7 @@ int filemap_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 		 * waiting for the lock.
 		 */
 		do_async_mmap_readahead(vma, ra, file, page, offset);
+		page_cache_readahead_hit(mapping, page);
 		lock_page(page);
 
 		/* Did it get truncated? */
@@ -1523,6 +1584,7 @@ retry_find:
 		page = find_lock_page(mapping, offset);
 		if (!page)
 			goto no_cached_page;
+		ClearPageReadaheadUnused(page);
 	}
 
 	/*
@@ -5217,6 +5217,7 @@ static struct trace_print_flags pageflag_names[] = {
 	{1UL << PG_buddy,		"buddy"		},
 	{1UL << PG_swapbacked,		"swapbacked"	},
 	{1UL << PG_unevictable,		"unevictable"	},
+	{1UL << PG_readahead_unused,	"readahead_unused" },
 #ifdef CONFIG_MMU
 	{1UL << PG_mlocked,		"mlocked"	},
 #endif
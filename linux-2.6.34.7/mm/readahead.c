@@ -20,13 +20,20 @@
 
 /*
  * Initialise a struct file's readahead state.  Assumes that the caller has
- * memset *ra to zero.
+ * memset *ra to zero, but clears the stride, thrashing and stream state
+ * itself for callers that keep one on the stack.
  */
 void
 file_ra_state_init(struct file_ra_state *ra, struct address_space *mapping)
 {
 	ra->ra_pages = mapping->backing_dev_info->ra_pages;
 	ra->prev_pos = -1;
+	ra->thrash_size = 0;
+	ra->stride = 0;
+	ra->prev_miss = 0;
+	ra->stride_next = 0;
+	ra->stride_chunk = 0;
+	memset(ra->streams, 0, sizeof(ra->streams));
 }
 EXPORT_SYMBOL_GPL(file_ra_state_init);
 
@@ -139,12 +146,15 @@ out:
  * behaviour which would occur if page allocations are causing VM writeback.
  * We really don't want to intermingle reads and writes like that.
  *
+ * The first @demand pages are about to be read by the caller, the rest
+ * are tagged PG_readahead_unused to count whether readahead paid off.
+ *
  * Returns the number of pages requested, or the maximum amount of I/O allowed.
  */
 static int
 __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 			pgoff_t offset, unsigned long nr_to_read,
-			unsigned long lookahead_size)
+			unsigned long lookahead_size, unsigned long demand)
 {
 	struct inode *inode = mapping->host;
 	struct page *page;
@@ -181,6 +191,8 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 		list_add(&page->lru, &page_pool);
 		if (page_idx == nr_to_read - lookahead_size)
 			SetPageReadahead(page);
+		if (page_idx >= demand)
+			SetPageReadaheadUnused(page);
 		ret++;
 	}
 
@@ -200,8 +212,9 @@ out:
  * Chunk the readahead into 2 megabyte units, so that we don't pin too much
  * memory at once.
  */
-int force_page_cache_readahead(struct address_space *mapping, struct file *filp,
-		pgoff_t offset, unsigned long nr_to_read)
+static int
+__force_page_cache_readahead(struct address_space *mapping, struct file *filp,
+		pgoff_t offset, unsigned long nr_to_read, unsigned long demand)
 {
 	int ret = 0;
 
@@ -217,7 +230,7 @@ int force_page_cache_readahead(struct address_space *mapping, struct file *filp,
 		if (this_chunk > nr_to_read)
 			this_chunk = nr_to_read;
 		err = __do_page_cache_readahead(mapping, filp,
-						offset, this_chunk, 0);
+						offset, this_chunk, 0, demand);
 		if (err < 0) {
 			ret = err;
 			break;
@@ -225,10 +238,18 @@ int force_page_cache_readahead(struct address_space *mapping, struct file *filp,
 		ret += err;
 		offset += this_chunk;
 		nr_to_read -= this_chunk;
+		demand -= min(demand, this_chunk);
 	}
 	return ret;
 }
 
+int force_page_cache_readahead(struct address_space *mapping, struct file *filp,
+		pgoff_t offset, unsigned long nr_to_read)
+{
+	return __force_page_cache_readahead(mapping, filp, offset,
+					    nr_to_read, 0);
+}
+
 /*
  * Given a desired number of PAGE_CACHE_SIZE readahead pages, return a
  * sensible upper limit.
@@ -239,18 +260,32 @@ unsigned long max_sane_readahead(unsigned long nr)
 		+ node_page_state(numa_node_id(), NR_FREE_PAGES)) / 2);
 }
 
+/*
+ * A reader got to a page that was read ahead.  Pages that are dropped
+ * before this happens are counted as wasted by the page cache.
+ */
+void __page_cache_readahead_hit(struct address_space *mapping,
+				struct page *page)
+{
+	if (TestClearPageReadaheadUnused(page))
+		inc_bdi_stat(mapping->backing_dev_info, BDI_RA_HIT);
+}
+
+static unsigned long __ra_submit(struct file_ra_state *ra,
+		struct address_space *mapping, struct file *filp,
+		unsigned long demand)
+{
+	return __do_page_cache_readahead(mapping, filp, ra->start, ra->size,
+					 ra->async_size, demand);
+}
+
 /*
  * Submit IO for the read-ahead request in file_ra_state.
  */
 unsigned long ra_submit(struct file_ra_state *ra,
 		       struct address_space *mapping, struct file *filp)
 {
-	int actual;
-
-	actual = __do_page_cache_readahead(mapping, filp,
-					ra->start, ra->size, ra->async_size);
-
-	return actual;
+	return __ra_submit(ra, mapping, filp, 0);
 }
 
 /*
@@ -328,7 +363,59 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
  *
  * The code ramps up the readahead size aggressively at first, but slow down as
  * it approaches max_readhead.
+ *
+ * If a sequential reader misses a page inside the current window, readahead
+ * pages are being evicted before they can be used.  The window is then capped
+ * to what the reader got through before that happened (thrash_size), and the
+ * cap is relaxed again a little for every window that is used up in full.
+ *
+ * A window that is given up for a new stream is kept in ra->streams, so that
+ * several interleaved streams each keep their window and keep ramping up.
+ */
+
+#define MIN_RA_PAGES	(VM_MIN_READAHEAD * 1024 / PAGE_CACHE_SIZE)
+
+/*
+ * Put the current window aside before starting a new one.
+ */
+static void ra_save_stream(struct file_ra_state *ra)
+{
+	if (!ra->size)
+		return;
+
+	memmove(ra->streams + 1, ra->streams,
+		(RA_STREAMS - 1) * sizeof(ra->streams[0]));
+	ra->streams[0].start = ra->start;
+	ra->streams[0].size = ra->size;
+	ra->streams[0].async_size = ra->async_size;
+}
+
+/*
+ * If @offset is where a window put aside expected its next read, swap
+ * it back in as the current one.
  */
+static int ra_resume_stream(struct file_ra_state *ra, pgoff_t offset)
+{
+	struct ra_stream *s, tmp;
+
+	for (s = ra->streams; s < ra->streams + RA_STREAMS; s++) {
+		if (!s->size)
+			continue;
+		if (offset != s->start + s->size - s->async_size &&
+		    offset != s->start + s->size)
+			continue;
+
+		tmp = *s;
+		s->start = ra->start;
+		s->size = ra->size;
+		s->async_size = ra->async_size;
+		ra->start = tmp.start;
+		ra->size = tmp.size;
+		ra->async_size = tmp.async_size;
+		return 1;
+	}
+	return 0;
+}
 
 /*
  * Count contiguously cached pages from @offset-1 to @offset-@max,
@@ -376,6 +463,7 @@ static int try_context_readahead(struct address_space *mapping,
 	if (size >= offset)
 		size *= 2;
 
+	ra_save_stream(ra);
 	ra->start = offset;
 	ra->size = get_init_ra_size(size + req_size, max);
 	ra->async_size = ra->size;
@@ -383,6 +471,81 @@ static int try_context_readahead(struct address_space *mapping,
 	return 1;
 }
 
+/*
+ * Strided reads, such as one record every few pages, leave holes that
+ * the page cache context above can't see through, so every record is a
+ * small random read.  Once the gap between such misses repeats, records
+ * are read ahead at that stride.  A sync miss elsewhere on the stride
+ * (e.g. an evicted record) restarts the batch from there.
+ *
+ * Returns 1 if @offset continues a stride; ra->stride_next is then the
+ * first record to read, and *@stride and *@chunk the stride and record
+ * size to read it with.  @ra is shared by every reader of the file and
+ * isn't locked, so those are read once here and passed on rather than
+ * read from @ra again.
+ */
+static int try_stride_readahead(struct file_ra_state *ra, pgoff_t offset,
+				unsigned long req_size,
+				bool hit_readahead_marker,
+				unsigned int *stride, unsigned int *chunk)
+{
+	unsigned int s = ACCESS_ONCE(ra->stride);
+	unsigned int c = ACCESS_ONCE(ra->stride_chunk);
+	pgoff_t prev_miss = ACCESS_ONCE(ra->prev_miss);
+	pgoff_t next = ACCESS_ONCE(ra->stride_next);
+	pgoff_t gap;
+
+	if (hit_readahead_marker) {
+		if (!s || !c || offset >= next || (next - offset) % s)
+			return 0;
+		*stride = s;
+		*chunk = c;
+		return 1;
+	}
+
+	gap = offset - prev_miss;
+	if (s && req_size < s && offset > prev_miss &&
+	    (gap == s || (c && gap % s == 0))) {
+		/* one more page for records that straddle a page boundary */
+		c = min_t(unsigned long, req_size + 1, s);
+		ra->prev_miss = offset;
+		ra->stride_next = offset;
+		ra->stride_chunk = c;
+		*stride = s;
+		*chunk = c;
+		return 1;
+	}
+
+	ra->stride = (offset > prev_miss && gap <= UINT_MAX) ? gap : 0;
+	ra->prev_miss = offset;
+	ra->stride_chunk = 0;
+	return 0;
+}
+
+/*
+ * Read the next batch of strided records, as many as fit in @max pages.
+ * The first page of the middle one is marked, so that the batch after
+ * it is started before the reader runs out.  The first @demand pages of
+ * the first record are being read right now.
+ */
+static unsigned long
+stride_readahead(struct address_space *mapping, struct file_ra_state *ra,
+		 struct file *filp, unsigned long max, unsigned long demand,
+		 unsigned int stride, unsigned int chunk)
+{
+	pgoff_t next = ACCESS_ONCE(ra->stride_next);
+	unsigned long nr = max_t(unsigned long, max / chunk, 1);
+	unsigned long i, ret = 0;
+
+	for (i = 0; i < nr; i++)
+		ret += __do_page_cache_readahead(mapping, filp,
+				next + i * stride, chunk,
+				i == nr / 2 ? chunk : 0, i ? 0 : demand);
+	ra->stride_next = next + nr * stride;
+
+	return ret;
+}
+
 /*
  * A minimal readahead algorithm for trivial sequential/random reads.
  */
@@ -393,6 +556,12 @@ ondemand_readahead(struct address_space *mapping,
 		   unsigned long req_size)
 {
 	unsigned long max = max_sane_readahead(ra->ra_pages);
+	/* pages from @offset on that the caller is about to read */
+	unsigned long demand = hit_readahead_marker ? 0 : req_size;
+	unsigned int stride, chunk;
+
+	if (ra->thrash_size)
+		max = min_t(unsigned long, max, ra->thrash_size);
 
 	/*
 	 * start of file
@@ -406,12 +575,42 @@ ondemand_readahead(struct address_space *mapping,
 	 */
 	if ((offset == (ra->start + ra->size - ra->async_size) ||
 	     offset == (ra->start + ra->size))) {
+		if (ra->thrash_size) {
+			ra->thrash_size += ra->thrash_size / 4 + 1;
+			if (ra->thrash_size >= ra->ra_pages)
+				ra->thrash_size = 0;
+		}
+		ra->start += ra->size;
+		ra->size = get_next_ra_size(ra, max);
+		ra->async_size = ra->size;
+		goto readit;
+	}
+
+	/*
+	 * It's the expected callback offset of another stream on this
+	 * file: bring its window back and push it forward.
+	 */
+	if (ra_resume_stream(ra, offset)) {
 		ra->start += ra->size;
 		ra->size = get_next_ra_size(ra, max);
 		ra->async_size = ra->size;
 		goto readit;
 	}
 
+	/*
+	 * A sequential reader missed a page inside the readahead window:
+	 * it was read ahead, and evicted before it could be used.  Cap the
+	 * window at what was used and start again from here.
+	 */
+	if (!hit_readahead_marker && ra_has_index(ra, offset) &&
+	    offset - (ra->prev_pos >> PAGE_CACHE_SHIFT) <= 1UL) {
+		ra->thrash_size = max_t(unsigned long, offset - ra->start,
+					MIN_RA_PAGES);
+		max = min_t(unsigned long, max, ra->thrash_size);
+		ra->size = 0;
+		goto initial_readahead;
+	}
+
 	/*
 	 * Hit a marked page without valid readahead state.
 	 * E.g. interleaved reads.
@@ -421,6 +620,11 @@ ondemand_readahead(struct address_space *mapping,
 	if (hit_readahead_marker) {
 		pgoff_t start;
 
+		if (try_stride_readahead(ra, offset, req_size, true,
+					 &stride, &chunk))
+			return stride_readahead(mapping, ra, filp, max, 0,
+						stride, chunk);
+
 		rcu_read_lock();
 		start = radix_tree_next_hole(&mapping->page_tree, offset+1,max);
 		rcu_read_unlock();
@@ -428,6 +632,7 @@ ondemand_readahead(struct address_space *mapping,
 		if (!start || start - offset > max)
 			return 0;
 
+		ra_save_stream(ra);
 		ra->start = start;
 		ra->size = start - offset;	/* old async_size */
 		ra->size += req_size;
@@ -455,13 +660,21 @@ ondemand_readahead(struct address_space *mapping,
 	if (try_context_readahead(mapping, ra, offset, req_size, max))
 		goto readit;
 
+	if (try_stride_readahead(ra, offset, req_size, false,
+				 &stride, &chunk))
+		return stride_readahead(mapping, ra, filp, max, demand,
+					stride, chunk);
+
 	/*
 	 * standalone, small random read
 	 * Read as is, and do not pollute the readahead state.
 	 */
-	return __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
+	return __do_page_cache_readahead(mapping, filp, offset, req_size, 0,
+					 demand);
 
 initial_readahead:
+	ra_save_stream(ra);
+	ra->stride_chunk = 0;
 	ra->start = offset;
 	ra->size = get_init_ra_size(req_size, max);
 	ra->async_size = ra->size > req_size ? ra->size - req_size : ra->size;
@@ -477,7 +690,12 @@ readit:
 		ra->size += ra->async_size;
 	}
 
-	return ra_submit(ra, mapping, filp);
+	/* a sync window never starts before @offset */
+	if (demand)
+		demand = offset + req_size > ra->start ?
+			 offset + req_size - ra->start : 0;
+
+	return __ra_submit(ra, mapping, filp, demand);
 }
 
 /**
@@ -502,9 +720,12 @@ void page_cache_sync_readahead(struct address_space *mapping,
 	if (!ra->ra_pages)
 		return;
 
+	inc_bdi_stat(mapping->backing_dev_info, BDI_RA_MISS);
+
 	/* be dumb */
 	if (filp && (filp->f_mode & FMODE_RANDOM)) {
-		force_page_cache_readahead(mapping, filp, offset, req_size);
+		__force_page_cache_readahead(mapping, filp, offset, req_size,
+					     req_size);
 		return;
 	}
 
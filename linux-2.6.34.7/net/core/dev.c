@@ -130,6 +130,7 @@
 #include <linux/jhash.h>
 #include <linux/random.h>
 #include <trace/events/napi.h>
+#include <net/busy_poll.h>
 
 #include "net-sysfs.h"
 
@@ -2804,6 +2805,7 @@ EXPORT_SYMBOL(skb_gro_reset_offset);
 
 gro_result_t napi_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 {
+	skb_mark_napi_id(skb, napi);
 	skb_gro_reset_offset(skb);
 
 	return napi_skb_finish(__napi_gro_receive(napi, skb), skb);
@@ -2903,6 +2905,7 @@ gro_result_t napi_gro_frags(struct napi_struct *napi)
 	if (!skb)
 		return GRO_DROP;
 
+	skb_mark_napi_id(skb, napi);
 	return napi_frags_finish(napi, skb, __napi_gro_receive(napi, skb));
 }
 EXPORT_SYMBOL(napi_gro_frags);
@@ -2954,7 +2957,8 @@ void __napi_complete(struct napi_struct *n)
 	BUG_ON(!test_bit(NAPI_STATE_SCHED, &n->state));
 	BUG_ON(n->gro_list);
 
-	list_del(&n->poll_list);
+	/* A busy poll owns the instance without putting it on a list */
+	list_del_init(&n->poll_list);
 	smp_mb__before_clear_bit();
 	clear_bit(NAPI_STATE_SCHED, &n->state);
 }
@@ -2978,6 +2982,145 @@ void napi_complete(struct napi_struct *n)
 }
 EXPORT_SYMBOL(napi_complete);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+#define NAPI_HASH_BITS	8
+#define BUSY_POLL_BUDGET	8
+
+unsigned int sysctl_net_busy_read __read_mostly;
+unsigned int sysctl_net_busy_poll __read_mostly;
+
+static struct hlist_head napi_hash[1 << NAPI_HASH_BITS];
+static DEFINE_SPINLOCK(napi_hash_lock);
+static unsigned int napi_gen_id;
+
+static struct napi_struct *napi_by_id(unsigned int napi_id)
+{
+	struct napi_struct *napi;
+	struct hlist_node *node;
+
+	hlist_for_each_entry_rcu(napi, node,
+				 &napi_hash[hash_32(napi_id, NAPI_HASH_BITS)],
+				 napi_hash_node)
+		if (napi->napi_id == napi_id)
+			return napi;
+
+	return NULL;
+}
+
+static void napi_hash_add(struct napi_struct *napi)
+{
+	spin_lock(&napi_hash_lock);
+
+	/* Zero means "not received through NAPI", skip it on wrap */
+	do {
+		if (unlikely(++napi_gen_id == 0))
+			napi_gen_id = 1;
+	} while (napi_by_id(napi_gen_id));
+	napi->napi_id = napi_gen_id;
+
+	hlist_add_head_rcu(&napi->napi_hash_node,
+			   &napi_hash[hash_32(napi->napi_id, NAPI_HASH_BITS)]);
+
+	spin_unlock(&napi_hash_lock);
+}
+
+static void napi_hash_del(struct napi_struct *napi)
+{
+	if (!napi->napi_id)
+		return;
+
+	spin_lock(&napi_hash_lock);
+	hlist_del_rcu(&napi->napi_hash_node);
+	napi->napi_id = 0;
+	spin_unlock(&napi_hash_lock);
+
+	/* Busy pollers look the instance up under rcu_read_lock() */
+	synchronize_net();
+}
+
+static inline u64 busy_loop_us_clock(void)
+{
+	return cpu_clock(raw_smp_processor_id()) >> 10;
+}
+
+/**
+ * napi_busy_loop - poll a NAPI context from process context
+ * @napi_id: id of the context, as recorded in sk->sk_napi_id
+ * @usecs: how long to keep polling for, or 0 to poll just once
+ * @loop_end: returns true once the caller has something to do
+ * @loop_end_arg: argument to @loop_end
+ *
+ * Calls the driver's ->poll() routine directly, for as long as nobody
+ * else has the instance scheduled, until @loop_end is satisfied, @usecs
+ * have elapsed, a signal is pending or the CPU is wanted elsewhere.
+ * Returns the final result of @loop_end.
+ */
+bool napi_busy_loop(unsigned int napi_id, unsigned long usecs,
+		    bool (*loop_end)(void *), void *loop_end_arg)
+{
+	u64 end_time = busy_loop_us_clock() + usecs;
+	struct napi_struct *napi;
+	bool done;
+	int rc;
+
+	rcu_read_lock();
+
+	napi = napi_by_id(napi_id);
+	if (!napi) {
+		rcu_read_unlock();
+		return loop_end(loop_end_arg);
+	}
+
+	for (;;) {
+		rc = 0;
+		local_bh_disable();
+		if (napi_schedule_prep(napi)) {
+			void *have = netpoll_poll_lock(napi);
+
+			rc = napi->poll(napi, BUSY_POLL_BUDGET);
+			trace_napi_poll(napi);
+
+			/*
+			 * The driver used its whole budget and so still
+			 * owns NAPI_STATE_SCHED: leave the rest to the
+			 * softirq, as net_rx_action() would.
+			 */
+			if (rc == BUSY_POLL_BUDGET)
+				__napi_schedule(napi);
+			netpoll_poll_unlock(have);
+		}
+		if (rc > 0)
+			NET_ADD_STATS_BH(dev_net(napi->dev),
+					 LINUX_MIB_BUSYPOLLRXPACKETS, rc);
+		local_bh_enable();
+
+		done = loop_end(loop_end_arg);
+		if (done || !usecs || need_resched() ||
+		    signal_pending(current) ||
+		    busy_loop_us_clock() >= end_time)
+			break;
+		cpu_relax();
+	}
+
+	if (done)
+		NET_INC_STATS(dev_net(napi->dev), LINUX_MIB_BUSYPOLLHITS);
+	else if (usecs)
+		NET_INC_STATS(dev_net(napi->dev), LINUX_MIB_BUSYPOLLSLEEPS);
+
+	rcu_read_unlock();
+	return done;
+}
+EXPORT_SYMBOL(napi_busy_loop);
+#else
+static inline void napi_hash_add(struct napi_struct *napi)
+{
+}
+
+static inline void napi_hash_del(struct napi_struct *napi)
+{
+}
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
 void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 		    int (*poll)(struct napi_struct *, int), int weight)
 {
@@ -2994,6 +3137,7 @@ void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 	napi->poll_owner = -1;
 #endif
 	set_bit(NAPI_STATE_SCHED, &napi->state);
+	napi_hash_add(napi);
 }
 EXPORT_SYMBOL(netif_napi_add);
 
@@ -3001,6 +3145,7 @@ void netif_napi_del(struct napi_struct *napi)
 {
 	struct sk_buff *skb, *next;
 
+	napi_hash_del(napi);
 	list_del_init(&napi->dev_list);
 	napi_free_frags(napi);
 
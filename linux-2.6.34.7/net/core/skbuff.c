@@ -562,6 +562,9 @@ static void __copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 #endif
 #endif
 	new->vlan_tci		= old->vlan_tci;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	new->napi_id		= old->napi_id;
+#endif
 
 	skb_copy_secmark(new, old);
 }
@@ -1422,7 +1425,7 @@ static inline int spd_fill_page(struct splice_pipe_desc *spd, struct page *page,
 				struct sk_buff *skb, int linear,
 				struct sock *sk)
 {
-	if (unlikely(spd->nr_pages == PIPE_BUFFERS))
+	if (unlikely(spd->nr_pages == spd->nr_pages_max))
 		return 1;
 
 	if (linear) {
@@ -1526,24 +1529,14 @@ static int __skb_splice_bits(struct sk_buff *skb, unsigned int *offset,
 }
 
 /*
- * Map data from the skb to a pipe. Should handle both the linear part,
+ * Map data from the skb to spd. Should handle both the linear part,
  * the fragments, and the frag list. It does NOT handle frag lists within
  * the frag list, if such a thing exists. We'd probably need to recurse to
  * handle that cleanly.
  */
-int skb_splice_bits(struct sk_buff *skb, unsigned int offset,
-		    struct pipe_inode_info *pipe, unsigned int tlen,
-		    unsigned int flags)
+static void skb_fill_spd(struct sk_buff *skb, unsigned int offset,
+			 unsigned int tlen, struct splice_pipe_desc *spd)
 {
-	struct partial_page partial[PIPE_BUFFERS];
-	struct page *pages[PIPE_BUFFERS];
-	struct splice_pipe_desc spd = {
-		.pages = pages,
-		.partial = partial,
-		.flags = flags,
-		.ops = &sock_pipe_buf_ops,
-		.spd_release = sock_spd_release,
-	};
 	struct sk_buff *frag_iter;
 	struct sock *sk = skb->sk;
 
@@ -1551,10 +1544,10 @@ int skb_splice_bits(struct sk_buff *skb, unsigned int offset,
 	 * __skb_splice_bits() only fails if the output has no room left,
 	 * so no point in going over the frag_list for the error case.
 	 */
-	if (__skb_splice_bits(skb, &offset, &tlen, &spd, sk))
-		goto done;
+	if (__skb_splice_bits(skb, &offset, &tlen, spd, sk))
+		return;
 	else if (!tlen)
-		goto done;
+		return;
 
 	/*
 	 * now see if we have a frag_list to map
@@ -1562,14 +1555,36 @@ int skb_splice_bits(struct sk_buff *skb, unsigned int offset,
 	skb_walk_frags(skb, frag_iter) {
 		if (!tlen)
 			break;
-		if (__skb_splice_bits(frag_iter, &offset, &tlen, &spd, sk))
+		if (__skb_splice_bits(frag_iter, &offset, &tlen, spd, sk))
 			break;
 	}
+}
 
-done:
-	if (spd.nr_pages) {
-		int ret;
+/*
+ * Map data from the skb to a pipe.
+ */
+int skb_splice_bits(struct sk_buff *skb, unsigned int offset,
+		    struct pipe_inode_info *pipe, unsigned int tlen,
+		    unsigned int flags)
+{
+	struct partial_page partial[PIPE_DEF_BUFFERS];
+	struct page *pages[PIPE_DEF_BUFFERS];
+	struct splice_pipe_desc spd = {
+		.pages = pages,
+		.partial = partial,
+		.flags = flags,
+		.ops = &sock_pipe_buf_ops,
+		.spd_release = sock_spd_release,
+	};
+	struct sock *sk = skb->sk;
+	int ret = 0;
 
+	if (splice_grow_spd(pipe, &spd))
+		return -ENOMEM;
+
+	skb_fill_spd(skb, offset, tlen, &spd);
+
+	if (spd.nr_pages) {
 		/*
 		 * Drop the socket lock, otherwise we have reverse
 		 * locking dependencies between sk_lock and i_mutex
@@ -1582,10 +1597,88 @@ done:
 		release_sock(sk);
 		ret = splice_to_pipe(pipe, &spd);
 		lock_sock(sk);
-		return ret;
 	}
 
-	return 0;
+	splice_shrink_spd(&spd);
+	return ret;
+}
+
+static ssize_t skb_push_page(struct file *out, struct page *page,
+			     unsigned int offset, unsigned int len,
+			     loff_t *ppos, int more)
+{
+	mm_segment_t old_fs;
+	ssize_t ret;
+
+	if (out->f_op->sendpage)
+		return out->f_op->sendpage(out, page, offset, len, ppos, more);
+
+	old_fs = get_fs();
+	set_fs(get_ds());
+	/* The cast to a user pointer is valid due to the set_fs() */
+	ret = vfs_write(out, (__force const char __user *)kmap(page) + offset,
+			len, ppos);
+	kunmap(page);
+	set_fs(old_fs);
+
+	return ret;
+}
+
+/*
+ * Like skb_splice_bits(), but hand the pages straight to @out instead of
+ * going through a pipe.  Sockets get the page references themselves
+ * through ->sendpage(), anything else is written to with a single copy.
+ * Returns the number of bytes @out took, which is all the caller may
+ * consume from the socket.
+ */
+int skb_splice_direct(struct sk_buff *skb, unsigned int offset,
+		      struct file *out, loff_t *ppos, unsigned int tlen,
+		      unsigned int flags)
+{
+	struct partial_page partial[PIPE_DEF_BUFFERS];
+	struct page *pages[PIPE_DEF_BUFFERS];
+	struct splice_pipe_desc spd = {
+		.pages = pages,
+		.partial = partial,
+		.nr_pages_max = PIPE_DEF_BUFFERS,
+		.flags = flags,
+	};
+	struct sock *sk = skb->sk;
+	ssize_t sent = 0, ret = 0;
+	int i;
+
+	skb_fill_spd(skb, offset, tlen, &spd);
+	if (!spd.nr_pages)
+		return 0;
+
+	/*
+	 * Same locking rules as skb_splice_bits(), with the added twist
+	 * that @out may be a socket spliced back into us by someone else.
+	 * The pushes may block, and once the lock is dropped @skb may be
+	 * collapsed or eaten by another reader: only the page references
+	 * taken above are used from here on, and the caller has to look
+	 * the skb up again by sequence number after we return.
+	 */
+	release_sock(sk);
+	for (i = 0; i < spd.nr_pages; i++) {
+		unsigned int len = partial[i].len;
+		int more = (flags & SPLICE_F_MORE) || i + 1 < spd.nr_pages;
+
+		if (!ret) {
+			ret = skb_push_page(out, pages[i], partial[i].offset,
+					    len, ppos, more);
+			if (ret > 0)
+				sent += ret;
+			if (ret == len)
+				ret = 0;
+			else if (ret >= 0)
+				ret = -EAGAIN;	/* @out is full */
+		}
+		put_page(pages[i]);
+	}
+	lock_sock(sk);
+
+	return sent ? sent : ret;
 }
 
 /**
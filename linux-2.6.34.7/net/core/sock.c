@@ -128,6 +128,7 @@
 
 #ifdef CONFIG_INET
 #include <net/tcp.h>
+#include <net/busy_poll.h>
 #endif
 
 /*
@@ -299,6 +300,7 @@ int sock_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 
 	skb->dev = NULL;
 	skb_set_owner_r(skb, sk);
+	sk_mark_napi_id(sk, skb);
 
 	/* Cache the SKB length before we tack it onto the receive
 	 * queue.  Once it is added it no longer belongs to us and
@@ -724,6 +726,18 @@ set_rcvbuf:
 		else
 			sock_reset_flag(sk, SOCK_RXQ_OVFL);
 		break;
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	case SO_BUSY_POLL:
+		/* Anyone may lower it, raising it burns CPU time */
+		if (val < 0)
+			ret = -EINVAL;
+		else if (val > sk->sk_ll_usec && !capable(CAP_NET_ADMIN))
+			ret = -EPERM;
+		else
+			sk->sk_ll_usec = val;
+		break;
+#endif
 	default:
 		ret = -ENOPROTOOPT;
 		break;
@@ -927,6 +941,12 @@ int sock_getsockopt(struct socket *sock, int level, int optname,
 		v.val = !!sock_flag(sk, SOCK_RXQ_OVFL);
 		break;
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	case SO_BUSY_POLL:
+		v.val = sk->sk_ll_usec;
+		break;
+#endif
+
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -1920,6 +1940,10 @@ void sock_init_data(struct socket *sock, struct sock *sk)
 	sk->sk_rcvlowat		=	1;
 	sk->sk_rcvtimeo		=	MAX_SCHEDULE_TIMEOUT;
 	sk->sk_sndtimeo		=	MAX_SCHEDULE_TIMEOUT;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	sk->sk_napi_id		=	0;
+	sk->sk_ll_usec		=	sysctl_net_busy_read;
+#endif
 
 	sk->sk_stamp = ktime_set(-1L, 0);
 
@@ -169,23 +169,30 @@ EXPORT_SYMBOL(inet_sock_destruct);
  *	Automatically bind an unbound socket.
  */
 
-static int inet_autobind(struct sock *sk)
+/* Called with the socket lock held. */
+static int __inet_autobind(struct sock *sk)
 {
-	struct inet_sock *inet;
-	/* We may need to bind the socket. */
-	lock_sock(sk);
-	inet = inet_sk(sk);
+	struct inet_sock *inet = inet_sk(sk);
+
 	if (!inet->inet_num) {
-		if (sk->sk_prot->get_port(sk, 0)) {
-			release_sock(sk);
+		if (sk->sk_prot->get_port(sk, 0))
 			return -EAGAIN;
-		}
 		inet->inet_sport = htons(inet->inet_num);
 	}
-	release_sock(sk);
 	return 0;
 }
 
+static int inet_autobind(struct sock *sk)
+{
+	int err;
+
+	/* We may need to bind the socket. */
+	lock_sock(sk);
+	err = __inet_autobind(sk);
+	release_sock(sk);
+	return err;
+}
+
 /*
  *	Move a socket into listening state.
  */
@@ -728,6 +735,29 @@ int inet_sendmsg(struct kiocb *iocb, struct socket *sock, struct msghdr *msg,
 }
 EXPORT_SYMBOL(inet_sendmsg);
 
+/*
+ * As inet_sendmsg(), but called with the socket lock held, for sending
+ * a batch of datagrams without dropping the lock between them.
+ */
+int inet_sendmsg_locked(struct kiocb *iocb, struct socket *sock,
+			struct msghdr *msg, size_t size)
+{
+	struct sock *sk = sock->sk;
+	int err;
+
+	if (__inet_autobind(sk))
+		return -EAGAIN;
+
+	if (sk->sk_prot->sendmsg_locked)
+		return sk->sk_prot->sendmsg_locked(iocb, sk, msg, size);
+
+	release_sock(sk);
+	err = sk->sk_prot->sendmsg(iocb, sk, msg, size);
+	lock_sock(sk);
+	return err;
+}
+EXPORT_SYMBOL(inet_sendmsg_locked);
+
 
 static ssize_t inet_sendpage(struct socket *sock, struct page *page, int offset,
 			     size_t size, int flags)
@@ -876,6 +906,7 @@ const struct proto_ops inet_stream_ops = {
 	.mmap		   = sock_no_mmap,
 	.sendpage	   = tcp_sendpage,
 	.splice_read	   = tcp_splice_read,
+	.splice_direct	   = tcp_splice_direct,
 #ifdef CONFIG_COMPAT
 	.compat_setsockopt = compat_sock_common_setsockopt,
 	.compat_getsockopt = compat_sock_common_getsockopt,
@@ -899,6 +930,7 @@ const struct proto_ops inet_dgram_ops = {
 	.setsockopt	   = sock_common_setsockopt,
 	.getsockopt	   = sock_common_getsockopt,
 	.sendmsg	   = inet_sendmsg,
+	.sendmsg_locked	   = inet_sendmsg_locked,
 	.recvmsg	   = sock_common_recvmsg,
 	.mmap		   = sock_no_mmap,
 	.sendpage	   = inet_sendpage,
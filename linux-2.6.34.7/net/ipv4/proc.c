@@ -251,6 +251,9 @@ static const struct snmp_mib snmp4_net_list[] = {
 	SNMP_MIB_ITEM("TCPSackShiftFallback", LINUX_MIB_SACKSHIFTFALLBACK),
 	SNMP_MIB_ITEM("TCPBacklogDrop", LINUX_MIB_TCPBACKLOGDROP),
 	SNMP_MIB_ITEM("TCPMinTTLDrop", LINUX_MIB_TCPMINTTLDROP),
+	SNMP_MIB_ITEM("BusyPollRxPackets", LINUX_MIB_BUSYPOLLRXPACKETS),
+	SNMP_MIB_ITEM("BusyPollHits", LINUX_MIB_BUSYPOLLHITS),
+	SNMP_MIB_ITEM("BusyPollSleeps", LINUX_MIB_BUSYPOLLSLEEPS),
 	SNMP_MIB_SENTINEL
 };
 
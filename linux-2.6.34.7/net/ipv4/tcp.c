@@ -272,6 +272,7 @@
 #include <net/xfrm.h>
 #include <net/ip.h>
 #include <net/netdma.h>
+#include <net/busy_poll.h>
 #include <net/sock.h>
 
 #include <asm/uaccess.h>
@@ -300,10 +301,12 @@ struct percpu_counter tcp_sockets_allocated;
 EXPORT_SYMBOL(tcp_sockets_allocated);
 
 /*
- * TCP splice context
+ * TCP splice context.  A direct splice has no pipe and goes to out/ppos.
  */
 struct tcp_splice_state {
 	struct pipe_inode_info *pipe;
+	struct file *out;
+	loff_t *ppos;
 	size_t len;
 	unsigned int flags;
 };
@@ -564,8 +567,12 @@ static int tcp_splice_data_recv(read_descriptor_t *rd_desc, struct sk_buff *skb,
 	struct tcp_splice_state *tss = rd_desc->arg.data;
 	int ret;
 
-	ret = skb_splice_bits(skb, offset, tss->pipe, min(rd_desc->count, len),
-			      tss->flags);
+	if (tss->pipe)
+		ret = skb_splice_bits(skb, offset, tss->pipe,
+				      min(rd_desc->count, len), tss->flags);
+	else
+		ret = skb_splice_direct(skb, offset, tss->out, tss->ppos,
+					min(rd_desc->count, len), tss->flags);
 	if (ret > 0)
 		rd_desc->count -= ret;
 	return ret;
@@ -582,45 +589,20 @@ static int __tcp_splice_read(struct sock *sk, struct tcp_splice_state *tss)
 	return tcp_read_sock(sk, &rd_desc, tcp_splice_data_recv);
 }
 
-/**
- *  tcp_splice_read - splice data from TCP socket to a pipe
- * @sock:	socket to splice from
- * @ppos:	position (not valid)
- * @pipe:	pipe to splice to
- * @len:	number of bytes to splice
- * @flags:	splice modifier flags
- *
- * Description:
- *    Will read pages from given socket and fill them into a pipe.
- *
- **/
-ssize_t tcp_splice_read(struct socket *sock, loff_t *ppos,
-			struct pipe_inode_info *pipe, size_t len,
-			unsigned int flags)
+static ssize_t tcp_splice(struct socket *sock, struct tcp_splice_state *tss)
 {
 	struct sock *sk = sock->sk;
-	struct tcp_splice_state tss = {
-		.pipe = pipe,
-		.len = len,
-		.flags = flags,
-	};
 	long timeo;
 	ssize_t spliced;
 	int ret;
 
-	/*
-	 * We can't seek on a socket input
-	 */
-	if (unlikely(*ppos))
-		return -ESPIPE;
-
 	ret = spliced = 0;
 
 	lock_sock(sk);
 
 	timeo = sock_rcvtimeo(sk, sock->file->f_flags & O_NONBLOCK);
-	while (tss.len) {
-		ret = __tcp_splice_read(sk, &tss);
+	while (tss->len) {
+		ret = __tcp_splice_read(sk, tss);
 		if (ret < 0)
 			break;
 		else if (!ret) {
@@ -654,7 +636,7 @@ ssize_t tcp_splice_read(struct socket *sock, loff_t *ppos,
 			}
 			continue;
 		}
-		tss.len -= ret;
+		tss->len -= ret;
 		spliced += ret;
 
 		if (!timeo)
@@ -676,6 +658,63 @@ ssize_t tcp_splice_read(struct socket *sock, loff_t *ppos,
 	return ret;
 }
 
+/**
+ *  tcp_splice_read - splice data from TCP socket to a pipe
+ * @sock:	socket to splice from
+ * @ppos:	position (not valid)
+ * @pipe:	pipe to splice to
+ * @len:	number of bytes to splice
+ * @flags:	splice modifier flags
+ *
+ * Description:
+ *    Will read pages from given socket and fill them into a pipe.
+ *
+ **/
+ssize_t tcp_splice_read(struct socket *sock, loff_t *ppos,
+			struct pipe_inode_info *pipe, size_t len,
+			unsigned int flags)
+{
+	struct tcp_splice_state tss = {
+		.pipe = pipe,
+		.len = len,
+		.flags = flags,
+	};
+
+	/*
+	 * We can't seek on a socket input
+	 */
+	if (unlikely(*ppos))
+		return -ESPIPE;
+
+	return tcp_splice(sock, &tss);
+}
+
+/**
+ *  tcp_splice_direct - splice data from TCP socket to a file or socket
+ * @sock:	socket to splice from
+ * @out:	file to splice to
+ * @ppos:	position in @out
+ * @len:	number of bytes to splice
+ * @flags:	splice modifier flags
+ *
+ * Description:
+ *    Will hand the socket's pages straight to @out, without a pipe in
+ *    between.  Only what @out accepts is consumed from the socket.
+ *
+ **/
+ssize_t tcp_splice_direct(struct socket *sock, struct file *out,
+			  loff_t *ppos, size_t len, unsigned int flags)
+{
+	struct tcp_splice_state tss = {
+		.out = out,
+		.ppos = ppos,
+		.len = len,
+		.flags = flags,
+	};
+
+	return tcp_splice(sock, &tss);
+}
+
 struct sk_buff *sk_stream_alloc_skb(struct sock *sk, int size, gfp_t gfp)
 {
 	struct sk_buff *skb;
@@ -1342,6 +1381,19 @@ int tcp_read_sock(struct sock *sk, read_descriptor_t *desc,
 					break;
 			}
 			used = recv_actor(desc, skb, offset, len);
+			/*
+			 * A recv_actor that drops the lock lets other readers
+			 * in (e.g. TCP splice to a file or socket).  If one of
+			 * them moved copied_seq meanwhile our seq is stale, so
+			 * stop here and leave copied_seq to them.
+			 */
+			if (unlikely(tp->copied_seq != seq)) {
+				if (used > 0)
+					copied += used;
+				else if (!copied)
+					copied = used;
+				goto out;
+			}
 			if (used < 0) {
 				if (!copied)
 					copied = used;
@@ -1372,7 +1424,7 @@ int tcp_read_sock(struct sock *sk, read_descriptor_t *desc,
 		tp->copied_seq = seq;
 	}
 	tp->copied_seq = seq;
-
+out:
 	tcp_rcv_space_adjust(sk);
 
 	/* Clean up data we have read: This will do ACK frames. */
@@ -1405,6 +1457,11 @@ int tcp_recvmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 	struct sk_buff *skb;
 	u32 urg_hole = 0;
 
+	/* Busy poll before taking the lock, so packets reach the queue */
+	if (sk_can_busy_loop(sk) && skb_queue_empty(&sk->sk_receive_queue) &&
+	    sk->sk_state == TCP_ESTABLISHED)
+		sk_busy_loop(sk, nonblock);
+
 	lock_sock(sk);
 
 	TCP_CHECK_TIMER(sk);
@@ -3309,6 +3366,7 @@ EXPORT_SYMBOL(tcp_read_sock);
 EXPORT_SYMBOL(tcp_recvmsg);
 EXPORT_SYMBOL(tcp_sendmsg);
 EXPORT_SYMBOL(tcp_splice_read);
+EXPORT_SYMBOL(tcp_splice_direct);
 EXPORT_SYMBOL(tcp_sendpage);
 EXPORT_SYMBOL(tcp_setsockopt);
 EXPORT_SYMBOL(tcp_shutdown);
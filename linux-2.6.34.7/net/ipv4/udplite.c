@@ -44,6 +44,7 @@ struct proto 	udplite_prot = {
 	.setsockopt	   = udp_setsockopt,
 	.getsockopt	   = udp_getsockopt,
 	.sendmsg	   = udp_sendmsg,
+	.sendmsg_locked	   = udp_sendmsg_locked,
 	.recvmsg	   = udp_recvmsg,
 	.sendpage	   = udp_sendpage,
 	.backlog_rcv	   = udp_queue_rcv_skb,
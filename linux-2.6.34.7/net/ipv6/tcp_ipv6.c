@@ -60,6 +60,7 @@
 #include <net/dsfield.h>
 #include <net/timewait_sock.h>
 #include <net/netdma.h>
+#include <net/busy_poll.h>
 #include <net/inet_common.h>
 
 #include <asm/uaccess.h>
@@ -1718,6 +1719,8 @@ process:
 	if (sk->sk_state == TCP_TIME_WAIT)
 		goto do_time_wait;
 
+	sk_mark_napi_id(sk, skb);
+
 	if (!xfrm6_policy_check(sk, XFRM_POLICY_IN, skb))
 		goto discard_and_relse;
 
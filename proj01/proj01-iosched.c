@@ -1,3 +1,4 @@
+
 ///////////////////////////////////////////////////
 //				Group 8
 //
@@ -15,103 +16,1158 @@
 
 
 /*
- * elevator noop
+ * team08 elevator
+ *
+ * Every io_context gets its own sub-queue, kept sorted by sector in an
+ * rbtree and served C-LOOK style.  Sub-queues with pending requests sit on
+ * a round-robin list per ioprio class; RT is always served before BE, and
+ * IDLE only when nothing else is queued.  Each time a sub-queue becomes
+ * active it gets a quantum of requests scaled by its ioprio level.
+ *
+ * When a synchronous read completes and its sub-queue has nothing else
+ * queued, we briefly hold off other queues in anticipation of the next
+ * dependent read from the same process.  The window is sized from a per
+ * process think-time estimate and we don't idle at all for processes that
+ * usually take longer than slice_idle to come back.
+ *
+ * Within the active sub-queue the next request is the one with the lowest
+ * predicted service time.  The prediction comes from a small table, indexed
+ * by seek distance, seek direction and request size, of service times
+ * sampled at completion.  Until a cell has been sampled it holds a prior
+ * that grows with distance and penalises backward seeks, so an untrained
+ * table behaves much like plain C-LOOK.
+ *
+ * The block layer calls us with the queue lock held for every insertion,
+ * so insertion is kept to a list append onto a per-cpu staging list.  The
+ * staged requests are sorted into their sub-queues in one go at the next
+ * dispatch, which keeps the rbtrees and sub-queue state from bouncing
+ * between submitting cpus and shortens the lock hold time per request.
  */
+#include <linux/kernel.h>
 #include <linux/blkdev.h>
 #include <linux/elevator.h>
 #include <linux/bio.h>
 #include <linux/module.h>
 #include <linux/slab.h>
 #include <linux/init.h>
+#include <linux/rbtree.h>
+#include <linux/hash.h>
+#include <linux/ioprio.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+#include <linux/log2.h>
+#include <linux/percpu.h>
+
+/*
+ * requests dispatched per round for a BE queue at the default priority
+ */
+static const int proj01_quantum = 4;
+static const int proj01_slice_idle = 2000;	/* max idle window, usecs */
+
+/*
+ * never idle shorter than this, timer and wakeup latency eat the rest
+ */
+#define PROJ01_MIN_IDLE		100
+
+/*
+ * unreferenced sub-queues keep their think-time history around this long
+ */
+#define PROJ01_QUEUE_TTL	(10 * HZ)
 
-struct noop_data {
-	struct list_head queue;
+/*
+ * think time samples are kept in fixed point, 256 == one full sample
+ */
+#define sample_valid(samples)	((samples) > 80)
+
+/*
+ * seek cost model dimensions.  Distance buckets are powers of 8 sectors,
+ * bucket 0 being a perfectly sequential request.
+ */
+#define PROJ01_DIST_BUCKETS	12
+#define PROJ01_SIZE_BUCKETS	4
+
+/*
+ * requests considered in each direction from the head when picking the
+ * cheapest one
+ */
+#define PROJ01_CANDIDATES	2
+
+struct proj01_cost {
+	unsigned long mean;		/* service time ewma, usecs */
+	unsigned long samples;
 };
 
-static void proj01_merged_requests(struct request_queue *q, struct request *rq,
-				 struct request *next)
+#define PROJ01_HASH_SHIFT	6
+#define PROJ01_HASH_SIZE	(1 << PROJ01_HASH_SHIFT)
+
+/*
+ * index into proj01_data->rr_list, in service order
+ */
+enum {
+	PROJ01_RT,
+	PROJ01_BE,
+	PROJ01_IDLE,
+	PROJ01_NR_CLASSES,
+};
+
+struct proj01_data;
+
+/*
+ * per io_context sub-queue
+ */
+struct proj01_queue {
+	struct proj01_data *pd;
+	struct io_context *ioc;		/* owner, we hold a reference */
+	struct hlist_node hash;		/* lookup by ioc */
+	struct list_head rr_node;	/* on pd->rr_list while queued */
+	struct list_head idle_node;	/* on pd->idle_list while unused */
+	unsigned long last_used;	/* jiffies, when ref dropped to 0 */
+
+	struct rb_root sort_list;	/* queued requests, sorted by sector */
+	unsigned int queued;
+	unsigned int staged;		/* not yet folded into sort_list */
+
+	int ref;			/* allocated requests + active */
+	unsigned int reads_in_driver;	/* sync reads being serviced */
+
+	/*
+	 * think time, time from the completion of a sync read to the
+	 * arrival of the next one, in usecs
+	 */
+	u64 last_end;
+	unsigned long ttime_total;
+	unsigned long ttime_samples;
+	unsigned long ttime_mean;
+
+	unsigned short org_ioprio;	/* ioc->ioprio we last looked at */
+	unsigned short ioprio_class;
+	unsigned short ioprio;
+
+	int slice_left;			/* requests left in this round */
+};
+
+struct proj01_data {
+	struct request_queue *q;
+
+	struct hlist_head hash[PROJ01_HASH_SIZE];
+	struct list_head rr_list[PROJ01_NR_CLASSES];
+	struct list_head idle_list;	/* unreferenced queues, oldest first */
+
+	struct proj01_queue *active;	/* queue currently being served */
+	sector_t head;			/* sector after the last dispatch */
+	unsigned int queued;
+	unsigned int in_driver;
+
+	/*
+	 * newly inserted requests, linked through rq->queuelist
+	 */
+	struct list_head __percpu *staged;
+	unsigned int nr_staged;
+
+	/*
+	 * anticipation state
+	 */
+	int idling;
+	struct hrtimer idle_timer;
+	struct work_struct unplug_work;
+
+	/*
+	 * seek cost model.  One request at a time is followed from dispatch
+	 * to completion to feed it.
+	 */
+	struct proj01_cost cost[2][PROJ01_DIST_BUCKETS][PROJ01_SIZE_BUCKETS];
+	struct request *sample_rq;
+	struct proj01_cost *sample_cell;
+	u64 sample_start;
+	u64 last_complete;
+
+	/*
+	 * settings that change how the i/o scheduler behaves
+	 */
+	int quantum;
+	int slice_idle;
+};
+
+static inline struct proj01_queue *rq_pq(struct request *rq)
 {
-	list_del_init(&next->queuelist);
+	return rq->elevator_private;
 }
 
-static int proj01_dispatch(struct request_queue *q, int force)
+static inline int rq_is_sync_read(struct request *rq)
+{
+	return rq_is_sync(rq) && rq_data_dir(rq) == READ;
+}
+
+/*
+ * requests in the sort_list have an empty queuelist, staged ones are
+ * linked on a per-cpu list
+ */
+static inline int rq_is_staged(struct request *rq)
+{
+	return !list_empty(&rq->queuelist);
+}
+
+static inline u64 proj01_now(void)
+{
+	return ktime_to_us(ktime_get());
+}
+
+static int proj01_prio_class(struct proj01_queue *pq)
+{
+	switch (pq->ioprio_class) {
+	case IOPRIO_CLASS_RT:
+		return PROJ01_RT;
+	case IOPRIO_CLASS_IDLE:
+		return PROJ01_IDLE;
+	default:
+		return PROJ01_BE;
+	}
+}
+
+/*
+ * Pick up the ioprio of the owning context.  If none was set explicitly we
+ * derive one from the cpu nice level and scheduling policy of the task,
+ * like CFQ does.
+ */
+static void proj01_init_prio(struct proj01_queue *pq)
+{
+	struct io_context *ioc = pq->ioc;
+
+	pq->org_ioprio = ioc->ioprio;
+
+	if (ioprio_valid(ioc->ioprio)) {
+		pq->ioprio_class = task_ioprio_class(ioc);
+		pq->ioprio = task_ioprio(ioc);
+	} else {
+		pq->ioprio_class = task_nice_ioclass(current);
+		pq->ioprio = task_nice_ioprio(current);
+	}
+
+	if (pq->ioprio_class == IOPRIO_CLASS_IDLE)
+		pq->ioprio = IOPRIO_BE_NR - 1;
+}
+
+/*
+ * Size of a round for this queue.  Level 4 (the default) gets the base
+ * quantum, level 0 twice that, level 7 a quarter of it.
+ */
+static int proj01_slice(struct proj01_data *pd, struct proj01_queue *pq)
+{
+	int slice = pd->quantum * (IOPRIO_BE_NR - pq->ioprio) / IOPRIO_NORM;
+
+	return max(slice, 1);
+}
+
+static struct proj01_queue *
+proj01_find_queue(struct proj01_data *pd, struct io_context *ioc)
+{
+	struct hlist_head *head = &pd->hash[hash_ptr(ioc, PROJ01_HASH_SHIFT)];
+	struct hlist_node *entry;
+	struct proj01_queue *pq;
+
+	hlist_for_each_entry(pq, entry, head, hash) {
+		if (pq->ioc == ioc)
+			return pq;
+	}
+
+	return NULL;
+}
+
+static void proj01_free_queue(struct proj01_queue *pq)
+{
+	hlist_del(&pq->hash);
+	list_del(&pq->idle_node);
+	put_io_context(pq->ioc);
+	kfree(pq);
+}
+
+static void proj01_get_queue(struct proj01_queue *pq)
+{
+	if (!pq->ref++)
+		list_del_init(&pq->idle_node);
+}
+
+/*
+ * Dropping the last reference doesn't free the queue right away, the
+ * think-time history is what tells us whether to idle for the process
+ * next time around.  The queue is freed once its owner is gone or it has
+ * gone unused for PROJ01_QUEUE_TTL.
+ */
+static void proj01_put_queue(struct proj01_queue *pq)
+{
+	BUG_ON(pq->ref <= 0);
+
+	if (--pq->ref)
+		return;
+
+	BUG_ON(pq->queued);
+	BUG_ON(pq->pd->active == pq);
+
+	if (!atomic_read(&pq->ioc->nr_tasks)) {
+		proj01_free_queue(pq);
+		return;
+	}
+
+	pq->last_used = jiffies;
+	list_add_tail(&pq->idle_node, &pq->pd->idle_list);
+}
+
+static void proj01_reap_queues(struct proj01_data *pd)
+{
+	struct proj01_queue *pq;
+
+	while (!list_empty(&pd->idle_list)) {
+		pq = list_entry(pd->idle_list.next, struct proj01_queue,
+				idle_node);
+		if (time_before(jiffies, pq->last_used + PROJ01_QUEUE_TTL) &&
+		    atomic_read(&pq->ioc->nr_tasks))
+			break;
+		proj01_free_queue(pq);
+	}
+}
+
+static void proj01_update_thinktime(struct proj01_data *pd,
+				    struct proj01_queue *pq)
+{
+	u64 ttime;
+
+	if (!pq->last_end)
+		return;
+
+	ttime = proj01_now() - pq->last_end;
+	ttime = min_t(u64, ttime, 2 * pd->slice_idle);
+
+	pq->ttime_samples = (7 * pq->ttime_samples + 256) / 8;
+	pq->ttime_total = (7 * pq->ttime_total + 256 * (unsigned long) ttime) / 8;
+	pq->ttime_mean = (pq->ttime_total + 128) / pq->ttime_samples;
+}
+
+/*
+ * Is it worth keeping the disk idle for this queue's next read?  Not if
+ * idling is off, the queue is IDLE class, its owner exited, or it usually
+ * thinks longer than we are willing to wait.
+ */
+static int proj01_should_idle(struct proj01_data *pd, struct proj01_queue *pq)
+{
+	if (!pd->slice_idle || pq->ioprio_class == IOPRIO_CLASS_IDLE)
+		return 0;
+
+	if (!atomic_read(&pq->ioc->nr_tasks))
+		return 0;
+
+	if (sample_valid(pq->ttime_samples) && pq->ttime_mean > pd->slice_idle)
+		return 0;
+
+	return 1;
+}
+
+/*
+ * Wait twice the mean think time, bounded by slice_idle.  Until we have
+ * enough samples just use slice_idle.
+ */
+static unsigned long proj01_idle_window(struct proj01_data *pd,
+					struct proj01_queue *pq)
+{
+	unsigned long window = pd->slice_idle;
+
+	if (sample_valid(pq->ttime_samples))
+		window = clamp_t(unsigned long, 2 * pq->ttime_mean,
+				 PROJ01_MIN_IDLE, window);
+
+	return window;
+}
+
+static void proj01_schedule_dispatch(struct proj01_data *pd)
+{
+	if (pd->queued || pd->nr_staged)
+		kblockd_schedule_work(pd->q, &pd->unplug_work);
+}
+
+static void proj01_arm_idle(struct proj01_data *pd, struct proj01_queue *pq)
+{
+	unsigned long window = proj01_idle_window(pd, pq);
+
+	pd->idling = 1;
+	hrtimer_start(&pd->idle_timer, ns_to_ktime(window * NSEC_PER_USEC),
+		      HRTIMER_MODE_REL);
+}
+
+static void proj01_stop_idling(struct proj01_data *pd)
+{
+	if (pd->idling) {
+		pd->idling = 0;
+		hrtimer_try_to_cancel(&pd->idle_timer);
+	}
+}
+
+static void proj01_set_active(struct proj01_data *pd, struct proj01_queue *pq)
+{
+	proj01_get_queue(pq);
+	pq->slice_left = proj01_slice(pd, pq);
+	pd->active = pq;
+}
+
+static void proj01_expire_active(struct proj01_data *pd)
 {
-	struct noop_data *nd = q->elevator->elevator_data;
+	struct proj01_queue *pq = pd->active;
 
-	if (!list_empty(&nd->queue)) {
-		struct request *rq;
-		rq = list_entry(nd->queue.next, struct request, queuelist);
-		list_del_init(&rq->queuelist);
-		elv_dispatch_sort(q, rq);
+	proj01_stop_idling(pd);
+	pd->active = NULL;
+	proj01_put_queue(pq);
+}
+
+/*
+ * get the first request at or after sector, wrapping around to the lowest
+ * sector if there is none
+ */
+static struct request *
+proj01_find_next(struct proj01_queue *pq, sector_t sector)
+{
+	struct rb_node *n = pq->sort_list.rb_node;
+	struct request *next = NULL;
+
+	while (n) {
+		struct request *rq = rb_entry_rq(n);
+
+		if (blk_rq_pos(rq) >= sector) {
+			next = rq;
+			n = n->rb_left;
+		} else
+			n = n->rb_right;
+	}
+
+	if (!next && pq->queued)
+		next = rb_entry_rq(rb_first(&pq->sort_list));
+
+	return next;
+}
+
+static unsigned int proj01_dist_bucket(u64 dist)
+{
+	if (!dist)
+		return 0;
+
+	return min(1 + ilog2(dist) / 3, PROJ01_DIST_BUCKETS - 1);
+}
+
+static unsigned int proj01_size_bucket(unsigned int sectors)
+{
+	if (sectors <= 8)
+		return 0;
+	if (sectors <= 32)
 		return 1;
+	if (sectors <= 128)
+		return 2;
+	return 3;
+}
+
+static struct proj01_cost *
+proj01_cost_cell(struct proj01_data *pd, struct request *rq)
+{
+	sector_t pos = blk_rq_pos(rq);
+	int backward = pos < pd->head;
+	u64 dist = backward ? pd->head - pos : pos - pd->head;
+
+	return &pd->cost[backward][proj01_dist_bucket(dist)]
+			[proj01_size_bucket(blk_rq_sectors(rq))];
+}
+
+static void proj01_reset_cost(struct proj01_data *pd)
+{
+	int dir, dist, size;
+
+	for (dir = 0; dir < 2; dir++)
+		for (dist = 0; dist < PROJ01_DIST_BUCKETS; dist++)
+			for (size = 0; size < PROJ01_SIZE_BUCKETS; size++) {
+				struct proj01_cost *c = &pd->cost[dir][dist][size];
+
+				c->mean = (100 + 400 * dist) << (dir && dist);
+				c->samples = 0;
+			}
+}
+
+static void proj01_sample_cost(struct proj01_cost *c, unsigned long stime)
+{
+	if (!c->samples)
+		c->mean = stime;
+	else
+		c->mean = (7 * c->mean + stime) / 8;
+
+	if (c->samples < ULONG_MAX)
+		c->samples++;
+}
+
+/*
+ * pick the request with the lowest predicted service time among the few
+ * closest to the head in either direction, plus the lowest sector which is
+ * where C-LOOK would wrap to
+ */
+static struct request *
+proj01_choose_request(struct proj01_data *pd, struct proj01_queue *pq)
+{
+	struct request *next = proj01_find_next(pq, pd->head);
+	struct request *best = next, *rq;
+	struct rb_node *n;
+	unsigned long cost, best_cost;
+	int i;
+
+	best_cost = proj01_cost_cell(pd, best)->mean;
+
+	n = rb_next(&next->rb_node);
+	for (i = 1; n && i < PROJ01_CANDIDATES; i++, n = rb_next(n)) {
+		rq = rb_entry_rq(n);
+		if (blk_rq_pos(rq) < pd->head)
+			break;
+		cost = proj01_cost_cell(pd, rq)->mean;
+		if (cost < best_cost) {
+			best = rq;
+			best_cost = cost;
+		}
 	}
-	return 0;
+
+	if (blk_rq_pos(next) >= pd->head)
+		n = rb_prev(&next->rb_node);
+	else
+		n = rb_last(&pq->sort_list);
+	for (i = 0; n && i < PROJ01_CANDIDATES; i++, n = rb_prev(n)) {
+		rq = rb_entry_rq(n);
+		if (blk_rq_pos(rq) >= pd->head)
+			break;
+		cost = proj01_cost_cell(pd, rq)->mean;
+		if (cost < best_cost) {
+			best = rq;
+			best_cost = cost;
+		}
+	}
+
+	rq = rb_entry_rq(rb_first(&pq->sort_list));
+	if (proj01_cost_cell(pd, rq)->mean < best_cost)
+		best = rq;
+
+	return best;
 }
 
-static void proj01_add_request(struct request_queue *q, struct request *rq)
+static void proj01_move_to_dispatch(struct proj01_data *pd, struct request *rq);
+
+static void proj01_add_rq_rb(struct proj01_queue *pq, struct request *rq)
 {
-	struct noop_data *nd = q->elevator->elevator_data;
+	struct request *__alias;
 
-	list_add_tail(&rq->queuelist, &nd->queue);
+	while (unlikely(__alias = elv_rb_add(&pq->sort_list, rq)))
+		proj01_move_to_dispatch(pq->pd, __alias);
 }
 
-static int proj01_queue_empty(struct request_queue *q)
+static void proj01_del_rq_rb(struct proj01_queue *pq, struct request *rq)
+{
+	struct proj01_data *pd = pq->pd;
+
+	elv_rb_del(&pq->sort_list, rq);
+	pq->queued--;
+	pd->queued--;
+
+	if (!pq->queued)
+		list_del_init(&pq->rr_node);
+}
+
+static void proj01_move_to_dispatch(struct proj01_data *pd, struct request *rq)
+{
+	struct request_queue *q = pd->q;
+
+	if (!pd->sample_rq) {
+		pd->sample_rq = rq;
+		pd->sample_cell = proj01_cost_cell(pd, rq);
+		pd->sample_start = 0;
+	}
+
+	proj01_del_rq_rb(rq_pq(rq), rq);
+	elv_dispatch_add_tail(q, rq);
+	pd->head = blk_rq_pos(rq) + blk_rq_sectors(rq);
+}
+
+static int
+proj01_merge(struct request_queue *q, struct request **req, struct bio *bio)
+{
+	struct proj01_data *pd = q->elevator->elevator_data;
+	struct io_context *ioc = current->io_context;
+	struct proj01_queue *pq;
+	struct request *__rq;
+
+	if (!ioc)
+		return ELEVATOR_NO_MERGE;
+
+	pq = proj01_find_queue(pd, ioc);
+	if (!pq)
+		return ELEVATOR_NO_MERGE;
+
+	__rq = elv_rb_find(&pq->sort_list, bio->bi_sector + bio_sectors(bio));
+	if (__rq && elv_rq_merge_ok(__rq, bio)) {
+		*req = __rq;
+		return ELEVATOR_FRONT_MERGE;
+	}
+
+	return ELEVATOR_NO_MERGE;
+}
+
+static void
+proj01_merged_request(struct request_queue *q, struct request *rq, int type)
+{
+	struct proj01_queue *pq = rq_pq(rq);
+
+	/*
+	 * a front merge changes the start sector, reposition in the rbtree
+	 */
+	if (type == ELEVATOR_FRONT_MERGE && !rq_is_staged(rq)) {
+		elv_rb_del(&pq->sort_list, rq);
+		proj01_add_rq_rb(pq, rq);
+	}
+}
+
+static void proj01_merged_requests(struct request_queue *q, struct request *rq,
+				 struct request *next)
 {
-	struct noop_data *nd = q->elevator->elevator_data;
+	struct proj01_data *pd = q->elevator->elevator_data;
 
-	return list_empty(&nd->queue);
+	if (rq_is_staged(next)) {
+		list_del_init(&next->queuelist);
+		rq_pq(next)->staged--;
+		pd->nr_staged--;
+	} else
+		proj01_del_rq_rb(rq_pq(next), next);
 }
 
 static struct request *
 proj01_former_request(struct request_queue *q, struct request *rq)
 {
-	struct noop_data *nd = q->elevator->elevator_data;
-
-	if (rq->queuelist.prev == &nd->queue)
+	if (rq_is_staged(rq))
 		return NULL;
-	return list_entry(rq->queuelist.prev, struct request, queuelist);
+
+	return elv_rb_former_request(q, rq);
 }
 
 static struct request *
 proj01_latter_request(struct request_queue *q, struct request *rq)
 {
-	struct noop_data *nd = q->elevator->elevator_data;
-
-	if (rq->queuelist.next == &nd->queue)
+	if (rq_is_staged(rq))
 		return NULL;
-	return list_entry(rq->queuelist.next, struct request, queuelist);
+
+	return elv_rb_latter_request(q, rq);
+}
+
+/*
+ * Only merge a bio into a request that came from the same sub-queue,
+ * otherwise one process' io ends up being charged to another.
+ */
+static int proj01_allow_merge(struct request_queue *q, struct request *rq,
+			      struct bio *bio)
+{
+	struct io_context *ioc = current->io_context;
+
+	return ioc && rq_pq(rq) && rq_pq(rq)->ioc == ioc;
+}
+
+/*
+ * Find the queue to serve next: the first queue of the highest class that
+ * has anything pending.  The previous active queue has already been moved
+ * to the tail of its list, which is what gives us round-robin.
+ *
+ * Returns NULL while we are waiting on the active queue, either for its
+ * last sync read to complete or for the next one to arrive.
+ */
+static struct proj01_queue *proj01_select_queue(struct proj01_data *pd)
+{
+	struct proj01_queue *pq = pd->active;
+	int class;
+
+	if (pq && !pq->queued) {
+		if (pd->idling)
+			return NULL;
+		if (pq->reads_in_driver && proj01_should_idle(pd, pq))
+			return NULL;
+		proj01_expire_active(pd);
+	} else if (pq) {
+		/*
+		 * keep going unless the slice is used up or a queue of a
+		 * better class showed up
+		 */
+		for (class = 0; class < proj01_prio_class(pq); class++)
+			if (!list_empty(&pd->rr_list[class]))
+				break;
+
+		if (pq->slice_left > 0 && class == proj01_prio_class(pq))
+			return pq;
+
+		list_move_tail(&pq->rr_node, &pd->rr_list[proj01_prio_class(pq)]);
+		proj01_expire_active(pd);
+	}
+
+	for (class = 0; class < PROJ01_NR_CLASSES; class++) {
+		if (list_empty(&pd->rr_list[class]))
+			continue;
+
+		pq = list_entry(pd->rr_list[class].next, struct proj01_queue,
+				rr_node);
+		proj01_set_active(pd, pq);
+		return pq;
+	}
+
+	return NULL;
+}
+
+static void proj01_insert_request(struct proj01_data *pd, struct request *rq)
+{
+	struct proj01_queue *pq = rq_pq(rq);
+
+	pq->queued++;
+	pd->queued++;
+	proj01_add_rq_rb(pq, rq);
+
+	if (list_empty(&pq->rr_node))
+		list_add_tail(&pq->rr_node, &pd->rr_list[proj01_prio_class(pq)]);
+}
+
+/*
+ * sort everything inserted since the last dispatch into the sub-queues
+ */
+static void proj01_fold_staged(struct proj01_data *pd)
+{
+	struct list_head *list;
+	struct request *rq;
+	int cpu;
+
+	if (!pd->nr_staged)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		list = per_cpu_ptr(pd->staged, cpu);
+		while (!list_empty(list)) {
+			rq = list_entry_rq(list->next);
+			list_del_init(&rq->queuelist);
+			rq_pq(rq)->staged--;
+			pd->nr_staged--;
+			proj01_insert_request(pd, rq);
+		}
+	}
+}
+
+static int proj01_dispatch(struct request_queue *q, int force)
+{
+	struct proj01_data *pd = q->elevator->elevator_data;
+	struct proj01_queue *pq;
+	struct request *rq;
+	int dispatched = 0;
+	int class;
+
+	proj01_fold_staged(pd);
+
+	if (unlikely(force)) {
+		if (pd->active)
+			proj01_expire_active(pd);
+
+		for (class = 0; class < PROJ01_NR_CLASSES; class++) {
+			while (!list_empty(&pd->rr_list[class])) {
+				pq = list_entry(pd->rr_list[class].next,
+						struct proj01_queue, rr_node);
+				while (pq->queued) {
+					rq = proj01_find_next(pq, pd->head);
+					proj01_move_to_dispatch(pd, rq);
+					dispatched++;
+				}
+			}
+		}
+		return dispatched;
+	}
+
+	pq = proj01_select_queue(pd);
+	if (!pq)
+		return 0;
+
+	rq = proj01_choose_request(pd, pq);
+	pq->slice_left--;
+	proj01_move_to_dispatch(pd, rq);
+	return 1;
+}
+
+static void proj01_add_request(struct request_queue *q, struct request *rq)
+{
+	struct proj01_data *pd = q->elevator->elevator_data;
+	struct proj01_queue *pq = rq_pq(rq);
+
+	if (rq_is_sync_read(rq) && !pq->queued && !pq->staged &&
+	    !pq->reads_in_driver)
+		proj01_update_thinktime(pd, pq);
+
+	list_add_tail(&rq->queuelist, per_cpu_ptr(pd->staged, smp_processor_id()));
+	pq->staged++;
+	pd->nr_staged++;
+
+	/*
+	 * the read we were waiting for, let it through right away
+	 */
+	if (pd->active == pq && pd->idling) {
+		proj01_stop_idling(pd);
+		__blk_run_queue(q);
+	}
+}
+
+static void proj01_activate_request(struct request_queue *q, struct request *rq)
+{
+	struct proj01_data *pd = q->elevator->elevator_data;
+
+	if (rq == pd->sample_rq)
+		pd->sample_start = proj01_now();
+
+	pd->in_driver++;
+	if (rq_is_sync_read(rq))
+		rq_pq(rq)->reads_in_driver++;
+}
+
+static void proj01_deactivate_request(struct request_queue *q,
+				      struct request *rq)
+{
+	struct proj01_data *pd = q->elevator->elevator_data;
+
+	if (rq == pd->sample_rq)
+		pd->sample_rq = NULL;
+
+	WARN_ON(!pd->in_driver);
+	pd->in_driver--;
+	if (rq_is_sync_read(rq))
+		rq_pq(rq)->reads_in_driver--;
+}
+
+/*
+ * Feed the cost model.  With more than one request in the driver the
+ * request can't have started service before the previous completion, so
+ * count from whichever came last.
+ */
+static void proj01_complete_sample(struct proj01_data *pd, struct request *rq)
+{
+	u64 now = proj01_now();
+
+	if (rq == pd->sample_rq) {
+		if (pd->sample_start && !rq->errors)
+			proj01_sample_cost(pd->sample_cell, now -
+				max(pd->sample_start, pd->last_complete));
+		pd->sample_rq = NULL;
+	}
+
+	pd->last_complete = now;
+}
+
+static void proj01_completed_request(struct request_queue *q,
+				     struct request *rq)
+{
+	struct proj01_data *pd = q->elevator->elevator_data;
+	struct proj01_queue *pq = rq_pq(rq);
+
+	WARN_ON(!pd->in_driver);
+	pd->in_driver--;
+	proj01_complete_sample(pd, rq);
+
+	if (rq_is_sync_read(rq)) {
+		WARN_ON(!pq->reads_in_driver);
+		pq->reads_in_driver--;
+		pq->last_end = proj01_now();
+
+		if (pd->active == pq && !pq->queued && !pq->reads_in_driver &&
+		    proj01_should_idle(pd, pq)) {
+			proj01_arm_idle(pd, pq);
+			return;
+		}
+	}
+
+	if (!pd->in_driver)
+		proj01_schedule_dispatch(pd);
+}
+
+static int proj01_queue_empty(struct request_queue *q)
+{
+	struct proj01_data *pd = q->elevator->elevator_data;
+
+	return !pd->queued && !pd->nr_staged;
+}
+
+static int
+proj01_set_request(struct request_queue *q, struct request *rq, gfp_t gfp_mask)
+{
+	struct proj01_data *pd = q->elevator->elevator_data;
+	struct proj01_queue *pq, *new_pq = NULL;
+	struct io_context *ioc;
+	unsigned long flags;
+
+	ioc = get_io_context(gfp_mask, q->node);
+	if (!ioc)
+		return 1;
+
+	spin_lock_irqsave(q->queue_lock, flags);
+	proj01_reap_queues(pd);
+	pq = proj01_find_queue(pd, ioc);
+	if (!pq) {
+		spin_unlock_irqrestore(q->queue_lock, flags);
+		new_pq = kmalloc_node(sizeof(*new_pq), gfp_mask | __GFP_ZERO,
+				      q->node);
+		if (!new_pq) {
+			put_io_context(ioc);
+			return 1;
+		}
+		spin_lock_irqsave(q->queue_lock, flags);
+
+		/*
+		 * someone else may have set it up while we slept
+		 */
+		pq = proj01_find_queue(pd, ioc);
+	}
+
+	if (!pq) {
+		pq = new_pq;
+		new_pq = NULL;
+		pq->pd = pd;
+		pq->ioc = ioc;
+		pq->sort_list = RB_ROOT;
+		INIT_LIST_HEAD(&pq->rr_node);
+		INIT_LIST_HEAD(&pq->idle_node);
+		proj01_init_prio(pq);
+		hlist_add_head(&pq->hash,
+			       &pd->hash[hash_ptr(ioc, PROJ01_HASH_SHIFT)]);
+		ioc = NULL;
+	} else if (unlikely(pq->org_ioprio != ioc->ioprio) && !pq->queued)
+		proj01_init_prio(pq);
+
+	proj01_get_queue(pq);
+	rq->elevator_private = pq;
+	spin_unlock_irqrestore(q->queue_lock, flags);
+
+	kfree(new_pq);
+	if (ioc)
+		put_io_context(ioc);
+	return 0;
+}
+
+static void proj01_put_request(struct request *rq)
+{
+	struct proj01_queue *pq = rq_pq(rq);
+
+	if (pq) {
+		if (rq == pq->pd->sample_rq)
+			pq->pd->sample_rq = NULL;
+		rq->elevator_private = NULL;
+		proj01_put_queue(pq);
+	}
+}
+
+static void proj01_kick_queue(struct work_struct *work)
+{
+	struct proj01_data *pd =
+		container_of(work, struct proj01_data, unplug_work);
+	struct request_queue *q = pd->q;
+
+	spin_lock_irq(q->queue_lock);
+	__blk_run_queue(q);
+	spin_unlock_irq(q->queue_lock);
+}
+
+/*
+ * The process we were idling for didn't come back in time.  The active
+ * queue is expired on the next dispatch.
+ */
+static enum hrtimer_restart proj01_idle_timer(struct hrtimer *timer)
+{
+	struct proj01_data *pd =
+		container_of(timer, struct proj01_data, idle_timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(pd->q->queue_lock, flags);
+	if (pd->idling) {
+		pd->idling = 0;
+		proj01_schedule_dispatch(pd);
+	}
+	spin_unlock_irqrestore(pd->q->queue_lock, flags);
+
+	return HRTIMER_NORESTART;
 }
 
 static void *proj01_init_queue(struct request_queue *q)
 {
-	struct noop_data *nd;
+	struct proj01_data *pd;
+	int i;
 
-	nd = kmalloc_node(sizeof(*nd), GFP_KERNEL, q->node);
-	if (!nd)
+	pd = kmalloc_node(sizeof(*pd), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!pd)
 		return NULL;
-	INIT_LIST_HEAD(&nd->queue);
-	return nd;
+
+	pd->staged = alloc_percpu(struct list_head);
+	if (!pd->staged) {
+		kfree(pd);
+		return NULL;
+	}
+	for_each_possible_cpu(i)
+		INIT_LIST_HEAD(per_cpu_ptr(pd->staged, i));
+
+	pd->q = q;
+	for (i = 0; i < PROJ01_HASH_SIZE; i++)
+		INIT_HLIST_HEAD(&pd->hash[i]);
+	for (i = 0; i < PROJ01_NR_CLASSES; i++)
+		INIT_LIST_HEAD(&pd->rr_list[i]);
+	INIT_LIST_HEAD(&pd->idle_list);
+
+	hrtimer_init(&pd->idle_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	pd->idle_timer.function = proj01_idle_timer;
+	INIT_WORK(&pd->unplug_work, proj01_kick_queue);
+
+	pd->quantum = proj01_quantum;
+	pd->slice_idle = proj01_slice_idle;
+	proj01_reset_cost(pd);
+	return pd;
 }
 
 static void proj01_exit_queue(struct elevator_queue *e)
 {
-	struct noop_data *nd = e->elevator_data;
+	struct proj01_data *pd = e->elevator_data;
+	struct request_queue *q = pd->q;
+	int i;
+
+	hrtimer_cancel(&pd->idle_timer);
+	cancel_work_sync(&pd->unplug_work);
+
+	spin_lock_irq(q->queue_lock);
+	if (pd->active)
+		proj01_expire_active(pd);
+	while (!list_empty(&pd->idle_list))
+		proj01_free_queue(list_entry(pd->idle_list.next,
+					     struct proj01_queue, idle_node));
+	spin_unlock_irq(q->queue_lock);
+
+	BUG_ON(pd->queued);
+	BUG_ON(pd->nr_staged);
+	for (i = 0; i < PROJ01_HASH_SIZE; i++)
+		BUG_ON(!hlist_empty(&pd->hash[i]));
+	free_percpu(pd->staged);
+	kfree(pd);
+}
+
+/*
+ * sysfs parts below
+ */
+static ssize_t
+proj01_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+proj01_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
 
-	BUG_ON(!list_empty(&nd->queue));
-	kfree(nd);
+	*var = simple_strtol(p, &p, 10);
+	return count;
 }
 
+#define SHOW_FUNCTION(__FUNC, __VAR)					\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct proj01_data *pd = e->elevator_data;			\
+	return proj01_var_show(__VAR, (page));				\
+}
+SHOW_FUNCTION(proj01_quantum_show, pd->quantum);
+SHOW_FUNCTION(proj01_slice_idle_show, pd->slice_idle);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX)				\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct proj01_data *pd = e->elevator_data;			\
+	int __data;							\
+	int ret = proj01_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	*(__PTR) = __data;						\
+	return ret;							\
+}
+STORE_FUNCTION(proj01_quantum_store, &pd->quantum, 1, INT_MAX);
+STORE_FUNCTION(proj01_slice_idle_store, &pd->slice_idle, 0, USEC_PER_SEC);
+#undef STORE_FUNCTION
+
+#define PROJ01_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, proj01_##name##_show, \
+				      proj01_##name##_store)
+
+/*
+ * One line per direction and distance bucket with the mean service time
+ * and sample count for each size bucket.  Writing anything resets the
+ * table to its priors.
+ */
+static ssize_t proj01_seek_model_show(struct elevator_queue *e, char *page)
+{
+	struct proj01_data *pd = e->elevator_data;
+	struct request_queue *q = pd->q;
+	char *p = page;
+	int dir, dist, size;
+
+	p += sprintf(p, "dir       dist    <=4k       <=16k      <=64k      >64k\n");
+
+	spin_lock_irq(q->queue_lock);
+	for (dir = 0; dir < 2; dir++) {
+		for (dist = 0; dist < PROJ01_DIST_BUCKETS; dist++) {
+			p += sprintf(p, "%s %10d", dir ? "bwd" : "fwd",
+				     dist ? 1 << (3 * (dist - 1)) : 0);
+			for (size = 0; size < PROJ01_SIZE_BUCKETS; size++) {
+				struct proj01_cost *c = &pd->cost[dir][dist][size];
+
+				p += sprintf(p, " %6lu/%-3lu", c->mean,
+					     min(c->samples, 999UL));
+			}
+			p += sprintf(p, "\n");
+		}
+	}
+	spin_unlock_irq(q->queue_lock);
+
+	return p - page;
+}
+
+static ssize_t proj01_seek_model_store(struct elevator_queue *e,
+				       const char *page, size_t count)
+{
+	struct proj01_data *pd = e->elevator_data;
+	struct request_queue *q = pd->q;
+
+	spin_lock_irq(q->queue_lock);
+	proj01_reset_cost(pd);
+	spin_unlock_irq(q->queue_lock);
+
+	return count;
+}
+
+static struct elv_fs_entry proj01_attrs[] = {
+	PROJ01_ATTR(quantum),
+	PROJ01_ATTR(slice_idle),
+	PROJ01_ATTR(seek_model),
+	__ATTR_NULL
+};
+
 static struct elevator_type elevator_proj01 = {
 	.ops = {
+		.elevator_merge_fn		= proj01_merge,
+		.elevator_merged_fn		= proj01_merged_request,
 		.elevator_merge_req_fn		= proj01_merged_requests,
+		.elevator_allow_merge_fn	= proj01_allow_merge,
 		.elevator_dispatch_fn		= proj01_dispatch,
 		.elevator_add_req_fn		= proj01_add_request,
+		.elevator_activate_req_fn	= proj01_activate_request,
+		.elevator_deactivate_req_fn	= proj01_deactivate_request,
 		.elevator_queue_empty_fn	= proj01_queue_empty,
+		.elevator_completed_req_fn	= proj01_completed_request,
 		.elevator_former_req_fn		= proj01_former_request,
 		.elevator_latter_req_fn		= proj01_latter_request,
+		.elevator_set_req_fn		= proj01_set_request,
+		.elevator_put_req_fn		= proj01_put_request,
 		.elevator_init_fn		= proj01_init_queue,
 		.elevator_exit_fn		= proj01_exit_queue,
 	},
+	.elevator_attrs = proj01_attrs,
 	.elevator_name = "team08",
 	.elevator_owner = THIS_MODULE,
 };
@@ -134,4 +1190,4 @@ module_exit(proj01_exit);
 
 MODULE_AUTHOR("cs411 team08");
 MODULE_LICENSE("GPL");
-MODULE_DESCRIPTION("CS411 Project 1 - No-op IO scheduler");
+MODULE_DESCRIPTION("CS411 Project 1 - Per-process round-robin IO scheduler");